@@ -0,0 +1,478 @@
+#include "export.h"
+
+// 导出模式：不显示，把视频流解码出的图像依次转换成YUV420P 写到文件。
+// 索引中的关键帧把视频分成若干GOP，连续的几个GOP 组成一个任务，工作线程各自用
+// 独立的AVFormatContext 和AVCodecContext 从任务的第一个关键帧开始解码，主线程
+// 按顺序写出各任务的图像。
+// MSRLE 的关键帧不一定重画整幅图像，为了和顺序解码逐位一致，每个任务解码完后
+// 再多解一帧，和下一个任务解出的第一帧比较；不同时下一个任务作废，由主线程用
+// 上一个任务留下的解码器接着顺序解码。
+// 任务的图像在写出前都留在内存中，工作线程领取任务时保证缓存的任务的图像
+// 总共不超过EXPORT_MAX_BYTES。关键帧间隔很大时一个任务就可能是整个视频，
+// 超过EXPORT_TASK_BYTES 的任务不交给工作线程，轮到时由主线程解码，每帧直接
+// 写出。
+
+#define EXPORT_TASK_FRAMES 128  // 每个任务至少的帧数
+#define EXPORT_TASKS_PER_THREAD 2 // 每个线程最多缓存的已解码任务数
+#define EXPORT_SPLIT_BYTES (32 * 1024 * 1024) // 图像大时任务按这个大小划分
+#define EXPORT_TASK_BYTES (128 * 1024 * 1024) // 工作线程解码的任务的图像上限
+#define EXPORT_MAX_BYTES (512 * 1024 * 1024)  // 所有缓存的任务的图像上限
+
+typedef struct ExportTask {
+    int64_t start, end; // 视频帧号(dts)范围[start, end)，start 是关键帧
+    int state;          // 0 解码中，1 完成，-1 失败
+    uint8_t *frames;    // 转换好的YUV420P 图像
+    int nb_frames;
+    int frames_allocated;
+    uint8_t *first_raw; // 解出的第一帧，解码器的原始格式
+    uint8_t *next_raw;  // 帧号end 的一帧，原始格式，没有时为NULL
+    AVFormatContext *ic; // 解完next_raw 的输入，主线程可能要接着解码
+    int64_t bytes; // 按索引估计的图像大小
+    int direct; // 图像太多，由主线程解码并直接写出，frames 只存一帧
+} ExportTask;
+
+typedef struct ExportContext {
+    const char *filename;
+    int lowres;      // 视频缩小为1/(1 << lowres) 解码
+    int index_cache; // 使用文件旁的索引缓存
+    int stream_index;
+    int width, height, pix_fmt;
+    int frame_size; // 一帧YUV420P 的字节数
+    int raw_size;   // 一帧原始格式的字节数
+
+    ExportTask *tasks;
+    int nb_tasks;
+    int next_task; // 下一个要领取的任务
+    int written;   // 已经写出的任务数
+    int window;    // 领取的任务不超过written + window，限制内存占用
+    int abort;
+    int nb_redecoded; // 关键帧不能独立解码、由主线程重新解码的任务数
+    ImgConvertContext *convert_ctx; // 所有工作线程共用
+    FILE *out;
+    AVMutex mutex;
+    AVCond cond;
+} ExportContext;
+
+// 打开输入文件和视频解码器，ec->stream_index 小于0 时使用第一个视频流。
+// 使用索引缓存时，工作线程打开前主线程已经建好了缓存。
+static AVFormatContext *export_open(ExportContext *ec, int index_threads) {
+    AVFormatParameters params, *ap = &params;
+    AVFormatContext *ic;
+    AVCodecContext *avctx;
+    AVCodec *codec;
+    int i;
+
+    memset(ap, 0, sizeof(*ap));
+    ap->readahead_buffers = 4;
+    ap->index_cache = ec->index_cache;
+    ap->index_threads = index_threads;
+    if (av_open_input_file(&ic, ec->filename, NULL, 0, ap) < 0)
+        return NULL;
+    for (i = 0; i < ic->nb_streams && ec->stream_index < 0; i++) {
+        if (ic->streams[i]->actx->codec_type == CODEC_TYPE_VIDEO)
+            ec->stream_index = i;
+    }
+    if (ec->stream_index >= 0 && ec->stream_index < ic->nb_streams) {
+        avctx = ic->streams[ec->stream_index]->actx;
+        codec = avcodec_find_decoder(avctx->codec_id);
+        avctx->lowres = ec->lowres;
+        if (avctx->codec_type == CODEC_TYPE_VIDEO && codec &&
+            avcodec_open(avctx, codec) >= 0)
+            return ic;
+    }
+    av_close_input_file(ic);
+    return NULL;
+}
+
+static void export_close(ExportContext *ec, AVFormatContext *ic) {
+    if (!ic)
+        return;
+    avcodec_close(ic->streams[ec->stream_index]->actx);
+    av_close_input_file(ic);
+}
+
+// 复制一帧原始格式的图像，填充字节清0，可以直接用memcmp() 比较。
+static uint8_t *export_copy_raw(ExportContext *ec, AVFrame *frame) {
+    uint8_t *buf = av_mallocz(ec->raw_size);
+    AVPicture pict;
+
+    if (!buf)
+        return NULL;
+    avpicture_fill(&pict, buf, ec->pix_fmt, ec->width, ec->height);
+    img_copy(&pict, (AVPicture *)frame, ec->pix_fmt, ec->width, ec->height);
+    return buf;
+}
+
+// 把一帧图像转换成YUV420P 加到任务的输出中，direct 的任务直接写出。
+static int export_add_frame(ExportContext *ec, ExportTask *t,
+                            const AVPicture *src) {
+    AVPicture pict;
+    int pos = t->direct ? 0 : t->nb_frames;
+
+    if (pos >= t->frames_allocated) {
+        // 第一次按任务的帧数分配，索引中的帧数不准时再加倍
+        int n = EXPORT_TASK_FRAMES;
+        uint8_t *frames;
+
+        if (t->frames_allocated)
+            n = t->frames_allocated * 2;
+        else if (t->direct)
+            n = 1;
+        else if (t->end - t->start < n)
+            n = (int)(t->end - t->start);
+        frames = av_realloc(t->frames, n * ec->frame_size);
+        if (!frames)
+            return -1;
+        t->frames = frames;
+        t->frames_allocated = n;
+    }
+    avpicture_fill(&pict, t->frames + pos * ec->frame_size, PIX_FMT_YUV420P,
+                   ec->width, ec->height);
+    if (img_convert_frame(ec->convert_ctx, &pict, src) < 0)
+        return -1;
+    if (t->direct && fwrite(t->frames, ec->frame_size, 1, ec->out) != 1)
+        return AVERROR_IO;
+    t->nb_frames++;
+    return 0;
+}
+
+// 从ic 当前的位置接着解码，帧号小于t->end 的图像加到t 的输出中，帧号不小于
+// t->end 的第一帧存到t->next_raw 后停止，ic 留在t->ic 中。读到文件尾时关闭ic。
+static int export_decode(ExportContext *ec, AVFormatContext *ic,
+                         ExportTask *t) {
+    AVCodecContext *avctx = ic->streams[ec->stream_index]->actx;
+    AVFrame frame;
+    AVPacket pkt;
+    int64_t dts = t->start - 1;
+    int got_picture, ret = 0;
+
+    memset(&frame, 0, sizeof(frame));
+    t->ic = ic;
+    for (;;) {
+        if (av_read_packet(ic, &pkt) < 0) {
+            if (url_ferror(&ic->pb))
+                ret = AVERROR_IO;
+            export_close(ec, ic);
+            t->ic = NULL;
+            break;
+        }
+        if (pkt.stream_index != ec->stream_index) {
+            av_free_packet(&pkt);
+            continue;
+        }
+        dts = pkt.dts != AV_NOPTS_VALUE ? pkt.dts : dts + 1;
+        avcodec_decode_video(avctx, &frame, &got_picture, pkt.data, pkt.size);
+        av_free_packet(&pkt);
+        if (!got_picture || dts < t->start)
+            continue;
+
+        if (dts >= t->end) {
+            t->next_raw = export_copy_raw(ec, &frame);
+            if (!t->next_raw)
+                ret = -1;
+            break;
+        }
+        if (!t->nb_frames && !t->first_raw) {
+            t->first_raw = export_copy_raw(ec, &frame);
+            if (!t->first_raw) {
+                ret = -1;
+                break;
+            }
+        }
+        ret = export_add_frame(ec, t, (AVPicture *)&frame);
+        if (ret < 0)
+            break;
+    }
+    return ret;
+}
+
+// 下一个任务能否领取：领取的任务不超过written + window，还没有写出的任务的
+// 图像总共不超过EXPORT_MAX_BYTES。轮到写出的任务总是可以领取。
+static int export_can_claim(ExportContext *ec) {
+    int64_t bytes = 0;
+    int i;
+
+    if (ec->next_task >= ec->written + ec->window)
+        return 0;
+    for (i = ec->written; i <= ec->next_task; i++) {
+        if (!ec->tasks[i].direct)
+            bytes += ec->tasks[i].bytes;
+    }
+    return ec->next_task == ec->written || bytes <= EXPORT_MAX_BYTES;
+}
+
+// 工作线程：依次领取任务，seek 到任务的第一个关键帧解码。
+static void *export_thread(void *arg) {
+    ExportContext *ec = arg;
+    AVFormatContext *ic;
+    ExportTask *t;
+    int ret;
+
+    for (;;) {
+        av_mutex_lock(&ec->mutex);
+        while (!ec->abort && ec->next_task < ec->nb_tasks &&
+               !export_can_claim(ec))
+            av_cond_wait(&ec->cond, &ec->mutex);
+        if (ec->abort || ec->next_task >= ec->nb_tasks) {
+            av_mutex_unlock(&ec->mutex);
+            break;
+        }
+        t = &ec->tasks[ec->next_task++];
+        av_mutex_unlock(&ec->mutex);
+        if (t->direct) // 轮到时主线程解码
+            continue;
+
+        ret = -1;
+        ic = export_open(ec, 1);
+        if (ic) {
+            if (t->start > 0 && av_seek_frame(ic, ec->stream_index, t->start,
+                                              AVSEEK_FLAG_BACKWARD) < 0)
+                export_close(ec, ic);
+            else
+                ret = export_decode(ec, ic, t);
+        }
+
+        av_mutex_lock(&ec->mutex);
+        t->state = ret < 0 ? -1 : 1;
+        av_cond_broadcast(&ec->cond);
+        av_mutex_unlock(&ec->mutex);
+    }
+    return NULL;
+}
+
+// 按索引中视频的关键帧划分任务，每个任务至少EXPORT_TASK_FRAMES 帧，图像大时
+// 减少到EXPORT_SPLIT_BYTES 以内。帧数超过EXPORT_TASK_BYTES 的任务(关键帧间隔
+// 太大)设置direct。没有索引时整个视频是一个direct 任务。
+static int export_split(ExportContext *ec, AVStream *st) {
+    AVIndexEntry e;
+    int64_t start = 0, last = -1;
+    int i, pass, min_frames = EXPORT_SPLIT_BYTES / ec->frame_size;
+
+    if (min_frames > EXPORT_TASK_FRAMES)
+        min_frames = EXPORT_TASK_FRAMES;
+    if (min_frames < 1)
+        min_frames = 1;
+
+    // 第一遍只数任务数，第二遍填写。图像大时min_frames 可以小到1，任务数
+    // 不能按EXPORT_TASK_FRAMES 估计，按索引项数分配又太浪费。
+    for (pass = 0; pass < 2; pass++) {
+        start = 0;
+        ec->nb_tasks = 0;
+        for (i = 0; i < st->nb_index_entries; i++) {
+            if (av_index_get_entry(st, i, &e) < 0)
+                return -1;
+            if ((e.flags & AVINDEX_KEYFRAME) &&
+                e.timestamp >= start + min_frames) {
+                if (pass) {
+                    ec->tasks[ec->nb_tasks].start = start;
+                    ec->tasks[ec->nb_tasks].end = e.timestamp;
+                }
+                ec->nb_tasks++;
+                start = e.timestamp;
+            }
+            if (e.timestamp > last)
+                last = e.timestamp;
+        }
+        // 最后一个任务到视频结束
+        if (!pass) {
+            ec->tasks = av_mallocz((ec->nb_tasks + 1) * sizeof(ExportTask));
+            if (!ec->tasks)
+                return -1;
+        }
+    }
+    ec->tasks[ec->nb_tasks].start = start;
+    ec->tasks[ec->nb_tasks].end = INT64_MAX;
+    ec->nb_tasks++;
+
+    for (i = 0; i < ec->nb_tasks; i++) {
+        ExportTask *t = &ec->tasks[i];
+        int64_t end = i + 1 < ec->nb_tasks ? t->end : last + 1;
+
+        t->bytes = (end - t->start) * ec->frame_size;
+        t->direct = t->bytes > EXPORT_TASK_BYTES || !st->nb_index_entries;
+    }
+    return 0;
+}
+
+static void export_free_task(ExportContext *ec, ExportTask *t) {
+    av_freep(&t->frames);
+    t->frames_allocated = 0;
+    av_freep(&t->first_raw);
+    av_freep(&t->next_raw);
+    export_close(ec, t->ic);
+    t->ic = NULL;
+}
+
+// 第i 个任务的第一帧和上一个任务多解的一帧不同时，丢掉任务的结果，
+// 用上一个任务的解码器接着顺序解码。
+static int export_check_task(ExportContext *ec, int i) {
+    ExportTask *t = &ec->tasks[i], *prev = &ec->tasks[i - 1];
+    AVPicture pict;
+    int ret;
+
+    if (!prev->next_raw || !prev->ic)
+        return t->state < 0 ? -1 : 0;
+    if (t->state > 0 && t->first_raw &&
+        !memcmp(t->first_raw, prev->next_raw, ec->raw_size))
+        return 0;
+
+    export_free_task(ec, t);
+    t->nb_frames = 0;
+    ec->nb_redecoded++;
+    avpicture_fill(&pict, prev->next_raw, ec->pix_fmt, ec->width, ec->height);
+    ret = export_add_frame(ec, t, &pict);
+    if (ret < 0)
+        return ret;
+    ret = export_decode(ec, prev->ic, t);
+    prev->ic = NULL;
+    return ret;
+}
+
+// 主线程解码direct 的任务：有上一个任务留下的解码器时接着顺序解码，否则
+// 从任务的第一个关键帧开始。
+static int export_direct_task(ExportContext *ec, int i) {
+    ExportTask *t = &ec->tasks[i], *prev = i ? &ec->tasks[i - 1] : NULL;
+    AVFormatContext *ic;
+    AVPicture pict;
+    int ret;
+
+    if (prev && prev->ic) {
+        ic = prev->ic;
+        prev->ic = NULL;
+        if (prev->next_raw) {
+            avpicture_fill(&pict, prev->next_raw, ec->pix_fmt, ec->width,
+                           ec->height);
+            ret = export_add_frame(ec, t, &pict);
+            if (ret < 0) {
+                export_close(ec, ic);
+                return ret;
+            }
+        }
+        return export_decode(ec, ic, t);
+    }
+
+    ic = export_open(ec, 1);
+    if (!ic)
+        return -1;
+    if (t->start > 0 &&
+        av_seek_frame(ic, ec->stream_index, t->start, AVSEEK_FLAG_BACKWARD) < 0) {
+        export_close(ec, ic);
+        return -1;
+    }
+    return export_decode(ec, ic, t);
+}
+
+int video_export(const char *filename, const char *out_filename,
+                 int nb_threads, int lowres, int index_cache,
+                 ExportStats *stats) {
+    ExportContext ec1, *ec = &ec1;
+    AVThread *threads;
+    AVFormatContext *ic;
+    AVStream *st;
+    FILE *out;
+    int64_t nb_frames = 0;
+    int i, ret = 0;
+
+    memset(ec, 0, sizeof(*ec));
+    memset(stats, 0, sizeof(*stats));
+    ec->filename = filename;
+    ec->lowres = lowres;
+    ec->index_cache = index_cache;
+    ec->window = nb_threads * EXPORT_TASKS_PER_THREAD;
+
+    ec->stream_index = -1;
+    ic = export_open(ec, nb_threads);
+    if (!ic) {
+        fprintf(stderr, "%s: could not open video stream\n", filename);
+        return -1;
+    }
+    st = ic->streams[ec->stream_index];
+    ec->width = st->actx->width;
+    ec->height = st->actx->height;
+    ec->pix_fmt = st->actx->pix_fmt;
+    ec->frame_size = avpicture_get_size(PIX_FMT_YUV420P, ec->width, ec->height);
+    ec->raw_size = avpicture_get_size(ec->pix_fmt, ec->width, ec->height);
+    ret = ec->frame_size > 0 && ec->raw_size > 0 ? export_split(ec, st) : -1;
+    export_close(ec, ic);
+    if (ret < 0) {
+        av_free(ec->tasks);
+        return -1;
+    }
+    ec->convert_ctx = img_convert_context_new(PIX_FMT_YUV420P, ec->pix_fmt,
+                                              ec->width, ec->height);
+    if (!ec->convert_ctx) {
+        av_free(ec->tasks);
+        return -1;
+    }
+
+    out = fopen(out_filename, "wb");
+    if (!out) {
+        fprintf(stderr, "%s: could not create\n", out_filename);
+        av_free(ec->tasks);
+        img_convert_context_free(ec->convert_ctx);
+        return -1;
+    }
+    ec->out = out;
+
+    av_mutex_init(&ec->mutex);
+    av_cond_init(&ec->cond);
+    threads = av_mallocz(nb_threads * sizeof(AVThread));
+    for (i = 0; threads && i < nb_threads; i++) {
+        if (av_thread_create(&threads[i], export_thread, ec) < 0)
+            break;
+    }
+    // 一个工作线程都没有时任务永远不会完成
+    nb_threads = i;
+    if (!nb_threads)
+        ret = -1;
+
+    for (i = 0; i < ec->nb_tasks && ret >= 0; i++) {
+        ExportTask *t = &ec->tasks[i];
+
+        if (t->direct) {
+            ret = export_direct_task(ec, i);
+        } else {
+            av_mutex_lock(&ec->mutex);
+            while (!t->state)
+                av_cond_wait(&ec->cond, &ec->mutex);
+            av_mutex_unlock(&ec->mutex);
+
+            ret = i ? export_check_task(ec, i) : (t->state < 0 ? -1 : 0);
+            if (ret >= 0 && fwrite(t->frames, ec->frame_size, t->nb_frames,
+                                   out) != (size_t)t->nb_frames)
+                ret = AVERROR_IO;
+        }
+        nb_frames += t->nb_frames;
+        av_freep(&t->frames);
+        av_freep(&t->first_raw);
+        if (i)
+            export_free_task(ec, &ec->tasks[i - 1]);
+
+        av_mutex_lock(&ec->mutex);
+        ec->written = i + 1;
+        if (ret < 0)
+            ec->abort = 1;
+        av_cond_broadcast(&ec->cond);
+        av_mutex_unlock(&ec->mutex);
+    }
+
+    for (i = 0; i < nb_threads; i++)
+        av_thread_join(&threads[i]);
+    for (i = 0; i < ec->nb_tasks; i++)
+        export_free_task(ec, &ec->tasks[i]);
+    av_free(threads);
+    av_free(ec->tasks);
+    img_convert_context_free(ec->convert_ctx);
+    av_mutex_destroy(&ec->mutex);
+    av_cond_destroy(&ec->cond);
+    if (fclose(out) != 0 && ret >= 0)
+        ret = AVERROR_IO;
+
+    if (ret < 0)
+        fprintf(stderr, "%s: error while exporting\n", filename);
+    stats->nb_frames = (int)nb_frames;
+    stats->nb_tasks = ec->nb_tasks;
+    stats->nb_redecoded = ec->nb_redecoded;
+    stats->nb_threads = nb_threads;
+    return ret;
+}
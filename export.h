@@ -0,0 +1,25 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "./libavformat/avformat.h"
+#include "./libavutil/thread.h"
+
+// ffplay 的导出模式，从ffplay.c 中独立出来，不依赖SDL，tools/export_test
+// 也用它做测试。实现的说明见export.c。
+
+// 一次导出的统计信息。
+typedef struct ExportStats {
+    int nb_frames;    // 写出的帧数
+    int nb_tasks;     // 划分的任务数
+    int nb_redecoded; // 关键帧不能独立解码、由主线程重新解码的任务数
+    int nb_threads;   // 实际启动的工作线程数
+} ExportStats;
+
+// 把filename 的视频解码并转换成YUV420P 写到out_filename，nb_threads 个工作
+// 线程并行解码。lowres 把视频缩小为1/(1 << lowres) 解码，index_cache 非0 时
+// 使用文件旁的索引缓存。成功返回0，出错返回负数。
+int video_export(const char *filename, const char *out_filename,
+                 int nb_threads, int lowres, int index_cache,
+                 ExportStats *stats);
+
+#endif
@@ -1,5 +1,9 @@
 
 #include "./libavformat/avformat.h"
+#include "./libavutil/atomic.h"
+#include "./libavutil/thread.h"
+#include "export.h"
+#include "packetqueue.h"
 
 #if defined(CONFIG_WIN32)
 #include <sys/timeb.h>
@@ -27,18 +31,20 @@
 
 #define FF_QUIT_EVENT (SDL_USEREVENT + 2)
 
-#define MAX_VIDEOQ_SIZE (5 * 256 * 1024)
-#define MAX_AUDIOQ_SIZE (5 * 16 * 1024)
+// 队列缓存上限按缓存的时长(毫秒)计算，低码率的音频和高码率的视频各自得到合适的
+// 缓存量；字节数上限见packetqueue.c。
+#define MAX_VIDEOQ_DURATION 1000
+#define MAX_AUDIOQ_DURATION 1000
 
 #define VIDEO_PICTURE_QUEUE_SIZE 1
-// 音视频数据包/数据帧队列数据结构定义
-typedef struct PacketQueue {
-    AVPacketList *first_pkt, *last_pkt;
-    int size;
-    int abort_request;
-    SDL_mutex *mutex;
-    SDL_cond *cond;
-} PacketQueue;
+
+// 解码后视频图像缓存的内存上限。
+#define FRAME_CACHE_SIZE (64 * 1024 * 1024)
+
+// 快进快退时下一个关键帧还没到显示时间，解复用线程每次睡眠的毫秒数。
+#define TRICK_WAIT_MS 10
+// seek 到关键帧后最多跳过这么多其他流的包去找视频包。
+#define TRICK_MAX_SKIP 64
 
 // 视频图像数据结构定义
 typedef struct VideoPicture {
@@ -78,13 +84,74 @@ typedef struct VideoState {
     SDL_mutex *video_decoder_mutex; // 视频数据包队列同步操作而定义的互斥量指针
     SDL_mutex *audio_decoder_mutex; // 音频数据包队列同步操作而定义的互斥量指针
 
+    SDL_mutex *wait_mutex;        // 配合continue_read_cond 使用的互斥量
+    SDL_cond *continue_read_cond; // 文件读完后解复用线程在此等待退出或seek 请求
+
+    // seek 请求，事件循环在wait_mutex 保护下设置，解复用线程处理。
+    int seek_req;
+    int seek_flags;
+    int64_t seek_pos;      // 目标时间，以AV_TIME_BASE 为单位
+    int64_t seek_frame;    // 精确seek 的视频帧号，AV_NOPTS_VALUE 表示到关键帧为止
+    int64_t seek_req_time; // 发出请求的时间，用于统计seek 延迟
+
+    // 暂停和单步，事件循环在wait_mutex 保护下设置，视频解码线程处理。
+    int paused;
+    int step;    // 请求单步，1 向前一帧，-1 向后一帧
+    int stepped; // 暂停期间单步过，继续播放时要重新对齐音频
+    SDL_cond *step_cond; // 暂停时视频解码线程在此等待单步请求
+
+    // 解码后的视频图像缓存，单步后退和反复播放一段时不用从关键帧重新解码。
+    // 只在视频解码线程中使用。
+    AVFrameCache *frame_cache;
+    int64_t frame_number; // 最近显示的视频帧号(dts)
+
+    // 转换成YUV420P 的上下文，只在视频解码线程中使用。
+    ImgConvertContext *convert_ctx;
+
+    // 边解码边转换：解码器每完成一段行就转换到锁定的显示表面，趁解码出的
+    // 行还在缓存中。只在视频解码线程中使用。
+    AVPicture band_pict; // 显示表面
+    int band_rows;       // 解码器已经报告的行数
+    int band_changed;    // 其中有改变、转换过的行数
+    int band_error;
+    int band_dirty;      // 非0 时只转换有改变的行
+
+    // 显示表面中是解码器输出的上一帧，下一帧只需转换有改变的行
+    int overlay_valid;
+
+    // 播放速度，1 正常播放，2 到32 快进，-2 到-32 快退，事件循环在wait_mutex
+    // 保护下设置。快进快退时音频暂停，解复用线程按时间在索引中找到该显示的
+    // 关键帧直接seek 过去，只读取和解码关键帧，开销和速度无关。
+    int rate;
+    int trick_rate;      // 解复用线程正在使用的速度
+    int64_t trick_frame; // 开始快进快退时的视频帧号
+    int64_t trick_time;  // 开始快进快退的时间
+    int trick_index;     // 最近读取的关键帧在索引中的序号
+
+    double video_clock; // 最近显示的视频帧的时间(秒)
+    double audio_clock; // 最近解码的音频包的时间(秒)
+
+    // seek 延迟统计，从发出请求到seek 后第一帧显示出来的时间(微秒)。
+    int seek_count;
+    int64_t seek_latency_total;
+    int64_t seek_latency_max;
+
     char filename[240]; // 媒体文件名
 
 } VideoState;
 
 static AVInputFormat *file_iformat;
+// seek 后放入队列的特殊包，解码线程取到时重置解码器。
+static AVPacket flush_pkt;
 static const char *input_filename;
 static VideoState *cur_stream;
+// 0 时解码完整个图像后再转换，命令行-nofuse 设置。
+static int fused_convert = 1;
+// 非0 时在媒体文件旁保存解析好的文件头和索引，命令行-index_cache 设置。
+// 默认关闭，避免在只读或者共享的目录中写文件。
+static int index_cache;
+// 视频缩小为1/(1 << lowres) 解码，解码器不支持时按原大小，命令行-lowres 设置。
+static int lowres;
 
 // SDL 库需要的显示表面。
 static SDL_Surface *screen;
@@ -105,142 +172,136 @@ int64_t av_gettime(void) {
     return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 #endif
 }
-// 初始化队列，初始化为0 后再创建线程同步使用的互斥和条件。
-static void packet_queue_init(PacketQueue *q) // packet queue handling
-{
-    memset(q, 0, sizeof(PacketQueue));
-    q->mutex = SDL_CreateMutex();
-    q->cond = SDL_CreateCond();
-}
-
-// 刷新队列，释放掉队列中所有动态分配的内存，包括音视频裸数据占用的内存和AVPacketList
-// 结构占用的内存
-static void packet_queue_flush(PacketQueue *q) {
-    AVPacketList *pkt, *pkt1;
-
-    // 由于是多线程程序，需要同步，所以在遍历队列释放所有动态分配内存前，加锁。
-    SDL_LockMutex(q->mutex);
-    for (pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
-        pkt1 = pkt->next;
-        av_free_packet(&pkt->pkt); // 释放音视频数据内存
-        av_freep(&pkt);            // 释放AVPacketList 结构
-    }
-    q->last_pkt = NULL;
-    q->first_pkt = NULL;
-    q->size = 0;
-    SDL_UnlockMutex(q->mutex);
-}
-
-// 释放队列占用所有资源，首先释放掉所有动态分配的内存，接着释放申请的互斥量和条件量。
-static void packet_queue_end(PacketQueue *q) {
-    packet_queue_flush(q);
-    SDL_DestroyMutex(q->mutex);
-    SDL_DestroyCond(q->cond);
-}
-
-// 往音视频队列中挂接音视频数据帧/数据包。
-static int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
-    AVPacketList *pkt1;
-
-    // 先分配一个AVPacketList 结构内存
-    pkt1 = av_malloc(sizeof(AVPacketList));
-    if (!pkt1)
-        return -1;
-    pkt1->pkt = *pkt;
-    pkt1->next = NULL;
+// 分配SDL 库需要的Overlay 显示表面，并设置长宽属性。
+static void alloc_picture(void *opaque) {
+    VideoState *is = opaque;
+    VideoPicture *vp;
 
-    SDL_LockMutex(q->mutex);
+    vp = &is->pictq[0];
 
-    if (!q->last_pkt)
-        q->first_pkt = pkt1;
-    else
-        q->last_pkt->next = pkt1;
-    // 添加到队列末尾
-    q->last_pkt = pkt1;
-    // 统计缓存的媒体数据大小
-    q->size += pkt1->pkt.size;
+    if (vp->bmp)
+        SDL_FreeYUVOverlay(vp->bmp);
 
-    // 设置条件量为有信号状态，如果解码线程因等待而睡眠就及时唤醒。
-    SDL_CondSignal(q->cond);
+    vp->bmp = SDL_CreateYUVOverlay(is->video_st->actx->width,
+                                   is->video_st->actx->height, SDL_YV12_OVERLAY,
+                                   screen);
 
-    SDL_UnlockMutex(q->mutex);
-    return 0;
+    vp->width = is->video_st->actx->width;
+    vp->height = is->video_st->actx->height;
 }
 
-// 设置异常请求退出状态。
-static void packet_queue_abort(PacketQueue *q) {
-    SDL_LockMutex(q->mutex);
-
-    q->abort_request = 1; // 请求异常退出
+// 锁定的显示表面，YV12 的U、V 平面按YUV420P 的顺序放到pict。
+static void overlay_picture(VideoPicture *vp, AVPicture *pict) {
+    pict->data[0] = vp->bmp->pixels[0];
+    pict->data[1] = vp->bmp->pixels[2];
+    pict->data[2] = vp->bmp->pixels[1];
 
-    SDL_CondSignal(q->cond);
-
-    SDL_UnlockMutex(q->mutex);
+    pict->linesize[0] = vp->bmp->pitches[0];
+    pict->linesize[1] = vp->bmp->pitches[2];
+    pict->linesize[2] = vp->bmp->pitches[1];
 }
 
-// 从队列中取出一帧/包数据。
-/* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
-static int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block) {
-    AVPacketList *pkt1;
-    int ret;
+// 取转换成YUV420P 的上下文。格式和大小不变时一直用同一个上下文，不用每帧
+// 分配中间图像；大图像按CPU 个数分条带并行转换。
+static ImgConvertContext *video_convert_ctx(VideoState *is) {
+    AVCodecContext *avctx = is->video_st->actx;
 
-    SDL_LockMutex(q->mutex);
+    if (!is->convert_ctx) {
+        is->convert_ctx = img_convert_context_new(
+            PIX_FMT_YUV420P, avctx->pix_fmt, avctx->width, avctx->height);
+        if (is->convert_ctx)
+            img_convert_context_set_threads(is->convert_ctx, 0);
+    }
+    is->convert_ctx =
+        img_convert_context_get(is->convert_ctx, PIX_FMT_YUV420P,
+                                avctx->pix_fmt, avctx->width, avctx->height);
+    return is->convert_ctx;
+}
 
-    for (;;) {
-        // 如果异常请求退出标记置位，就带错误码返回。
-        if (q->abort_request) {
-            ret = -1; // 异常
-            break;
-        }
+// 转换src 中从y 开始的height 行，dirty 不为NULL 时只转换其中有改变的行
+// (见AVFrame.dirty)。返回转换的行数，出错时返回-1。
+static int video_convert_rows(VideoState *is, AVPicture *dst,
+                              const AVPicture *src, const uint8_t *dirty, int y,
+                              int height) {
+    int end = y + height, y0 = y, y1, n = 0;
 
-        pkt1 = q->first_pkt;
-        if (pkt1) {
-            // 如果队列中有数据，就取第一个数据包
-            q->first_pkt = pkt1->next;
-            if (!q->first_pkt)
-                q->last_pkt = NULL;
-            // 修正缓存的媒体大小
-            q->size -= pkt1->pkt.size;
-            *pkt = pkt1->pkt;
-            // 释放掉AVPacketList 结构
-            av_free(pkt1);
-            ret = 1;
-            break;
-        } else if (!block) // 阻塞标记，1(阻塞模式)，0(非阻塞模式)
-        {
-            ret = 0; // 非阻塞模式，没东西直接返回0
-            break;
-        } else {
-            // 如果是阻塞模式，没数据就进入睡眠状态等待
-            SDL_CondWait(q->cond, q->mutex);
+    if (!dirty) {
+        if (img_convert_frame_rows(is->convert_ctx, dst, src, y, height) < 0)
+            return -1;
+        return height;
+    }
+    // 连续有改变的块合成一段转换
+    while (y0 < end) {
+        if (!dirty[y0 / AV_DIRTY_ROWS]) {
+            y0 = (y0 / AV_DIRTY_ROWS + 1) * AV_DIRTY_ROWS;
+            continue;
         }
+        y1 = y0;
+        while (y1 < end && dirty[y1 / AV_DIRTY_ROWS])
+            y1 = (y1 / AV_DIRTY_ROWS + 1) * AV_DIRTY_ROWS;
+        if (y1 > end)
+            y1 = end;
+        if (img_convert_frame_rows(is->convert_ctx, dst, src, y0, y1 - y0) < 0)
+            return -1;
+        n += y1 - y0;
+        y0 = y1;
     }
-    SDL_UnlockMutex(q->mutex);
-    return ret;
+    return n;
 }
 
-// 分配SDL 库需要的Overlay 显示表面，并设置长宽属性。
-static void alloc_picture(void *opaque) {
-    VideoState *is = opaque;
-    VideoPicture *vp;
+// 解码器完成一段行时调用，把这些行转换到显示表面。
+static void video_draw_band(AVCodecContext *avctx, const AVFrame *src, int y,
+                            int height) {
+    VideoState *is = avctx->opaque;
+    int n;
 
-    vp = &is->pictq[0];
+    if (is->band_error)
+        return;
+    n = video_convert_rows(is, &is->band_pict, (const AVPicture *)src,
+                           is->band_dirty ? src->dirty : NULL, y, height);
+    if (n < 0) {
+        is->band_error = 1;
+        return;
+    }
+    is->band_rows += height;
+    is->band_changed += n;
+}
 
-    if (vp->bmp)
-        SDL_FreeYUVOverlay(vp->bmp);
+// 开始边解码边转换，锁定显示表面。
+static int video_band_begin(VideoState *is) {
+    AVCodecContext *avctx = is->video_st->actx;
+    VideoPicture *vp = &is->pictq[0];
 
-    vp->bmp = SDL_CreateYUVOverlay(is->video_st->actx->width,
-                                   is->video_st->actx->height, SDL_YV12_OVERLAY,
-                                   screen);
+    if (!fused_convert || !vp->bmp || !video_convert_ctx(is))
+        return -1;
+    SDL_LockYUVOverlay(vp->bmp);
+    overlay_picture(vp, &is->band_pict);
+    is->band_rows = 0;
+    is->band_changed = 0;
+    is->band_error = 0;
+    is->band_dirty = is->overlay_valid;
+    avctx->opaque = is;
+    avctx->draw_horiz_band = video_draw_band;
+    return 0;
+}
 
-    vp->width = is->video_st->actx->width;
-    vp->height = is->video_st->actx->height;
+// 解码结束后解锁显示表面，所有的行都已经转换时返回0，否则要整个重新转换。
+static int video_band_end(VideoState *is) {
+    AVCodecContext *avctx = is->video_st->actx;
+
+    avctx->draw_horiz_band = NULL;
+    SDL_UnlockYUVOverlay(is->pictq[0].bmp);
+    return !is->band_error && is->band_rows == avctx->height ? 0 : -1;
 }
 
-static int video_display(VideoState *is, AVFrame *src_frame, double pts) {
+// 显示一帧图像，src 为NULL 时解码时已经转换到显示表面。dirty 是src 中有
+// 改变的行(见AVFrame.dirty)，为NULL 时整个转换。没有行改变时不刷新显示。
+static int video_display(VideoState *is, const AVPicture *src,
+                         const uint8_t *dirty, double pts) {
+    AVCodecContext *avctx = is->video_st->actx;
     VideoPicture *vp;
-    int dst_pix_fmt;
     AVPicture pict;
+    int changed = avctx->height;
 
     if (is->videoq.abort_request)
         return -1;
@@ -254,41 +315,129 @@ static int video_display(VideoState *is, AVFrame *src_frame, double pts) {
         if (pts)
             Sleep((int)(is->frame_last_delay * 1000));
 #if 1
-        /* get a pointer on the bitmap */
-        SDL_LockYUVOverlay(vp->bmp);
+        if (src) {
+            /* get a pointer on the bitmap */
+            SDL_LockYUVOverlay(vp->bmp);
+            overlay_picture(vp, &pict);
+            if (video_convert_ctx(is)) {
+                changed = dirty ? video_convert_rows(is, &pict, src, dirty, 0,
+                                                     avctx->height)
+                                : -1;
+                if (changed < 0) {
+                    img_convert_frame(is->convert_ctx, &pict, src);
+                    changed = avctx->height;
+                }
+            }
+            SDL_UnlockYUVOverlay(vp->bmp); /* update the bitmap content */
+        } else {
+            changed = is->band_changed;
+        }
+
+        // SDL 1.2 的Overlay 只能整个显示，只能跳过没有改变的帧
+        if (changed) {
+            rect.x = 0;
+            rect.y = 0;
+            rect.w = avctx->width;
+            rect.h = avctx->height;
+            SDL_DisplayYUVOverlay(vp->bmp, &rect);
+        }
+#endif
+    }
+    return 0;
+}
+// 记录一次seek 的延迟。
+static void update_seek_stats(VideoState *is, int64_t latency) {
+    is->seek_count++;
+    is->seek_latency_total += latency;
+    if (latency > is->seek_latency_max)
+        is->seek_latency_max = latency;
+}
 
-        dst_pix_fmt = PIX_FMT_YUV420P;
-        pict.data[0] = vp->bmp->pixels[0];
-        pict.data[1] = vp->bmp->pixels[2];
-        pict.data[2] = vp->bmp->pixels[1];
+// 请求seek 到pos(以AV_TIME_BASE 为单位)，rel 小于0 时向后找关键帧。
+// frame 不是AV_NOPTS_VALUE 时是精确seek，视频从关键帧解码到这一帧才开始显示。
+// 先中断解复用线程对队列空间的等待，再发出请求，上一个请求还没有处理时忽略。
+static void stream_seek(VideoState *is, int64_t pos, int rel, int64_t frame) {
+    packet_queue_interrupt(&is->audioq, 1);
+    packet_queue_interrupt(&is->videoq, 1);
+
+    SDL_LockMutex(is->wait_mutex);
+    if (!is->seek_req) {
+        is->seek_pos = pos;
+        is->seek_flags = rel < 0 ? AVSEEK_FLAG_BACKWARD : 0;
+        is->seek_frame = frame;
+        is->seek_req_time = av_gettime();
+        is->seek_req = 1;
+        SDL_CondSignal(is->continue_read_cond);
+    }
+    SDL_UnlockMutex(is->wait_mutex);
+}
 
-        pict.linesize[0] = vp->bmp->pitches[0];
-        pict.linesize[1] = vp->bmp->pitches[2];
-        pict.linesize[2] = vp->bmp->pitches[1];
+// 精确seek 到视频的第frame 帧。换算成时间时取帧的中间，av_seek_frame()
+// 截断换算回帧号时不会少1。
+static void stream_seek_frame(VideoState *is, int64_t frame) {
+    AVRational tb = is->video_st->time_base;
 
-        img_convert(&pict, dst_pix_fmt, (AVPicture *)src_frame,
-                    is->video_st->actx->pix_fmt, is->video_st->actx->width,
-                    is->video_st->actx->height);
+    stream_seek(is,
+                av_rescale(2 * frame + 1, AV_TIME_BASE * (int64_t)tb.num,
+                           2 * (int64_t)tb.den),
+                -1, frame);
+}
 
-        SDL_UnlockYUVOverlay(vp->bmp); /* update the bitmap content */
+// 暂停时等待单步请求，seeking 非0 时要继续解码到精确seek 的目标帧，不等待。
+// 返回请求的单步，没有时返回0。暂停期间单步过，继续播放时*resume 置1。
+static int video_wait_step(VideoState *is, int seeking, int *resume) {
+    int step;
+
+    SDL_LockMutex(is->wait_mutex);
+    while (is->paused && !is->step && !seeking && !is->abort_request)
+        SDL_CondWait(is->step_cond, is->wait_mutex);
+    step = is->step;
+    is->step = 0;
+    *resume = !is->paused && is->stepped;
+    if (*resume)
+        is->stepped = 0;
+    SDL_UnlockMutex(is->wait_mutex);
+    return step;
+}
 
-        rect.x = 0;
-        rect.y = 0;
-        rect.w = is->video_st->actx->width;
-        rect.h = is->video_st->actx->height;
-        SDL_DisplayYUVOverlay(vp->bmp, &rect);
-#endif
-    }
+// 从图像缓存中取第frame 帧显示，没有时返回-1。
+static int video_display_cached(VideoState *is, int64_t frame) {
+    AVPicture pict;
+    int pix_fmt, width, height;
+
+    if (av_frame_cache_get(is->frame_cache, is->video_stream, frame, &pict,
+                           &pix_fmt, &width, &height) < 0 ||
+        pix_fmt != is->video_st->actx->pix_fmt ||
+        width != is->video_st->actx->width ||
+        height != is->video_st->actx->height)
+        return -1;
+    if (video_display(is, &pict, NULL, 0) < 0)
+        return -1;
+    is->overlay_valid = 0;
+    is->frame_number = frame;
+    is->video_clock = av_q2d(is->video_st->time_base) * frame;
     return 0;
 }
+
 // 视频解码线程，主要功能是分配解码帧缓存和SDL
 // 显示缓存后进入解码循环(从队列中取数据帧，解码，计算时钟，显示)，释放视频数据帧
 // / 数据包缓存。
+// 解码出的图像都放入图像缓存。单步后退时解码器已经越过了目标帧，从缓存中取，
+// 没有时精确seek，从前面的关键帧解码到目标帧。
 static int video_thread(void *arg) {
     VideoState *is = arg;
+    AVCodecContext *avctx = is->video_st->actx;
     AVPacket pkt1, *pkt = &pkt1;
     int len1, got_picture;
     double pts = 0;
+    int64_t seek_time = 0; // 非0 时seek 后还没有显示出第一帧，是seek 请求的时间
+    int64_t frame_no, target;
+    int64_t last_decoded = AV_NOPTS_VALUE; // 解码器最近解出的帧号
+    int64_t skip_to = AV_NOPTS_VALUE; // 精确seek 的目标帧号，之前的帧只解码不显示
+    int seeking = 0; // 单步时发出了精确seek，目标帧还没有显示
+    int step = 0;    // 还没有完成的单步
+    int fused;       // 这一帧解码时已经转换到显示表面
+    int resume, no_delay;
     // 分配解码帧缓存
     AVFrame *frame = av_malloc(sizeof(AVFrame));
     memset(frame, 0, sizeof(AVFrame));
@@ -297,24 +446,96 @@ static int video_thread(void *arg) {
     alloc_picture(is);
 
     for (;;) {
+        if (!step) {
+            step = video_wait_step(is, seeking, &resume);
+            // 单步后视频和音频不在同一位置，精确seek 到下一帧，音频跟着重新开始。
+            if (resume) {
+                stream_seek_frame(is, is->frame_number + 1);
+                seeking = 1;
+                continue;
+            }
+        }
+
+        // 目标帧在解码器的位置之前，只能从缓存中取。
+        if (step < 0 || (step > 0 && is->frame_number < last_decoded)) {
+            target = is->frame_number + step;
+            step = 0;
+            if (target < 0 || video_display_cached(is, target) == 0)
+                continue;
+            stream_seek_frame(is, target);
+            seeking = 1;
+            continue;
+        }
+
         // 从队列中取数据帧/数据包
         if (packet_queue_get(&is->videoq, pkt, 1) < 0)
             break;
 
-        // 实质性解码
+        // seek 后重置解码器，flush_pkt 的pts 是seek 请求的时间，dts 是精确seek
+        // 的目标帧号。
+        if (pkt->data == flush_pkt.data) {
+            SDL_LockMutex(is->video_decoder_mutex);
+            avcodec_flush_buffers(avctx);
+            SDL_UnlockMutex(is->video_decoder_mutex);
+            seek_time = pkt->pts;
+            skip_to = pkt->dts;
+            last_decoded = AV_NOPTS_VALUE;
+            seeking = 0;
+            is->overlay_valid = 0;
+            continue;
+        }
+
+        // 实质性解码，要显示的帧边解码边转换到显示表面
+        frame_no = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : last_decoded + 1;
+        fused = !seeking &&
+                (skip_to == AV_NOPTS_VALUE || frame_no >= skip_to) &&
+                video_band_begin(is) == 0;
         SDL_LockMutex(is->video_decoder_mutex);
-        len1 = avcodec_decode_video(is->video_st->actx, frame, &got_picture,
-                                    pkt->data, pkt->size);
+        len1 = avcodec_decode_video(avctx, frame, &got_picture, pkt->data,
+                                    pkt->size);
         SDL_UnlockMutex(is->video_decoder_mutex);
+        if (fused)
+            fused = video_band_end(is) == 0;
 
         // 计算同步时钟
         if (pkt->dts != AV_NOPTS_VALUE)
             pts = av_q2d(is->video_st->time_base) * pkt->dts;
 
         // 判断得到图像，调用显示函数同步显示视频图像。
+        // seek 后的第一帧、暂停时单步的帧和快进快退的帧立即显示，不再等一帧的
+        // 间隔。
+        // 精确seek 的目标帧之前的帧只放入缓存，不显示；发出精确seek 后、
+        // 取到flush_pkt 之前的帧是seek 前留在队列中的，也不显示。
         if (got_picture) {
-            if (video_display(is, frame, pts) < 0)
+            last_decoded = frame_no;
+            // 快进快退时关键帧接连解码在上一个关键帧的图像上，不一定是这一帧
+            // 真正的图像，不放入缓存
+            if (is->rate == 1 && is->trick_rate == 1)
+                av_frame_cache_put(is->frame_cache, is->video_stream, frame_no,
+                                   (AVPicture *)frame, avctx->pix_fmt,
+                                   avctx->width, avctx->height);
+            if (seeking ||
+                (skip_to != AV_NOPTS_VALUE && frame_no < skip_to)) {
+                is->overlay_valid = 0;
+                av_free_packet(pkt);
+                continue;
+            }
+            skip_to = AV_NOPTS_VALUE;
+            step = 0;
+
+            no_delay = seek_time || is->paused || is->rate != 1;
+            // 显示表面中是上一帧时只转换有改变的行
+            if (video_display(is, fused ? NULL : (AVPicture *)frame,
+                              is->overlay_valid ? frame->dirty : NULL,
+                              no_delay ? 0 : pts) < 0)
                 goto the_end;
+            is->overlay_valid = 1;
+            is->frame_number = frame_no;
+            is->video_clock = pts;
+            if (seek_time) {
+                update_seek_stats(is, av_gettime() - seek_time);
+                seek_time = 0;
+            }
         }
         // 释放视频数据帧/数据包内存，此数据包内存是在av_get_packet()函数中调用av_malloc()分配的。
         av_free_packet(pkt);
@@ -375,6 +596,16 @@ static int audio_decode_frame(VideoState *is, uint8_t *audio_buf,
         if (packet_queue_get(&is->audioq, pkt, 1) < 0)
             return -1;
 
+        // seek 后重置解码器，丢弃以前的滤波器状态。
+        if (pkt->data == flush_pkt.data) {
+            SDL_LockMutex(is->audio_decoder_mutex);
+            avcodec_flush_buffers(is->audio_st->actx);
+            SDL_UnlockMutex(is->audio_decoder_mutex);
+            continue;
+        }
+        if (pkt->dts != AV_NOPTS_VALUE)
+            is->audio_clock = av_q2d(is->audio_st->time_base) * pkt->dts;
+
         // 初始化数据包首地址和大小，用于一包中包含多个音频帧需多次解码的情况。
         is->audio_pkt_data = pkt->data;
         is->audio_pkt_size = pkt->size;
@@ -454,6 +685,8 @@ static int stream_component_open(VideoState *is, int stream_index) {
     codec = avcodec_find_decoder(enc->codec_id);
 
     // 核心功能之一,打开编解码器，初始化具体编解码器的运行环境。
+    if (enc->codec_type == CODEC_TYPE_VIDEO)
+        enc->lowres = lowres;
     if (!codec || avcodec_open(enc, codec) < 0)
         return -1;
 
@@ -464,19 +697,32 @@ static int stream_component_open(VideoState *is, int stream_index) {
         is->audio_st = ic->streams[stream_index];
         is->audio_buf_size = 0;
         is->audio_buf_index = 0;
-        // 初始化音频队列
+        // 设置音频队列的时间基和缓存时长上限
         memset(&is->audio_pkt, 0, sizeof(is->audio_pkt));
-        packet_queue_init(&is->audioq);
+        is->audioq.time_base = is->audio_st->time_base;
+        is->audioq.max_duration = MAX_AUDIOQ_DURATION;
         SDL_PauseAudio(0); // 启动广义的音频解码线程。
         break;
     case CODEC_TYPE_VIDEO:
+        // avcodec_open() 已经按lowres 设置了输出大小，窗口按这个大小设置，
+        // 视频解码线程也按这个大小分配显示表面，不会拉伸显示。
+        screen = SDL_SetVideoMode(enc->width, enc->height, 0,
+                                  SDL_HWSURFACE | SDL_ASYNCBLIT | SDL_HWACCEL |
+                                      SDL_RESIZABLE);
+        if (!screen) {
+            fprintf(stderr, "SDL_SetVideoMode: %s\n", SDL_GetError());
+            avcodec_close(enc);
+            return -1;
+        }
+        SDL_WM_SetCaption("FFplay", "FFplay"); // 修改是为了适配视频大小
         // 在VideoState 中记录视频流参数。
         is->video_stream = stream_index;
         is->video_st = ic->streams[stream_index];
 
         is->frame_last_delay = is->video_st->frame_last_delay;
-        // 初始化视频队列
-        packet_queue_init(&is->videoq);
+        // 设置视频队列的时间基和缓存时长上限
+        is->videoq.time_base = is->video_st->time_base;
+        is->videoq.max_duration = MAX_VIDEOQ_DURATION;
         is->video_tid =
             SDL_CreateThread(video_thread, is); // 直接启动视频解码线程。
         break;
@@ -502,12 +748,10 @@ static void stream_component_close(VideoState *is, int stream_index) {
     case CODEC_TYPE_AUDIO:
         packet_queue_abort(&is->audioq);
         SDL_CloseAudio();
-        packet_queue_end(&is->audioq);
         break;
     case CODEC_TYPE_VIDEO:
         packet_queue_abort(&is->videoq);
         SDL_WaitThread(is->video_tid, NULL);
-        packet_queue_end(&is->videoq);
         break;
     default:
         break;
@@ -515,6 +759,139 @@ static void stream_component_close(VideoState *is, int stream_index) {
     // 释放编解码器上下文资源
     avcodec_close(enc);
 }
+// 解复用线程无事可做时睡眠，直到有退出、seek 或变速请求。
+static void stream_wait_event(VideoState *is) {
+    SDL_LockMutex(is->wait_mutex);
+    if (!is->abort_request && !is->seek_req && is->rate == is->trick_rate)
+        SDL_CondWait(is->continue_read_cond, is->wait_mutex);
+    SDL_UnlockMutex(is->wait_mutex);
+}
+
+// 同stream_wait_event()，最多睡眠ms 毫秒。
+static void stream_wait_timeout(VideoState *is, int ms) {
+    SDL_LockMutex(is->wait_mutex);
+    if (!is->abort_request && !is->seek_req && is->rate == is->trick_rate)
+        SDL_CondWaitTimeout(is->continue_read_cond, is->wait_mutex, ms);
+    SDL_UnlockMutex(is->wait_mutex);
+}
+
+// 从视频的第frame 帧开始按当前速度计时。
+static void stream_trick_restart(VideoState *is, int64_t frame) {
+    is->trick_frame = frame;
+    is->trick_time = av_gettime();
+    is->trick_index = -1;
+}
+
+// 切换播放速度。进入快进快退时丢掉队列中的包；回到正常速度时精确seek 到
+// 当前显示的帧，音频从同一位置开始。
+static void stream_change_trick_rate(VideoState *is) {
+    AVPacket pkt;
+    int old_rate = is->trick_rate;
+
+    SDL_LockMutex(is->wait_mutex);
+    is->trick_rate = is->rate;
+    SDL_UnlockMutex(is->wait_mutex);
+    packet_queue_interrupt(&is->audioq, 0);
+    packet_queue_interrupt(&is->videoq, 0);
+
+    if (is->trick_rate == 1) {
+        stream_seek_frame(is, is->frame_number);
+        return;
+    }
+    stream_trick_restart(is, is->frame_number);
+    if (old_rate == 1) {
+        pkt = flush_pkt;
+        pkt.pts = 0;
+        if (is->audio_stream >= 0)
+            packet_queue_flush(&is->audioq);
+        packet_queue_flush(&is->videoq);
+        packet_queue_put(&is->videoq, &pkt);
+    }
+}
+
+// 快进快退时读取一个关键帧：按经过的时间和速度算出当前的视频帧号，在索引中
+// 找之前最近的关键帧，和上次读取的不同时seek 过去读出来放入视频队列。
+static void stream_trick_play(VideoState *is) {
+    AVStream *st = is->video_st;
+    AVPacket pkt;
+    AVIndexEntry e;
+    int64_t target;
+    int i, n;
+
+    // 暂停时从当前显示的帧重新计时。
+    if (is->paused) {
+        stream_trick_restart(is, is->frame_number);
+        stream_wait_timeout(is, TRICK_WAIT_MS);
+        return;
+    }
+
+    target = is->trick_frame +
+             av_rescale((av_gettime() - is->trick_time) * is->trick_rate,
+                        st->time_base.den,
+                        AV_TIME_BASE * (int64_t)st->time_base.num);
+    i = av_index_search_timestamp(st, target, AVSEEK_FLAG_BACKWARD);
+    if (i < 0 || i == is->trick_index || av_index_get_entry(st, i, &e) < 0) {
+        stream_wait_timeout(is, TRICK_WAIT_MS);
+        return;
+    }
+    is->trick_index = i;
+
+    if (av_seek_frame(is->ic, is->video_stream, e.timestamp,
+                      AVSEEK_FLAG_BACKWARD) < 0)
+        return;
+    for (n = 0; n < TRICK_MAX_SKIP; n++) {
+        if (av_read_packet(is->ic, &pkt) < 0)
+            break;
+        if (pkt.stream_index == is->video_stream) {
+            packet_queue_wait_space(&is->videoq);
+            if (packet_queue_put(&is->videoq, &pkt) < 0)
+                av_free_packet(&pkt);
+            break;
+        }
+        av_free_packet(&pkt);
+    }
+}
+
+// 处理seek 请求：移动文件位置，丢弃队列中seek 前的包，再放入flush_pkt 通知
+// 解码线程重置解码器。
+static void stream_do_seek(VideoState *is) {
+    AVPacket pkt;
+    int64_t pos, req_time, frame;
+    int flags;
+
+    SDL_LockMutex(is->wait_mutex);
+    pos = is->seek_pos;
+    flags = is->seek_flags;
+    frame = is->seek_frame;
+    req_time = is->seek_req_time;
+    is->seek_req = 0;
+    SDL_UnlockMutex(is->wait_mutex);
+
+    if (av_seek_frame(is->ic, -1, pos, flags) < 0) {
+        fprintf(stderr, "%s: error while seeking\n", is->filename);
+    } else {
+        // 快进快退时从seek 的位置重新计时。
+        if (is->video_stream >= 0)
+            stream_trick_restart(
+                is, av_rescale(pos, is->video_st->time_base.den,
+                               AV_TIME_BASE *
+                                   (int64_t)is->video_st->time_base.num));
+        pkt = flush_pkt;
+        pkt.pts = req_time;
+        if (is->audio_stream >= 0) {
+            packet_queue_flush(&is->audioq);
+            packet_queue_put(&is->audioq, &pkt);
+        }
+        if (is->video_stream >= 0) {
+            pkt.dts = frame;
+            packet_queue_flush(&is->videoq);
+            packet_queue_put(&is->videoq, &pkt);
+        }
+    }
+    packet_queue_interrupt(&is->audioq, 0);
+    packet_queue_interrupt(&is->videoq, 0);
+}
+
 // 文件解析线程，函数名有点不名副其实。完成三大功能，直接识别文件格式和间接识别媒体格式，打开具体的编解码器并启动解码线程，分离音视频媒体包并挂接到相应队列。
 static int decode_thread(void *arg) {
     VideoState *is = arg;
@@ -523,8 +900,6 @@ static int decode_thread(void *arg) {
     AVPacket pkt1, *pkt = &pkt1;
     AVFormatParameters params, *ap = &params;
 
-    int flags = SDL_HWSURFACE | SDL_ASYNCBLIT | SDL_HWACCEL | SDL_RESIZABLE;
-
     // 初始化基本变量指示没有相应的流。
     video_index = -1;
     audio_index = -1;
@@ -533,6 +908,16 @@ static int decode_thread(void *arg) {
     is->audio_stream = -1;
 
     memset(ap, 0, sizeof(*ap));
+    // 后台预读，解复用线程不再阻塞在磁盘I/O 上。
+    ap->readahead_buffers = 4;
+    // 非交织AVI 一次规划64 个包，按文件位置合并读取。
+    ap->ni_sched_packets = 64;
+    // 非交织AVI 音视频各用一个I/O 上下文，交替读取时互不冲掉缓存。
+    ap->ni_stream_io = 1;
+    // 文件旁保存解析好的文件头和索引，再次打开时不用重新解析。
+    ap->index_cache = index_cache;
+    // 没有idx1 的文件用所有的CPU 并行扫描重建索引。
+    ap->index_threads = av_cpu_count();
     // 调用函数直接识别文件格式，在此函数中再调用其他函数间接识别媒体格式。
     err = av_open_input_file(&ic, is->filename, NULL, 0, ap);
     if (err < 0) {
@@ -545,7 +930,7 @@ static int decode_thread(void *arg) {
     for (i = 0; i < ic->nb_streams; i++) {
         AVCodecContext *enc = ic->streams[i]->actx;
         switch (enc->codec_type) {
-            // 保存音视频流索引，并把显示视频参数设置到SDL 库。
+            // 保存音视频流索引，显示视频参数在打开解码器后设置到SDL 库。
         case CODEC_TYPE_AUDIO:
             if (audio_index < 0)
                 audio_index = i;
@@ -554,10 +939,6 @@ static int decode_thread(void *arg) {
             if (video_index < 0)
                 video_index = i;
 
-            screen = SDL_SetVideoMode(enc->width, enc->height, 0, flags);
-
-            SDL_WM_SetCaption("FFplay", "FFplay"); // 修改是为了适配视频大小
-
             //          schedule_refresh(is, 40);
             break;
         default:
@@ -582,19 +963,32 @@ static int decode_thread(void *arg) {
             // 如果异常退出请求置位，就退出文件解析线程。
             break;
         }
+        if (is->seek_req)
+            stream_do_seek(is);
+        if (is->rate != is->trick_rate)
+            stream_change_trick_rate(is);
+        if (is->trick_rate != 1) {
+            stream_trick_play(is);
+            continue;
+        }
+
+        // 如果队列缓存已经足够，就睡眠等待解码线程腾出空间，不再轮询。
+        // if the queue are full, no need to read more
+        packet_queue_wait_space(&is->audioq);
+        packet_queue_wait_space(&is->videoq);
+        if (is->abort_request)
+            break;
 
-        if (is->audioq.size > MAX_AUDIOQ_SIZE ||
-            is->videoq.size > MAX_VIDEOQ_SIZE || url_feof(&ic->pb)) {
-            // 如果队列满，就稍微延时一下。
-            SDL_Delay(
-                10); // if the queue are full, no need to read more,wait 10 ms
+        if (url_feof(&ic->pb)) {
+            // 文件读完，等待用户事件。
+            stream_wait_event(is);
             continue;
         }
         // 从媒体文件中完整的读取一包音视频数据。
         ret = av_read_packet(ic, pkt); // av_read_frame(ic, pkt);
         if (ret < 0) {
             if (url_ferror(&ic->pb) == 0) {
-                SDL_Delay(100); // wait for user event
+                stream_wait_event(is); // wait for user event
                 continue;
             } else
                 break;
@@ -610,9 +1004,11 @@ static int decode_thread(void *arg) {
         }
         // 判断包数据的类型，分别挂接到相应队列，如果是不识别的类型，就直接释放丢弃掉。
         if (pkt->stream_index == is->audio_stream) {
-            packet_queue_put(&is->audioq, pkt);
+            if (packet_queue_put(&is->audioq, pkt) < 0)
+                av_free_packet(pkt);
         } else if (pkt->stream_index == is->video_stream) {
-            packet_queue_put(&is->videoq, pkt);
+            if (packet_queue_put(&is->videoq, pkt) < 0)
+                av_free_packet(pkt);
         } else {
             av_free_packet(pkt);
         }
@@ -620,7 +1016,7 @@ static int decode_thread(void *arg) {
     // 简单的延时，让后面的线程有机会把数据解码显示完。当然丢弃掉最后的一点点数据也可以。
     while (!is->abort_request) // wait until the end
     {
-        SDL_Delay(100);
+        stream_wait_event(is);
     }
 
     ret = 0;
@@ -659,6 +1055,16 @@ static VideoState *stream_open(const char *filename, AVInputFormat *iformat) {
 
     is->audio_decoder_mutex = SDL_CreateMutex();
     is->video_decoder_mutex = SDL_CreateMutex();
+    is->wait_mutex = SDL_CreateMutex();
+    is->continue_read_cond = SDL_CreateCond();
+    is->step_cond = SDL_CreateCond();
+    is->rate = 1;
+    is->trick_rate = 1;
+    is->frame_cache = av_frame_cache_new(FRAME_CACHE_SIZE);
+
+    // 队列在启动解复用线程前初始化，退出时随时可以安全地唤醒睡眠的线程。
+    packet_queue_init(&is->audioq);
+    packet_queue_init(&is->videoq);
 
     is->parse_tid = SDL_CreateThread(decode_thread, is);
     if (!is->parse_tid) {
@@ -672,9 +1078,19 @@ static void stream_close(VideoState *is) {
     VideoPicture *vp;
     int i;
 
+    // 置退出标记，并唤醒可能在等待队列空间或用户事件的解复用线程。
+    SDL_LockMutex(is->wait_mutex);
     is->abort_request = 1;
+    SDL_CondSignal(is->continue_read_cond);
+    SDL_CondSignal(is->step_cond);
+    SDL_UnlockMutex(is->wait_mutex);
+    packet_queue_abort(&is->audioq);
+    packet_queue_abort(&is->videoq);
     SDL_WaitThread(is->parse_tid, NULL);
 
+    packet_queue_end(&is->audioq);
+    packet_queue_end(&is->videoq);
+
     for (i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++) {
         vp = &is->pictq[i];
         if (vp->bmp) {
@@ -685,6 +1101,29 @@ static void stream_close(VideoState *is) {
 
     SDL_DestroyMutex(is->audio_decoder_mutex);
     SDL_DestroyMutex(is->video_decoder_mutex);
+    SDL_DestroyMutex(is->wait_mutex);
+    SDL_DestroyCond(is->continue_read_cond);
+    SDL_DestroyCond(is->step_cond);
+
+    if (is->frame_cache) {
+        AVFrameCacheStats st;
+
+        av_frame_cache_get_stats(is->frame_cache, &st);
+        if (st.requests)
+            fprintf(stderr,
+                    "frame cache: %d/%d hits, %d frames, %d KB used, "
+                    "%d evictions\n",
+                    (int)st.hits, (int)st.requests, st.entries,
+                    (int)(st.bytes_used / 1024), (int)st.evictions);
+        av_frame_cache_free(is->frame_cache);
+    }
+    img_convert_context_free(is->convert_ctx);
+
+    if (is->seek_count)
+        fprintf(stderr, "seek: %d, latency avg %d ms, max %d ms\n",
+                is->seek_count,
+                (int)(is->seek_latency_total / is->seek_count / 1000),
+                (int)(is->seek_latency_max / 1000));
 
     free(is);
 }
@@ -699,10 +1138,71 @@ void do_exit(void) {
     SDL_Quit();
     exit(0);
 }
+// 当前播放的时间(秒)，有视频时以视频为准。
+static double get_master_clock(VideoState *is) {
+    if (is->video_stream >= 0)
+        return is->video_clock;
+    return is->audio_clock;
+}
+
+// 暂停或继续播放。
+static void stream_toggle_pause(VideoState *is) {
+    SDL_LockMutex(is->wait_mutex);
+    is->paused = !is->paused;
+    SDL_CondSignal(is->step_cond);
+    SDL_UnlockMutex(is->wait_mutex);
+    if (is->audio_stream >= 0)
+        SDL_PauseAudio(is->paused || is->rate != 1);
+}
+
+// 依次可选的播放速度。
+static const int trick_rates[] = {-32, -16, -8, -4, -2, 1, 2, 4, 8, 16, 32};
+
+// 播放速度在trick_rates 中向快进(dir 为1)或快退(dir 为-1)方向调一档。
+// 只有视频流有索引时才能快进快退。
+static void stream_change_rate(VideoState *is, int dir) {
+    int i, n = sizeof(trick_rates) / sizeof(trick_rates[0]);
+
+    if (is->video_stream < 0 || !is->video_st->nb_index_entries)
+        return;
+    for (i = 0; i < n - 1 && trick_rates[i] != is->rate; i++)
+        ;
+    i += dir;
+    if (i < 0 || i >= n)
+        return;
+
+    // 和seek 一样先中断解复用线程对队列空间的等待。
+    packet_queue_interrupt(&is->audioq, 1);
+    packet_queue_interrupt(&is->videoq, 1);
+    SDL_LockMutex(is->wait_mutex);
+    is->rate = trick_rates[i];
+    SDL_CondSignal(is->continue_read_cond);
+    SDL_UnlockMutex(is->wait_mutex);
+    if (is->audio_stream >= 0)
+        SDL_PauseAudio(is->paused || is->rate != 1);
+    fprintf(stderr, "rate %dx\n", is->rate);
+}
+
+// 暂停时请求单步，step 为1 时向前一帧，-1 时向后一帧；没有暂停时先暂停。
+static void stream_step(VideoState *is, int step) {
+    if (is->video_stream < 0)
+        return;
+    if (!is->paused) {
+        stream_toggle_pause(is);
+        return;
+    }
+    SDL_LockMutex(is->wait_mutex);
+    is->step = step;
+    is->stepped = 1;
+    SDL_CondSignal(is->step_cond);
+    SDL_UnlockMutex(is->wait_mutex);
+}
+
 // SDL 库的消息事件循环。
 void event_loop(void) // handle an event sent by the GUI
 {
     SDL_Event event;
+    double incr, pos;
 
     for (;;) {
         SDL_WaitEvent(&event);
@@ -713,6 +1213,50 @@ void event_loop(void) // handle an event sent by the GUI
             case SDLK_q:
                 do_exit();
                 break;
+            // 空格或p 暂停，暂停时句号和逗号前后单步一帧。
+            case SDLK_SPACE:
+            case SDLK_p:
+                if (cur_stream)
+                    stream_toggle_pause(cur_stream);
+                break;
+            case SDLK_PERIOD:
+                if (cur_stream)
+                    stream_step(cur_stream, 1);
+                break;
+            case SDLK_COMMA:
+                if (cur_stream)
+                    stream_step(cur_stream, -1);
+                break;
+            // 方括号调整快进快退的速度。
+            case SDLK_RIGHTBRACKET:
+                if (cur_stream)
+                    stream_change_rate(cur_stream, 1);
+                break;
+            case SDLK_LEFTBRACKET:
+                if (cur_stream)
+                    stream_change_rate(cur_stream, -1);
+                break;
+            // 左右键前后seek 10 秒，上下键前后seek 1 分钟。
+            case SDLK_LEFT:
+                incr = -10.0;
+                goto do_seek;
+            case SDLK_RIGHT:
+                incr = 10.0;
+                goto do_seek;
+            case SDLK_UP:
+                incr = 60.0;
+                goto do_seek;
+            case SDLK_DOWN:
+                incr = -60.0;
+            do_seek:
+                if (cur_stream) {
+                    pos = get_master_clock(cur_stream) + incr;
+                    if (pos < 0)
+                        pos = 0;
+                    stream_seek(cur_stream, (int64_t)(pos * AV_TIME_BASE),
+                                (int)incr, AV_NOPTS_VALUE);
+                }
+                break;
             default:
                 break;
             }
@@ -726,13 +1270,54 @@ void event_loop(void) // handle an event sent by the GUI
         }
     }
 }
+
 // 入口函数，初始化SDL 库，注册SDL 消息事件，启动文件解析线程，进入消息循环。
+// 命令行：ffplay [-export 输出文件] [-threads 线程数] [-nofuse] [-lowres n]
+// [-index_cache] [输入文件]，有-export 时不播放，把视频解码成YUV420P 写到
+// 输出文件；-nofuse 时解码完整个图像后再转换；-lowres 把视频缩小为1/2、1/4
+// 或1/8 (n 为1、2、3) 解码，用于预览；-index_cache 在文件旁保存索引缓存
+// "文件名.ffindex"，再次打开时直接使用。
 int main(int argc, char **argv) {
     int flags = SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER;
+    const char *export_filename = NULL;
+    int i, nb_threads = av_cpu_count();
 
     av_register_all();
 
+    flush_pkt.data = (uint8_t *)"FLUSH";
+    flush_pkt.dts = AV_NOPTS_VALUE;
+
     input_filename = "D:\\workspace\\ffsrc\\CLOCKTXT_320.avi";
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-export") && i + 1 < argc)
+            export_filename = argv[++i];
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+            nb_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-nofuse"))
+            fused_convert = 0;
+        else if (!strcmp(argv[i], "-index_cache"))
+            index_cache = 1;
+        else if (!strcmp(argv[i], "-lowres") && i + 1 < argc)
+            lowres = atoi(argv[++i]);
+        else
+            input_filename = argv[i];
+    }
+    if (nb_threads < 1)
+        nb_threads = 1;
+    if (export_filename) {
+        ExportStats stats;
+        int64_t start_time = av_gettime();
+
+        if (video_export(input_filename, export_filename, nb_threads, lowres,
+                         index_cache, &stats) < 0)
+            return 1;
+        fprintf(stderr,
+                "export: %d frames, %d tasks (%d re-decoded), %d threads, "
+                "%d ms\n",
+                stats.nb_frames, stats.nb_tasks, stats.nb_redecoded,
+                stats.nb_threads, (int)((av_gettime() - start_time) / 1000));
+        return 0;
+    }
 
     if (SDL_Init(flags))
         exit(1);
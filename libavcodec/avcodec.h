@@ -48,10 +48,17 @@ typedef struct AVPicture {
     int linesize[4];
 } AVPicture;
 
+#define AV_DIRTY_ROWS 16 // AVFrame.dirty 中每一项对应的行数
+
 typedef struct AVFrame {
     uint8_t *data[4]; // 有多重意义，其一用NULL 来判断是否被占用
     int linesize[4];
     uint8_t *base[4]; // 有多重意义，其一用NULL 来判断是否分配内存
+
+    // 和同一个解码器输出的上一帧相比改变了哪些行，每AV_DIRTY_ROWS 行一项，
+    // 非0 表示其中有像素改变。NULL 表示解码器不跟踪，整个图像都当作改变。
+    // 由解码器分配，下次解码前有效。
+    uint8_t *dirty;
 } AVFrame;
 
 // AVCodecContext结构表示程序运行的当前Codec使用的上下文，着重于所有Codec共有的属性(并且是在程序运行时才能确定其值)和关联其他结构的字段。
@@ -64,7 +71,13 @@ typedef struct AVCodecContext {
         *extradata;     // Codec的私有数据，对Audio是WAVEFORMATEX结构扩展字节。
     int extradata_size; // 对Video是BITMAPINFOHEADER后的扩展字节
 
-    int width, height; // video only
+    int width, height; // video only，输出图像的大小
+
+    // 缩小解码，输出原图的1/(1 << lowres)，在avcodec_open() 前设置，解码器
+    // 不支持时改成解码器支持的最大值。coded_width/coded_height 是原图的大小，
+    // avcodec_open() 中为0 时取width/height，再把width/height 改成输出的大小。
+    int lowres;
+    int coded_width, coded_height;
 
     enum PixelFormat pix_fmt; // 输出像素格式/视频图像格式
 
@@ -87,6 +100,13 @@ typedef struct AVCodecContext {
     void *internal_buffer;
 
     struct AVPaletteControl *palctrl;
+
+    // 解码器每完成一段行就调用一次，src 中从y 开始的height 行已经是这一帧的
+    // 最终结果，调用者可以趁数据还在缓存中处理。各段不重叠，先后由解码器决定
+    // (MSRLE 从下往上)，y 是16 的倍数，最后一段从0 开始。为NULL 时不调用。
+    void (*draw_horiz_band)(struct AVCodecContext *c, const AVFrame *src, int y,
+                            int height);
+    void *opaque; // 调用者的私有数据，给draw_horiz_band 使用
 } AVCodecContext;
 
 // 表示音视频编解码器，着重于功能函数，一种媒体类型对应一个AVCodec结构，在程序运行时有多个实例串联成链表便于查找。
@@ -105,6 +125,11 @@ typedef struct AVCodec {
     int capabilities; // 标示Codec的能力，在瘦身后的ffplay中没太大作用，可忽略
 
     struct AVCodec *next; // 用于把所有Codec串成一个链表，便于遍历
+
+    // 可选，丢弃解码器内部缓存的前后帧状态，seek 后从新的位置开始解码。
+    void (*flush)(AVCodecContext *);
+
+    int max_lowres; // 支持的最大AVCodecContext.lowres
 } AVCodec;
 
 // 调色板大小和大小宏定义，每个调色板四字节(R,G,B,α)。
@@ -139,6 +164,24 @@ void avcodec_get_chroma_sub_sample(int pix_fmt, int *h_shift, int *v_shift);
 int img_convert(AVPicture *dst, int dst_pix_fmt, const AVPicture *src,
                 int pix_fmt, int width, int height);
 
+// 图像格式转换上下文，按(目标格式, 源格式, 宽, 高) 创建一次，转换步骤和需要的
+// 中间格式在创建时确定，中间图像只分配一次。多个线程可以同时用同一个上下文
+// 转换不同的图像。用img_convert_context_set_threads() 设置线程数后，大图像
+// 分成几个条带由线程池并行转换。
+typedef struct ImgConvertContext ImgConvertContext;
+
+ImgConvertContext *img_convert_context_new(int dst_pix_fmt, int src_pix_fmt,
+                                           int width, int height);
+ImgConvertContext *img_convert_context_get(ImgConvertContext *c,
+                                           int dst_pix_fmt, int src_pix_fmt,
+                                           int width, int height);
+void img_convert_context_free(ImgConvertContext *c);
+int img_convert_context_set_threads(ImgConvertContext *c, int nb_threads);
+int img_convert_frame(ImgConvertContext *c, AVPicture *dst,
+                      const AVPicture *src);
+int img_convert_frame_rows(ImgConvertContext *c, AVPicture *dst,
+                           const AVPicture *src, int y, int height);
+
 void avcodec_init(void);
 
 void register_avcodec(AVCodec *format);
@@ -160,6 +203,7 @@ int avcodec_decode_video(AVCodecContext *avctx, AVFrame *picture,
                          int *got_picture_ptr, uint8_t *buf, int buf_size);
 
 int avcodec_close(AVCodecContext *avctx);
+void avcodec_flush_buffers(AVCodecContext *avctx);
 
 void avcodec_register_all(void);
 
@@ -175,6 +219,27 @@ void *av_fast_realloc(void *ptr, unsigned int *size, unsigned int min_size);
 void img_copy(AVPicture *dst, const AVPicture *src, int pix_fmt, int width,
               int height);
 
+// 解码后图像的LRU 缓存，按(流序号, 帧号)查找，用于回退、单步和反复播放一段。
+typedef struct AVFrameCache AVFrameCache;
+
+typedef struct AVFrameCacheStats {
+    int64_t requests;   // av_frame_cache_get() 调用次数
+    int64_t hits;       // 其中找到的次数
+    int64_t evictions;  // 因内存不够淘汰的图像数
+    int64_t bytes_used; // 当前占用的内存
+    int64_t max_bytes;  // 内存上限
+    int entries;        // 当前缓存的图像数
+} AVFrameCacheStats;
+
+AVFrameCache *av_frame_cache_new(int64_t max_bytes);
+void av_frame_cache_free(AVFrameCache *c);
+int av_frame_cache_put(AVFrameCache *c, int stream_index, int64_t frame_number,
+                       const AVPicture *pict, int pix_fmt, int width,
+                       int height);
+int av_frame_cache_get(AVFrameCache *c, int stream_index, int64_t frame_number,
+                       AVPicture *pict, int *pix_fmt, int *width, int *height);
+void av_frame_cache_get_stats(AVFrameCache *c, AVFrameCacheStats *stats);
+
 #ifdef __cplusplus
 }
 
@@ -0,0 +1,222 @@
+#include "avcodec.h"
+
+// 解码后图像的缓存。MSRLE 的非关键帧依赖前一帧图像，回退或者反复播放一段时，
+// 每次都要从前面的关键帧重新解码；把解码出的图像按(流序号, 帧号)缓存起来，
+// 再次需要时直接复制。缓存按占用的内存限制大小，超出时淘汰最久没有用到的图像。
+// 用哈希表查找，所有项另外按使用先后串成双向链表，表头是最近用到的。
+// 不是线程安全的，调用者自己加锁。
+
+#define FRAME_CACHE_MIN_BUCKETS 64
+
+typedef struct FrameCacheEntry {
+    struct FrameCacheEntry *hash_next;  // 同一哈希桶的下一项
+    struct FrameCacheEntry *prev, *next; // LRU 链表
+    int stream_index;
+    int64_t frame_number;
+    int pix_fmt, width, height;
+    int size; // buf 的大小
+    uint8_t *buf;
+    AVPicture pict; // 指向buf
+} FrameCacheEntry;
+
+struct AVFrameCache {
+    FrameCacheEntry **buckets;
+    unsigned int nb_buckets; // 2 的幂
+    FrameCacheEntry *head, *tail; // head 最近用到，tail 最先淘汰
+    int64_t max_bytes;
+    AVFrameCacheStats stats;
+};
+
+static unsigned int frame_cache_hash(int stream_index, int64_t frame_number) {
+    uint64_t h = (uint64_t)frame_number * uint64_t_C(0x9E3779B97F4A7C15);
+
+    return (unsigned int)(h >> 32) ^ (unsigned int)stream_index;
+}
+
+static FrameCacheEntry **frame_cache_find(AVFrameCache *c, int stream_index,
+                                          int64_t frame_number) {
+    FrameCacheEntry **pe = &c->buckets[frame_cache_hash(stream_index,
+                                                        frame_number) &
+                                       (c->nb_buckets - 1)];
+
+    while (*pe && ((*pe)->stream_index != stream_index ||
+                   (*pe)->frame_number != frame_number))
+        pe = &(*pe)->hash_next;
+    return pe;
+}
+
+static void frame_cache_unlink(AVFrameCache *c, FrameCacheEntry *e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        c->head = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+    else
+        c->tail = e->prev;
+}
+
+static void frame_cache_push_front(AVFrameCache *c, FrameCacheEntry *e) {
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head)
+        c->head->prev = e;
+    else
+        c->tail = e;
+    c->head = e;
+}
+
+// 从哈希表和链表中取下e，不释放内存。
+static void frame_cache_remove(AVFrameCache *c, FrameCacheEntry *e) {
+    FrameCacheEntry **pe = frame_cache_find(c, e->stream_index,
+                                            e->frame_number);
+
+    *pe = e->hash_next;
+    frame_cache_unlink(c, e);
+    c->stats.bytes_used -= (int64_t)sizeof(FrameCacheEntry) + e->size;
+    c->stats.entries--;
+}
+
+static void frame_cache_free_entry(FrameCacheEntry *e) {
+    av_free(e->buf);
+    av_free(e);
+}
+
+// 项数超过桶数时桶数加倍，保持链长在1 左右。
+static void frame_cache_grow(AVFrameCache *c) {
+    unsigned int nb = c->nb_buckets * 2, i;
+    FrameCacheEntry **buckets, *e, *next;
+
+    buckets = av_mallocz(nb * sizeof(FrameCacheEntry *));
+    if (!buckets)
+        return;
+    for (i = 0; i < c->nb_buckets; i++) {
+        for (e = c->buckets[i]; e; e = next) {
+            unsigned int h =
+                frame_cache_hash(e->stream_index, e->frame_number) & (nb - 1);
+            next = e->hash_next;
+            e->hash_next = buckets[h];
+            buckets[h] = e;
+        }
+    }
+    av_free(c->buckets);
+    c->buckets = buckets;
+    c->nb_buckets = nb;
+}
+
+AVFrameCache *av_frame_cache_new(int64_t max_bytes) {
+    AVFrameCache *c = av_mallocz(sizeof(AVFrameCache));
+
+    if (!c)
+        return NULL;
+    c->nb_buckets = FRAME_CACHE_MIN_BUCKETS;
+    c->buckets = av_mallocz(c->nb_buckets * sizeof(FrameCacheEntry *));
+    if (!c->buckets) {
+        av_free(c);
+        return NULL;
+    }
+    c->max_bytes = max_bytes;
+    c->stats.max_bytes = max_bytes;
+    return c;
+}
+
+void av_frame_cache_free(AVFrameCache *c) {
+    FrameCacheEntry *e, *next;
+
+    if (!c)
+        return;
+    for (e = c->head; e; e = next) {
+        next = e->next;
+        frame_cache_free_entry(e);
+    }
+    av_free(c->buckets);
+    av_free(c);
+}
+
+// 把图像复制到缓存中，已有同一帧时覆盖。内存不够时从链表尾淘汰，淘汰下来的项
+// 大小合适时直接重用，连续播放时不用反复分配释放内存。
+int av_frame_cache_put(AVFrameCache *c, int stream_index, int64_t frame_number,
+                       const AVPicture *pict, int pix_fmt, int width,
+                       int height) {
+    FrameCacheEntry *e, *reuse = NULL, **pe;
+    int size = avpicture_get_size(pix_fmt, width, height);
+    int64_t bytes = (int64_t)sizeof(FrameCacheEntry) + size;
+
+    if (size < 0 || bytes > c->max_bytes)
+        return -1;
+
+    pe = frame_cache_find(c, stream_index, frame_number);
+    if (*pe) {
+        reuse = *pe;
+        frame_cache_remove(c, reuse);
+    }
+
+    while (c->tail && c->stats.bytes_used + bytes > c->max_bytes) {
+        e = c->tail;
+        frame_cache_remove(c, e);
+        c->stats.evictions++;
+        if (!reuse && e->size == size)
+            reuse = e;
+        else
+            frame_cache_free_entry(e);
+    }
+
+    if (reuse && reuse->size == size) {
+        e = reuse;
+    } else {
+        if (reuse)
+            frame_cache_free_entry(reuse);
+        e = av_mallocz(sizeof(FrameCacheEntry));
+        if (!e)
+            return -1;
+        e->buf = av_malloc(size);
+        if (!e->buf) {
+            av_free(e);
+            return -1;
+        }
+        e->size = size;
+    }
+
+    e->stream_index = stream_index;
+    e->frame_number = frame_number;
+    e->pix_fmt = pix_fmt;
+    e->width = width;
+    e->height = height;
+    avpicture_fill(&e->pict, e->buf, pix_fmt, width, height);
+    img_copy(&e->pict, pict, pix_fmt, width, height);
+
+    pe = frame_cache_find(c, stream_index, frame_number);
+    e->hash_next = NULL;
+    *pe = e;
+    frame_cache_push_front(c, e);
+    c->stats.bytes_used += bytes;
+    c->stats.entries++;
+    if ((unsigned int)c->stats.entries > c->nb_buckets)
+        frame_cache_grow(c);
+    return 0;
+}
+
+// 查找缓存的图像，找到时返回0，pict 指向缓存中的数据，下次调用
+// av_frame_cache_put() 前有效；没有时返回-1。
+int av_frame_cache_get(AVFrameCache *c, int stream_index, int64_t frame_number,
+                       AVPicture *pict, int *pix_fmt, int *width,
+                       int *height) {
+    FrameCacheEntry *e = *frame_cache_find(c, stream_index, frame_number);
+
+    c->stats.requests++;
+    if (!e)
+        return -1;
+    c->stats.hits++;
+    frame_cache_unlink(c, e);
+    frame_cache_push_front(c, e);
+
+    *pict = e->pict;
+    *pix_fmt = e->pix_fmt;
+    *width = e->width;
+    *height = e->height;
+    return 0;
+}
+
+void av_frame_cache_get_stats(AVFrameCache *c, AVFrameCacheStats *stats) {
+    *stats = c->stats;
+}
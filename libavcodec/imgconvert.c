@@ -1,9 +1,15 @@
 #include "avcodec.h"
 #include "dsputil.h"
+#include "../libavutil/atomic.h"
+#include "../libavutil/cpu.h"
+#include "../libavutil/thread.h"
 // 定义并实现图像颜色空间转换使用的函数和宏
 #define xglue(x, y) x##y
 #define glue(x, y) xglue(x, y)
 
+#define FFMIN(a, b) ((a) > (b) ? (b) : (a))
+#define FFMAX(a, b) ((a) > (b) ? (a) : (b))
+
 #define FF_COLOR_RGB 0  // RGB color space
 #define FF_COLOR_GRAY 1 // gray color space
 #define FF_COLOR_YUV 2  // YUV color space. 16 <= Y <= 235, 16 <= U, V <= 240
@@ -1272,6 +1278,161 @@ static void gray_to_monoblack(AVPicture *dst, const AVPicture *src, int width,
     gray_to_mono(dst, src, width, height, 0x00);
 }
 
+// PAL8 转YUV420P 用的查找表，每个调色板项预先算好Y、U、V，转换时查表，
+// 不用先转成RGB24 再转YUV。算法和经过RGB24、YUV444P 的通用转换完全相同，
+// 色度是2x2 个像素的U、V 的平均，宽高为偶数时结果和通用转换一致。
+typedef struct PalYUVTable {
+    uint32_t palette[256]; // 建表时的调色板
+    uint32_t yuv[256];     // Y | U << 8 | V << 24
+    int valid;
+} PalYUVTable;
+
+// 上次用到的查找表，调色板没有变化时直接使用。MSRLE 等解码器只在
+// palctrl->palette_changed 时才改调色板，逐项比较1KB 的调色板比重建查找表
+// 快得多。多个线程同时转换时，拿不到锁的线程在栈上临时建表。
+static PalYUVTable pal_yuv_table;
+static volatile int pal_yuv_lock;
+
+static void build_pal_yuv_table(PalYUVTable *t, const uint32_t *palette) {
+    int i, r, g, b;
+    uint32_t v;
+
+    for (i = 0; i < 256; i++) {
+        v = palette[i];
+        r = (v >> 16) & 0xff;
+        g = (v >> 8) & 0xff;
+        b = v & 0xff;
+        t->yuv[i] = RGB_TO_Y_CCIR(r, g, b) |
+                    (RGB_TO_U_CCIR(r, g, b, 0) << 8) |
+                    ((uint32_t)RGB_TO_V_CCIR(r, g, b, 0) << 24);
+    }
+    memcpy(t->palette, palette, sizeof(t->palette));
+    t->valid = 1;
+}
+
+// 取出查找表项中的U、V，U 在低16 位，V 在高16 位，几项相加时互不进位。
+#define PAL_UV(v) (((v) >> 8) & 0x00ff00ff)
+
+void ff_pal8_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                          int height, const uint32_t *yuv) {
+    const uint8_t *p1, *p2;
+    uint8_t *lum1, *lum2, *cb, *cr;
+    uint32_t a, b, c, d, uv;
+    int x;
+
+    p1 = src->data[0];
+    lum1 = dst->data[0];
+    cb = dst->data[1];
+    cr = dst->data[2];
+
+    for (; height >= 2; height -= 2) {
+        p2 = p1 + src->linesize[0];
+        lum2 = lum1 + dst->linesize[0];
+        for (x = 0; x + 2 <= width; x += 2) {
+            a = yuv[p1[x]];
+            b = yuv[p1[x + 1]];
+            c = yuv[p2[x]];
+            d = yuv[p2[x + 1]];
+            lum1[x] = (uint8_t)a;
+            lum1[x + 1] = (uint8_t)b;
+            lum2[x] = (uint8_t)c;
+            lum2[x + 1] = (uint8_t)d;
+            uv = PAL_UV(a) + PAL_UV(b) + PAL_UV(c) + PAL_UV(d) + 0x00020002;
+            cb[x >> 1] = (uint8_t)(uv >> 2);
+            cr[x >> 1] = (uint8_t)(uv >> 18);
+        }
+        if (x < width) { // 宽度为奇数
+            a = yuv[p1[x]];
+            c = yuv[p2[x]];
+            lum1[x] = (uint8_t)a;
+            lum2[x] = (uint8_t)c;
+            uv = PAL_UV(a) + PAL_UV(c) + 0x00010001;
+            cb[x >> 1] = (uint8_t)(uv >> 1);
+            cr[x >> 1] = (uint8_t)(uv >> 17);
+        }
+        p1 += 2 * src->linesize[0];
+        lum1 += 2 * dst->linesize[0];
+        cb += dst->linesize[1];
+        cr += dst->linesize[2];
+    }
+
+    if (height) { // 高度为奇数
+        for (x = 0; x + 2 <= width; x += 2) {
+            a = yuv[p1[x]];
+            b = yuv[p1[x + 1]];
+            lum1[x] = (uint8_t)a;
+            lum1[x + 1] = (uint8_t)b;
+            uv = PAL_UV(a) + PAL_UV(b) + 0x00010001;
+            cb[x >> 1] = (uint8_t)(uv >> 1);
+            cr[x >> 1] = (uint8_t)(uv >> 17);
+        }
+        if (x < width) {
+            a = yuv[p1[x]];
+            lum1[x] = (uint8_t)a;
+            cb[x >> 1] = (uint8_t)(a >> 8);
+            cr[x >> 1] = (uint8_t)(a >> 24);
+        }
+    }
+}
+
+// 查表转换的函数，img_convert_init() 中按CPU 支持的指令集选择。
+static void (*pal8_to_yuv420p_table)(AVPicture *dst, const AVPicture *src,
+                                     int width, int height,
+                                     const uint32_t *yuv) =
+    ff_pal8_to_yuv420p_c;
+
+static void pal8_to_yuv420p(AVPicture *dst, const AVPicture *src, int width,
+                            int height) {
+    const uint32_t *palette = (const uint32_t *)src->data[1];
+    PalYUVTable tmp;
+
+    if (av_atomic_int_cas(&pal_yuv_lock, 0, 1) != 0) {
+        build_pal_yuv_table(&tmp, palette);
+        pal8_to_yuv420p_table(dst, src, width, height, tmp.yuv);
+        return;
+    }
+    if (!pal_yuv_table.valid ||
+        memcmp(pal_yuv_table.palette, palette, sizeof(pal_yuv_table.palette)))
+        build_pal_yuv_table(&pal_yuv_table, palette);
+    pal8_to_yuv420p_table(dst, src, width, height, pal_yuv_table.yuv);
+    av_atomic_int_set(&pal_yuv_lock, 0);
+}
+
+// imgconvert_x86.c 中的SIMD 实现只处理宽度是16 的倍数、高度是偶数的部分，
+// 剩下的右边几列和最后一行交给这些C 函数。
+#define C_REFERENCE(name)                                                      \
+    void ff_##name##_c(AVPicture *dst, const AVPicture *src, int width,        \
+                       int height) {                                           \
+        name(dst, src, width, height);                                         \
+    }
+
+C_REFERENCE(yuv422_to_yuv420p)
+C_REFERENCE(uyvy422_to_yuv420p)
+C_REFERENCE(yuv420p_to_rgb24)
+C_REFERENCE(yuv420p_to_rgba32)
+C_REFERENCE(rgb24_to_yuv420p)
+
+#ifdef ARCH_X86
+void ff_yuv422_to_yuv420p_sse2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_uyvy422_to_yuv420p_sse2(AVPicture *dst, const AVPicture *src,
+                                int width, int height);
+void ff_yuv420p_to_rgba32_sse2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_yuv420p_to_rgb24_ssse3(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_rgb24_to_yuv420p_ssse3(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_yuv422_to_yuv420p_avx2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_uyvy422_to_yuv420p_avx2(AVPicture *dst, const AVPicture *src,
+                                int width, int height);
+void ff_yuv420p_to_rgba32_avx2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_pal8_to_yuv420p_avx2(AVPicture *dst, const AVPicture *src, int width,
+                             int height, const uint32_t *yuv);
+#endif
+
 typedef struct ConvertEntry {
     void (*convert)(AVPicture *dst, const AVPicture *src, int width,
                     int height);
@@ -1297,7 +1458,7 @@ satisfied:
 static ConvertEntry convert_table[PIX_FMT_NB][PIX_FMT_NB];
 
 static void img_convert_init(void) {
-    int i;
+    int i, flags = av_get_cpu_flags();
     uint8_t *cm = cropTbl + MAX_NEG_CROP;
 
     for (i = 0; i < 256; i++) {
@@ -1389,9 +1550,37 @@ static void img_convert_init(void) {
     convert_table[PIX_FMT_PAL8][PIX_FMT_BGR24].convert = pal8_to_bgr24;
     convert_table[PIX_FMT_PAL8][PIX_FMT_RGB24].convert = pal8_to_rgb24;
     convert_table[PIX_FMT_PAL8][PIX_FMT_RGBA32].convert = pal8_to_rgba32;
+    convert_table[PIX_FMT_PAL8][PIX_FMT_YUV420P].convert = pal8_to_yuv420p;
 
     convert_table[PIX_FMT_UYVY411][PIX_FMT_YUV411P].convert =
         uyvy411_to_yuv411p;
+
+    pal8_to_yuv420p_table = ff_pal8_to_yuv420p_c;
+#ifdef ARCH_X86
+    if (flags & AV_CPU_FLAG_SSE2) {
+        convert_table[PIX_FMT_YUV422][PIX_FMT_YUV420P].convert =
+            ff_yuv422_to_yuv420p_sse2;
+        convert_table[PIX_FMT_UYVY422][PIX_FMT_YUV420P].convert =
+            ff_uyvy422_to_yuv420p_sse2;
+        convert_table[PIX_FMT_YUV420P][PIX_FMT_RGBA32].convert =
+            ff_yuv420p_to_rgba32_sse2;
+    }
+    if (flags & AV_CPU_FLAG_SSSE3) {
+        convert_table[PIX_FMT_YUV420P][PIX_FMT_RGB24].convert =
+            ff_yuv420p_to_rgb24_ssse3;
+        convert_table[PIX_FMT_RGB24][PIX_FMT_YUV420P].convert =
+            ff_rgb24_to_yuv420p_ssse3;
+    }
+    if (flags & AV_CPU_FLAG_AVX2) {
+        convert_table[PIX_FMT_YUV422][PIX_FMT_YUV420P].convert =
+            ff_yuv422_to_yuv420p_avx2;
+        convert_table[PIX_FMT_UYVY422][PIX_FMT_YUV420P].convert =
+            ff_uyvy422_to_yuv420p_avx2;
+        convert_table[PIX_FMT_YUV420P][PIX_FMT_RGBA32].convert =
+            ff_yuv420p_to_rgba32_avx2;
+        pal8_to_yuv420p_table = ff_pal8_to_yuv420p_avx2;
+    }
+#endif
 }
 
 static inline int is_yuv_planar(PixFmtInfo *ps) {
@@ -1400,63 +1589,122 @@ static inline int is_yuv_planar(PixFmtInfo *ps) {
            ps->pixel_type == FF_PIXEL_PLANAR;
 }
 
-int img_convert(AVPicture *dst, int dst_pix_fmt, const AVPicture *src,
-                int src_pix_fmt, int src_width, int src_height) {
-    static int inited;
-    int i, ret, dst_width, dst_height, int_pix_fmt;
-    PixFmtInfo *src_pix, *dst_pix;
-    ConvertEntry *ce;
-    AVPicture tmp1, *tmp = &tmp1;
-
-    if (src_pix_fmt < 0 || src_pix_fmt >= PIX_FMT_NB || dst_pix_fmt < 0 ||
-        dst_pix_fmt >= PIX_FMT_NB)
-        return -1;
+// 第一次使用时初始化转换表，多个线程同时初始化也没有害处。
+static void img_convert_init_once(void) {
+    static volatile int inited;
 
-    if (src_width <= 0 || src_height <= 0)
-        return 0;
-
-    if (!inited) {
-        inited = 1;
+    if (!av_atomic_int_get(&inited)) {
         img_convert_init();
+        av_atomic_int_set(&inited, 1);
     }
+}
 
-    dst_width = src_width;
-    dst_height = src_height;
-
-    dst_pix = &pix_fmt_info[dst_pix_fmt];
-    src_pix = &pix_fmt_info[src_pix_fmt];
-
-    if (src_pix_fmt == dst_pix_fmt) // no conversion needed: just copy
-    {
-        img_copy(dst, src, dst_pix_fmt, dst_width, dst_height);
-        return 0;
+typedef void (*ResizeFunc)(uint8_t *dst, int dst_wrap, const uint8_t *src,
+                           int src_wrap, int width, int height);
+
+// YUV 平面格式之间缩放色度平面的函数，没有合适的函数时返回NULL。
+static ResizeFunc get_resize_func(PixFmtInfo *dst_pix, PixFmtInfo *src_pix) {
+    int x_shift = dst_pix->x_chroma_shift - src_pix->x_chroma_shift;
+    int y_shift = dst_pix->y_chroma_shift - src_pix->y_chroma_shift;
+
+    // there must be filters for conversion at least from and to YUV444
+    // format
+    switch (((x_shift & 0xf) << 4) | (y_shift & 0xf)) {
+    case 0x00:
+        return ff_img_copy_plane;
+    case 0x10:
+        return shrink21;
+    case 0x20:
+        return shrink41;
+    case 0x01:
+        return shrink12;
+    case 0x11:
+        return ff_shrink22;
+    case 0x22:
+        return ff_shrink44;
+    case 0xf0:
+        return grow21;
+    case 0xe0:
+        return grow41;
+    case 0xff:
+        return grow22;
+    case 0xee:
+        return grow44;
+    case 0xf1:
+        return conv411;
+    default:
+        return NULL; // currently not handled
     }
+}
 
-    ce = &convert_table[src_pix_fmt][dst_pix_fmt];
-    if (ce->convert) {
-        ce->convert(dst, src, dst_width,
-                    dst_height); // specific conversion routine
-        return 0;
+#define CONVERT_COPY 0        // 格式相同，直接复制
+#define CONVERT_TABLE 1       // convert_table 中的转换函数
+#define CONVERT_GRAY_TO_YUV 2 // GRAY8 转YUV 平面格式
+#define CONVERT_YUV_TO_GRAY 3 // YUV 平面格式转GRAY8
+#define CONVERT_YUV_TO_YUV 4  // YUV 平面格式之间缩放色度
+
+// 不经过中间格式的一步转换。
+typedef struct ConvertStep {
+    int type; // CONVERT_*
+    int src_pix_fmt, dst_pix_fmt;
+    void (*convert)(AVPicture *dst, const AVPicture *src, int width,
+                    int height);
+    ResizeFunc resize;
+} ConvertStep;
+
+// 找出从src_pix_fmt 直接转到dst_pix_fmt 的方法，需要中间格式时返回-1。
+static int get_convert_step(ConvertStep *s, int dst_pix_fmt,
+                            int src_pix_fmt) {
+    PixFmtInfo *dst_pix = &pix_fmt_info[dst_pix_fmt];
+    PixFmtInfo *src_pix = &pix_fmt_info[src_pix_fmt];
+
+    memset(s, 0, sizeof(*s));
+    s->src_pix_fmt = src_pix_fmt;
+    s->dst_pix_fmt = dst_pix_fmt;
+    if (src_pix_fmt == dst_pix_fmt) {
+        s->type = CONVERT_COPY;
+    } else if (convert_table[src_pix_fmt][dst_pix_fmt].convert) {
+        s->type = CONVERT_TABLE;
+        s->convert = convert_table[src_pix_fmt][dst_pix_fmt].convert;
+    } else if (is_yuv_planar(dst_pix) && src_pix_fmt == PIX_FMT_GRAY8) {
+        s->type = CONVERT_GRAY_TO_YUV;
+    } else if (is_yuv_planar(src_pix) && dst_pix_fmt == PIX_FMT_GRAY8) {
+        s->type = CONVERT_YUV_TO_GRAY;
+    } else if (is_yuv_planar(dst_pix) && is_yuv_planar(src_pix) &&
+               (s->resize = get_resize_func(dst_pix, src_pix)) != NULL) {
+        s->type = CONVERT_YUV_TO_YUV;
+    } else {
+        return -1;
     }
+    return 0;
+}
 
-    if (is_yuv_planar(dst_pix) && src_pix_fmt == PIX_FMT_GRAY8) // gray to YUV
-    {
-        int w, h, y;
-        uint8_t *d;
+static void convert_step(const ConvertStep *s, AVPicture *dst,
+                         const AVPicture *src, int width, int height) {
+    PixFmtInfo *dst_pix = &pix_fmt_info[s->dst_pix_fmt];
+    PixFmtInfo *src_pix = &pix_fmt_info[s->src_pix_fmt];
+    const uint8_t *y_table, *c_table;
+    int i, w, h, y;
+    uint8_t *d;
 
+    switch (s->type) {
+    case CONVERT_COPY:
+        img_copy(dst, src, s->dst_pix_fmt, width, height);
+        break;
+    case CONVERT_TABLE:
+        s->convert(dst, src, width, height);
+        break;
+    case CONVERT_GRAY_TO_YUV:
         if (dst_pix->color_type == FF_COLOR_YUV_JPEG) {
             ff_img_copy_plane(dst->data[0], dst->linesize[0], src->data[0],
-                              src->linesize[0], dst_width, dst_height);
+                              src->linesize[0], width, height);
         } else {
             img_apply_table(dst->data[0], dst->linesize[0], src->data[0],
-                            src->linesize[0], dst_width, dst_height,
-                            y_jpeg_to_ccir);
+                            src->linesize[0], width, height, y_jpeg_to_ccir);
         }
 
-        w = dst_width; // fill U and V with 128
-        h = dst_height;
-        w >>= dst_pix->x_chroma_shift;
-        h >>= dst_pix->y_chroma_shift;
+        w = width >> dst_pix->x_chroma_shift; // fill U and V with 128
+        h = height >> dst_pix->y_chroma_shift;
         for (i = 1; i <= 2; i++) {
             d = dst->data[i];
             for (y = 0; y < h; y++) {
@@ -1464,96 +1712,29 @@ int img_convert(AVPicture *dst, int dst_pix_fmt, const AVPicture *src,
                 d += dst->linesize[i];
             }
         }
-        return 0;
-    }
-
-    if (is_yuv_planar(src_pix) && dst_pix_fmt == PIX_FMT_GRAY8) // YUV to gray
-    {
+        break;
+    case CONVERT_YUV_TO_GRAY:
         if (src_pix->color_type == FF_COLOR_YUV_JPEG) {
             ff_img_copy_plane(dst->data[0], dst->linesize[0], src->data[0],
-                              src->linesize[0], dst_width, dst_height);
+                              src->linesize[0], width, height);
         } else {
             img_apply_table(dst->data[0], dst->linesize[0], src->data[0],
-                            src->linesize[0], dst_width, dst_height,
-                            y_ccir_to_jpeg);
-        }
-        return 0;
-    }
-
-    if (is_yuv_planar(dst_pix) && is_yuv_planar(src_pix)) // YUV to YUV planar
-    {
-        int x_shift, y_shift, w, h, xy_shift;
-        void (*resize_func)(uint8_t *dst, int dst_wrap, const uint8_t *src,
-                            int src_wrap, int width, int height);
-
-        // compute chroma size of the smallest dimensions
-        w = dst_width;
-        h = dst_height;
-        if (dst_pix->x_chroma_shift >= src_pix->x_chroma_shift)
-            w >>= dst_pix->x_chroma_shift;
-        else
-            w >>= src_pix->x_chroma_shift;
-        if (dst_pix->y_chroma_shift >= src_pix->y_chroma_shift)
-            h >>= dst_pix->y_chroma_shift;
-        else
-            h >>= src_pix->y_chroma_shift;
-
-        x_shift = (dst_pix->x_chroma_shift - src_pix->x_chroma_shift);
-        y_shift = (dst_pix->y_chroma_shift - src_pix->y_chroma_shift);
-        xy_shift = ((x_shift & 0xf) << 4) | (y_shift & 0xf);
-
-        // there must be filters for conversion at least from and to YUV444
-        // format
-        switch (xy_shift) {
-        case 0x00:
-            resize_func = ff_img_copy_plane;
-            break;
-        case 0x10:
-            resize_func = shrink21;
-            break;
-        case 0x20:
-            resize_func = shrink41;
-            break;
-        case 0x01:
-            resize_func = shrink12;
-            break;
-        case 0x11:
-            resize_func = ff_shrink22;
-            break;
-        case 0x22:
-            resize_func = ff_shrink44;
-            break;
-        case 0xf0:
-            resize_func = grow21;
-            break;
-        case 0xe0:
-            resize_func = grow41;
-            break;
-        case 0xff:
-            resize_func = grow22;
-            break;
-        case 0xee:
-            resize_func = grow44;
-            break;
-        case 0xf1:
-            resize_func = conv411;
-            break;
-        default:
-            goto no_chroma_filter; // currently not handled
+                            src->linesize[0], width, height, y_ccir_to_jpeg);
         }
-
+        break;
+    case CONVERT_YUV_TO_YUV:
         ff_img_copy_plane(dst->data[0], dst->linesize[0], src->data[0],
-                          src->linesize[0], dst_width, dst_height);
+                          src->linesize[0], width, height);
 
+        w = width >> dst_pix->x_chroma_shift;
+        h = height >> dst_pix->y_chroma_shift;
         for (i = 1; i <= 2; i++)
-            resize_func(dst->data[i], dst->linesize[i], src->data[i],
-                        src->linesize[i], dst_width >> dst_pix->x_chroma_shift,
-                        dst_height >> dst_pix->y_chroma_shift);
+            s->resize(dst->data[i], dst->linesize[i], src->data[i],
+                      src->linesize[i], w, h);
 
         // if yuv color space conversion is needed, we do it here on the
         // destination image
         if (dst_pix->color_type != src_pix->color_type) {
-            const uint8_t *y_table, *c_table;
             if (dst_pix->color_type == FF_COLOR_YUV) {
                 y_table = y_jpeg_to_ccir;
                 c_table = c_jpeg_to_ccir;
@@ -1563,61 +1744,82 @@ int img_convert(AVPicture *dst, int dst_pix_fmt, const AVPicture *src,
             }
 
             img_apply_table(dst->data[0], dst->linesize[0], dst->data[0],
-                            dst->linesize[0], dst_width, dst_height, y_table);
+                            dst->linesize[0], width, height, y_table);
 
             for (i = 1; i <= 2; i++)
                 img_apply_table(dst->data[i], dst->linesize[i], dst->data[i],
-                                dst->linesize[i],
-                                dst_width >> dst_pix->x_chroma_shift,
-                                dst_height >> dst_pix->y_chroma_shift, c_table);
+                                dst->linesize[i], w, h, c_table);
         }
-        return 0;
+        break;
     }
+}
 
-no_chroma_filter: // try to use an intermediate format
+// 没有直接转换的方法时使用的中间格式。
+static int get_int_pix_fmt(int dst_pix_fmt, int src_pix_fmt) {
+    PixFmtInfo *dst_pix = &pix_fmt_info[dst_pix_fmt];
+    PixFmtInfo *src_pix = &pix_fmt_info[src_pix_fmt];
 
     if (src_pix_fmt == PIX_FMT_YUV422 || dst_pix_fmt == PIX_FMT_YUV422) {
-        int_pix_fmt =
-            PIX_FMT_YUV422P; // specific case: convert to YUV422P first
+        return PIX_FMT_YUV422P; // specific case: convert to YUV422P first
     } else if (src_pix_fmt == PIX_FMT_UYVY422 ||
                dst_pix_fmt == PIX_FMT_UYVY422) {
-
-        int_pix_fmt =
-            PIX_FMT_YUV422P; // specific case: convert to YUV422P first
+        return PIX_FMT_YUV422P; // specific case: convert to YUV422P first
     } else if (src_pix_fmt == PIX_FMT_UYVY411 ||
                dst_pix_fmt == PIX_FMT_UYVY411) {
-
-        int_pix_fmt =
-            PIX_FMT_YUV411P; // specific case: convert to YUV411P first
+        return PIX_FMT_YUV411P; // specific case: convert to YUV411P first
     } else if ((src_pix->color_type == FF_COLOR_GRAY &&
                 src_pix_fmt != PIX_FMT_GRAY8) ||
                (dst_pix->color_type == FF_COLOR_GRAY &&
                 dst_pix_fmt != PIX_FMT_GRAY8)) {
-
-        int_pix_fmt = PIX_FMT_GRAY8; // gray8 is the normalized format
+        return PIX_FMT_GRAY8; // gray8 is the normalized format
     } else if ((is_yuv_planar(src_pix) && src_pix_fmt != PIX_FMT_YUV444P &&
                 src_pix_fmt != PIX_FMT_YUVJ444P)) {
         if (src_pix->color_type ==
             FF_COLOR_YUV_JPEG) // yuv444 is the normalized format
-            int_pix_fmt = PIX_FMT_YUVJ444P;
+            return PIX_FMT_YUVJ444P;
         else
-            int_pix_fmt = PIX_FMT_YUV444P;
+            return PIX_FMT_YUV444P;
     } else if ((is_yuv_planar(dst_pix) && dst_pix_fmt != PIX_FMT_YUV444P &&
                 dst_pix_fmt != PIX_FMT_YUVJ444P)) {
         if (dst_pix->color_type ==
             FF_COLOR_YUV_JPEG) // yuv444 is the normalized format
-            int_pix_fmt = PIX_FMT_YUVJ444P;
+            return PIX_FMT_YUVJ444P;
         else
-            int_pix_fmt = PIX_FMT_YUV444P;
+            return PIX_FMT_YUV444P;
     } else // the two formats are rgb or gray8 or yuv[j]444p
     {
         if (src_pix->is_alpha && dst_pix->is_alpha)
-            int_pix_fmt = PIX_FMT_RGBA32;
+            return PIX_FMT_RGBA32;
         else
-            int_pix_fmt = PIX_FMT_RGB24;
+            return PIX_FMT_RGB24;
     }
+}
+
+int img_convert(AVPicture *dst, int dst_pix_fmt, const AVPicture *src,
+                int src_pix_fmt, int src_width, int src_height) {
+    int ret, int_pix_fmt;
+    ConvertStep step;
+    AVPicture tmp1, *tmp = &tmp1;
 
-    if (avpicture_alloc(tmp, int_pix_fmt, dst_width, dst_height) < 0)
+    if (src_pix_fmt < 0 || src_pix_fmt >= PIX_FMT_NB || dst_pix_fmt < 0 ||
+        dst_pix_fmt >= PIX_FMT_NB)
+        return -1;
+
+    if (src_width <= 0 || src_height <= 0)
+        return 0;
+
+    img_convert_init_once();
+
+    if (get_convert_step(&step, dst_pix_fmt, src_pix_fmt) == 0) {
+        convert_step(&step, dst, src, src_width, src_height);
+        return 0;
+    }
+
+    // try to use an intermediate format
+    int_pix_fmt = get_int_pix_fmt(dst_pix_fmt, src_pix_fmt);
+    if (int_pix_fmt == src_pix_fmt || int_pix_fmt == dst_pix_fmt)
+        return -1; // 不支持的转换，避免无限递归
+    if (avpicture_alloc(tmp, int_pix_fmt, src_width, src_height) < 0)
         return -1;
 
     ret = -1;
@@ -1626,7 +1828,7 @@ no_chroma_filter: // try to use an intermediate format
         0)
         goto fail1;
 
-    if (img_convert(dst, dst_pix_fmt, tmp, int_pix_fmt, dst_width, dst_height) <
+    if (img_convert(dst, dst_pix_fmt, tmp, int_pix_fmt, src_width, src_height) <
         0)
         goto fail1;
     ret = 0;
@@ -1636,4 +1838,412 @@ fail1:
     return ret;
 }
 
+/* 转换上下文 */
+
+#define IMG_CONVERT_MAX_STEPS 8
+#define IMG_CONVERT_SLOTS 4 // 可以同时转换的线程数，更多的线程临时分配中间图像
+#define IMG_CONVERT_MAX_THREADS 16
+#define IMG_CONVERT_BAND_PIXELS (128 * 1024) // 每个条带至少的像素数
+
+typedef struct ImgConvertPool ImgConvertPool;
+
+// 一组中间图像，同一时刻只给一个线程使用。
+typedef struct ImgConvertSlot {
+    volatile int busy;
+    uint8_t *buf; // 第一次使用时分配
+    AVPicture tmp[IMG_CONVERT_MAX_STEPS - 1];
+} ImgConvertSlot;
+
+struct ImgConvertContext {
+    int dst_pix_fmt, src_pix_fmt, width, height;
+    int nb_steps;
+    ConvertStep steps[IMG_CONVERT_MAX_STEPS]; // 创建后不再改变
+    int tmp_size; // 一组中间图像的总大小
+    ImgConvertSlot slots[IMG_CONVERT_SLOTS];
+
+    // 分条带多线程转换。条带的起始行是band_align 的倍数，各步的色度平面
+    // 都从整行开始。
+    int band_align;
+    int nb_threads;
+    ImgConvertPool *pool;    // 第一次分条带转换时创建
+    volatile int pool_busy; // 同时只有一个线程使用线程池，其他线程自己转换
+};
+
+// 按img_convert() 选择中间格式的方法，把转换拆成不经过中间格式的几步。
+static int img_convert_plan(ImgConvertContext *c, int dst_pix_fmt,
+                            int src_pix_fmt, int depth) {
+    int int_pix_fmt;
+
+    if (c->nb_steps >= IMG_CONVERT_MAX_STEPS ||
+        depth >= IMG_CONVERT_MAX_STEPS)
+        return -1;
+    if (get_convert_step(&c->steps[c->nb_steps], dst_pix_fmt, src_pix_fmt) ==
+        0) {
+        c->nb_steps++;
+        return 0;
+    }
+    int_pix_fmt = get_int_pix_fmt(dst_pix_fmt, src_pix_fmt);
+    if (int_pix_fmt == src_pix_fmt || int_pix_fmt == dst_pix_fmt)
+        return -1;
+    if (img_convert_plan(c, int_pix_fmt, src_pix_fmt, depth + 1) < 0)
+        return -1;
+    return img_convert_plan(c, dst_pix_fmt, int_pix_fmt, depth + 1);
+}
+
+static int img_convert_slot_alloc(ImgConvertContext *c, ImgConvertSlot *s) {
+    uint8_t *p;
+    int i;
+
+    s->buf = av_malloc(c->tmp_size);
+    if (!s->buf)
+        return -1;
+    p = s->buf;
+    for (i = 0; i < c->nb_steps - 1; i++)
+        p += avpicture_fill(&s->tmp[i], p, c->steps[i].dst_pix_fmt, c->width,
+                            c->height);
+    return 0;
+}
+
+// 取一组空闲的中间图像，都在使用时返回NULL。
+static ImgConvertSlot *img_convert_get_slot(ImgConvertContext *c) {
+    ImgConvertSlot *s;
+    int i;
+
+    for (i = 0; i < IMG_CONVERT_SLOTS; i++) {
+        s = &c->slots[i];
+        if (av_atomic_int_cas(&s->busy, 0, 1) != 0)
+            continue;
+        if (!s->buf && img_convert_slot_alloc(c, s) < 0) {
+            av_atomic_int_set(&s->busy, 0);
+            return NULL;
+        }
+        return s;
+    }
+    return NULL;
+}
+
+// 分条带转换的线程池，工作线程一直保留到上下文释放。调用线程也转换条带，
+// 池中有nb_threads - 1 个工作线程。
+struct ImgConvertPool {
+    AVMutex mutex;
+    AVCond cond;      // 工作线程在此等待新任务
+    AVCond done_cond; // 调用线程在此等待工作线程完成
+    AVThread threads[IMG_CONVERT_MAX_THREADS - 1];
+    int nb_workers;
+    int quit;
+    int job;     // 任务序号，每提交一次加1
+    int pending; // 还没有完成当前任务的工作线程数
+
+    // 当前任务，工作线程用next_band 领取条带
+    ImgConvertContext *c;
+    ImgConvertSlot *slot;
+    AVPicture *dst;
+    const AVPicture *src;
+    int nb_bands;
+    volatile int next_band;
+};
+
+// d 为s 中从第y 行开始的部分，色度平面按格式的y_chroma_shift 换算，调色板不动。
+static void picture_offset_rows(AVPicture *d, const AVPicture *s, int pix_fmt,
+                                int y) {
+    PixFmtInfo *pf = &pix_fmt_info[pix_fmt];
+    int i;
+
+    *d = *s;
+    d->data[0] += y * s->linesize[0];
+    if (pf->pixel_type == FF_PIXEL_PLANAR && pf->nb_channels >= 3) {
+        for (i = 1; i <= 2; i++)
+            d->data[i] += (y >> pf->y_chroma_shift) * s->linesize[i];
+    }
+}
+
+static int img_convert_band_start(ImgConvertContext *c, int band,
+                                  int nb_bands) {
+    if (band >= nb_bands)
+        return c->height;
+    return (int)((int64_t)c->height * band / nb_bands) & ~(c->band_align - 1);
+}
+
+// 转换第y0 行到第y1 行，各步的中间结果写到slot 中对应的行。
+static void img_convert_band(ImgConvertContext *c, ImgConvertSlot *slot,
+                             AVPicture *dst, const AVPicture *src, int y0,
+                             int y1) {
+    uint32_t palette[256];
+    AVPicture in, out;
+    int i;
+
+    for (i = 0; i < c->nb_steps; i++) {
+        picture_offset_rows(&in, i ? &slot->tmp[i - 1] : src,
+                            c->steps[i].src_pix_fmt, y0);
+        picture_offset_rows(&out, i == c->nb_steps - 1 ? dst : &slot->tmp[i],
+                            c->steps[i].dst_pix_fmt, y0);
+        // 每个条带都会写同样的调色板，只让第一个条带写到图像中
+        if (y0 && pix_fmt_info[c->steps[i].dst_pix_fmt].pixel_type ==
+                      FF_PIXEL_PALETTE)
+            out.data[1] = (uint8_t *)palette;
+        convert_step(&c->steps[i], &out, &in, c->width, y1 - y0);
+    }
+}
+
+// 领取并转换条带，直到没有剩下的条带。
+static void img_convert_pool_run(ImgConvertPool *p) {
+    ImgConvertContext *c = p->c;
+    int band, y0, y1;
+
+    while ((band = av_atomic_int_add_and_fetch(&p->next_band, 1) - 1) <
+           p->nb_bands) {
+        y0 = img_convert_band_start(c, band, p->nb_bands);
+        y1 = img_convert_band_start(c, band + 1, p->nb_bands);
+        if (y0 < y1)
+            img_convert_band(c, p->slot, p->dst, p->src, y0, y1);
+    }
+}
+
+static void *img_convert_worker(void *arg) {
+    ImgConvertPool *p = arg;
+    int job = 0;
+
+    av_mutex_lock(&p->mutex);
+    for (;;) {
+        while (!p->quit && p->job == job)
+            av_cond_wait(&p->cond, &p->mutex);
+        if (p->quit)
+            break;
+        job = p->job;
+        av_mutex_unlock(&p->mutex);
+
+        img_convert_pool_run(p);
+
+        av_mutex_lock(&p->mutex);
+        if (--p->pending == 0)
+            av_cond_signal(&p->done_cond);
+    }
+    av_mutex_unlock(&p->mutex);
+    return NULL;
+}
+
+static void img_convert_pool_free(ImgConvertPool *p) {
+    int i;
+
+    if (!p)
+        return;
+    av_mutex_lock(&p->mutex);
+    p->quit = 1;
+    av_cond_broadcast(&p->cond);
+    av_mutex_unlock(&p->mutex);
+    for (i = 0; i < p->nb_workers; i++)
+        av_thread_join(&p->threads[i]);
+    av_cond_destroy(&p->cond);
+    av_cond_destroy(&p->done_cond);
+    av_mutex_destroy(&p->mutex);
+    av_free(p);
+}
+
+static ImgConvertPool *img_convert_pool_new(int nb_workers) {
+    ImgConvertPool *p = av_mallocz(sizeof(ImgConvertPool));
+
+    if (!p)
+        return NULL;
+    av_mutex_init(&p->mutex);
+    av_cond_init(&p->cond);
+    av_cond_init(&p->done_cond);
+    for (p->nb_workers = 0; p->nb_workers < nb_workers; p->nb_workers++) {
+        if (av_thread_create(&p->threads[p->nb_workers], img_convert_worker,
+                             p) < 0)
+            break;
+    }
+    if (!p->nb_workers) {
+        img_convert_pool_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+// 把图像分成nb_bands 个条带，调用线程和工作线程一起转换。
+static void img_convert_pool_exec(ImgConvertPool *p, ImgConvertContext *c,
+                                  ImgConvertSlot *slot, AVPicture *dst,
+                                  const AVPicture *src, int nb_bands) {
+    av_mutex_lock(&p->mutex);
+    p->c = c;
+    p->slot = slot;
+    p->dst = dst;
+    p->src = src;
+    p->nb_bands = nb_bands;
+    p->next_band = 0;
+    p->pending = p->nb_workers;
+    p->job++;
+    av_cond_broadcast(&p->cond);
+    av_mutex_unlock(&p->mutex);
+
+    img_convert_pool_run(p);
+
+    av_mutex_lock(&p->mutex);
+    while (p->pending)
+        av_cond_wait(&p->done_cond, &p->mutex);
+    av_mutex_unlock(&p->mutex);
+}
+
+// 设置分条带转换的线程数，0 表示CPU 个数，1 不分条带。图像小于
+// 2 * IMG_CONVERT_BAND_PIXELS 时总是在调用线程中转换。不能和
+// img_convert_frame() 同时调用。
+int img_convert_context_set_threads(ImgConvertContext *c, int nb_threads) {
+    if (nb_threads <= 0)
+        nb_threads = av_cpu_count();
+    if (nb_threads > IMG_CONVERT_MAX_THREADS)
+        nb_threads = IMG_CONVERT_MAX_THREADS;
+    if (nb_threads != c->nb_threads) {
+        img_convert_pool_free(c->pool);
+        c->pool = NULL;
+        c->nb_threads = nb_threads;
+    }
+    return 0;
+}
+
+ImgConvertContext *img_convert_context_new(int dst_pix_fmt, int src_pix_fmt,
+                                           int width, int height) {
+    ImgConvertContext *c;
+    int i, h_shift, v_shift;
+
+    if (src_pix_fmt < 0 || src_pix_fmt >= PIX_FMT_NB || dst_pix_fmt < 0 ||
+        dst_pix_fmt >= PIX_FMT_NB || width <= 0 || height <= 0)
+        return NULL;
+
+    img_convert_init_once();
+
+    c = av_mallocz(sizeof(ImgConvertContext));
+    if (!c)
+        return NULL;
+    c->dst_pix_fmt = dst_pix_fmt;
+    c->src_pix_fmt = src_pix_fmt;
+    c->width = width;
+    c->height = height;
+    if (img_convert_plan(c, dst_pix_fmt, src_pix_fmt, 0) < 0) {
+        av_free(c);
+        return NULL;
+    }
+    for (i = 0; i < c->nb_steps - 1; i++)
+        c->tmp_size +=
+            avpicture_get_size(c->steps[i].dst_pix_fmt, width, height);
+
+    c->band_align = 1;
+    for (i = 0; i < c->nb_steps; i++) {
+        avcodec_get_chroma_sub_sample(c->steps[i].dst_pix_fmt, &h_shift,
+                                      &v_shift);
+        c->band_align = FFMAX(c->band_align, 1 << v_shift);
+        avcodec_get_chroma_sub_sample(c->steps[i].src_pix_fmt, &h_shift,
+                                      &v_shift);
+        c->band_align = FFMAX(c->band_align, 1 << v_shift);
+    }
+    c->nb_threads = 1;
+    return c;
+}
+
+// 参数和c 相同时返回c，否则释放c 并创建新的上下文，线程数沿用c 的设置。
+ImgConvertContext *img_convert_context_get(ImgConvertContext *c,
+                                           int dst_pix_fmt, int src_pix_fmt,
+                                           int width, int height) {
+    int nb_threads;
+
+    if (c && c->dst_pix_fmt == dst_pix_fmt && c->src_pix_fmt == src_pix_fmt &&
+        c->width == width && c->height == height)
+        return c;
+    nb_threads = c ? c->nb_threads : 1;
+    img_convert_context_free(c);
+    c = img_convert_context_new(dst_pix_fmt, src_pix_fmt, width, height);
+    if (c)
+        img_convert_context_set_threads(c, nb_threads);
+    return c;
+}
+
+void img_convert_context_free(ImgConvertContext *c) {
+    int i;
+
+    if (!c)
+        return;
+    img_convert_pool_free(c->pool);
+    for (i = 0; i < IMG_CONVERT_SLOTS; i++)
+        av_free(c->slots[i].buf);
+    av_free(c);
+}
+
+// 取这次转换用的一组中间图像，放在*slot。只有一步时不需要，*slot 为NULL。
+static int img_convert_slot_begin(ImgConvertContext *c, ImgConvertSlot **slot,
+                                  ImgConvertSlot *tmp_slot) {
+    *slot = NULL;
+    if (c->nb_steps == 1)
+        return 0;
+    *slot = img_convert_get_slot(c);
+    if (!*slot) {
+        *slot = tmp_slot;
+        if (img_convert_slot_alloc(c, tmp_slot) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void img_convert_slot_end(ImgConvertSlot *slot,
+                                 ImgConvertSlot *tmp_slot) {
+    if (slot == tmp_slot)
+        av_free(tmp_slot->buf);
+    else if (slot)
+        av_atomic_int_set(&slot->busy, 0);
+}
+
+int img_convert_frame(ImgConvertContext *c, AVPicture *dst,
+                      const AVPicture *src) {
+    ImgConvertSlot *slot, tmp_slot;
+    int nb_bands;
+
+    nb_bands = (int)((int64_t)c->width * c->height / IMG_CONVERT_BAND_PIXELS);
+    nb_bands = FFMIN(nb_bands, c->nb_threads);
+    nb_bands = FFMIN(nb_bands, c->height / c->band_align);
+    // grow22() 等按剩下的行数决定什么时候换源行，高度不是band_align 的倍数时
+    // 分条带的结果和整个转换不同
+    if (c->height % c->band_align)
+        nb_bands = 1;
+
+    if (c->nb_steps == 1 && nb_bands < 2) {
+        convert_step(&c->steps[0], dst, src, c->width, c->height);
+        return 0;
+    }
+
+    if (img_convert_slot_begin(c, &slot, &tmp_slot) < 0)
+        return -1;
+
+    // 线程池被其他线程占用或者创建失败时在调用线程中整个转换
+    if (nb_bands >= 2 && av_atomic_int_cas(&c->pool_busy, 0, 1) == 0) {
+        if (!c->pool)
+            c->pool = img_convert_pool_new(c->nb_threads - 1);
+        if (c->pool)
+            img_convert_pool_exec(c->pool, c, slot, dst, src, nb_bands);
+        else
+            img_convert_band(c, slot, dst, src, 0, c->height);
+        av_atomic_int_set(&c->pool_busy, 0);
+    } else {
+        img_convert_band(c, slot, dst, src, 0, c->height);
+    }
+
+    img_convert_slot_end(slot, &tmp_slot);
+    return 0;
+}
+
+// 只转换从y 开始的height 行，配合解码器的draw_horiz_band 使用，趁解码出的行
+// 还在缓存中转换。y 必须是band_align 的倍数，height 除了最后一段也是；整个
+// 高度不是band_align 的倍数时只能整个转换(见img_convert_frame())。
+int img_convert_frame_rows(ImgConvertContext *c, AVPicture *dst,
+                           const AVPicture *src, int y, int height) {
+    ImgConvertSlot *slot, tmp_slot;
+
+    if (y < 0 || height <= 0 || y + height > c->height ||
+        y % c->band_align || c->height % c->band_align ||
+        (height % c->band_align && y + height != c->height))
+        return -1;
+
+    if (img_convert_slot_begin(c, &slot, &tmp_slot) < 0)
+        return -1;
+    img_convert_band(c, slot, dst, src, y, y + height);
+    img_convert_slot_end(slot, &tmp_slot);
+    return 0;
+}
+
 #undef FIX
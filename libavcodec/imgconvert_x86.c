@@ -0,0 +1,691 @@
+#include "avcodec.h"
+#include "../libavutil/cpu.h"
+
+// imgconvert.c 中几个常用转换的SSE2/SSSE3/AVX2 实现，结果和C 实现完全相同。
+// SIMD 部分一次处理两行、16 列(AVX2 为32 列)，宽度不是它的倍数时右边剩下的列、
+// 高度为奇数时最后一行交给imgconvert.c 中的ff_*_c() 处理。
+// RGB 和YUV 之间的转换用_mm_madd_epi16 做32 位的乘加，舍入和移位都和C 实现相同。
+
+#ifdef ARCH_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <tmmintrin.h>
+
+#define SCALEBITS 10
+#define ONE_HALF (1 << (SCALEBITS - 1))
+#define FIX(x) ((int)((x) * (1 << SCALEBITS) + 0.5))
+
+// 两个16 位系数交替排列，和_mm_unpack*_epi16(a, b) 的结果做_mm_madd_epi16。
+#define COEF_PAIR(a, b) ((int)(((unsigned)(a)&0xffff) | ((unsigned)(b) << 16)))
+
+typedef void (*ConvertFunc)(AVPicture *dst, const AVPicture *src, int width,
+                            int height);
+
+void ff_yuv422_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                            int height);
+void ff_uyvy422_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                             int height);
+void ff_yuv420p_to_rgb24_c(AVPicture *dst, const AVPicture *src, int width,
+                           int height);
+void ff_yuv420p_to_rgba32_c(AVPicture *dst, const AVPicture *src, int width,
+                            int height);
+void ff_rgb24_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                           int height);
+void ff_pal8_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                          int height, const uint32_t *yuv);
+
+// 各平面每两列亮度对应的字节数，0 表示不移动这个平面(调色板或者没有用到)。
+static const int bpp_yuv420p[3] = {2, 1, 1};
+static const int bpp_yuv422[3] = {4, 0, 0};
+static const int bpp_rgb24[3] = {6, 0, 0};
+static const int bpp_rgba32[3] = {8, 0, 0};
+static const int bpp_pal8[3] = {2, 0, 0};
+
+// d 为s 中从第x 列、第y 行开始的部分，x、y 都是偶数，色度平面行数减半。
+static void picture_offset(AVPicture *d, const AVPicture *s, int x, int y,
+                           const int *bpp) {
+    int i;
+
+    *d = *s;
+    d->data[0] += (x >> 1) * bpp[0] + y * s->linesize[0];
+    for (i = 1; i < 3; i++) {
+        if (bpp[i])
+            d->data[i] += (x >> 1) * bpp[i] + (y >> 1) * s->linesize[i];
+    }
+}
+
+// SIMD 部分已经处理了左边w 列的偶数行，剩下的交给C 函数。
+static void convert_rest(ConvertFunc convert, AVPicture *dst,
+                         const AVPicture *src, int width, int height, int w,
+                         const int *dst_bpp, const int *src_bpp) {
+    AVPicture d, s;
+    int h = height & ~1;
+
+    if (w < width) {
+        picture_offset(&d, dst, w, 0, dst_bpp);
+        picture_offset(&s, src, w, 0, src_bpp);
+        convert(&d, &s, width - w, height);
+    }
+    if (h < height && w > 0) {
+        picture_offset(&d, dst, 0, h, dst_bpp);
+        picture_offset(&s, src, 0, h, src_bpp);
+        convert(&d, &s, w, 1);
+    }
+}
+
+/* YUV422/UYVY422 -> YUV420P，色度取每两行的第一行 */
+
+// a、b 中16 位字的低字节/高字节依次排成16 个字节。
+static inline AV_TARGET_SSE2 __m128i low_bytes_sse2(__m128i a, __m128i b) {
+    __m128i mask = _mm_set1_epi16(0xff);
+
+    return _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+}
+
+static inline AV_TARGET_SSE2 __m128i high_bytes_sse2(__m128i a, __m128i b) {
+    return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+}
+
+// uyvy 为0 时是YUYV，亮度在低字节，为1 时是UYVY，亮度在高字节。
+static inline AV_TARGET_SSE2 void packed422_to_yuv420p_sse2(
+    AVPicture *dst, const AVPicture *src, int width, int height, int uyvy) {
+    const uint8_t *p;
+    uint8_t *lum, *cb, *cr;
+    __m128i a, b, c, zero = _mm_setzero_si128();
+    int x, y, w = width & ~15;
+
+    for (y = 0; y + 2 <= height; y += 2) {
+        p = src->data[0] + y * src->linesize[0];
+        lum = dst->data[0] + y * dst->linesize[0];
+        cb = dst->data[1] + (y >> 1) * dst->linesize[1];
+        cr = dst->data[2] + (y >> 1) * dst->linesize[2];
+        for (x = 0; x < w; x += 16) {
+            a = _mm_loadu_si128((const __m128i *)(p + 2 * x));
+            b = _mm_loadu_si128((const __m128i *)(p + 2 * x + 16));
+            if (uyvy) {
+                _mm_storeu_si128((__m128i *)(lum + x), high_bytes_sse2(a, b));
+                c = low_bytes_sse2(a, b);
+            } else {
+                _mm_storeu_si128((__m128i *)(lum + x), low_bytes_sse2(a, b));
+                c = high_bytes_sse2(a, b);
+            }
+            _mm_storel_epi64((__m128i *)(cb + (x >> 1)), low_bytes_sse2(c, zero));
+            _mm_storel_epi64((__m128i *)(cr + (x >> 1)),
+                             high_bytes_sse2(c, zero));
+
+            // 第二行只取亮度
+            a = _mm_loadu_si128(
+                (const __m128i *)(p + src->linesize[0] + 2 * x));
+            b = _mm_loadu_si128(
+                (const __m128i *)(p + src->linesize[0] + 2 * x + 16));
+            _mm_storeu_si128((__m128i *)(lum + dst->linesize[0] + x),
+                             uyvy ? high_bytes_sse2(a, b)
+                                  : low_bytes_sse2(a, b));
+        }
+    }
+}
+
+AV_TARGET_SSE2 void ff_yuv422_to_yuv420p_sse2(AVPicture *dst,
+                                              const AVPicture *src, int width,
+                                              int height) {
+    packed422_to_yuv420p_sse2(dst, src, width, height, 0);
+    convert_rest(ff_yuv422_to_yuv420p_c, dst, src, width, height, width & ~15,
+                 bpp_yuv420p, bpp_yuv422);
+}
+
+AV_TARGET_SSE2 void ff_uyvy422_to_yuv420p_sse2(AVPicture *dst,
+                                               const AVPicture *src, int width,
+                                               int height) {
+    packed422_to_yuv420p_sse2(dst, src, width, height, 1);
+    convert_rest(ff_uyvy422_to_yuv420p_c, dst, src, width, height,
+                 width & ~15, bpp_yuv420p, bpp_yuv422);
+}
+
+// AVX2 的pack 指令在两个128 位的半边内各自进行，结果按64 位重新排列。
+static inline AV_TARGET_AVX2 __m256i low_bytes_avx2(__m256i a, __m256i b) {
+    __m256i mask = _mm256_set1_epi16(0xff);
+
+    return _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(_mm256_and_si256(a, mask),
+                            _mm256_and_si256(b, mask)),
+        0xD8);
+}
+
+static inline AV_TARGET_AVX2 __m256i high_bytes_avx2(__m256i a, __m256i b) {
+    return _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8)),
+        0xD8);
+}
+
+static inline AV_TARGET_AVX2 void packed422_to_yuv420p_avx2(
+    AVPicture *dst, const AVPicture *src, int width, int height, int uyvy) {
+    const uint8_t *p;
+    uint8_t *lum, *cb, *cr;
+    __m256i a, b, c;
+    int x, y, w = width & ~31;
+
+    for (y = 0; y + 2 <= height; y += 2) {
+        p = src->data[0] + y * src->linesize[0];
+        lum = dst->data[0] + y * dst->linesize[0];
+        cb = dst->data[1] + (y >> 1) * dst->linesize[1];
+        cr = dst->data[2] + (y >> 1) * dst->linesize[2];
+        for (x = 0; x < w; x += 32) {
+            a = _mm256_loadu_si256((const __m256i *)(p + 2 * x));
+            b = _mm256_loadu_si256((const __m256i *)(p + 2 * x + 32));
+            if (uyvy) {
+                _mm256_storeu_si256((__m256i *)(lum + x), high_bytes_avx2(a, b));
+                c = low_bytes_avx2(a, b);
+            } else {
+                _mm256_storeu_si256((__m256i *)(lum + x), low_bytes_avx2(a, b));
+                c = high_bytes_avx2(a, b);
+            }
+            // c 中U、V 交错，拆开后低半边是16 个U，高半边是16 个V
+            c = low_bytes_avx2(_mm256_and_si256(c, _mm256_set1_epi16(0xff)),
+                               _mm256_srli_epi16(c, 8));
+            _mm_storeu_si128((__m128i *)(cb + (x >> 1)),
+                             _mm256_castsi256_si128(c));
+            _mm_storeu_si128((__m128i *)(cr + (x >> 1)),
+                             _mm256_extracti128_si256(c, 1));
+
+            a = _mm256_loadu_si256(
+                (const __m256i *)(p + src->linesize[0] + 2 * x));
+            b = _mm256_loadu_si256(
+                (const __m256i *)(p + src->linesize[0] + 2 * x + 32));
+            _mm256_storeu_si256((__m256i *)(lum + dst->linesize[0] + x),
+                                uyvy ? high_bytes_avx2(a, b)
+                                     : low_bytes_avx2(a, b));
+        }
+    }
+}
+
+AV_TARGET_AVX2 void ff_yuv422_to_yuv420p_avx2(AVPicture *dst,
+                                              const AVPicture *src, int width,
+                                              int height) {
+    packed422_to_yuv420p_avx2(dst, src, width, height, 0);
+    convert_rest(ff_yuv422_to_yuv420p_c, dst, src, width, height, width & ~31,
+                 bpp_yuv420p, bpp_yuv422);
+}
+
+AV_TARGET_AVX2 void ff_uyvy422_to_yuv420p_avx2(AVPicture *dst,
+                                               const AVPicture *src, int width,
+                                               int height) {
+    packed422_to_yuv420p_avx2(dst, src, width, height, 1);
+    convert_rest(ff_uyvy422_to_yuv420p_c, dst, src, width, height,
+                 width & ~31, bpp_yuv420p, bpp_yuv422);
+}
+
+/* YUV420P -> RGB，对应YUV_TO_RGB1_CCIR、YUV_TO_RGB2_CCIR */
+
+// y 是8 个减去16 的亮度，cb、cr 是对应的减去128 的色度，算出16 位的R、G、B。
+static inline AV_TARGET_SSE2 void yuv_to_rgb_sse2(__m128i y, __m128i cb,
+                                                  __m128i cr, __m128i *r,
+                                                  __m128i *g, __m128i *b) {
+    const __m128i coef_r = _mm_set1_epi32(
+        COEF_PAIR(FIX(255.0 / 219.0), FIX(1.40200 * 255.0 / 224.0)));
+    const __m128i coef_g = _mm_set1_epi32(
+        COEF_PAIR(FIX(255.0 / 219.0), -FIX(0.34414 * 255.0 / 224.0)));
+    const __m128i coef_g2 =
+        _mm_set1_epi32(COEF_PAIR(-FIX(0.71414 * 255.0 / 224.0), ONE_HALF));
+    const __m128i coef_b = _mm_set1_epi32(
+        COEF_PAIR(FIX(255.0 / 219.0), FIX(1.77200 * 255.0 / 224.0)));
+    const __m128i round = _mm_set1_epi32(ONE_HALF);
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i ycr_lo = _mm_unpacklo_epi16(y, cr), ycr_hi = _mm_unpackhi_epi16(y, cr);
+    __m128i ycb_lo = _mm_unpacklo_epi16(y, cb), ycb_hi = _mm_unpackhi_epi16(y, cb);
+    __m128i cr1_lo = _mm_unpacklo_epi16(cr, one),
+            cr1_hi = _mm_unpackhi_epi16(cr, one);
+    __m128i lo, hi;
+
+    lo = _mm_add_epi32(_mm_madd_epi16(ycr_lo, coef_r), round);
+    hi = _mm_add_epi32(_mm_madd_epi16(ycr_hi, coef_r), round);
+    *r = _mm_packs_epi32(_mm_srai_epi32(lo, SCALEBITS),
+                         _mm_srai_epi32(hi, SCALEBITS));
+
+    lo = _mm_add_epi32(_mm_madd_epi16(ycb_lo, coef_g),
+                       _mm_madd_epi16(cr1_lo, coef_g2));
+    hi = _mm_add_epi32(_mm_madd_epi16(ycb_hi, coef_g),
+                       _mm_madd_epi16(cr1_hi, coef_g2));
+    *g = _mm_packs_epi32(_mm_srai_epi32(lo, SCALEBITS),
+                         _mm_srai_epi32(hi, SCALEBITS));
+
+    lo = _mm_add_epi32(_mm_madd_epi16(ycb_lo, coef_b), round);
+    hi = _mm_add_epi32(_mm_madd_epi16(ycb_hi, coef_b), round);
+    *b = _mm_packs_epi32(_mm_srai_epi32(lo, SCALEBITS),
+                         _mm_srai_epi32(hi, SCALEBITS));
+}
+
+// 读8 个色度，减去128 后每个重复两次，lo 对应前8 个像素，hi 对应后8 个。
+static inline AV_TARGET_SSE2 void load_chroma_sse2(const uint8_t *p,
+                                                   __m128i *lo, __m128i *hi) {
+    __m128i c = _mm_sub_epi16(
+        _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p),
+                          _mm_setzero_si128()),
+        _mm_set1_epi16(128));
+
+    *lo = _mm_unpacklo_epi16(c, c);
+    *hi = _mm_unpackhi_epi16(c, c);
+}
+
+// 一行16 个像素，结果是8 位的R、G、B，超出范围的值截断到0~255，和cm[] 相同。
+static inline AV_TARGET_SSE2 void yuv_row_sse2(const uint8_t *lum,
+                                               const __m128i *cb,
+                                               const __m128i *cr, __m128i *r,
+                                               __m128i *g, __m128i *b) {
+    __m128i y = _mm_loadu_si128((const __m128i *)lum);
+    __m128i zero = _mm_setzero_si128(), off = _mm_set1_epi16(16);
+    __m128i r0, g0, b0, r1, g1, b1;
+
+    yuv_to_rgb_sse2(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), off), cb[0],
+                    cr[0], &r0, &g0, &b0);
+    yuv_to_rgb_sse2(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), off), cb[1],
+                    cr[1], &r1, &g1, &b1);
+    *r = _mm_packus_epi16(r0, r1);
+    *g = _mm_packus_epi16(g0, g1);
+    *b = _mm_packus_epi16(b0, b1);
+}
+
+// 16 个像素按RGBA32 的格式(内存中是B、G、R、A) 存到d。
+static inline AV_TARGET_SSE2 void store_rgba32_sse2(uint8_t *d, __m128i r,
+                                                    __m128i g, __m128i b) {
+    __m128i a = _mm_set1_epi8((char)0xff);
+    __m128i bg_lo = _mm_unpacklo_epi8(b, g), bg_hi = _mm_unpackhi_epi8(b, g);
+    __m128i ra_lo = _mm_unpacklo_epi8(r, a), ra_hi = _mm_unpackhi_epi8(r, a);
+
+    _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(bg_lo, ra_lo));
+    _mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(bg_hi, ra_hi));
+    _mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(bg_hi, ra_hi));
+}
+
+AV_TARGET_SSE2 void ff_yuv420p_to_rgba32_sse2(AVPicture *dst,
+                                              const AVPicture *src, int width,
+                                              int height) {
+    const uint8_t *lum, *cb, *cr;
+    uint8_t *d;
+    __m128i u[2], v[2], r, g, b;
+    int x, y, w = width & ~15;
+
+    for (y = 0; y + 2 <= height; y += 2) {
+        lum = src->data[0] + y * src->linesize[0];
+        cb = src->data[1] + (y >> 1) * src->linesize[1];
+        cr = src->data[2] + (y >> 1) * src->linesize[2];
+        d = dst->data[0] + y * dst->linesize[0];
+        for (x = 0; x < w; x += 16) {
+            load_chroma_sse2(cb + (x >> 1), &u[0], &u[1]);
+            load_chroma_sse2(cr + (x >> 1), &v[0], &v[1]);
+            yuv_row_sse2(lum + x, u, v, &r, &g, &b);
+            store_rgba32_sse2(d + 4 * x, r, g, b);
+            yuv_row_sse2(lum + src->linesize[0] + x, u, v, &r, &g, &b);
+            store_rgba32_sse2(d + dst->linesize[0] + 4 * x, r, g, b);
+        }
+    }
+    convert_rest(ff_yuv420p_to_rgba32_c, dst, src, width, height, w,
+                 bpp_rgba32, bpp_yuv420p);
+}
+
+// 16 个像素按RGB24 的格式存到d：先排成RGBA32，每个32 位去掉A 后拼起来。
+static inline AV_TARGET_SSSE3 void store_rgb24_ssse3(uint8_t *d, __m128i r,
+                                                     __m128i g, __m128i b) {
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                       -1, -1, -1, -1);
+    __m128i zero = _mm_setzero_si128();
+    __m128i bg_lo = _mm_unpacklo_epi8(b, g), bg_hi = _mm_unpackhi_epi8(b, g);
+    __m128i r_lo = _mm_unpacklo_epi8(r, zero), r_hi = _mm_unpackhi_epi8(r, zero);
+    __m128i s0 = _mm_shuffle_epi8(_mm_unpacklo_epi16(bg_lo, r_lo), shuf);
+    __m128i s1 = _mm_shuffle_epi8(_mm_unpackhi_epi16(bg_lo, r_lo), shuf);
+    __m128i s2 = _mm_shuffle_epi8(_mm_unpacklo_epi16(bg_hi, r_hi), shuf);
+    __m128i s3 = _mm_shuffle_epi8(_mm_unpackhi_epi16(bg_hi, r_hi), shuf);
+
+    _mm_storeu_si128((__m128i *)d, _mm_or_si128(s0, _mm_slli_si128(s1, 12)));
+    _mm_storeu_si128((__m128i *)(d + 16),
+                     _mm_or_si128(_mm_srli_si128(s1, 4), _mm_slli_si128(s2, 8)));
+    _mm_storeu_si128((__m128i *)(d + 32),
+                     _mm_or_si128(_mm_srli_si128(s2, 8), _mm_slli_si128(s3, 4)));
+}
+
+AV_TARGET_SSSE3 void ff_yuv420p_to_rgb24_ssse3(AVPicture *dst,
+                                               const AVPicture *src, int width,
+                                               int height) {
+    const uint8_t *lum, *cb, *cr;
+    uint8_t *d;
+    __m128i u[2], v[2], r, g, b;
+    int x, y, w = width & ~15;
+
+    for (y = 0; y + 2 <= height; y += 2) {
+        lum = src->data[0] + y * src->linesize[0];
+        cb = src->data[1] + (y >> 1) * src->linesize[1];
+        cr = src->data[2] + (y >> 1) * src->linesize[2];
+        d = dst->data[0] + y * dst->linesize[0];
+        for (x = 0; x < w; x += 16) {
+            load_chroma_sse2(cb + (x >> 1), &u[0], &u[1]);
+            load_chroma_sse2(cr + (x >> 1), &v[0], &v[1]);
+            yuv_row_sse2(lum + x, u, v, &r, &g, &b);
+            store_rgb24_ssse3(d + 3 * x, r, g, b);
+            yuv_row_sse2(lum + src->linesize[0] + x, u, v, &r, &g, &b);
+            store_rgb24_ssse3(d + dst->linesize[0] + 3 * x, r, g, b);
+        }
+    }
+    convert_rest(ff_yuv420p_to_rgb24_c, dst, src, width, height, w, bpp_rgb24,
+                 bpp_yuv420p);
+}
+
+// 和yuv_to_rgb_sse2() 相同，一次8 个像素，两个半边各4 个。
+static inline AV_TARGET_AVX2 void yuv_to_rgb_avx2(__m256i y, __m256i cb,
+                                                  __m256i cr, __m256i *r,
+                                                  __m256i *g, __m256i *b) {
+    const __m256i coef_r = _mm256_set1_epi32(
+        COEF_PAIR(FIX(255.0 / 219.0), FIX(1.40200 * 255.0 / 224.0)));
+    const __m256i coef_g = _mm256_set1_epi32(
+        COEF_PAIR(FIX(255.0 / 219.0), -FIX(0.34414 * 255.0 / 224.0)));
+    const __m256i coef_g2 =
+        _mm256_set1_epi32(COEF_PAIR(-FIX(0.71414 * 255.0 / 224.0), ONE_HALF));
+    const __m256i coef_b = _mm256_set1_epi32(
+        COEF_PAIR(FIX(255.0 / 219.0), FIX(1.77200 * 255.0 / 224.0)));
+    const __m256i round = _mm256_set1_epi32(ONE_HALF);
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i ycr_lo = _mm256_unpacklo_epi16(y, cr),
+            ycr_hi = _mm256_unpackhi_epi16(y, cr);
+    __m256i ycb_lo = _mm256_unpacklo_epi16(y, cb),
+            ycb_hi = _mm256_unpackhi_epi16(y, cb);
+    __m256i cr1_lo = _mm256_unpacklo_epi16(cr, one),
+            cr1_hi = _mm256_unpackhi_epi16(cr, one);
+    __m256i lo, hi;
+
+    lo = _mm256_add_epi32(_mm256_madd_epi16(ycr_lo, coef_r), round);
+    hi = _mm256_add_epi32(_mm256_madd_epi16(ycr_hi, coef_r), round);
+    *r = _mm256_packs_epi32(_mm256_srai_epi32(lo, SCALEBITS),
+                            _mm256_srai_epi32(hi, SCALEBITS));
+
+    lo = _mm256_add_epi32(_mm256_madd_epi16(ycb_lo, coef_g),
+                          _mm256_madd_epi16(cr1_lo, coef_g2));
+    hi = _mm256_add_epi32(_mm256_madd_epi16(ycb_hi, coef_g),
+                          _mm256_madd_epi16(cr1_hi, coef_g2));
+    *g = _mm256_packs_epi32(_mm256_srai_epi32(lo, SCALEBITS),
+                            _mm256_srai_epi32(hi, SCALEBITS));
+
+    lo = _mm256_add_epi32(_mm256_madd_epi16(ycb_lo, coef_b), round);
+    hi = _mm256_add_epi32(_mm256_madd_epi16(ycb_hi, coef_b), round);
+    *b = _mm256_packs_epi32(_mm256_srai_epi32(lo, SCALEBITS),
+                            _mm256_srai_epi32(hi, SCALEBITS));
+}
+
+// 一行32 个像素。unpack 在两个半边内进行：亮度的低半边是像素0~7、16~23，
+// 高半边是8~15、24~31，色度按同样的方式排列，pack 后像素又回到原来的顺序。
+static inline AV_TARGET_AVX2 void yuv_row_avx2(const uint8_t *lum,
+                                               const __m256i *cb,
+                                               const __m256i *cr, __m256i *r,
+                                               __m256i *g, __m256i *b) {
+    __m256i y = _mm256_loadu_si256((const __m256i *)lum);
+    __m256i zero = _mm256_setzero_si256(), off = _mm256_set1_epi16(16);
+    __m256i r0, g0, b0, r1, g1, b1;
+
+    yuv_to_rgb_avx2(_mm256_sub_epi16(_mm256_unpacklo_epi8(y, zero), off),
+                    cb[0], cr[0], &r0, &g0, &b0);
+    yuv_to_rgb_avx2(_mm256_sub_epi16(_mm256_unpackhi_epi8(y, zero), off),
+                    cb[1], cr[1], &r1, &g1, &b1);
+    *r = _mm256_packus_epi16(r0, r1);
+    *g = _mm256_packus_epi16(g0, g1);
+    *b = _mm256_packus_epi16(b0, b1);
+}
+
+static inline AV_TARGET_AVX2 void load_chroma_avx2(const uint8_t *p,
+                                                   __m256i *lo, __m256i *hi) {
+    __m256i c = _mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p)),
+        _mm256_set1_epi16(128));
+
+    *lo = _mm256_unpacklo_epi16(c, c);
+    *hi = _mm256_unpackhi_epi16(c, c);
+}
+
+static inline AV_TARGET_AVX2 void store_rgba32_avx2(uint8_t *d, __m256i r,
+                                                    __m256i g, __m256i b) {
+    __m256i a = _mm256_set1_epi8((char)0xff);
+    __m256i bg_lo = _mm256_unpacklo_epi8(b, g), bg_hi = _mm256_unpackhi_epi8(b, g);
+    __m256i ra_lo = _mm256_unpacklo_epi8(r, a), ra_hi = _mm256_unpackhi_epi8(r, a);
+    __m256i p0 = _mm256_unpacklo_epi16(bg_lo, ra_lo); // 像素0~3、16~19
+    __m256i p1 = _mm256_unpackhi_epi16(bg_lo, ra_lo); // 4~7、20~23
+    __m256i p2 = _mm256_unpacklo_epi16(bg_hi, ra_hi); // 8~11、24~27
+    __m256i p3 = _mm256_unpackhi_epi16(bg_hi, ra_hi); // 12~15、28~31
+
+    _mm256_storeu_si256((__m256i *)d, _mm256_permute2x128_si256(p0, p1, 0x20));
+    _mm256_storeu_si256((__m256i *)(d + 32),
+                        _mm256_permute2x128_si256(p2, p3, 0x20));
+    _mm256_storeu_si256((__m256i *)(d + 64),
+                        _mm256_permute2x128_si256(p0, p1, 0x31));
+    _mm256_storeu_si256((__m256i *)(d + 96),
+                        _mm256_permute2x128_si256(p2, p3, 0x31));
+}
+
+AV_TARGET_AVX2 void ff_yuv420p_to_rgba32_avx2(AVPicture *dst,
+                                              const AVPicture *src, int width,
+                                              int height) {
+    const uint8_t *lum, *cb, *cr;
+    uint8_t *d;
+    __m256i u[2], v[2], r, g, b;
+    int x, y, w = width & ~31;
+
+    for (y = 0; y + 2 <= height; y += 2) {
+        lum = src->data[0] + y * src->linesize[0];
+        cb = src->data[1] + (y >> 1) * src->linesize[1];
+        cr = src->data[2] + (y >> 1) * src->linesize[2];
+        d = dst->data[0] + y * dst->linesize[0];
+        for (x = 0; x < w; x += 32) {
+            load_chroma_avx2(cb + (x >> 1), &u[0], &u[1]);
+            load_chroma_avx2(cr + (x >> 1), &v[0], &v[1]);
+            yuv_row_avx2(lum + x, u, v, &r, &g, &b);
+            store_rgba32_avx2(d + 4 * x, r, g, b);
+            yuv_row_avx2(lum + src->linesize[0] + x, u, v, &r, &g, &b);
+            store_rgba32_avx2(d + dst->linesize[0] + 4 * x, r, g, b);
+        }
+    }
+    convert_rest(ff_yuv420p_to_rgba32_c, dst, src, width, height, w,
+                 bpp_rgba32, bpp_yuv420p);
+}
+
+/* RGB24 -> YUV420P，对应RGB_TO_Y_CCIR、RGB_TO_U_CCIR、RGB_TO_V_CCIR */
+
+// 从48 个字节中取出16 个像素的R、G、B，每个通道用三个pshufb 拼起来。
+static const int8_t rgb24_shuffle[3][3][16] = {
+    {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}},
+};
+
+// 读16 个像素，rgb[0..2] 是R、G、B 前8 个像素的16 位值，rgb[3..5] 是后8 个。
+static inline AV_TARGET_SSSE3 void load_rgb24_ssse3(const uint8_t *p,
+                                                    __m128i *rgb) {
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 32));
+    __m128i zero = _mm_setzero_si128(), v;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        v = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(
+                    a, _mm_loadu_si128((const __m128i *)rgb24_shuffle[i][0])),
+                _mm_shuffle_epi8(
+                    b, _mm_loadu_si128((const __m128i *)rgb24_shuffle[i][1]))),
+            _mm_shuffle_epi8(
+                c, _mm_loadu_si128((const __m128i *)rgb24_shuffle[i][2])));
+        rgb[i] = _mm_unpacklo_epi8(v, zero);
+        rgb[i + 3] = _mm_unpackhi_epi8(v, zero);
+    }
+}
+
+// 8 个像素的亮度，结果是16 位的。
+static inline AV_TARGET_SSE2 __m128i rgb_to_y_sse2(__m128i r, __m128i g,
+                                                   __m128i b) {
+    const __m128i coef_rg = _mm_set1_epi32(COEF_PAIR(
+        FIX(0.29900 * 219.0 / 255.0), FIX(0.58700 * 219.0 / 255.0)));
+    const __m128i coef_b = _mm_set1_epi32(COEF_PAIR(
+        FIX(0.11400 * 219.0 / 255.0), ONE_HALF + (16 << SCALEBITS)));
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i lo, hi;
+
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coef_rg),
+                       _mm_madd_epi16(_mm_unpacklo_epi16(b, one), coef_b));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coef_rg),
+                       _mm_madd_epi16(_mm_unpackhi_epi16(b, one), coef_b));
+    return _mm_packs_epi32(_mm_srai_epi32(lo, SCALEBITS),
+                           _mm_srai_epi32(hi, SCALEBITS));
+}
+
+// 8 个2x2 块的R、G、B 之和算出U 或V(coef1 对R、G，coef2 对B 和舍入)，
+// 结果是16 位的。
+static inline AV_TARGET_SSE2 __m128i rgb_to_c_sse2(__m128i r, __m128i g,
+                                                   __m128i b, __m128i coef1,
+                                                   __m128i coef2) {
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i lo, hi;
+
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coef1),
+                       _mm_madd_epi16(_mm_unpacklo_epi16(b, one), coef2));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coef1),
+                       _mm_madd_epi16(_mm_unpackhi_epi16(b, one), coef2));
+    return _mm_add_epi16(_mm_packs_epi32(_mm_srai_epi32(lo, SCALEBITS + 2),
+                                         _mm_srai_epi32(hi, SCALEBITS + 2)),
+                         _mm_set1_epi16(128));
+}
+
+AV_TARGET_SSSE3 void ff_rgb24_to_yuv420p_ssse3(AVPicture *dst,
+                                               const AVPicture *src, int width,
+                                               int height) {
+    const __m128i coef_u1 = _mm_set1_epi32(COEF_PAIR(
+        -FIX(0.16874 * 224.0 / 255.0), -FIX(0.33126 * 224.0 / 255.0)));
+    const __m128i coef_u2 = _mm_set1_epi32(
+        COEF_PAIR(FIX(0.50000 * 224.0 / 255.0), (ONE_HALF << 2) - 1));
+    const __m128i coef_v1 = _mm_set1_epi32(COEF_PAIR(
+        FIX(0.50000 * 224.0 / 255.0), -FIX(0.41869 * 224.0 / 255.0)));
+    const __m128i coef_v2 = _mm_set1_epi32(
+        COEF_PAIR(-FIX(0.08131 * 224.0 / 255.0), (ONE_HALF << 2) - 1));
+    const __m128i one = _mm_set1_epi16(1);
+    const uint8_t *p;
+    uint8_t *lum, *cb, *cr;
+    __m128i s1[6], s2[6], sum[3];
+    int x, y, i, w = width & ~15;
+
+    for (y = 0; y + 2 <= height; y += 2) {
+        p = src->data[0] + y * src->linesize[0];
+        lum = dst->data[0] + y * dst->linesize[0];
+        cb = dst->data[1] + (y >> 1) * dst->linesize[1];
+        cr = dst->data[2] + (y >> 1) * dst->linesize[2];
+        for (x = 0; x < w; x += 16) {
+            load_rgb24_ssse3(p + 3 * x, s1);
+            load_rgb24_ssse3(p + src->linesize[0] + 3 * x, s2);
+            _mm_storeu_si128((__m128i *)(lum + x),
+                             _mm_packus_epi16(rgb_to_y_sse2(s1[0], s1[1], s1[2]),
+                                              rgb_to_y_sse2(s1[3], s1[4], s1[5])));
+            _mm_storeu_si128((__m128i *)(lum + dst->linesize[0] + x),
+                             _mm_packus_epi16(rgb_to_y_sse2(s2[0], s2[1], s2[2]),
+                                              rgb_to_y_sse2(s2[3], s2[4], s2[5])));
+
+            // 上下两行相加，再把左右相邻的两个像素相加
+            for (i = 0; i < 3; i++) {
+                sum[i] = _mm_packs_epi32(
+                    _mm_madd_epi16(_mm_add_epi16(s1[i], s2[i]), one),
+                    _mm_madd_epi16(_mm_add_epi16(s1[i + 3], s2[i + 3]), one));
+            }
+            _mm_storel_epi64(
+                (__m128i *)(cb + (x >> 1)),
+                _mm_packus_epi16(
+                    rgb_to_c_sse2(sum[0], sum[1], sum[2], coef_u1, coef_u2),
+                    _mm_setzero_si128()));
+            _mm_storel_epi64(
+                (__m128i *)(cr + (x >> 1)),
+                _mm_packus_epi16(
+                    rgb_to_c_sse2(sum[0], sum[1], sum[2], coef_v1, coef_v2),
+                    _mm_setzero_si128()));
+        }
+    }
+    convert_rest(ff_rgb24_to_yuv420p_c, dst, src, width, height, w,
+                 bpp_yuv420p, bpp_rgb24);
+}
+
+/* PAL8 -> YUV420P，查找表每项是Y | U << 8 | V << 24，用gather 一次查8 个 */
+
+// 16 个查表结果的Y 排成16 个字节。
+static inline AV_TARGET_AVX2 __m128i pal_luma_avx2(__m256i a, __m256i b) {
+    __m256i mask = _mm256_set1_epi32(0xff);
+    __m256i w = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask)),
+        0xD8);
+
+    return _mm_packus_epi16(_mm256_castsi256_si128(w),
+                            _mm256_extracti128_si256(w, 1));
+}
+
+AV_TARGET_AVX2 void ff_pal8_to_yuv420p_avx2(AVPicture *dst,
+                                            const AVPicture *src, int width,
+                                            int height, const uint32_t *yuv) {
+    const __m256i uv_mask = _mm256_set1_epi32(0x00ff00ff);
+    const __m256i uv_round = _mm256_set1_epi16(2);
+    // 每个半边中4 个U 放在前4 个字节，4 个V 放在后4 个字节
+    const __m256i uv_shuf = _mm256_setr_epi8(
+        0, 4, 8, 12, 2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8,
+        12, 2, 6, 10, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i uv_perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 3, 6, 7);
+    const int *table = (const int *)yuv;
+    const uint8_t *p1, *p2;
+    uint8_t *lum1, *lum2, *cb, *cr;
+    __m128i i1, i2, c;
+    __m256i a0, a1, b0, b1, s0, s1, uv;
+    AVPicture d, s;
+    int x, y, w = width & ~15;
+
+    for (y = 0; y + 2 <= height; y += 2) {
+        p1 = src->data[0] + y * src->linesize[0];
+        p2 = p1 + src->linesize[0];
+        lum1 = dst->data[0] + y * dst->linesize[0];
+        lum2 = lum1 + dst->linesize[0];
+        cb = dst->data[1] + (y >> 1) * dst->linesize[1];
+        cr = dst->data[2] + (y >> 1) * dst->linesize[2];
+        for (x = 0; x < w; x += 16) {
+            i1 = _mm_loadu_si128((const __m128i *)(p1 + x));
+            i2 = _mm_loadu_si128((const __m128i *)(p2 + x));
+            a0 = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(i1), 4);
+            a1 = _mm256_i32gather_epi32(
+                table, _mm256_cvtepu8_epi32(_mm_srli_si128(i1, 8)), 4);
+            b0 = _mm256_i32gather_epi32(table, _mm256_cvtepu8_epi32(i2), 4);
+            b1 = _mm256_i32gather_epi32(
+                table, _mm256_cvtepu8_epi32(_mm_srli_si128(i2, 8)), 4);
+            _mm_storeu_si128((__m128i *)(lum1 + x), pal_luma_avx2(a0, a1));
+            _mm_storeu_si128((__m128i *)(lum2 + x), pal_luma_avx2(b0, b1));
+
+            // U、V 放在32 位的低、高16 位，相加时互不进位
+            s0 = _mm256_add_epi32(
+                _mm256_and_si256(_mm256_srli_epi32(a0, 8), uv_mask),
+                _mm256_and_si256(_mm256_srli_epi32(b0, 8), uv_mask));
+            s1 = _mm256_add_epi32(
+                _mm256_and_si256(_mm256_srli_epi32(a1, 8), uv_mask),
+                _mm256_and_si256(_mm256_srli_epi32(b1, 8), uv_mask));
+            uv = _mm256_permute4x64_epi64(_mm256_hadd_epi32(s0, s1), 0xD8);
+            uv = _mm256_srli_epi16(_mm256_add_epi16(uv, uv_round), 2);
+            uv = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(uv, uv_shuf),
+                                             uv_perm);
+            c = _mm256_castsi256_si128(uv);
+            _mm_storel_epi64((__m128i *)(cb + (x >> 1)), c);
+            _mm_storel_epi64((__m128i *)(cr + (x >> 1)), _mm_srli_si128(c, 8));
+        }
+    }
+
+    if (w < width) {
+        picture_offset(&d, dst, w, 0, bpp_yuv420p);
+        picture_offset(&s, src, w, 0, bpp_pal8);
+        ff_pal8_to_yuv420p_c(&d, &s, width - w, height, yuv);
+    }
+    if ((height & 1) && w > 0) {
+        picture_offset(&d, dst, 0, height & ~1, bpp_yuv420p);
+        picture_offset(&s, src, 0, height & ~1, bpp_pal8);
+        ff_pal8_to_yuv420p_c(&d, &s, w, 1, yuv);
+    }
+}
+#endif
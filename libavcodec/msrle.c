@@ -21,14 +21,88 @@ typedef struct MsrleContext {
     unsigned char *buf;
     int size;
 
+    // 通过draw_horiz_band 报告完成的行，[band_end, height) 已经报告过
+    int band_rows;
+    int band_end;
+
+    // 这一帧写过的行，每AV_DIRTY_ROWS 行一项，输出到AVFrame.dirty
+    uint8_t *dirty;
+    int nb_dirty;
+    uint8_t dirty_dummy; // 已经越过图像时写到这里
 } MsrleContext;
 
+#define FFMIN(a, b) ((a) > (b) ? (b) : (a))
+
+#define MSRLE_BAND_BYTES (32 * 1024) // 一段大约的字节数，和转换的结果一起留在缓存中
+
+// 正在解码输出图像的第row 行，下面的行都已经完成，按band_rows 对齐报告给调用者。
+// row 小于0 时这一帧解码结束，报告剩下的所有行。
+static void msrle_report_rows(MsrleContext *s, int row) {
+    int y, start;
+
+    if (!s->avctx->draw_horiz_band)
+        return;
+    y = row < 0 ? 0 : row + 1;
+    start = (y + s->band_rows - 1) / s->band_rows * s->band_rows;
+    if (start < s->band_end) {
+        s->avctx->draw_horiz_band(s->avctx, &s->frame, start,
+                                  s->band_end - start);
+        s->band_end = start;
+    }
+}
+
+// 换到输出图像的第row 行，返回这一行在dirty 中对应的项，写像素时置1。
+static uint8_t *msrle_new_row(MsrleContext *s, int row) {
+    msrle_report_rows(s, row);
+    if (row < 0)
+        return &s->dirty_dummy;
+    return &s->dirty[row / AV_DIRTY_ROWS];
+}
+
+static void msrle_load_palette(MsrleContext *s) {
+    // make the palette available
+    memcpy(s->frame.data[1], s->avctx->palctrl->palette, AVPALETTE_SIZE);
+    if (s->avctx->palctrl->palette_changed) {
+        //      s->frame.palette_has_changed = 1;
+        s->avctx->palctrl->palette_changed = 0;
+        memset(s->dirty, 1, s->nb_dirty); // 颜色变了，所有的行都要重新转换
+    }
+}
+
 #define FETCH_NEXT_STREAM_BYTE()                                               \
     if (stream_ptr >= s->size) {                                               \
         return;                                                                \
     }                                                                          \
     stream_byte = s->buf[stream_ptr++];
 
+// 4 位像素的一个字节拆成两个像素，高4 位在前。
+#define NIB2(b) {(b) >> 4, (b)&0x0F}
+#define NIB8(b)                                                                \
+    NIB2(b), NIB2(b + 1), NIB2(b + 2), NIB2(b + 3), NIB2(b + 4), NIB2(b + 5),  \
+        NIB2(b + 6), NIB2(b + 7)
+#define NIB32(b) NIB8(b), NIB8(b + 8), NIB8(b + 16), NIB8(b + 24)
+
+static const uint8_t msrle_nibbles[256][2] = {
+    NIB32(0),   NIB32(32),  NIB32(64),  NIB32(96),
+    NIB32(128), NIB32(160), NIB32(192), NIB32(224)};
+
+// 4 位像素的行程：n 个像素交替取byte 的高4 位和低4 位。
+static void msrle_fill_pal4(uint8_t *dst, int byte, int n) {
+    uint8_t pat[4];
+    int i;
+
+    pat[0] = pat[2] = msrle_nibbles[byte][0];
+    pat[1] = pat[3] = msrle_nibbles[byte][1];
+    if (pat[0] == pat[1]) {
+        memset(dst, pat[0], n);
+        return;
+    }
+    for (; n >= 4; n -= 4, dst += 4)
+        memcpy(dst, pat, 4);
+    for (i = 0; i < n; i++)
+        dst[i] = pat[i];
+}
+
 static void msrle_decode_pal4(MsrleContext *s) {
     int stream_ptr = 0;
     unsigned char rle_code;
@@ -38,14 +112,10 @@ static void msrle_decode_pal4(MsrleContext *s) {
     int row_dec = s->frame.linesize[0];
     int row_ptr = (s->avctx->height - 1) * row_dec;
     int frame_size = row_dec * s->avctx->height;
+    uint8_t *dirty = msrle_new_row(s, row_ptr / row_dec);
     int i;
 
-    // make the palette available
-    memcpy(s->frame.data[1], s->avctx->palctrl->palette, AVPALETTE_SIZE);
-    if (s->avctx->palctrl->palette_changed) {
-        //      s->frame.palette_has_changed = 1;
-        s->avctx->palctrl->palette_changed = 0;
-    }
+    msrle_load_palette(s);
 
     while (row_ptr >= 0) {
         FETCH_NEXT_STREAM_BYTE();
@@ -57,6 +127,7 @@ static void msrle_decode_pal4(MsrleContext *s) {
                 // line is done, goto the next one
                 row_ptr -= row_dec;
                 pixel_ptr = 0;
+                dirty = msrle_new_row(s, row_ptr / row_dec);
             } else if (stream_byte == 1) {
                 // decode is done
                 return;
@@ -66,6 +137,7 @@ static void msrle_decode_pal4(MsrleContext *s) {
                 pixel_ptr += stream_byte;
                 FETCH_NEXT_STREAM_BYTE();
                 row_ptr -= stream_byte * row_dec;
+                dirty = msrle_new_row(s, row_ptr / row_dec);
             } else {
                 // copy pixels from encoded stream
                 odd_pixel = stream_byte & 1;
@@ -75,6 +147,22 @@ static void msrle_decode_pal4(MsrleContext *s) {
                     (row_ptr < 0)) {
                     return;
                 }
+                *dirty = 1;
+
+                // 像素都在这一行内、数据也都在时整块拆开
+                if (pixel_ptr + stream_byte <= s->avctx->width &&
+                    stream_ptr + rle_code <= s->size) {
+                    uint8_t *dst = &s->frame.data[0][row_ptr + pixel_ptr];
+                    const uint8_t *src = &s->buf[stream_ptr];
+
+                    for (i = 0; i < stream_byte >> 1; i++)
+                        memcpy(dst + 2 * i, msrle_nibbles[src[i]], 2);
+                    if (odd_pixel)
+                        dst[2 * i] = src[i] >> 4;
+                    pixel_ptr += stream_byte;
+                    stream_ptr += rle_code + extra_byte;
+                    continue;
+                }
 
                 for (i = 0; i < rle_code; i++) {
                     if (pixel_ptr >= s->avctx->width)
@@ -100,15 +188,16 @@ static void msrle_decode_pal4(MsrleContext *s) {
                 (row_ptr < 0)) {
                 return;
             }
+            *dirty = 1;
             FETCH_NEXT_STREAM_BYTE();
-            for (i = 0; i < rle_code; i++) {
-                if (pixel_ptr >= s->avctx->width)
-                    break;
-                if ((i & 1) == 0)
-                    s->frame.data[0][row_ptr + pixel_ptr] = stream_byte >> 4;
-                else
-                    s->frame.data[0][row_ptr + pixel_ptr] = stream_byte & 0x0F;
-                pixel_ptr++;
+            // 到行尾为止
+            i = s->avctx->width - pixel_ptr;
+            if (i > rle_code)
+                i = rle_code;
+            if (i > 0) {
+                msrle_fill_pal4(&s->frame.data[0][row_ptr + pixel_ptr],
+                                stream_byte, i);
+                pixel_ptr += i;
             }
         }
     }
@@ -128,13 +217,9 @@ static void msrle_decode_pal8(MsrleContext *s) {
     int row_dec = s->frame.linesize[0];
     int row_ptr = (s->avctx->height - 1) * row_dec;
     int frame_size = row_dec * s->avctx->height;
+    uint8_t *dirty = msrle_new_row(s, row_ptr / row_dec);
 
-    // make the palette available
-    memcpy(s->frame.data[1], s->avctx->palctrl->palette, AVPALETTE_SIZE);
-    if (s->avctx->palctrl->palette_changed) {
-        //      s->frame.palette_has_changed = 1;
-        s->avctx->palctrl->palette_changed = 0;
-    }
+    msrle_load_palette(s);
 
     while (row_ptr >= 0) {
         FETCH_NEXT_STREAM_BYTE();
@@ -146,6 +231,7 @@ static void msrle_decode_pal8(MsrleContext *s) {
                 // line is done, goto the next one
                 row_ptr -= row_dec;
                 pixel_ptr = 0;
+                dirty = msrle_new_row(s, row_ptr / row_dec);
             } else if (stream_byte == 1) {
                 // decode is done
                 return;
@@ -155,6 +241,7 @@ static void msrle_decode_pal8(MsrleContext *s) {
                 pixel_ptr += stream_byte;
                 FETCH_NEXT_STREAM_BYTE();
                 row_ptr -= stream_byte * row_dec;
+                dirty = msrle_new_row(s, row_ptr / row_dec);
             } else {
                 // copy pixels from encoded stream
                 if ((row_ptr + pixel_ptr + stream_byte > frame_size) ||
@@ -167,12 +254,13 @@ static void msrle_decode_pal8(MsrleContext *s) {
                 if (stream_ptr + rle_code + extra_byte > s->size) {
                     return;
                 }
+                *dirty = 1;
 
-                while (rle_code--) {
-                    FETCH_NEXT_STREAM_BYTE();
-                    s->frame.data[0][row_ptr + pixel_ptr] = stream_byte;
-                    pixel_ptr++;
-                }
+                // 上面已经检查过数据足够，整块复制
+                memcpy(&s->frame.data[0][row_ptr + pixel_ptr],
+                       &s->buf[stream_ptr], rle_code);
+                stream_ptr += rle_code;
+                pixel_ptr += rle_code;
 
                 // if the RLE code is odd, skip a byte in the stream
                 if (extra_byte)
@@ -184,13 +272,13 @@ static void msrle_decode_pal8(MsrleContext *s) {
                 (row_ptr < 0)) {
                 return;
             }
+            *dirty = 1;
 
             FETCH_NEXT_STREAM_BYTE();
 
-            while (rle_code--) {
-                s->frame.data[0][row_ptr + pixel_ptr] = stream_byte;
-                pixel_ptr++;
-            }
+            memset(&s->frame.data[0][row_ptr + pixel_ptr], stream_byte,
+                   rle_code);
+            pixel_ptr += rle_code;
         }
     }
 
@@ -200,6 +288,149 @@ static void msrle_decode_pal8(MsrleContext *s) {
     }
 }
 
+// 缩小解码时从原图的第x 个像素开始的n 个像素中，把列号是(1 << lowres) 倍数的
+// 写到输出的行dst。超出原图宽度的像素丢掉。
+static void msrle_lowres_copy(uint8_t *dst, const uint8_t *src, int x, int n,
+                              int width, int lowres, int pal4) {
+    int i = -x & ((1 << lowres) - 1);
+
+    if (n > width - x)
+        n = width - x;
+    for (; i < n; i += 1 << lowres) {
+        dst[(x + i) >> lowres] =
+            pal4 ? msrle_nibbles[src[i >> 1]][i & 1] : src[i];
+    }
+}
+
+// 行程：间隔是偶数，留下来的4 位像素都取byte 的同一半。
+static void msrle_lowres_fill(uint8_t *dst, int byte, int x, int n, int width,
+                              int lowres, int pal4) {
+    int i = -x & ((1 << lowres) - 1);
+
+    if (n > width - x)
+        n = width - x;
+    if (i < n)
+        memset(dst + ((x + i) >> lowres),
+               pal4 ? msrle_nibbles[byte][i & 1] : byte,
+               (n - i + (1 << lowres) - 1) >> lowres);
+}
+
+// 换到原图的第y 行，行号是(1 << lowres) 的倍数时dst 指向输出的行，否则为NULL。
+static uint8_t *msrle_lowres_row(MsrleContext *s, int y, uint8_t **dst) {
+    int lowres = s->avctx->lowres;
+    uint8_t *dirty = msrle_new_row(s, y < 0 ? -1 : y >> lowres);
+
+    if (y < 0 || (y & ((1 << lowres) - 1))) {
+        *dst = NULL;
+        return &s->dirty_dummy;
+    }
+    *dst = s->frame.data[0] + (y >> lowres) * s->frame.linesize[0];
+    return dirty;
+}
+
+// 缩小解码，4 位和8 位像素共用。按原图的坐标走完整个数据流，只写行号和列号
+// 都是(1 << lowres) 倍数的像素，输出就是原图隔行隔列取出的像素，差分帧也一样。
+// 调色板图像的像素是颜色序号，不能取平均。码流出错时越界按原图的宽度判断，
+// 8 位像素超出宽度的部分丢掉，不写到相邻的行，结果可能和原大小解码不同。
+static void msrle_decode_lowres(MsrleContext *s) {
+    int lowres = s->avctx->lowres;
+    int width = s->avctx->coded_width;
+    int height = s->avctx->coded_height;
+    int pal4 = s->avctx->bits_per_sample == 4;
+    int stream_ptr = 0;
+    unsigned char rle_code;
+    unsigned char extra_byte;
+    unsigned char stream_byte;
+    int x = 0, y = height - 1;
+    uint8_t *dst;
+    uint8_t *dirty = msrle_lowres_row(s, y, &dst);
+    int n;
+
+    msrle_load_palette(s);
+
+    while (y >= 0) {
+        FETCH_NEXT_STREAM_BYTE();
+        rle_code = stream_byte;
+        if (rle_code == 0) {
+            FETCH_NEXT_STREAM_BYTE();
+            if (stream_byte == 0) {
+                y--;
+                x = 0;
+                dirty = msrle_lowres_row(s, y, &dst);
+            } else if (stream_byte == 1) {
+                return;
+            } else if (stream_byte == 2) {
+                FETCH_NEXT_STREAM_BYTE();
+                x += stream_byte;
+                FETCH_NEXT_STREAM_BYTE();
+                y -= stream_byte;
+                dirty = msrle_lowres_row(s, y, &dst);
+            } else {
+                // 直接给出的像素，数据按字节补齐到偶数个
+                if (x + stream_byte > (height - y) * width || y < 0)
+                    return;
+                n = stream_byte;
+                rle_code = pal4 ? (stream_byte + 1) / 2 : stream_byte;
+                extra_byte = rle_code & 0x01;
+                if (pal4) {
+                    // 和原大小解码一样到行尾为止，行尾以后的数据不跳过；
+                    // 数据不够时写完已有的像素
+                    n = x < width ? FFMIN(n, width - x) : 0;
+                    rle_code = (n + 1) / 2;
+                    if (stream_ptr + rle_code > s->size) {
+                        n = FFMIN(n, (s->size - stream_ptr) * 2);
+                        if (dst && n > 0) {
+                            *dirty = 1;
+                            msrle_lowres_copy(dst, &s->buf[stream_ptr], x, n,
+                                              width, lowres, pal4);
+                        }
+                        return;
+                    }
+                } else if (stream_ptr + rle_code + extra_byte > s->size) {
+                    return;
+                }
+                if (dst) {
+                    *dirty = 1;
+                    msrle_lowres_copy(dst, &s->buf[stream_ptr], x, n, width,
+                                      lowres, pal4);
+                }
+                stream_ptr += rle_code + extra_byte;
+                x += n;
+            }
+        } else {
+            // 行程，4 位像素到行尾为止
+            if (x + stream_byte > (height - y) * width || y < 0)
+                return;
+            FETCH_NEXT_STREAM_BYTE();
+            n = pal4 ? FFMIN(rle_code, width - x) : rle_code;
+            if (n > 0) {
+                if (dst) {
+                    *dirty = 1;
+                    msrle_lowres_fill(dst, stream_byte, x, n, width, lowres,
+                                      pal4);
+                }
+                x += n;
+            }
+        }
+    }
+}
+
+static int msrle_alloc_dirty(MsrleContext *s) {
+    int n = (s->avctx->height + AV_DIRTY_ROWS - 1) / AV_DIRTY_ROWS;
+
+    if (n != s->nb_dirty) {
+        av_free(s->dirty);
+        s->dirty = av_malloc(n);
+        if (!s->dirty) {
+            s->nb_dirty = 0;
+            return -1;
+        }
+        s->nb_dirty = n;
+    }
+    s->frame.dirty = s->dirty;
+    return 0;
+}
+
 static int msrle_decode_init(AVCodecContext *avctx) {
     MsrleContext *s = (MsrleContext *)avctx->priv_data;
 
@@ -215,23 +446,45 @@ static int msrle_decode_init(AVCodecContext *avctx) {
 static int msrle_decode_frame(AVCodecContext *avctx, void *data, int *data_size,
                               uint8_t *buf, int buf_size) {
     MsrleContext *s = (MsrleContext *)avctx->priv_data;
+    int dirty;
 
     s->buf = buf;
     s->size = buf_size;
 
+    // 没有上一帧时所有的行都当作改变
+    dirty = s->frame.data[0] ? 0 : 1;
+    if (avctx->lowres &&
+        avcodec_check_dimensions(avctx, avctx->coded_width, avctx->coded_height))
+        return -1;
     if (avctx->reget_buffer(avctx, &s->frame))
         return -1;
+    if (msrle_alloc_dirty(s) < 0)
+        return -1;
+    memset(s->dirty, dirty, s->nb_dirty);
+
+    s->band_rows = (MSRLE_BAND_BYTES / s->frame.linesize[0]) & ~15;
+    if (s->band_rows < 16)
+        s->band_rows = 16;
+    s->band_end = avctx->height;
 
     switch (avctx->bits_per_sample) {
     case 8:
-        msrle_decode_pal8(s);
+        if (avctx->lowres)
+            msrle_decode_lowres(s);
+        else
+            msrle_decode_pal8(s);
         break;
     case 4:
-        msrle_decode_pal4(s);
+        if (avctx->lowres)
+            msrle_decode_lowres(s);
+        else
+            msrle_decode_pal4(s);
         break;
     default:
         break;
     }
+    // 提前结束或者出错时没有解码到的行保持上一帧的内容，也是最终结果
+    msrle_report_rows(s, -1);
 
     *data_size = sizeof(AVFrame);
     *(AVFrame *)data = s->frame;
@@ -246,11 +499,23 @@ static int msrle_decode_end(AVCodecContext *avctx) {
     // release the last frame
     if (s->frame.data[0])
         avctx->release_buffer(avctx, &s->frame);
+    av_freep(&s->dirty);
+    s->nb_dirty = 0;
 
     return 0;
 }
 
+// 差分帧是在上一帧的图像上修改，seek 后释放上一帧，从新的一帧开始。
+static void msrle_flush(AVCodecContext *avctx) {
+    MsrleContext *s = (MsrleContext *)avctx->priv_data;
+
+    if (s->frame.data[0])
+        avctx->release_buffer(avctx, &s->frame);
+}
+
 AVCodec msrle_decoder = {"msrle",           CODEC_TYPE_VIDEO,
                          CODEC_ID_MSRLE,    sizeof(MsrleContext),
                          msrle_decode_init, NULL,
-                         msrle_decode_end,  msrle_decode_frame};
+                         msrle_decode_end,  msrle_decode_frame,
+                         0,                 NULL,
+                         msrle_flush,       3};
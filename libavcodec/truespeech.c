@@ -333,6 +333,11 @@ static int truespeech_decode_frame(AVCodecContext *avctx, void *data,
     return buf_size;
 }
 
+// 滤波器的状态跨帧保存，seek 后清零，和刚打开解码器时一样。
+static void truespeech_flush(AVCodecContext *avctx) {
+    memset(avctx->priv_data, 0, sizeof(TSContext));
+}
+
 AVCodec truespeech_decoder = {
     "truespeech",
     CODEC_TYPE_AUDIO,
@@ -342,4 +347,7 @@ AVCodec truespeech_decoder = {
     NULL,
     NULL,
     truespeech_decode_frame,
+    0,
+    NULL,
+    truespeech_flush,
 };
@@ -326,6 +326,18 @@ int avcodec_open(AVCodecContext *avctx, AVCodec *codec) {
     avctx->codec = codec;
     avctx->codec_id = codec->id;
     avctx->frame_number = 0;
+
+    // 输出的大小向上取整，重复打开时仍从原图的大小计算
+    if (avctx->lowres < 0 || avctx->lowres > codec->max_lowres)
+        avctx->lowres = avctx->lowres < 0 ? 0 : codec->max_lowres;
+    if (!avctx->coded_width && !avctx->coded_height) {
+        avctx->coded_width = avctx->width;
+        avctx->coded_height = avctx->height;
+    }
+    avctx->width = (avctx->coded_width + (1 << avctx->lowres) - 1) >>
+                   avctx->lowres;
+    avctx->height = (avctx->coded_height + (1 << avctx->lowres) - 1) >>
+                    avctx->lowres;
     ret = avctx->codec->init(avctx);
     if (ret < 0) {
         av_freep(&avctx->priv_data);
@@ -378,6 +390,12 @@ int avcodec_close(AVCodecContext *avctx) {
     return 0;
 }
 
+// seek 后调用，让解码器丢弃和以前的数据相关的状态。
+void avcodec_flush_buffers(AVCodecContext *avctx) {
+    if (avctx->codec && avctx->codec->flush)
+        avctx->codec->flush(avctx);
+}
+
 AVCodec *avcodec_find_decoder(enum CodecID id) {
     AVCodec *p;
     p = first_avcodec;
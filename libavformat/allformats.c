@@ -3,6 +3,8 @@
 // 简单的注册/初始化函数，把相应的协议，文件格式，解码器等用相应的链表串起来便于查找。
 
 extern URLProtocol file_protocol;
+extern URLProtocol mmap_protocol;
+extern URLProtocol uring_protocol;
 
 void av_register_all(void) {
     // inited 变量声明成static，做一下比较是为了避免此函数多次调用。
@@ -25,4 +27,6 @@ void av_register_all(void) {
     // 把所有的输入协议用链表的方式都串连起来，比如tcp/udp/file
     // 等，链表头指针是first_protocol。
     register_protocol(&file_protocol);
+    register_protocol(&mmap_protocol);
+    register_protocol(&uring_protocol);
 }
@@ -50,6 +50,7 @@ typedef struct AVPacket {
     int stream_index; // 当前音视频数据包对应的流索引，在本例中用于区别音频还是视频。
     int flags;        // 数据包的一些标记，比如是否是关键帧等。
     void (*destruct)(struct AVPacket *);
+    void *priv; // destruct 回调使用的私有数据，比如映射区的引用
 } AVPacket;
 
 // 把音视频AVPacket组成一个小链表。
@@ -73,29 +74,40 @@ static inline void av_free_packet(AVPacket *pkt) {
         pkt->destruct(pkt);
 }
 
+// 数据包缓存池，按大小分级缓存数据包的数据缓存，避免每包malloc/free。
+typedef struct AVPacketPool AVPacketPool;
+
+// 数据包缓存池的统计信息，命中率为hits / requests。
+typedef struct AVPacketPoolStats {
+    int64_t requests;     // 申请缓存的次数
+    int64_t hits;         // 直接从池中取到缓存的次数
+    int64_t bytes_in_use; // 当前借出的缓存字节数
+    int64_t bytes_cached; // 池中空闲的缓存字节数
+    int64_t peak_bytes;   // 借出和空闲缓存总字节数的峰值
+} AVPacketPoolStats;
+
+AVPacketPool *av_packet_pool_new(void);
+void av_packet_pool_release(AVPacketPool **pool);
+int av_packet_pool_alloc(AVPacketPool *pool, AVPacket *pkt, int size);
+void av_packet_pool_get_stats(AVPacketPool *pool, AVPacketPoolStats *stats);
+
+int av_get_mapped_packet(ByteIOContext *s, AVPacket *pkt, int size);
+
 // 读文件往数据包中填数据，注意程序跑到这里时，文件偏移量已确定，要读数据的大小也确定，
 // 但是数据包的缓存没有分配。分配好内存后，要初始化包的一些变量。
+// 如果广义文件关联了缓存池，数据包缓存从缓存池中借用。
 static inline int av_get_packet(ByteIOContext *s, AVPacket *pkt, int size) {
     int ret;
-    unsigned char *data;
-    if ((unsigned)size > (unsigned)size + FF_INPUT_BUFFER_PADDING_SIZE)
-        return AVERROR_NOMEM;
+
+    // 广义文件是内存映射的，数据包直接指向映射区，不用分配缓存和拷贝数据。
+    ret = av_get_mapped_packet(s, pkt, size);
+    if (ret >= 0)
+        return ret;
+
     // 分配数据包缓存
-    data = av_malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
-    if (!data)
-        return AVERROR_NOMEM;
-
-    memset(data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-
-    // 初始化相关值
-    pkt->pts = AV_NOPTS_VALUE;
-    pkt->dts = AV_NOPTS_VALUE;
-    pkt->pos = -1;
-    pkt->flags = 0;
-    pkt->stream_index = 0;
-    pkt->data = data;
-    pkt->size = size;
-    pkt->destruct = av_destruct_packet;
+    ret = av_packet_pool_alloc(s->packet_pool, pkt, size);
+    if (ret < 0)
+        return ret;
 
     pkt->pos = url_ftell(s);
     // 实际读广义文件填充数据包，如果读文件错误时通常是到了末尾，要归还刚刚malloc出来的内存。
@@ -125,6 +137,9 @@ typedef struct AVIndexEntry {
                    // 8byte align)
 } AVIndexEntry;
 
+// 索引表的紧凑存储，在index.c 中定义，通过av_index_* 函数访问。
+typedef struct AVIndex AVIndex;
+
 // 表示当前媒体流的上下文，着重于所有媒体流共有的属性(并且是在程序运行时才能确定其值)和关联其他结构的字段
 typedef struct AVStream {
     AVCodecContext *actx; // 关联当前音视频媒体使用的编解码器
@@ -134,20 +149,26 @@ typedef struct AVStream {
 
     AVRational time_base; // 由 av_set_pts_info()函数初始化
 
-    AVIndexEntry *index_entries; // only used if the format does not support
-                                 // seeking natively
+    AVIndex *index; // only used if the format does not support seeking
+                    // natively
     int nb_index_entries;
-    int index_entries_allocated_size;
 
     double frame_last_delay; // 帧最后延迟
 } AVStream;
 
 // AVFormatParameters
-// 结构在瘦身后的ffplay中没有实际意义，为保证函数接口不变，没有删除。
+// 打开输入文件时的可选参数，全0 表示使用默认行为。
 typedef struct AVFormatParameters {
     int dbg; // only for debug
+    int readahead_buffers; // >0 时打开异步预读，预读的缓存块数，参见url_setreadahead()
+    int ni_sched_packets;  // >0 时非交织AVI 按文件位置调度读取，调度窗口的包数
+    int ni_stream_io;      // 非0 时非交织AVI 每个流用独立的I/O 上下文读取
+    int index_cache;       // 非0 时使用文件旁的索引缓存，参见indexcache.c
+    int index_threads;     // >0 时没有idx1 的AVI 用这么多线程扫描movi 重建索引
 } AVFormatParameters;
 
+struct AVFormatContext; // 下面的函数指针参数使用，定义在后面
+
 // AVInputFormat 定义输入文件容器格式，着重于功能函数，
 // 一种文件容器格式对应一个AVInputFormat结构，在程序运行时有多个实例，但瘦身后ffplay
 // 仅一个实例。
@@ -164,6 +185,17 @@ typedef struct AVInputFormat {
 
     int (*read_close)(struct AVFormatContext *);
 
+    // 可选，seek 到stream_index 流中timestamp 对应的帧，flags 为AVSEEK_FLAG_*。
+    int (*read_seek)(struct AVFormatContext *, int stream_index,
+                     int64_t timestamp, int flags);
+
+    // 可选，从索引缓存恢复read_header() 的结果，失败时返回负数，由调用者
+    // 释放已创建的流后改用read_header()。
+    int (*read_cache)(struct AVFormatContext *, ByteIOContext *cache,
+                      AVFormatParameters *ap);
+    // 可选，把read_header() 的结果写到索引缓存。
+    int (*write_cache)(struct AVFormatContext *, ByteIOContext *cache);
+
     const char *extensions; // 文件扩展名
 
     struct AVInputFormat
@@ -187,8 +219,19 @@ typedef struct AVFormatContext // format I/O context
 
     AVStream *streams[MAX_STREAMS]; // 关联音视频流
 
+    AVPacketPool *packet_pool; // 数据包缓存池，pb 读包时从中借用缓存
+
+    char filename[1024]; // 输入文件名，文件格式需要另外打开文件时使用
+
 } AVFormatContext;
 
+// 打开的索引缓存文件。缓存文件映射到内存，pb 从映射区读格式私有的数据。
+typedef struct AVIndexCache {
+    AVFileMapping *map;
+    AVInputFormat *iformat; // 缓存中记录的文件格式
+    ByteIOContext pb;
+} AVIndexCache;
+
 int avidec_init(void);
 
 void av_register_input_format(AVInputFormat *format);
@@ -208,6 +251,9 @@ int av_open_input_file(AVFormatContext **ic_ptr, const char *filename,
 
 int av_read_frame(AVFormatContext *s, AVPacket *pkt);
 int av_read_packet(AVFormatContext *s, AVPacket *pkt);
+int av_find_default_stream_index(AVFormatContext *s);
+int av_seek_frame(AVFormatContext *s, int stream_index, int64_t timestamp,
+                  int flags);
 void av_close_input_file(AVFormatContext *s);
 AVStream *av_new_stream(AVFormatContext *s, int id);
 void av_set_pts_info(AVStream *s, int pts_wrap_bits, int pts_num, int pts_den);
@@ -215,9 +261,19 @@ void av_set_pts_info(AVStream *s, int pts_wrap_bits, int pts_num, int pts_den);
 int av_index_search_timestamp(AVStream *st, int64_t timestamp, int flags);
 int av_add_index_entry(AVStream *st, int64_t pos, int64_t timestamp, int size,
                        int distance, int flags);
+int av_index_get_entry(AVStream *st, int i, AVIndexEntry *e);
+int64_t av_index_memory_usage(AVStream *st);
+void av_index_free(AVStream *st);
+int av_index_write(AVStream *st, ByteIOContext *pb);
+int av_index_read(AVStream *st, ByteIOContext *pb);
+
+int av_index_cache_open(AVIndexCache **pc, const char *filename);
+void av_index_cache_close(AVIndexCache *c);
+int av_index_cache_write(AVFormatContext *s);
 
 int strstart(const char *str, const char *val, const char **ptr);
 void pstrcpy(char *buf, int buf_size, const char *str);
+int pstrcat(char *buf, int buf_size, const char *s);
 
 #ifdef __cplusplus
 }
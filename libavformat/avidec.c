@@ -1,4 +1,6 @@
 #include "avformat.h"
+#include "../libavutil/cpu.h"
+#include "../libavutil/thread.h"
 
 #include <assert.h>
 // AVI 文件解析的相关函数
@@ -15,8 +17,25 @@
 #define FFMIN(a, b) ((a) > (b) ? (b) : (a))
 #define FFMAX(a, b) ((a) > (b) ? (a) : (b))
 
+#define IDX1_BLOCK_ENTRIES 4096 // 一次读入内存的idx1 索引项数
+
+#define LE_32(x)                                                               \
+    ((((const uint8_t *)(x))[3] << 24) | (((const uint8_t *)(x))[2] << 16) |   \
+     (((const uint8_t *)(x))[1] << 8) | ((const uint8_t *)(x))[0])
+
+#define AVI_SCHED_MAX_GAP (32 * 1024)        // 相邻的包间隔不超过此值时合并成一次读
+#define AVI_SCHED_MAX_SPAN (4 * 1024 * 1024) // 一次合并读的最大范围
+
+#define CHUNK_START 1 // 块头首字节可能的取值：数字、'i'、'J'
+#define CHUNK_NEXT 2  // 块头第二个字节可能的取值：数字、'x'、'U'
+
+#define AVI_SCAN_MIN_RANGE (4 * 1024 * 1024) // 重建索引时每个线程至少扫描的字节数
+
 static int avi_load_index(AVFormatContext *s);
 static int guess_ni_flag(AVFormatContext *s);
+static void avi_open_stream_io(AVFormatContext *s, AVFormatParameters *ap);
+static void avi_setup_ni(AVFormatContext *s, AVFormatParameters *ap);
+static int avi_build_index(AVFormatContext *s, int nb_threads);
 
 // 定义了AVI文件中媒体流的一些属性，用于解析AVI文件。
 typedef struct {
@@ -35,8 +54,42 @@ typedef struct {
 
     int prefix; // normally 'd'<<8 + 'c' or 'w'<<8 + 'b'
     int prefix_count;
+
+    ByteIOContext *pb; // 非交织AVI 本流独立的I/O 上下文，NULL 时用AVFormatContext 的pb
 } AVIStream;
 
+// 非交织AVI 读调度窗口中的一项，记录一个按计划要读的包。
+typedef struct AVISchedEntry {
+    AVPacket pkt;
+    offset_t pos;     // 包数据在文件中的位置
+    int size;         // 包数据大小
+    int stream_index;
+    int64_t dts;
+    int flags;
+    int ret; // av_get_packet() 的返回值，不大于0 时pkt 中没有数据
+} AVISchedEntry;
+
+// 重建索引时扫描到的一个块。
+typedef struct AVIScanChunk {
+    int64_t pos;     // 块头位置
+    uint32_t size;   // 块数据大小
+    int stream;      // 数据块所属的流，其他块为-1
+} AVIScanChunk;
+
+// 重建索引时一个线程扫描的范围，块头在[start, end) 中的块都由它记录。
+typedef struct AVIScanRange {
+    const uint8_t *data; // 映射到内存的整个文件
+    int64_t start, end;
+    int64_t limit;       // movi 的结束位置，块数据不能超出
+    int nb_streams;
+    AVIScanChunk *chunks;
+    int nb_chunks;
+    int chunks_allocated;
+    int64_t next;        // 扫描停下的位置，即最后一块之后，不小于end
+    int error;
+    AVThread thread;
+} AVIScanRange;
+
 // AVIContext定义了AVI中流的一些属性，其中stream_index_2
 // 定义了当前应该读取流的索引。
 typedef struct {
@@ -48,6 +101,22 @@ typedef struct {
                         // 指示当前应该读取的流的索引。初值为-1，表示没有确定应该读的流。
                         // 实际表示AVFormatContext 结构中AVStream
                         // *streams[]数组中的索引。
+
+    // 非交织AVI 的读调度。按时间顺序提前规划sched_size 个包，按文件位置排序后
+    // 合并读取，再按时间顺序交出，文件读取接近顺序读。sched 为NULL 时不调度。
+    AVISchedEntry *sched;
+    AVISchedEntry **sched_order; // 按文件位置排序的调度项
+    int sched_size;              // 调度窗口大小，包数
+    int sched_count;             // 窗口中已读好的包数
+    int sched_next;              // 下一个交出的包
+
+    int stream_io;   // 有流使用独立的I/O 上下文
+    // 按时间顺序最后一个读(或规划)的包的结束位置。包不是从pb 读的时候，
+    // 索引读完后pb 要回到这里，和原来只用pb 顺序读时的位置一致。
+    offset_t ni_end;
+    // 索引已经读完，pb 回到过ni_end，之后从pb 的当前位置顺序往下找块。
+    // 调度和每个流独立I/O 两种读法共用，seek 后清0。
+    int ni_index_done;
 } AVIContext;
 
 // CodecTag数据结构，用于关联具体媒体格式的ID和Tag标签。
@@ -68,6 +137,33 @@ const CodecTag codec_wav_tags[] = {
     {0, 0},
 };
 
+// 重新同步时识别的块头只有##dc/##wb/##pc、ix##、JUNK 几种，
+// 它们的前两个字节分属下面的两个集合。
+static uint8_t avi_chunk_class[256];
+
+// 返回[p, end) 中第一个可能是块头开始的位置，即首字节属于CHUNK_START
+// 并且下一个字节属于CHUNK_NEXT 的位置；最后一个字节看不到下一个字节，
+// 只检查首字节。没有时返回end。
+const uint8_t *ff_avi_find_chunk_c(const uint8_t *p, const uint8_t *end) {
+    if (p == end)
+        return end;
+    for (; p < end - 1; p++) {
+        if ((avi_chunk_class[p[0]] & CHUNK_START) &&
+            (avi_chunk_class[p[1]] & CHUNK_NEXT))
+            return p;
+    }
+    return (avi_chunk_class[p[0]] & CHUNK_START) ? p : end;
+}
+
+#ifdef ARCH_X86
+const uint8_t *ff_avi_find_chunk_sse2(const uint8_t *p, const uint8_t *end);
+const uint8_t *ff_avi_find_chunk_avx2(const uint8_t *p, const uint8_t *end);
+#endif
+
+// 查找块头的函数，avidec_init() 中按CPU 支持的指令集选择。
+static const uint8_t *(*avi_find_chunk)(const uint8_t *p,
+                                        const uint8_t *end) = ff_avi_find_chunk_c;
+
 // 以媒体tag标签为关键字，查找codec_bmp_tags或codec_wav_tags数组，返回媒体ID。
 enum CodecID codec_get_id(const CodecTag *tags, unsigned int tag) {
     while (tags->id != CODEC_ID_NONE) {
@@ -114,6 +210,7 @@ static void clean_index(AVFormatContext *s) {
         int n = st->nb_index_entries;
         int max = ast->sample_size;
         int64_t pos, size, ts;
+        AVIndexEntry e;
 
         // 如果索引表项大于1，则认为索引表已建好，不再排序重建。如果sample_size
         // 为0,则没办法重建。
@@ -127,9 +224,10 @@ static void clean_index(AVFormatContext *s) {
             max += max;
 
         // 取位置，大小，时钟等基本参数。
-        pos = st->index_entries[0].pos;
-        size = st->index_entries[0].size;
-        ts = st->index_entries[0].timestamp;
+        av_index_get_entry(st, 0, &e);
+        pos = e.pos;
+        size = e.size;
+        ts = e.timestamp;
 
         for (j = 0; j < size; j += max) {
             // 以max指定的字节打包成帧，添加到索引表。
@@ -406,75 +504,330 @@ end_of_header:
     }
     // 加载AVI文件索引。
     avi_load_index(s);
+    // 没有idx1 时扫描movi 重建索引，以便seek 和非交织读取。
+    if (ap && ap->index_threads > 0) {
+        for (i = 0; i < s->nb_streams; i++) {
+            if (s->streams[i]->nb_index_entries)
+                break;
+        }
+        if (i == s->nb_streams)
+            avi_build_index(s, ap->index_threads);
+    }
     // 判别是否是非交织avi。
     avi->non_interleaved |= guess_ni_flag(s);
     if (avi->non_interleaved) {
         // 对那些非交织存储的媒体流，人工的补上索引，便于读取操作。
         clean_index(s);
+        avi_setup_ni(s, ap);
     }
 
     return 0;
 }
+
+// 准备非交织AVI 的读取方式，pb 要在媒体数据开始的位置。
+static void avi_setup_ni(AVFormatContext *s, AVFormatParameters *ap) {
+    AVIContext *avi = s->priv_data;
+    ByteIOContext *pb = &s->pb;
+
+    // 映射方式下seek 没有代价，不需要调度。
+    if (ap && ap->ni_sched_packets > 0 && !pb->mapping) {
+        avi->sched = av_mallocz(ap->ni_sched_packets * sizeof(AVISchedEntry));
+        avi->sched_order =
+            av_malloc(ap->ni_sched_packets * sizeof(AVISchedEntry *));
+        // 分配失败时不调度，按原来的方式读
+        if (!avi->sched || !avi->sched_order) {
+            av_freep(&avi->sched);
+            av_freep(&avi->sched_order);
+        } else {
+            avi->sched_size = ap->ni_sched_packets;
+        }
+    }
+    avi->ni_end = url_ftell(pb);
+
+    // 每个流另外打开一次文件，各自的缓存和预读只服务本流，
+    // 音视频交替读取时不会互相冲掉缓存的数据。
+    if (ap && ap->ni_stream_io && !pb->mapping)
+        avi_open_stream_io(s, ap);
+}
+
+// 为每个有索引的流打开独立的I/O 上下文，打开失败的流继续用公共的pb。
+static void avi_open_stream_io(AVFormatContext *s, AVFormatParameters *ap) {
+    AVIContext *avi = s->priv_data;
+    int i;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVIStream *ast = st->priv_data;
+
+        if (st->nb_index_entries <= 0)
+            continue;
+        ast->pb = av_mallocz(sizeof(ByteIOContext));
+        if (!ast->pb)
+            continue;
+        if (url_fopen(ast->pb, s->filename, URL_RDONLY) < 0) {
+            av_freep(&ast->pb);
+            continue;
+        }
+        ast->pb->packet_pool = s->pb.packet_pool;
+        if (ap->readahead_buffers > 0)
+            url_setreadahead(ast->pb, ap->readahead_buffers);
+        avi->stream_io = 1;
+    }
+}
+
+// 取读流n 的数据使用的I/O 上下文。
+static ByteIOContext *avi_stream_pb(AVFormatContext *s, int n) {
+    AVIStream *ast = s->streams[n]->priv_data;
+
+    return ast->pb ? ast->pb : &s->pb;
+}
+
+// 非交织AVI，按已读数据计算各个流的下一个时间点，选出时间点最近的流，
+// 查找索引表取出对应的索引，返回索引序号，没有对应的索引时返回-1。
+static int avi_ni_next_index(AVFormatContext *s, int *stream_index) {
+    int best_stream_index = 0;
+    AVStream *best_st = NULL;
+    AVIStream *best_ast;
+    int64_t best_ts = INT64_MAX;
+    int i;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        // 遍历所有媒体流，按照已经播放的流数据，计算下一个最近的时间点。
+        AVStream *st = s->streams[i];
+        AVIStream *ast = st->priv_data;
+        int64_t ts = ast->frame_offset;
+
+        // 把帧偏移换算成帧数。
+        if (ast->sample_size)
+            ts /= ast->sample_size;
+        // 把帧数换算成pts表示时间。
+        ts = av_rescale(ts, AV_TIME_BASE * (int64_t)st->time_base.num,
+                        st->time_base.den);
+        // 取最小的时间点对应的时间，流指针，流索引作为要读取的最佳(读取)流参数。
+        if (ts < best_ts) {
+            // 每次读取时间点(ast->frame_offset)最近的包
+            best_ts = ts;
+            best_st = st;
+            best_stream_index = i;
+        }
+    }
+    best_ast = best_st->priv_data;
+    *stream_index = best_stream_index;
+    // 换算最小的时间点，查找索引表取出对应的索引。
+    // 在缓存足够大，一次性完整读取帧数据时，此时best_ast->remaining
+    // 参数为0。
+    best_ts = av_rescale(best_ts, best_st->time_base.den,
+                         AV_TIME_BASE * (int64_t)best_st->time_base.num);
+    if (best_ast->remaining)
+        return av_index_search_timestamp(best_st, best_ts,
+                                         AVSEEK_FLAG_ANY | AVSEEK_FLAG_BACKWARD);
+    return av_index_search_timestamp(best_st, best_ts, AVSEEK_FLAG_ANY);
+}
+
+// 计算一次从当前块中读取的数据大小。
+static int avi_read_size(AVIStream *ast) {
+    int size;
+
+    if (ast->sample_size <=
+        1) // minorityreport.AVI block_align=1024 sample_size=1 IMA-ADPCM
+        size = INT_MAX;
+    else if (ast->sample_size < 32)
+        size = 64 * ast->sample_size;
+    else
+        size = ast->sample_size;
+
+    if (size > ast->remaining)
+        size = ast->remaining;
+    return size;
+}
+
+// 计算包的关键帧标志。
+static int avi_packet_flags(AVStream *st, AVIStream *ast, int64_t dts) {
+    if (st->actx->codec_type == CODEC_TYPE_VIDEO) {
+        if (st->nb_index_entries) {
+            AVIndexEntry e;
+            int index;
+
+            index = av_index_search_timestamp(st, dts, 0);
+
+            if (av_index_get_entry(st, index, &e) >= 0 &&
+                e.timestamp == ast->frame_offset) {
+                if (e.flags & AVINDEX_KEYFRAME)
+                    return PKT_FLAG_KEY;
+            }
+            return 0;
+        }
+        return PKT_FLAG_KEY; // if no index, better to say that all frames
+                             // are key frames
+    }
+    return PKT_FLAG_KEY;
+}
+
+// 按不调度时的规则规划下一个包，只更新流的读状态，不读数据。
+// 没有可以按索引读的包时返回-1。
+static int avi_sched_plan(AVFormatContext *s, AVISchedEntry *e) {
+    AVIContext *avi = s->priv_data;
+    AVStream *st;
+    AVIStream *ast;
+    AVIndexEntry ie;
+    int n, i, size;
+
+    i = avi_ni_next_index(s, &n);
+    if (i < 0)
+        return -1;
+    st = s->streams[n];
+    ast = st->priv_data;
+
+    av_index_get_entry(st, i, &ie);
+    e->pos = ie.pos + 8 + ast->packet_size - ast->remaining;
+    if (!ast->remaining)
+        ast->packet_size = ast->remaining = ie.size;
+    size = avi_read_size(ast);
+
+    e->size = size;
+    e->stream_index = n;
+    e->dts = ast->frame_offset;
+    if (ast->sample_size)
+        e->dts /= ast->sample_size;
+    e->flags = avi_packet_flags(st, ast, e->dts);
+
+    if (ast->sample_size)
+        ast->frame_offset += size;
+    else
+        ast->frame_offset++;
+
+    ast->remaining -= size;
+    if (!ast->remaining) {
+        ast->packet_size = 0;
+        size += size & 1;
+    }
+    avi->ni_end = e->pos + size;
+    return 0;
+}
+
+static int avi_sched_cmp(const void *a, const void *b) {
+    const AVISchedEntry *e1 = *(const AVISchedEntry **)a;
+    const AVISchedEntry *e2 = *(const AVISchedEntry **)b;
+
+    if (e1->pos != e2->pos)
+        return e1->pos < e2->pos ? -1 : 1;
+    return 0;
+}
+
+// 规划一个窗口的包，按文件位置排序，相距不远的包合并成一段连续读取，
+// 并提示底层协议提前读整段数据。
+static void avi_sched_fill(AVFormatContext *s) {
+    AVIContext *avi = s->priv_data;
+    ByteIOContext *pb = &s->pb;
+    AVISchedEntry *e;
+    offset_t start, end;
+    int n, k, j;
+
+    for (n = 0; n < avi->sched_size; n++) {
+        if (avi_sched_plan(s, &avi->sched[n]) < 0)
+            break;
+        avi->sched_order[n] = &avi->sched[n];
+    }
+    qsort(avi->sched_order, n, sizeof(AVISchedEntry *), avi_sched_cmp);
+
+    for (k = 0; k < n; k = j) {
+        start = avi->sched_order[k]->pos;
+        end = start + avi->sched_order[k]->size;
+        for (j = k + 1; j < n; j++) {
+            e = avi->sched_order[j];
+            if (e->pos - end > AVI_SCHED_MAX_GAP ||
+                e->pos + e->size - start > AVI_SCHED_MAX_SPAN)
+                break;
+            end = FFMAX(end, e->pos + e->size);
+        }
+        url_fprefetch(avi_stream_pb(s, avi->sched_order[k]->stream_index),
+                      start, (int)(end - start));
+
+        // 段内按文件位置顺序读，包之间的小间隔在缓存内跳过。
+        for (; k < j; k++) {
+            e = avi->sched_order[k];
+            pb = avi_stream_pb(s, e->stream_index);
+            url_fseek(pb, e->pos, SEEK_SET);
+            e->ret = av_get_packet(pb, &e->pkt, e->size);
+            // 读失败时包已经释放或者根本没有分配，清空后交出和释放都不会
+            // 再碰到原来的数据
+            if (e->ret <= 0)
+                memset(&e->pkt, 0, sizeof(e->pkt));
+        }
+    }
+
+    avi->sched_count = n;
+    avi->sched_next = 0;
+}
+
+// 从调度窗口按时间顺序交出一个包，返回包的大小。窗口为空时返回-1，
+// 包没有读到时返回AVERROR_IO，后面的包仍然可以接着读。
+static int avi_sched_read_packet(AVFormatContext *s, AVPacket *pkt) {
+    AVIContext *avi = s->priv_data;
+    AVISchedEntry *e;
+
+    if (avi->sched_next == avi->sched_count)
+        avi_sched_fill(s);
+    if (avi->sched_next == avi->sched_count)
+        return -1;
+
+    e = &avi->sched[avi->sched_next++];
+    if (e->ret <= 0)
+        return AVERROR_IO;
+    *pkt = e->pkt;
+    pkt->dts = e->dts;
+    pkt->stream_index = e->stream_index;
+    pkt->flags |= e->flags;
+    return e->ret;
+}
+
 // avi文件可以简单认为音视频媒体数据时间基相同，因此音视频数据需要同步读取，同步解码，播放才能同步。
 // 交织存储的avi文件，临近存储的音视频帧解码时间表示时间相近，微小的解码时间表示时间差别可以用帧缓存队列抵消，所以可以简单的按照文件顺序读取媒体数据。
 // 非交织存储的avi文件，视频和音频这两种媒体数据相隔甚远，小缓存简单的顺序读文件时，不能同时读到音频和视频数据，最后导致不同步，ffplay采取按最近时间点来决定读音频还是视频数据。
 int avi_read_packet(AVFormatContext *s, AVPacket *pkt) {
     AVIContext *avi = s->priv_data;
     ByteIOContext *pb = &s->pb;
+    ByteIOContext *rpb = pb; // 读包数据使用的I/O 上下文
     int n, d[8], size;
     offset_t i, sync;
 
+    if (avi->sched) {
+        size = avi_sched_read_packet(s, pkt);
+        if (size >= 0 || size == AVERROR_IO)
+            return size;
+        // 索引读完，回到不调度时应在的文件位置，按原来的方式继续。
+        // 只回去一次，之后pb 读到哪里就从哪里接着找，ni_end 不再跟着变。
+        if (!avi->ni_index_done) {
+            url_fseek(pb, avi->ni_end, SEEK_SET);
+            avi->ni_index_done = 1;
+        }
+    }
+
     if (avi->non_interleaved) {
         // 如果是非交织AVI，用最近时间点来决定读取视频还是音频数据。
-        int best_stream_index = 0;
-        AVStream *best_st = NULL;
-        AVIStream *best_ast;
-        int64_t best_ts = INT64_MAX;
-        int i;
-
-        for (i = 0; i < s->nb_streams; i++) {
-            // 遍历所有媒体流，按照已经播放的流数据，计算下一个最近的时间点。
-            AVStream *st = s->streams[i];
-            AVIStream *ast = st->priv_data;
-            int64_t ts = ast->frame_offset;
-
-            // 把帧偏移换算成帧数。
-            if (ast->sample_size)
-                ts /= ast->sample_size;
-            // 把帧数换算成pts表示时间。
-            ts = av_rescale(ts, AV_TIME_BASE * (int64_t)st->time_base.num,
-                            st->time_base.den);
-            // 取最小的时间点对应的时间，流指针，流索引作为要读取的最佳(读取)流参数。
-            if (ts < best_ts) {
-                // 每次读取时间点(ast->frame_offset)最近的包
-                best_ts = ts;
-                best_st = st;
-                best_stream_index = i;
-            }
-        }
-        best_ast = best_st->priv_data;
-        // 换算最小的时间点，查找索引表取出对应的索引。
-        // 在缓存足够大，一次性完整读取帧数据时，此时best_ast->remaining
-        // 参数为0。
-        best_ts = av_rescale(best_ts, best_st->time_base.den,
-                             AV_TIME_BASE * (int64_t)best_st->time_base.num);
-        if (best_ast->remaining)
-            i = av_index_search_timestamp(
-                best_st, best_ts, AVSEEK_FLAG_ANY | AVSEEK_FLAG_BACKWARD);
-        else
-            i = av_index_search_timestamp(best_st, best_ts, AVSEEK_FLAG_ANY);
+        int best_stream_index;
 
+        i = avi_ni_next_index(s, &best_stream_index);
         if (i >= 0) {
-            int64_t pos = best_st->index_entries[i].pos;
-            pos += best_ast->packet_size - best_ast->remaining;
-            url_fseek(&s->pb, pos + 8, SEEK_SET);
+            AVStream *best_st = s->streams[best_stream_index];
+            AVIStream *best_ast = best_st->priv_data;
+            AVIndexEntry e;
+            int64_t pos;
+
+            av_index_get_entry(best_st, i, &e);
+            pos = e.pos + best_ast->packet_size - best_ast->remaining;
+            rpb = avi_stream_pb(s, best_stream_index);
+            url_fseek(rpb, pos + 8, SEEK_SET);
 
             assert(best_ast->remaining <= best_ast->packet_size);
 
             avi->stream_index_2 = best_stream_index;
             if (!best_ast->remaining)
-                best_ast->packet_size = best_ast->remaining =
-                    best_st->index_entries[i].size;
+                best_ast->packet_size = best_ast->remaining = e.size;
+        } else if (avi->stream_io && !avi->ni_index_done) {
+            // 包都从各流的I/O 上下文读，pb 不在顺序读时应在的位置，回去一次
+            url_fseek(pb, avi->ni_end, SEEK_SET);
+            avi->ni_index_done = 1;
         }
     }
 
@@ -485,18 +838,9 @@ resync:
         AVIStream *ast = st->priv_data;
         int size;
 
-        if (ast->sample_size <=
-            1) // minorityreport.AVI block_align=1024 sample_size=1 IMA-ADPCM
-            size = INT_MAX;
-        else if (ast->sample_size < 32)
-            size = 64 * ast->sample_size;
-        else
-            size = ast->sample_size;
-
-        if (size > ast->remaining)
-            size = ast->remaining;
+        size = avi_read_size(ast);
 
-        av_get_packet(pb, pkt, size);
+        av_get_packet(rpb, pkt, size);
 
         pkt->dts = ast->frame_offset;
 
@@ -505,25 +849,7 @@ resync:
 
         pkt->stream_index = avi->stream_index_2;
 
-        if (st->actx->codec_type == CODEC_TYPE_VIDEO) {
-            if (st->index_entries) {
-                AVIndexEntry *e;
-                int index;
-
-                index = av_index_search_timestamp(st, pkt->dts, 0);
-                e = &st->index_entries[index];
-
-                if (index >= 0 && e->timestamp == ast->frame_offset) {
-                    if (e->flags & AVINDEX_KEYFRAME)
-                        pkt->flags |= PKT_FLAG_KEY;
-                }
-            } else {
-                pkt->flags |= PKT_FLAG_KEY; // if no index, better to say that
-                                            // all frames are key frames
-            }
-        } else {
-            pkt->flags |= PKT_FLAG_KEY;
-        }
+        pkt->flags |= avi_packet_flags(st, ast, pkt->dts);
 
         if (ast->sample_size)
             ast->frame_offset += pkt->size;
@@ -535,10 +861,12 @@ resync:
             avi->stream_index_2 = -1;
             ast->packet_size = 0;
             if (size & 1) {
-                get_byte(pb);
+                get_byte(rpb);
                 size++;
             }
         }
+        if (rpb != pb)
+            avi->ni_end = url_ftell(rpb);
 
         return size;
     }
@@ -550,6 +878,29 @@ resync:
         if (i >= avi->movi_end)
             break;
 
+        // 窗口中等待检查的字节都不可能是块头开始时，直接在缓存中找下一个
+        // 可能的块头，中间的字节不可能组成块头，整段跳过，不再逐字节get_byte()。
+        // 跳过后窗口清为-1，块头的判断仍然在下面逐字节进行。
+        if (pb->buf_ptr < pb->buf_end) {
+            for (j = 1; j < 8; j++) {
+                if (d[j] >= 0 && (avi_chunk_class[d[j]] & CHUNK_START))
+                    break;
+            }
+            if (j == 8) {
+                offset_t skip = avi_find_chunk(pb->buf_ptr, pb->buf_end) - pb->buf_ptr;
+
+                if (skip > avi->movi_end - i)
+                    skip = avi->movi_end - i;
+                if (skip > 0) {
+                    pb->buf_ptr += skip;
+                    i += skip;
+                    memset(d, -1, sizeof(int) * 8);
+                    if (i >= avi->movi_end)
+                        break;
+                }
+            }
+        }
+
         for (j = 0; j < 7; j++)
             d[j] = d[j + 1];
 
@@ -641,49 +992,64 @@ resync:
 static int avi_read_idx1(AVFormatContext *s, int size) {
     AVIContext *avi = s->priv_data;
     ByteIOContext *pb = &s->pb;
-    int nb_index_entries, i;
+    int nb_index_entries, i, n, k;
     AVStream *st;
     AVIStream *ast;
     unsigned int index, tag, flags, pos, len;
     unsigned last_pos = -1;
+    uint8_t *buf, *e;
 
     nb_index_entries = size / 16;
     if (nb_index_entries <= 0)
         return -1;
 
+    // 索引一次读入一大块再逐项解析，不再每个字段调用四次get_byte()。
+    buf = av_malloc(FFMIN(nb_index_entries, IDX1_BLOCK_ENTRIES) * 16);
+    if (!buf)
+        return -1;
+
     for (i = 0; i < nb_index_entries;
-         i++) // read the entries and sort them in each stream component
+         i += n) // read the entries and sort them in each stream component
     {
-        tag = get_le32(pb);
-        flags = get_le32(pb);
-        pos = get_le32(pb);
-        len = get_le32(pb);
+        n = FFMIN(nb_index_entries - i, IDX1_BLOCK_ENTRIES);
+        n = url_fread(pb, buf, n * 16) / 16;
+        if (n <= 0)
+            break;
 
-        if (i == 0 && pos > avi->movi_list)
-            avi->movi_list = 0;
+        for (k = 0, e = buf; k < n; k++, e += 16) {
+            tag = LE_32(e);
+            flags = LE_32(e + 4);
+            pos = LE_32(e + 8);
+            len = LE_32(e + 12);
 
-        pos += avi->movi_list;
+            if (i + k == 0 && pos > avi->movi_list)
+                avi->movi_list = 0;
 
-        index = ((tag & 0xff) - '0') * 10;
-        index += ((tag >> 8) & 0xff) - '0';
-        if (index >= s->nb_streams)
-            continue;
+            pos += avi->movi_list;
 
-        st = s->streams[index];
-        ast = st->priv_data;
+            index = ((tag & 0xff) - '0') * 10;
+            index += ((tag >> 8) & 0xff) - '0';
+            if (index >= s->nb_streams)
+                continue;
 
-        if (last_pos == pos)
-            avi->non_interleaved = 1;
-        else
-            av_add_index_entry(st, pos, ast->cum_len, len, 0,
-                               (flags & AVIIF_INDEX) ? AVINDEX_KEYFRAME : 0);
+            st = s->streams[index];
+            ast = st->priv_data;
 
-        if (ast->sample_size)
-            ast->cum_len += len / ast->sample_size;
-        else
-            ast->cum_len++;
-        last_pos = pos;
+            // 同一个流的索引项按时间递增，av_add_index_entry() 走追加的快速路径。
+            if (last_pos == pos)
+                avi->non_interleaved = 1;
+            else
+                av_add_index_entry(st, pos, ast->cum_len, len, 0,
+                                   (flags & AVIIF_INDEX) ? AVINDEX_KEYFRAME : 0);
+
+            if (ast->sample_size)
+                ast->cum_len += len / ast->sample_size;
+            else
+                ast->cum_len++;
+            last_pos = pos;
+        }
     }
+    av_free(buf);
     return 0;
 }
 
@@ -695,15 +1061,18 @@ static int guess_ni_flag(AVFormatContext *s) {
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *st = s->streams[i];
         int n = st->nb_index_entries;
+        AVIndexEntry e;
 
         if (n <= 0)
             continue;
 
-        if (st->index_entries[0].pos > last_start)
-            last_start = st->index_entries[0].pos;
+        av_index_get_entry(st, 0, &e);
+        if (e.pos > last_start)
+            last_start = e.pos;
 
-        if (st->index_entries[n - 1].pos < first_end)
-            first_end = st->index_entries[n - 1].pos;
+        av_index_get_entry(st, n - 1, &e);
+        if (e.pos < first_end)
+            first_end = e.pos;
     }
     return last_start > first_end;
 }
@@ -741,13 +1110,458 @@ the_end:
     return 0;
 }
 
+// 检查pos 处是否是有效的块头，是时返回下一块的位置，并通过stream 和size
+// 返回所属的流(不进索引的块为-1)和数据大小，否则返回-1。
+// 只认##dc/##db/##wb/##pc、ix##、JUNK、LIST 几种块，LIST rec 进入子块。
+static int64_t avi_scan_chunk(const AVIScanRange *r, int64_t pos, int *stream,
+                              uint32_t *size) {
+    const uint8_t *p = r->data + pos;
+    int n;
+
+    if (pos + 8 > r->limit)
+        return -1;
+    *size = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+    *stream = -1;
+    if (p[0] == 'L' && p[1] == 'I' && p[2] == 'S' && p[3] == 'T') {
+        if (pos + 12 <= r->limit && p[8] == 'r' && p[9] == 'e' && p[10] == 'c' &&
+            p[11] == ' ')
+            return pos + 12;
+    } else if (p[0] == 'J' && p[1] == 'U' && p[2] == 'N' && p[3] == 'K') {
+    } else if (p[0] == 'i' && p[1] == 'x') {
+        if (p[2] < '0' || p[2] > '9' || p[3] < '0' || p[3] > '9' ||
+            (p[2] - '0') * 10 + (p[3] - '0') >= r->nb_streams)
+            return -1;
+    } else {
+        if (p[0] < '0' || p[0] > '9' || p[1] < '0' || p[1] > '9')
+            return -1;
+        n = (p[0] - '0') * 10 + (p[1] - '0');
+        if (n >= r->nb_streams)
+            return -1;
+        if ((p[2] == 'd' && (p[3] == 'c' || p[3] == 'b')) ||
+            (p[2] == 'w' && p[3] == 'b'))
+            *stream = n;
+        else if (p[2] != 'p' || p[3] != 'c')
+            return -1;
+    }
+    if (*size > r->limit - pos - 8)
+        return -1;
+    return pos + 8 + *size + (*size & 1);
+}
+
+// 从pos 开始沿着块链扫描，把块头在[pos, r->end) 中的块记到r 中，遇到无效的块头
+// 时逐字节向后找下一个有效的块头，返回扫描停下的位置。结果只取决于pos，
+// 从不同位置开始的两次扫描一旦经过同一个块，以后就完全相同。
+// ref 非NULL 时，扫到ref 中已有的块就停下，通过ref_index 返回它在ref 中的序号。
+static int64_t avi_scan(AVIScanRange *r, int64_t pos, const AVIScanRange *ref,
+                        int *ref_index) {
+    const uint8_t *q;
+    int64_t next;
+    uint32_t size;
+    int stream, k = 0;
+
+    while (pos < r->end) {
+        next = avi_scan_chunk(r, pos, &stream, &size);
+        if (next < 0) {
+            // 块头的前两个字节都不可能出现时，用avi_find_chunk() 整段跳过。
+            // LIST 块只能沿着块链找到，重新同步时不找。
+            for (q = r->data + pos + 1;; q++) {
+                q = avi_find_chunk(q, r->data + r->end);
+                if (q == r->data + r->end ||
+                    avi_scan_chunk(r, q - r->data, &stream, &size) >= 0)
+                    break;
+            }
+            pos = q - r->data;
+            continue;
+        }
+        if (ref) {
+            while (k < ref->nb_chunks && ref->chunks[k].pos < pos)
+                k++;
+            if (k < ref->nb_chunks && ref->chunks[k].pos == pos) {
+                *ref_index = k;
+                return pos;
+            }
+        }
+        if (r->nb_chunks >= r->chunks_allocated) {
+            int n = r->chunks_allocated ? 2 * r->chunks_allocated : 1024;
+            AVIScanChunk *chunks;
+
+            if (n > INT_MAX / (int)sizeof(AVIScanChunk) ||
+                !(chunks = av_realloc(r->chunks, n * sizeof(AVIScanChunk)))) {
+                r->error = 1;
+                return r->end;
+            }
+            r->chunks = chunks;
+            r->chunks_allocated = n;
+        }
+        r->chunks[r->nb_chunks].pos = pos;
+        r->chunks[r->nb_chunks].size = size;
+        r->chunks[r->nb_chunks].stream = stream;
+        r->nb_chunks++;
+        pos = next;
+    }
+    if (ref_index)
+        *ref_index = -1;
+    return pos;
+}
+
+static void *avi_scan_thread(void *arg) {
+    AVIScanRange *r = arg;
+
+    r->next = avi_scan(r, r->start, NULL, NULL);
+    return NULL;
+}
+
+static void avi_add_scan_index(AVFormatContext *s, const AVIScanRange *r,
+                               int first) {
+    int i, flags;
+
+    for (i = first; i < r->nb_chunks; i++) {
+        const AVIScanChunk *c = &r->chunks[i];
+        AVStream *st;
+        AVIStream *ast;
+
+        if (c->stream < 0)
+            continue;
+        st = s->streams[c->stream];
+        ast = st->priv_data;
+        // 没有idx1 就不知道视频的哪些块是关键帧。MSRLE 等的后续帧常常只画
+        // 变化的部分，从这些帧开始seek 或者并行解码都会出错，所以只把视频流
+        // 的第一块当作关键帧，其他流的块都是关键帧。
+        flags = AVINDEX_KEYFRAME;
+        if (st->actx->codec_type == CODEC_TYPE_VIDEO && st->nb_index_entries)
+            flags = 0;
+        av_add_index_entry(st, c->pos, ast->cum_len, c->size, 0, flags);
+        if (ast->sample_size)
+            ast->cum_len += c->size / ast->sample_size;
+        else
+            ast->cum_len++;
+    }
+}
+
+// 没有idx1 时把movi 映射到内存，分成nb_threads 段，各段在独立的线程中沿块链
+// 扫描，再从movi 开始把各段首尾接起来，结果和从头顺序扫描完全相同：前一段停下
+// 的位置如果是后一段扫到的块，后一段从这块开始的结果可以直接用，否则从这个
+// 位置重新扫描后一段，直到和后一段扫到的块会合。文件不能映射时返回-1。
+static int avi_build_index(AVFormatContext *s, int nb_threads) {
+    AVIContext *avi = s->priv_data;
+    AVFileMapping *map = s->pb.mapping;
+    AVIScanRange *ranges, tmp;
+    int64_t start = avi->movi_list + 4, limit, pos;
+    int i, j, nb_ranges, ret = -1;
+
+    if (map)
+        av_file_mapping_ref(map);
+    else if (av_file_map(url_local_path(s->filename), &map) < 0)
+        return -1;
+    // 中断的录制文件movi 的大小常常不对，以文件实际大小为准。
+    limit = FFMIN(avi->movi_end, map->size);
+    if (start >= limit) {
+        av_file_mapping_unref(map);
+        return -1;
+    }
+
+    nb_ranges = (int)FFMIN(nb_threads, (limit - start) / AVI_SCAN_MIN_RANGE);
+    nb_ranges = FFMAX(nb_ranges, 1);
+    ranges = av_mallocz(nb_ranges * sizeof(AVIScanRange));
+    if (!ranges) {
+        av_file_mapping_unref(map);
+        return -1;
+    }
+    for (i = 0; i < nb_ranges; i++) {
+        ranges[i].data = map->data;
+        ranges[i].start = start + (limit - start) * i / nb_ranges;
+        ranges[i].end = start + (limit - start) * (i + 1) / nb_ranges;
+        ranges[i].limit = limit;
+        ranges[i].nb_streams = s->nb_streams;
+    }
+
+    // 最后一段在当前线程中扫描，创建线程失败的段也在当前线程中扫描。
+    for (i = 0; i < nb_ranges - 1; i++) {
+        if (av_thread_create(&ranges[i].thread, avi_scan_thread, &ranges[i]) < 0)
+            ranges[i].error = -1; // 标记没有线程，不用等待
+    }
+    avi_scan_thread(&ranges[nb_ranges - 1]);
+    for (i = 0; i < nb_ranges - 1; i++) {
+        if (ranges[i].error < 0) {
+            ranges[i].error = 0;
+            avi_scan_thread(&ranges[i]);
+        } else {
+            av_thread_join(&ranges[i].thread);
+        }
+    }
+    for (i = 0; i < nb_ranges; i++) {
+        if (ranges[i].error)
+            goto fail;
+    }
+
+    pos = start;
+    for (i = 0; i < nb_ranges; i++) {
+        AVIScanRange *r = &ranges[i];
+
+        if (pos >= r->end)
+            continue;
+        j = 0;
+        if (pos > r->start) {
+            tmp = *r;
+            tmp.chunks = NULL;
+            tmp.nb_chunks = tmp.chunks_allocated = 0;
+            pos = avi_scan(&tmp, pos, r, &j);
+            avi_add_scan_index(s, &tmp, 0);
+            av_free(tmp.chunks);
+            if (tmp.error)
+                goto fail;
+            if (j < 0)
+                continue;
+        }
+        avi_add_scan_index(s, r, j);
+        pos = r->next;
+    }
+    ret = 0;
+
+fail:
+    for (i = 0; i < nb_ranges; i++)
+        av_free(ranges[i].chunks);
+    av_free(ranges);
+    av_file_mapping_unref(map);
+    if (ret < 0) {
+        for (i = 0; i < s->nb_streams; i++) {
+            AVIStream *ast = s->streams[i]->priv_data;
+
+            av_index_free(s->streams[i]);
+            ast->cum_len = 0;
+        }
+    }
+    return ret;
+}
+
+// 把avi_read_header() 的结果写到索引缓存：AVIContext 中的文件布局，每个流
+// 的编解码参数、AVIStream 的时间参数和索引。
+static int avi_write_cache(AVFormatContext *s, ByteIOContext *pb) {
+    AVIContext *avi = s->priv_data;
+    int i;
+
+    put_le64(pb, avi->riff_end);
+    put_le64(pb, avi->movi_list);
+    put_le64(pb, avi->movi_end);
+    put_le32(pb, avi->non_interleaved);
+    put_le32(pb, s->nb_streams);
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st = s->streams[i];
+        AVIStream *ast = st->priv_data;
+        AVCodecContext *actx = st->actx;
+
+        put_le32(pb, actx->codec_type);
+        put_le32(pb, actx->codec_id);
+        put_le32(pb, actx->bit_rate);
+        put_le32(pb, actx->width);
+        put_le32(pb, actx->height);
+        put_le32(pb, actx->bits_per_sample);
+        put_le32(pb, actx->channels);
+        put_le32(pb, actx->sample_rate);
+        put_le32(pb, actx->block_align);
+        put_le32(pb, actx->extradata_size);
+        put_buffer(pb, actx->extradata, actx->extradata_size);
+
+        put_le32(pb, ast->scale);
+        put_le32(pb, ast->rate);
+        put_le32(pb, ast->sample_size);
+        put_le64(pb, ast->frame_offset);
+        put_le64(pb, ast->cum_len);
+
+        av_index_write(st, pb);
+    }
+    return 0;
+}
+
+// 从索引缓存恢复avi_read_header() 的结果，数据不完整或者不合理时返回-1。
+static int avi_read_cache(AVFormatContext *s, ByteIOContext *cache,
+                          AVFormatParameters *ap) {
+    AVIContext *avi = s->priv_data;
+    int i, n;
+
+    avi->stream_index_2 = -1;
+    avi->riff_end = get_le64(cache);
+    avi->movi_list = get_le64(cache);
+    avi->movi_end = get_le64(cache);
+    avi->non_interleaved = get_le32(cache);
+    n = get_le32(cache);
+    if (n <= 0 || n > MAX_STREAMS)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        AVStream *st = av_new_stream(s, i);
+        AVIStream *ast;
+        AVCodecContext *actx;
+
+        if (!st)
+            return -1;
+        ast = av_mallocz(sizeof(AVIStream));
+        if (!ast)
+            return -1;
+        st->priv_data = ast;
+        actx = st->actx;
+
+        actx->codec_type = get_le32(cache);
+        actx->codec_id = get_le32(cache);
+        actx->bit_rate = get_le32(cache);
+        actx->width = get_le32(cache);
+        actx->height = get_le32(cache);
+        actx->bits_per_sample = get_le32(cache);
+        actx->channels = get_le32(cache);
+        actx->sample_rate = get_le32(cache);
+        actx->block_align = get_le32(cache);
+        actx->extradata_size = get_le32(cache);
+        if (actx->extradata_size < 0 || actx->extradata_size >= (1 << 30)) {
+            actx->extradata_size = 0;
+            return -1;
+        }
+        if (actx->extradata_size) {
+            actx->extradata =
+                av_mallocz(actx->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+            if (!actx->extradata ||
+                url_fread(cache, actx->extradata, actx->extradata_size) !=
+                    actx->extradata_size)
+                return -1;
+        }
+        // 和avi_read_header() 一样从extradata 取调色板。
+        if (actx->codec_type == CODEC_TYPE_VIDEO && actx->extradata_size &&
+            actx->bits_per_sample <= 8) {
+            actx->palctrl = av_mallocz(sizeof(AVPaletteControl));
+            if (!actx->palctrl)
+                return -1;
+            memcpy(actx->palctrl->palette, actx->extradata,
+                   FFMIN(actx->extradata_size, AVPALETTE_SIZE));
+            actx->palctrl->palette_changed = 1;
+        }
+
+        ast->scale = get_le32(cache);
+        ast->rate = get_le32(cache);
+        ast->sample_size = get_le32(cache);
+        ast->frame_offset = get_le64(cache);
+        ast->cum_len = get_le64(cache);
+        if (!ast->scale || !ast->rate)
+            return -1;
+        av_set_pts_info(st, 64, ast->scale, ast->rate);
+        if (actx->codec_type == CODEC_TYPE_VIDEO)
+            st->frame_last_delay = 1.0 * ast->scale / ast->rate;
+
+        if (av_index_read(st, cache) < 0)
+            return -1;
+    }
+    if (url_feof(cache))
+        return -1;
+
+    // 回到文件头解析完时的位置，即movi 标签之后。
+    url_fseek(&s->pb, avi->movi_list + 4, SEEK_SET);
+    if (avi->non_interleaved)
+        avi_setup_ni(s, ap);
+    return 0;
+}
+
+// 返回流的索引中第一个位置不小于pos 的项的序号，都小于pos 时返回最后一项，
+// 没有索引时返回-1。同一个流的块在文件中按时间顺序存放，位置是递增的。
+static int avi_index_search_pos(AVStream *st, int64_t pos) {
+    int a = 0, b = st->nb_index_entries - 1, m;
+    AVIndexEntry e;
+
+    if (b < 0)
+        return -1;
+    while (a < b) {
+        m = (a + b) >> 1;
+        av_index_get_entry(st, m, &e);
+        if (e.pos < pos)
+            a = m + 1;
+        else
+            b = m;
+    }
+    return a;
+}
+
+// 按索引seek：在stream_index 流中找到timestamp 对应的帧，其他流找同一时间的块，
+// 交织文件从这一帧的位置顺序读，其他流从这个位置之后的第一块开始。
+// 重置各个流的读状态和调度窗口，文件位置移到这一帧的块头。
+static int avi_read_seek(AVFormatContext *s, int stream_index, int64_t timestamp,
+                         int flags) {
+    AVIContext *avi = s->priv_data;
+    AVStream *st = s->streams[stream_index];
+    AVIndexEntry e;
+    int i, index, n;
+    int64_t pos;
+
+    if (flags & AVSEEK_FLAG_BYTE) {
+        // 按文件位置seek 时先换成这个位置的块的时间。
+        index = avi_index_search_pos(st, timestamp);
+        if (index < 0 || av_index_get_entry(st, index, &e) < 0)
+            return -1;
+        timestamp = e.timestamp;
+        flags &= ~AVSEEK_FLAG_BYTE;
+    }
+    index = av_index_search_timestamp(st, timestamp, flags);
+    if (index < 0 || av_index_get_entry(st, index, &e) < 0)
+        return -1;
+    pos = e.pos;
+    timestamp = e.timestamp;
+
+    // 丢弃调度窗口中还没有交出的包，下次读包时从新的位置重新规划。
+    for (i = avi->sched_next; i < avi->sched_count; i++)
+        av_free_packet(&avi->sched[i].pkt);
+    avi->sched_next = avi->sched_count = 0;
+
+    for (i = 0; i < s->nb_streams; i++) {
+        AVStream *st2 = s->streams[i];
+        AVIStream *ast2 = st2->priv_data;
+
+        ast2->packet_size = ast2->remaining = 0;
+        n = st2->nb_index_entries;
+        if (n <= 0)
+            continue;
+
+        index = av_index_search_timestamp(
+            st2,
+            av_rescale(timestamp, st2->time_base.den * (int64_t)st->time_base.num,
+                       st->time_base.den * (int64_t)st2->time_base.num),
+            flags | AVSEEK_FLAG_BACKWARD);
+        if (index < 0)
+            index = 0;
+        av_index_get_entry(st2, index, &e);
+
+        if (!avi->non_interleaved) {
+            while (index > 0 && e.pos > pos)
+                av_index_get_entry(st2, --index, &e);
+            while (index + 1 < n && e.pos < pos)
+                av_index_get_entry(st2, ++index, &e);
+        }
+
+        ast2->frame_offset = e.timestamp;
+        if (ast2->sample_size)
+            ast2->frame_offset *= ast2->sample_size;
+    }
+
+    url_fseek(&s->pb, pos, SEEK_SET);
+    avi->ni_end = pos;
+    avi->ni_index_done = 0;
+    avi->stream_index_2 = -1;
+    return 0;
+}
+
 static int avi_read_close(AVFormatContext *s) {
     int i;
     AVIContext *avi = s->priv_data;
 
+    // 释放调度窗口中还没有交出的包。
+    for (i = avi->sched_next; i < avi->sched_count; i++)
+        av_free_packet(&avi->sched[i].pkt);
+    av_freep(&avi->sched);
+    av_freep(&avi->sched_order);
+
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *st = s->streams[i];
         AVIStream *ast = st->priv_data;
+        if (ast && ast->pb) {
+            url_fclose(ast->pb);
+            av_free(ast->pb);
+        }
         av_free(ast);
         av_free(st->actx->extradata);
         av_free(st->actx->palctrl);
@@ -770,9 +1584,25 @@ static int avi_probe(AVProbeData *p) {
 AVInputFormat avi_iformat = {
     "avi",           sizeof(AVIContext), avi_probe,
     avi_read_header, avi_read_packet,    avi_read_close,
+    avi_read_seek,   avi_read_cache,     avi_write_cache,
 };
 
 int avidec_init(void) {
+    int c, flags = av_get_cpu_flags();
+
+    for (c = '0'; c <= '9'; c++)
+        avi_chunk_class[c] = CHUNK_START | CHUNK_NEXT;
+    avi_chunk_class['i'] = avi_chunk_class['J'] = CHUNK_START;
+    avi_chunk_class['x'] = avi_chunk_class['U'] = CHUNK_NEXT;
+
+    avi_find_chunk = ff_avi_find_chunk_c;
+#ifdef ARCH_X86
+    if (flags & AV_CPU_FLAG_SSE2)
+        avi_find_chunk = ff_avi_find_chunk_sse2;
+    if (flags & AV_CPU_FLAG_AVX2)
+        avi_find_chunk = ff_avi_find_chunk_avx2;
+#endif
+
     av_register_input_format(&avi_iformat);
     return 0;
 }
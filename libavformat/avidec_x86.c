@@ -0,0 +1,84 @@
+#include "avformat.h"
+#include "../libavutil/cpu.h"
+
+// avi_read_packet() 重新同步时查找块头的SSE2/AVX2 实现，功能和avidec.c 中的
+// ff_avi_find_chunk_c() 完全相同：返回[p, end) 中第一个首字节是数字、'i' 或'J'，
+// 并且下一个字节是数字、'x' 或'U' 的位置(最后一个字节只检查首字节)，
+// 没有时返回end。一次比较16/32 个字节。
+
+#ifdef ARCH_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+
+const uint8_t *ff_avi_find_chunk_c(const uint8_t *p, const uint8_t *end);
+
+// 返回最低的置1 位的序号，mask 非0。
+static inline int avi_ctz(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, mask);
+    return (int)i;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// 字节是数字或者等于c1、c2 时对应字节置0xFF。
+// 减'0' 后按有符号数比较，非数字字符都落在[0, 9] 之外。
+static inline AV_TARGET_SSE2 __m128i avi_in_set_sse2(__m128i v, char c1,
+                                                      char c2) {
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(-1)),
+                                  _mm_cmplt_epi8(x, _mm_set1_epi8(10)));
+
+    return _mm_or_si128(digit,
+                        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(c1)),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8(c2))));
+}
+
+AV_TARGET_SSE2 const uint8_t *ff_avi_find_chunk_sse2(const uint8_t *p,
+                                                      const uint8_t *end) {
+    __m128i v, w;
+    int mask;
+
+    // 每次比较p[0..15] 和p[1..16]，要求p[16] 有效。
+    while (end - p > 16) {
+        v = _mm_loadu_si128((const __m128i *)p);
+        w = _mm_loadu_si128((const __m128i *)(p + 1));
+        mask = _mm_movemask_epi8(_mm_and_si128(avi_in_set_sse2(v, 'i', 'J'),
+                                               avi_in_set_sse2(w, 'x', 'U')));
+        if (mask)
+            return p + avi_ctz(mask);
+        p += 16;
+    }
+    return ff_avi_find_chunk_c(p, end);
+}
+
+static inline AV_TARGET_AVX2 __m256i avi_in_set_avx2(__m256i v, char c1,
+                                                      char c2) {
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i digit = _mm256_andnot_si256(_mm256_cmpgt_epi8(_mm256_setzero_si256(), x),
+                                        _mm256_cmpgt_epi8(_mm256_set1_epi8(10), x));
+
+    return _mm256_or_si256(
+        digit, _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c1)),
+                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c2))));
+}
+
+AV_TARGET_AVX2 const uint8_t *ff_avi_find_chunk_avx2(const uint8_t *p,
+                                                      const uint8_t *end) {
+    __m256i v, w;
+    unsigned mask;
+
+    while (end - p > 32) {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        w = _mm256_loadu_si256((const __m256i *)(p + 1));
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+            avi_in_set_avx2(v, 'i', 'J'), avi_in_set_avx2(w, 'x', 'U')));
+        if (mask)
+            return p + avi_ctz(mask);
+        p += 32;
+    }
+    return ff_avi_find_chunk_sse2(p, end);
+}
+#endif
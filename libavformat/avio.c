@@ -78,6 +78,21 @@ fail:
     *puc = NULL;
     return err;
 }
+// 返回文件名去掉协议前缀后的本地路径，前缀的判断和url_open() 相同，
+// 一个字母的前缀是盘符，不去掉。
+const char *url_local_path(const char *filename) {
+    const char *p = filename;
+
+    while (*p != '\0' && *p != ':') {
+        if (!isalpha(*p))
+            return filename;
+        p++;
+    }
+    if (*p == '\0' || p - filename <= 1)
+        return filename;
+    return p + 1;
+}
+
 // 简单的中转读操作到底层协议的读函数，完成读操作。
 int url_read(URLContext *h, unsigned char *buf, int size) {
     int ret;
@@ -87,6 +102,15 @@ int url_read(URLContext *h, unsigned char *buf, int size) {
     return ret;
 }
 
+// 简单的中转写操作到底层协议的写函数，只读打开或协议不支持写时返回错误。
+int url_write(URLContext *h, unsigned char *buf, int size) {
+    if (!(h->flags & (URL_WRONLY | URL_RDWR)))
+        return AVERROR_IO;
+    if (!h->prot->url_write)
+        return AVERROR_IO;
+    return h->prot->url_write(h, buf, size);
+}
+
 // 简单的中转seek 操作到底层协议的seek函数，完成seek操作。
 offset_t url_seek(URLContext *h, offset_t pos, int whence) {
     offset_t ret;
@@ -106,3 +130,17 @@ int url_close(URLContext *h) {
 }
 // 取最大数据包大小，如果非0，必须是实质有效的。
 int url_get_max_packet_size(URLContext *h) { return h->max_packet_size; }
+
+// 取协议的内存映射区，协议不支持内存映射时返回NULL。
+AVFileMapping *url_get_mapping(URLContext *h) {
+    if (!h->prot->url_get_mapping)
+        return NULL;
+    return h->prot->url_get_mapping(h);
+}
+
+// 提示协议提前读[pos, pos + size) 范围的数据，协议不支持时什么也不做。
+int url_prefetch(URLContext *h, offset_t pos, int size) {
+    if (!h->prot->url_prefetch)
+        return 0;
+    return h->prot->url_prefetch(h, pos, size);
+}
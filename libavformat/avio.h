@@ -12,6 +12,14 @@ typedef int64_t offset_t;
 #define URL_WRONLY 1
 #define URL_RDWR 2
 
+// 映射到内存的整个文件，由mmap 协议创建，带引用计数，
+// 直接指向映射区的数据包各自持有一个引用。
+typedef struct AVFileMapping {
+    uint8_t *data;         // 映射区首地址
+    offset_t size;         // 文件大小
+    volatile int refcount; // 引用计数，为0 时解除映射
+} AVFileMapping;
+
 // URLContext 结构表示程序运行的当前广义输入文件使用的上下文，
 // 着重于所有广义输入文件共有的属性(并且是在程序运行时才能确定其值)和关联其他结构的字段
 typedef struct URLContext {
@@ -30,6 +38,8 @@ typedef struct URLProtocol {
     int (*url_write)(URLContext *h, unsigned char *buf, int size);
     offset_t (*url_seek)(URLContext *h, offset_t pos, int whence);
     int (*url_close)(URLContext *h);
+    AVFileMapping *(*url_get_mapping)(URLContext *h); // 可选，返回内存映射区
+    int (*url_prefetch)(URLContext *h, offset_t pos, int size); // 可选，提前发起读操作
     struct URLProtocol
         *next; // 用于把所有支持的广义的输入文件连接成链表，便于遍历查找。
 } URLProtocol;
@@ -57,14 +67,35 @@ typedef struct ByteIOContext {
     int write_flag;      // true if open for writing
     int max_packet_size; // 如果非0，表示最大数据帧大小，用于分配足够的缓存。
     int error;           // contains the error code or 0 if no error happened
+    struct AVPacketPool *packet_pool; // av_get_packet 使用的数据包缓存池，
+                                      // 由AVFormatContext 持有
+    AVFileMapping *mapping; // 非NULL 时缓存直接指向映射区，不再拷贝数据
+    struct ReadAheadContext *readahead; // 非NULL 时由后台线程预读数据
+    int64_t seek_count; // 实际定位底层文件的次数，缓存内的seek 不计
+    int64_t bytes_read; // 从底层文件读出的字节数
 } ByteIOContext;
 
+// 预读线程的统计信息，waits / fills 反映解复用线程等待I/O 的比例。
+typedef struct ByteIOReadAheadStats {
+    int64_t fills;     // 从预读缓存取数据的次数
+    int64_t waits;     // 预读缓存为空，解复用线程等待I/O 的次数
+    int64_t seeks;     // 取消预读并重新定位的次数
+    int64_t redirects; // seek 目标已经预读，直接复用预读数据的次数
+} ByteIOReadAheadStats;
+
 int url_open(URLContext **h, const char *filename, int flags);
+const char *url_local_path(const char *filename);
 int url_read(URLContext *h, unsigned char *buf, int size);
 int url_write(URLContext *h, unsigned char *buf, int size);
 offset_t url_seek(URLContext *h, offset_t pos, int whence);
 int url_close(URLContext *h);
 int url_get_max_packet_size(URLContext *h);
+AVFileMapping *url_get_mapping(URLContext *h);
+int url_prefetch(URLContext *h, offset_t pos, int size);
+
+int av_file_map(const char *filename, AVFileMapping **pmap);
+void av_file_mapping_ref(AVFileMapping *map);
+void av_file_mapping_unref(AVFileMapping *map);
 
 int register_protocol(URLProtocol *protocol);
 
@@ -85,8 +116,19 @@ int url_fread(ByteIOContext *s, unsigned char *buf, int size); // get_buffer
 int get_byte(ByteIOContext *s);
 unsigned int get_le32(ByteIOContext *s);
 unsigned int get_le16(ByteIOContext *s);
+uint64_t get_le64(ByteIOContext *s);
+
+void put_byte(ByteIOContext *s, int b);
+void put_buffer(ByteIOContext *s, const unsigned char *buf, int size);
+void put_le16(ByteIOContext *s, unsigned int val);
+void put_le32(ByteIOContext *s, unsigned int val);
+void put_le64(ByteIOContext *s, uint64_t val);
+void put_flush_packet(ByteIOContext *s);
 
 int url_setbufsize(ByteIOContext *s, int buf_size);
+int url_setreadahead(ByteIOContext *s, int nb_buffers);
+int url_get_readahead_stats(ByteIOContext *s, ByteIOReadAheadStats *stats);
+int url_fprefetch(ByteIOContext *s, offset_t pos, int size);
 int url_fopen(ByteIOContext *s, const char *filename, int flags);
 int url_fclose(ByteIOContext *s);
 
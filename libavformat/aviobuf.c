@@ -1,9 +1,245 @@
 #include "../berrno.h"
+#include "../libavutil/thread.h"
 #include "avformat.h"
 #include "avio.h"
 #include <stdarg.h>
 
 #define IO_BUFFER_SIZE 32768
+#define MAP_WINDOW_SIZE (1 << 30) // 映射方式下缓存窗口的最大字节数
+#define MAX_READAHEAD_BUFFERS 32
+
+// 预读缓存，记录一块已读好的数据及其在文件中的位置。
+typedef struct ReadAheadSlot {
+    uint8_t *data;
+    offset_t pos; // 数据在文件中的起始位置
+    int len;      // 数据长度，<=0 表示读到文件末尾或出错
+} ReadAheadSlot;
+
+// 异步预读上下文。后台线程顺序读文件填满nb_slots 块预读缓存，解复用线程的
+// fill_buffer() 只需和预读缓存交换指针。ByteIOContext 会被按值拷贝(参见
+// av_open_input_stream)，所以这里只保存底层读写函数，不保存ByteIOContext 的指针。
+typedef struct ReadAheadContext {
+    AVThread thread;
+    AVMutex mutex;
+    AVCond cond;
+    void *opaque;
+    int (*read_buf)(void *opaque, uint8_t *buf, int buf_size);
+    offset_t (*seek)(void *opaque, offset_t offset, int whence);
+    int buffer_size;
+    ReadAheadSlot slots[MAX_READAHEAD_BUFFERS];
+    int nb_slots;
+    int rindex;      // 下一块交给解复用线程的预读缓存
+    int nb_filled;   // 已读好的预读缓存块数
+    offset_t next_pos; // 后台线程下一次读的文件位置
+    int generation;  // 每次重新定位加1，丢弃定位前发起的读操作的结果
+    int reading;     // 后台线程正在调用底层读函数
+    int paused;      // 解复用线程正在直接操作底层文件，后台线程不能发起新的读操作
+    int eof;         // 已读到文件末尾，等待重新定位
+    int skip;        // seek 落在预读缓存中间时，取出后需要跳过的字节数
+    int abort;
+    ByteIOReadAheadStats stats;
+} ReadAheadContext;
+
+static void *readahead_thread(void *arg) {
+    ReadAheadContext *ra = arg;
+    ReadAheadSlot *slot;
+    uint8_t *data;
+    offset_t pos;
+    int generation, len;
+
+    av_mutex_lock(&ra->mutex);
+    while (!ra->abort) {
+        if (ra->paused || ra->eof || ra->nb_filled == ra->nb_slots) {
+            av_cond_wait(&ra->cond, &ra->mutex);
+            continue;
+        }
+        slot = &ra->slots[(ra->rindex + ra->nb_filled) % ra->nb_slots];
+        data = slot->data;
+        pos = ra->next_pos;
+        generation = ra->generation;
+        ra->reading = 1;
+        av_mutex_unlock(&ra->mutex);
+
+        // 读文件时不持有锁，解复用线程可以同时取已读好的数据。
+        len = ra->read_buf(ra->opaque, data, ra->buffer_size);
+
+        av_mutex_lock(&ra->mutex);
+        ra->reading = 0;
+        // 读的过程中发生了重新定位，这块数据作废。
+        if (generation == ra->generation) {
+            slot->pos = pos;
+            slot->len = len;
+            ra->nb_filled++;
+            if (len > 0)
+                ra->next_pos += len;
+            else
+                ra->eof = 1;
+        }
+        av_cond_broadcast(&ra->cond);
+    }
+    av_mutex_unlock(&ra->mutex);
+    return NULL;
+}
+
+// 从预读缓存取一块数据，和ByteIOContext 当前的缓存交换指针，不拷贝数据。
+static void readahead_fill(ByteIOContext *s) {
+    ReadAheadContext *ra = s->readahead;
+    ReadAheadSlot *slot;
+    uint8_t *data;
+
+    av_mutex_lock(&ra->mutex);
+    if (!ra->nb_filled) {
+        ra->stats.waits++;
+        while (!ra->nb_filled)
+            av_cond_wait(&ra->cond, &ra->mutex);
+    }
+    slot = &ra->slots[ra->rindex];
+    if (slot->len <= 0) {
+        // 到了文件末尾，保留这块缓存，后续读操作同样得到文件末尾。
+        s->eof_reached = 1;
+        if (slot->len < 0)
+            s->error = slot->len;
+    } else {
+        ra->stats.fills++;
+        s->bytes_read += slot->len;
+        data = s->buffer;
+        s->buffer = slot->data;
+        slot->data = data;
+        s->pos = slot->pos + slot->len;
+        s->buf_ptr = s->buffer + ra->skip;
+        s->buf_end = s->buffer + slot->len;
+        ra->skip = 0;
+        ra->rindex = (ra->rindex + 1) % ra->nb_slots;
+        ra->nb_filled--;
+        av_cond_broadcast(&ra->cond);
+    }
+    av_mutex_unlock(&ra->mutex);
+}
+
+// 暂停后台线程，等它当前的读操作返回，之后解复用线程可以直接操作底层文件。
+// 调用者持有锁。
+static void readahead_pause(ReadAheadContext *ra) {
+    ra->paused = 1;
+    while (ra->reading)
+        av_cond_wait(&ra->cond, &ra->mutex);
+}
+
+static void readahead_resume(ReadAheadContext *ra) {
+    ra->paused = 0;
+    av_cond_broadcast(&ra->cond);
+}
+
+// 重新定位。目标已经预读时丢弃它前面的缓存，直接复用；否则取消所有预读，
+// 等后台线程当前的读操作返回后再定位底层文件。
+static int readahead_seek(ByteIOContext *s, offset_t offset) {
+    ReadAheadContext *ra = s->readahead;
+    ReadAheadSlot *slot;
+    offset_t ret = 0;
+
+    av_mutex_lock(&ra->mutex);
+    ra->skip = 0;
+    while (ra->nb_filled) {
+        slot = &ra->slots[ra->rindex];
+        if (slot->len > 0 && offset >= slot->pos &&
+            offset < slot->pos + slot->len) {
+            ra->skip = (int)(offset - slot->pos);
+            ra->stats.redirects++;
+            av_mutex_unlock(&ra->mutex);
+            return 0;
+        }
+        ra->rindex = (ra->rindex + 1) % ra->nb_slots;
+        ra->nb_filled--;
+    }
+
+    ra->stats.seeks++;
+    s->seek_count++;
+    ra->generation++;
+    readahead_pause(ra);
+    ret = ra->seek(ra->opaque, offset, SEEK_SET);
+    ra->next_pos = offset;
+    ra->eof = 0;
+    readahead_resume(ra);
+    av_mutex_unlock(&ra->mutex);
+
+    return ret == (offset_t)-EPIPE ? -EPIPE : 0;
+}
+
+// 停止预读线程，释放预读缓存。
+static void readahead_close(ByteIOContext *s) {
+    ReadAheadContext *ra = s->readahead;
+    int i;
+
+    av_mutex_lock(&ra->mutex);
+    ra->abort = 1;
+    av_cond_broadcast(&ra->cond);
+    av_mutex_unlock(&ra->mutex);
+    av_thread_join(&ra->thread);
+
+    for (i = 0; i < ra->nb_slots; i++)
+        av_free(ra->slots[i].data);
+    av_cond_destroy(&ra->cond);
+    av_mutex_destroy(&ra->mutex);
+    av_free(ra);
+    s->readahead = NULL;
+}
+
+// 打开异步预读，后台线程提前读好nb_buffers 块缓存大小的数据。
+// 映射方式下没有I/O 可以预读，直接返回。
+int url_setreadahead(ByteIOContext *s, int nb_buffers) {
+    ReadAheadContext *ra;
+    int i;
+
+    if (s->mapping || s->readahead || s->write_flag || !s->read_buf)
+        return 0;
+    if (nb_buffers < 1 || nb_buffers > MAX_READAHEAD_BUFFERS)
+        return -EINVAL;
+
+    ra = av_mallocz(sizeof(ReadAheadContext));
+    if (!ra)
+        return -ENOMEM;
+    ra->opaque = s->opaque;
+    ra->read_buf = s->read_buf;
+    ra->seek = s->seek;
+    ra->buffer_size = s->buffer_size;
+    ra->nb_slots = nb_buffers;
+    ra->next_pos = s->pos; // 底层文件的当前位置
+    for (i = 0; i < nb_buffers; i++) {
+        ra->slots[i].data = av_malloc(s->buffer_size);
+        if (!ra->slots[i].data)
+            goto fail;
+    }
+    if (av_mutex_init(&ra->mutex) < 0)
+        goto fail;
+    if (av_cond_init(&ra->cond) < 0) {
+        av_mutex_destroy(&ra->mutex);
+        goto fail;
+    }
+    if (av_thread_create(&ra->thread, readahead_thread, ra) < 0) {
+        av_cond_destroy(&ra->cond);
+        av_mutex_destroy(&ra->mutex);
+        goto fail;
+    }
+    s->readahead = ra;
+    return 0;
+
+fail:
+    for (i = 0; i < nb_buffers; i++)
+        av_free(ra->slots[i].data);
+    av_free(ra);
+    return -ENOMEM;
+}
+
+// 取预读统计信息，没有打开预读时返回-1。
+int url_get_readahead_stats(ByteIOContext *s, ByteIOReadAheadStats *stats) {
+    ReadAheadContext *ra = s->readahead;
+
+    if (!ra)
+        return -1;
+    av_mutex_lock(&ra->mutex);
+    *stats = ra->stats;
+    av_mutex_unlock(&ra->mutex);
+    return 0;
+}
 
 // 初始化广义文件ByteIOContext结构，一些简单的赋值操作。
 int init_put_byte(
@@ -41,6 +277,11 @@ int init_put_byte(
     s->eof_reached = 0;
     s->error = 0;
     s->max_packet_size = 0;
+    s->packet_pool = NULL;
+    s->mapping = NULL;
+    s->readahead = NULL;
+    s->seek_count = 0;
+    s->bytes_read = 0;
 
     return 0;
 }
@@ -71,8 +312,15 @@ offset_t url_fseek(ByteIOContext *s, offset_t offset, int whence) {
             return -EPIPE;
         s->buf_ptr = s->buffer;
         s->buf_end = s->buffer;
-        if (s->seek(s->opaque, offset, SEEK_SET) == (offset_t)-EPIPE)
-            return -EPIPE;
+        // 打开预读时由预读模块取消或复用已经发起的读操作。
+        if (s->readahead) {
+            if (readahead_seek(s, offset) < 0)
+                return -EPIPE;
+        } else {
+            s->seek_count++;
+            if (s->seek(s->opaque, offset, SEEK_SET) == (offset_t)-EPIPE)
+                return -EPIPE;
+        }
         s->pos = offset;
     }
     s->eof_reached = 0;
@@ -92,6 +340,17 @@ offset_t url_fsize(ByteIOContext *s) {
 
     if (!s->seek)
         return -EPIPE;
+    if (s->readahead) {
+        // 等后台线程当前的读操作返回，再恢复到它的读位置。
+        ReadAheadContext *ra = s->readahead;
+        av_mutex_lock(&ra->mutex);
+        readahead_pause(ra);
+        size = s->seek(s->opaque, -1, SEEK_END) + 1;
+        s->seek(s->opaque, ra->next_pos, SEEK_SET);
+        readahead_resume(ra);
+        av_mutex_unlock(&ra->mutex);
+        return size;
+    }
     size = s->seek(s->opaque, -1, SEEK_END) + 1;
     s->seek(s->opaque, s->pos, SEEK_SET);
     return size;
@@ -101,6 +360,23 @@ int url_feof(ByteIOContext *s) { return s->eof_reached; }
 // 返回当前广义文件ByteIOContext操作错误码
 int url_ferror(ByteIOContext *s) { return s->error; }
 
+// 映射方式下的缓存填充，只是把缓存窗口移到映射区的当前位置，不拷贝数据。
+static void fill_mapped_buffer(ByteIOContext *s) {
+    offset_t left = s->mapping->size - s->pos;
+
+    if (left <= 0) {
+        s->eof_reached = 1;
+        return;
+    }
+    if (left > MAP_WINDOW_SIZE)
+        left = MAP_WINDOW_SIZE;
+    s->buffer = s->mapping->data + s->pos;
+    s->buffer_size = (int)left;
+    s->buf_ptr = s->buffer;
+    s->buf_end = s->buffer + left;
+    s->pos += left;
+}
+
 // Input stream
 // 填充广义文件ByteIOContext 内部的数据缓存区。
 static void fill_buffer(ByteIOContext *s) {
@@ -109,6 +385,20 @@ static void fill_buffer(ByteIOContext *s) {
     if (s->eof_reached)
         return;
 
+    if (s->mapping) {
+        fill_mapped_buffer(s);
+        return;
+    }
+    if (s->readahead) {
+        readahead_fill(s);
+        return;
+    }
+    // 内存缓存没有底层文件，读完就是文件末尾。
+    if (!s->read_buf) {
+        s->eof_reached = 1;
+        return;
+    }
+
     // 调用底层文件系统的读函数实际读数据填到缓存，注意这里经过了好几次跳转才到底层读函数。
     // 首先跳转的url_read_buf()函数，再跳转到url_read()，再跳转到实际文件协议的读函数完成读操作。
     len = s->read_buf(s->opaque, s->buffer, s->buffer_size);
@@ -125,6 +415,7 @@ static void fill_buffer(ByteIOContext *s) {
     } else {
         // 如果正确读取，修改一下基本参数
         s->pos += len;
+        s->bytes_read += len;
         s->buf_ptr = s->buffer;
         s->buf_end = s->buffer + len;
     }
@@ -163,7 +454,79 @@ unsigned int get_le32(ByteIOContext *s) {
     return val;
 }
 
-#define url_write_buf NULL
+uint64_t get_le64(ByteIOContext *s) {
+    uint64_t val;
+    val = (uint64_t)get_le32(s);
+    val |= (uint64_t)get_le32(s) << 32;
+    return val;
+}
+
+// Output stream
+// 把缓存中的数据写到底层文件，写错误记在error 中。
+static void flush_buffer(ByteIOContext *s) {
+    int len;
+
+    if (s->buf_ptr > s->buffer) {
+        if (s->write_buf) {
+            len = s->write_buf(s->opaque, s->buffer, s->buf_ptr - s->buffer);
+            if (len < 0)
+                s->error = len;
+        }
+        s->pos += s->buf_ptr - s->buffer;
+    }
+    s->buf_ptr = s->buffer;
+}
+
+// 向广义文件ByteIOContext 写一个字节，缓存满时写到底层文件。
+void put_byte(ByteIOContext *s, int b) {
+    *(s->buf_ptr)++ = b;
+    if (s->buf_ptr >= s->buf_end)
+        flush_buffer(s);
+}
+
+void put_buffer(ByteIOContext *s, const unsigned char *buf, int size) {
+    int len;
+
+    while (size > 0) {
+        len = s->buf_end - s->buf_ptr;
+        if (len > size)
+            len = size;
+        memcpy(s->buf_ptr, buf, len);
+        s->buf_ptr += len;
+
+        if (s->buf_ptr >= s->buf_end)
+            flush_buffer(s);
+
+        buf += len;
+        size -= len;
+    }
+}
+
+void put_le16(ByteIOContext *s, unsigned int val) {
+    put_byte(s, val);
+    put_byte(s, val >> 8);
+}
+
+void put_le32(ByteIOContext *s, unsigned int val) {
+    put_le16(s, val);
+    put_le16(s, val >> 16);
+}
+
+void put_le64(ByteIOContext *s, uint64_t val) {
+    put_le32(s, (uint32_t)val);
+    put_le32(s, (uint32_t)(val >> 32));
+}
+
+void put_flush_packet(ByteIOContext *s) {
+    flush_buffer(s);
+    s->must_flush = 0;
+}
+
+// 简单中转写操作函数。
+static int url_write_buf(void *opaque, uint8_t *buf, int buf_size) {
+    URLContext *h = opaque;
+    return url_write(h, buf, buf_size);
+}
 
 // 简单中转读操作函数。
 static int url_read_buf(void *opaque, uint8_t *buf, int buf_size) {
@@ -181,6 +544,12 @@ int url_setbufsize(ByteIOContext *s,
                    int buf_size) // must be called before any I/O
 {
     uint8_t *buffer;
+    // 映射方式下缓存就是映射区，不需要分配。
+    if (s->mapping)
+        return 0;
+    // 预读缓存已经按原大小分配。
+    if (s->readahead)
+        return -EINVAL;
     // 分配广义文件ByteIOContext 内部缓存。
     buffer = av_malloc(buf_size);
     if (!buffer)
@@ -238,6 +607,14 @@ int url_fopen(ByteIOContext *s, const char *filename, int flags) {
     // 保存最大包大小。
     s->max_packet_size = max_packet_size;
 
+    // 协议支持内存映射时，缓存直接指向映射区，释放刚分配的缓存。
+    s->mapping = url_get_mapping(h);
+    if (s->mapping) {
+        av_free(buffer);
+        s->buffer = s->buf_ptr = s->buf_end = s->mapping->data;
+        s->buffer_size = 0;
+    }
+
     return 0;
 }
 
@@ -245,10 +622,24 @@ int url_fopen(ByteIOContext *s, const char *filename, int flags) {
 int url_fclose(ByteIOContext *s) {
     URLContext *h = s->opaque;
 
-    av_free(s->buffer);
+    if (s->readahead)
+        readahead_close(s);
+    if (s->write_flag)
+        put_flush_packet(s);
+    if (!s->mapping)
+        av_free(s->buffer);
     memset(s, 0, sizeof(ByteIOContext));
     return url_close(h);
 }
+
+// 提示底层协议提前读[pos, pos + size) 范围的数据，解析非交织文件时可以先把
+// 后面要跳着读的位置告诉协议。映射方式下数据已经在内存中，预读方式下底层文件
+// 归后台线程使用，都直接返回。
+int url_fprefetch(ByteIOContext *s, offset_t pos, int size) {
+    if (s->mapping || s->readahead || s->read_buf != url_read_buf)
+        return 0;
+    return url_prefetch(s->opaque, pos, size);
+}
 // 广义文件ByteIOContext 读操作，注意此函数从get_buffer
 // 改名而来，更贴切函数功能，也为了完备广义文件操作函数集。
 int url_fread(ByteIOContext *s, unsigned char *buf, int size) // get_buffer
@@ -265,8 +656,10 @@ int url_fread(ByteIOContext *s, unsigned char *buf, int size) // get_buffer
             len = size;
         if (len == 0) // 如果内部缓存没有数据。
         {
-            if (size > s->buffer_size) {
+            if (size > s->buffer_size && !s->mapping && !s->readahead &&
+                s->read_buf) {
                 // 如果要读取的数据量比内部缓存数据量大，就调用底层函数读取数据绕过内部缓存直接到目标缓存。
+                // 映射方式下缓存窗口没有拷贝代价，预读方式下底层文件归后台线程使用，都不绕过。
                 len = s->read_buf(s->opaque, buf, size);
                 if (len <= 0) {
                     // 如果底层文件系统读错误，设置文件末尾标记和错误码，跳出循环，返回实际读到的字节数。
@@ -277,6 +670,7 @@ int url_fread(ByteIOContext *s, unsigned char *buf, int size) // get_buffer
                 } else {
                     // 如果底层文件系统正确读，修改相关参数，进入下一轮循环。特别注意此处读文件绕过了内部缓存。
                     s->pos += len;
+                    s->bytes_read += len;
                     size -= len;
                     buf += len;
                     s->buf_ptr = s->buffer;
@@ -301,3 +695,23 @@ int url_fread(ByteIOContext *s, unsigned char *buf, int size) // get_buffer
     // 返回实际读取的字节数。
     return size1 - size;
 }
+
+// 把内存中的一段数据当作广义文件读，不关联底层协议。整段数据就是文件内容，
+// 可以在其中任意seek，读到末尾时置eof_reached。只支持读方式。
+int url_open_buf(ByteIOContext *s, uint8_t *buf, int buf_size, int flags) {
+    int ret;
+
+    if (flags & (URL_WRONLY | URL_RDWR))
+        return -EINVAL;
+    ret = init_put_byte(s, buf, buf_size, 0, NULL, NULL, NULL, NULL);
+    if (ret < 0)
+        return ret;
+    s->buf_end = buf + buf_size;
+    s->pos = buf_size;
+    return 0;
+}
+
+// 关闭内存广义文件，返回已读或已写的字节数，数据由调用者释放。
+int url_close_buf(ByteIOContext *s) {
+    return s->buf_ptr - s->buffer;
+}
@@ -35,3 +35,12 @@ void pstrcpy(char *buf, int buf_size, const char *str) {
     }
     *q = '\0';
 }
+
+// 字符串追加函数，追加后的总长度受buf_size 限制，返回追加后的字符串长度。
+int pstrcat(char *buf, int buf_size, const char *s) {
+    int len;
+    len = strlen(buf);
+    if (len < buf_size)
+        pstrcpy(buf + len, buf_size - len, s);
+    return len + strlen(s);
+}
@@ -0,0 +1,489 @@
+#include "avformat.h"
+
+// 流索引表的紧凑存储，供av_add_index_entry() 和av_index_search_timestamp() 使用。
+// 索引项每INDEX_BLOCK_SIZE 项分为一块，除最后一块外都是满的，第i 项在第
+// i >> INDEX_BLOCK_BITS 块。块内各字段分开存放：位置存成相对块内最小位置的
+// 32 位差值；时间戳逐项加1 时不存，只记第一项，否则存成相对第一项的32 位差值；
+// 差值放不下时退回64 位原值。大小和标志合成一个32 位数。
+// 这样AVI 视频的索引每项8 字节，音频每项12 字节，原来的AVIndexEntry 是24 字节。
+// 查找时间戳分两级：先在各块首项时间戳组成的连续数组中折半查找，再在块内查找。
+
+#define INDEX_BLOCK_BITS 8
+#define INDEX_BLOCK_SIZE (1 << INDEX_BLOCK_BITS)
+
+#define INDEX_MAX_ENTRIES 0x7FFFFF00
+
+#define INDEX_TS_DENSE 0 // 时间戳是首项加序号，不存
+#define INDEX_TS_DELTA 1 // 存uint32_t 差值
+#define INDEX_TS_FULL 2  // 存int64_t 原值
+
+typedef struct AVIndexBlock {
+    int64_t base_pos; // 块内最小的位置
+    int64_t base_ts;  // 块内首项的时间戳
+    int nb;           // 块内项数
+    int pos_full;     // 位置存int64_t 原值
+    int ts_mode;      // INDEX_TS_*
+    void *pos;
+    void *ts;
+    uint32_t *size_flags; // size << 2 | flags
+} AVIndexBlock;
+
+struct AVIndex {
+    AVIndexBlock *blocks;
+    int64_t *first_ts; // 各块首项的时间戳，两级查找的第一级
+    int nb_blocks;
+    int blocks_allocated;
+    int nb_entries;
+};
+
+static inline int64_t index_block_pos(const AVIndexBlock *b, int k) {
+    if (b->pos_full)
+        return ((int64_t *)b->pos)[k];
+    return b->base_pos + ((uint32_t *)b->pos)[k];
+}
+
+static inline int64_t index_block_ts(const AVIndexBlock *b, int k) {
+    if (b->ts_mode == INDEX_TS_DENSE)
+        return b->base_ts + k;
+    if (b->ts_mode == INDEX_TS_DELTA)
+        return b->base_ts + ((uint32_t *)b->ts)[k];
+    return ((int64_t *)b->ts)[k];
+}
+
+static void index_block_get(const AVIndexBlock *b, int k, AVIndexEntry *e) {
+    uint32_t sf = b->size_flags[k];
+
+    e->pos = index_block_pos(b, k);
+    e->timestamp = index_block_ts(b, k);
+    e->size = (int32_t)sf >> 2;
+    e->flags = sf & 3;
+}
+
+static void index_block_free(AVIndexBlock *b) {
+    av_free(b->pos);
+    av_free(b->ts);
+    av_free(b->size_flags);
+    memset(b, 0, sizeof(AVIndexBlock));
+}
+
+// 按块内的n 项选择最省的存放方式，重新分配并填写块的各个数组。
+// 数组总是按整块分配，以后追加不用再分配。失败时块保持不变。
+static int index_block_encode(AVIndexBlock *b, const AVIndexEntry *e, int n) {
+    int64_t min_pos = e[0].pos, max_pos = e[0].pos;
+    int k, pos_full, ts_mode = INDEX_TS_DENSE;
+    void *pos, *ts = NULL;
+    uint32_t *size_flags;
+
+    for (k = 1; k < n; k++) {
+        if (e[k].pos < min_pos)
+            min_pos = e[k].pos;
+        if (e[k].pos > max_pos)
+            max_pos = e[k].pos;
+        if (e[k].timestamp != e[0].timestamp + k)
+            ts_mode = INDEX_TS_DELTA;
+    }
+    pos_full = (uint64_t)max_pos - (uint64_t)min_pos > 0xFFFFFFFFu;
+    // 块内时间戳递增，首尾的差值放得下所有的差值就放得下。
+    if (ts_mode == INDEX_TS_DELTA &&
+        (uint64_t)e[n - 1].timestamp - (uint64_t)e[0].timestamp > 0xFFFFFFFFu)
+        ts_mode = INDEX_TS_FULL;
+
+    pos = av_malloc(INDEX_BLOCK_SIZE * (pos_full ? 8 : 4));
+    size_flags = av_malloc(INDEX_BLOCK_SIZE * 4);
+    if (ts_mode != INDEX_TS_DENSE)
+        ts = av_malloc(INDEX_BLOCK_SIZE * (ts_mode == INDEX_TS_FULL ? 8 : 4));
+    if (!pos || !size_flags || (ts_mode != INDEX_TS_DENSE && !ts)) {
+        av_free(pos);
+        av_free(ts);
+        av_free(size_flags);
+        return -1;
+    }
+
+    for (k = 0; k < n; k++) {
+        if (pos_full)
+            ((int64_t *)pos)[k] = e[k].pos;
+        else
+            ((uint32_t *)pos)[k] = (uint32_t)(e[k].pos - min_pos);
+        if (ts_mode == INDEX_TS_DELTA)
+            ((uint32_t *)ts)[k] = (uint32_t)(e[k].timestamp - e[0].timestamp);
+        else if (ts_mode == INDEX_TS_FULL)
+            ((int64_t *)ts)[k] = e[k].timestamp;
+        size_flags[k] = (uint32_t)e[k].size << 2 | (e[k].flags & 3);
+    }
+
+    index_block_free(b);
+    b->base_pos = min_pos;
+    b->base_ts = e[0].timestamp;
+    b->nb = n;
+    b->pos_full = pos_full;
+    b->ts_mode = ts_mode;
+    b->pos = pos;
+    b->ts = ts;
+    b->size_flags = size_flags;
+    return 0;
+}
+
+// 第k 项(k 不大于块内项数)按块现在的存放方式能否放得下。
+static int index_block_fits(const AVIndexBlock *b, int k, int64_t pos,
+                            int64_t ts) {
+    if (!b->size_flags)
+        return 0;
+    if (!b->pos_full &&
+        (pos < b->base_pos || (uint64_t)pos - b->base_pos > 0xFFFFFFFFu))
+        return 0;
+    if (b->ts_mode == INDEX_TS_DENSE)
+        return ts == b->base_ts + k;
+    if (b->ts_mode == INDEX_TS_DELTA)
+        return ts >= b->base_ts && (uint64_t)ts - b->base_ts <= 0xFFFFFFFFu;
+    return 1;
+}
+
+// 覆盖或追加(k 等于块内项数)块内第k 项，放不下时整块重新编码。
+static int index_block_set(AVIndexBlock *b, int k, int64_t pos, int64_t ts,
+                           int size, int flags) {
+    if (!index_block_fits(b, k, pos, ts)) {
+        AVIndexEntry tmp[INDEX_BLOCK_SIZE];
+        int i, n = k < b->nb ? b->nb : k + 1;
+
+        for (i = 0; i < b->nb; i++)
+            index_block_get(b, i, &tmp[i]);
+        tmp[k].pos = pos;
+        tmp[k].timestamp = ts;
+        tmp[k].size = size;
+        tmp[k].flags = flags;
+        return index_block_encode(b, tmp, n);
+    }
+
+    if (b->pos_full)
+        ((int64_t *)b->pos)[k] = pos;
+    else
+        ((uint32_t *)b->pos)[k] = (uint32_t)(pos - b->base_pos);
+    if (b->ts_mode == INDEX_TS_DELTA)
+        ((uint32_t *)b->ts)[k] = (uint32_t)(ts - b->base_ts);
+    else if (b->ts_mode == INDEX_TS_FULL)
+        ((int64_t *)b->ts)[k] = ts;
+    b->size_flags[k] = (uint32_t)size << 2 | (flags & 3);
+    if (k == b->nb)
+        b->nb++;
+    return 0;
+}
+
+static inline int64_t index_ts(const AVIndex *idx, int i) {
+    return index_block_ts(&idx->blocks[i >> INDEX_BLOCK_BITS],
+                          i & (INDEX_BLOCK_SIZE - 1));
+}
+
+static inline int index_flags(const AVIndex *idx, int i) {
+    return idx->blocks[i >> INDEX_BLOCK_BITS]
+               .size_flags[i & (INDEX_BLOCK_SIZE - 1)] & 3;
+}
+
+// 覆盖或追加(i 等于总项数)第i 项。
+static int index_set(AVIndex *idx, int i, int64_t pos, int64_t ts, int size,
+                     int flags) {
+    int bi = i >> INDEX_BLOCK_BITS, k = i & (INDEX_BLOCK_SIZE - 1);
+
+    if (bi == idx->nb_blocks) {
+        if (bi == idx->blocks_allocated) {
+            int n = idx->blocks_allocated ? idx->blocks_allocated * 2 : 4;
+            AVIndexBlock *blocks;
+            int64_t *first_ts;
+
+            blocks = av_realloc(idx->blocks, n * sizeof(AVIndexBlock));
+            if (!blocks)
+                return -1;
+            idx->blocks = blocks;
+            first_ts = av_realloc(idx->first_ts, n * sizeof(int64_t));
+            if (!first_ts)
+                return -1;
+            idx->first_ts = first_ts;
+            memset(blocks + bi, 0, (n - bi) * sizeof(AVIndexBlock));
+            idx->blocks_allocated = n;
+        }
+        idx->nb_blocks++;
+    }
+
+    if (index_block_set(&idx->blocks[bi], k, pos, ts, size, flags) < 0) {
+        // 新开的块没有写成功，不能留空块。
+        if (!idx->blocks[bi].nb)
+            idx->nb_blocks--;
+        return -1;
+    }
+    if (!k)
+        idx->first_ts[bi] = ts;
+    if (i == idx->nb_entries)
+        idx->nb_entries++;
+    return 0;
+}
+
+// 截断到前n 项，释放多出的块。
+static void index_truncate(AVIndex *idx, int n) {
+    int nb_blocks = (n + INDEX_BLOCK_SIZE - 1) >> INDEX_BLOCK_BITS;
+
+    while (idx->nb_blocks > nb_blocks)
+        index_block_free(&idx->blocks[--idx->nb_blocks]);
+    if (nb_blocks)
+        idx->blocks[nb_blocks - 1].nb = n - ((nb_blocks - 1) << INDEX_BLOCK_BITS);
+    idx->nb_entries = n;
+}
+
+// 返回时间戳不大于ts 的最后一项，没有时返回-1。
+static int index_find(const AVIndex *idx, int64_t ts) {
+    const AVIndexBlock *b;
+    uint64_t d;
+    int lo = 0, hi = idx->nb_blocks, m, bi;
+
+    // 第一级：找首项时间戳不大于ts 的最后一块。
+    while (lo < hi) {
+        m = (lo + hi) >> 1;
+        if (idx->first_ts[m] <= ts)
+            lo = m + 1;
+        else
+            hi = m;
+    }
+    if (!lo)
+        return -1;
+    bi = lo - 1;
+    b = &idx->blocks[bi];
+
+    // 第二级：块内查找，时间戳连续时直接算出序号。
+    d = (uint64_t)ts - b->base_ts;
+    if (b->ts_mode == INDEX_TS_DENSE) {
+        m = d >= (uint64_t)b->nb ? b->nb - 1 : (int)d;
+    } else if (b->ts_mode == INDEX_TS_DELTA && d > 0xFFFFFFFFu) {
+        m = b->nb - 1;
+    } else {
+        // 首项不大于ts，找第一个大于ts 的项，前一项即是。
+        const uint32_t *delta = b->ts;
+        const int64_t *full = b->ts;
+
+        lo = 1;
+        hi = b->nb;
+        while (lo < hi) {
+            m = (lo + hi) >> 1;
+            if (b->ts_mode == INDEX_TS_DELTA ? delta[m] <= d : full[m] <= ts)
+                lo = m + 1;
+            else
+                hi = m;
+        }
+        m = lo - 1;
+    }
+    return (bi << INDEX_BLOCK_BITS) + m;
+}
+
+// 添加索引到索引表。有些媒体文件为便于seek，有音视频数据帧有索引，ffplay
+// 把这些索引以时间排序放到一个数据中。返回值添加项的索引。
+int av_add_index_entry(AVStream *st, int64_t pos, int64_t timestamp, int size,
+                       int distance, int flags) {
+    AVIndex *idx = st->index;
+    AVIndexEntry *tail;
+    int index, n, i, ret = 0;
+
+    if (!idx) {
+        idx = st->index = av_mallocz(sizeof(AVIndex));
+        if (!idx)
+            return -1;
+    }
+    n = idx->nb_entries;
+    if (n >= INDEX_MAX_ENTRIES) // 越界判断
+        return -1;
+
+    // 时间戳不小于最后一项时直接追加或覆盖最后一项，不用查找。
+    // 按时间顺序建索引时总是走这条路径。
+    if (!n || index_ts(idx, n - 1) <= timestamp) {
+        index = n;
+        if (n && index_ts(idx, n - 1) == timestamp)
+            index--;
+        if (index_set(idx, index, pos, timestamp, size, flags) < 0)
+            return -1;
+        st->nb_index_entries = idx->nb_entries;
+        return index;
+    }
+
+    // 最后一项的时间戳比timestamp 大，一定找得到。
+    index = av_index_search_timestamp(st, timestamp, AVSEEK_FLAG_ANY);
+    if (index_ts(idx, index) == timestamp)
+        return index_set(idx, index, pos, timestamp, size, flags) < 0 ? -1
+                                                                      : index;
+
+    // 中插。AVI 不会走到这里，和原来用memmove 一样是O(n)：
+    // 取出后面的项，截断后插入新项，再依次追加回去。
+    tail = av_malloc((n - index) * sizeof(AVIndexEntry));
+    if (!tail)
+        return -1;
+    for (i = index; i < n; i++)
+        index_block_get(&idx->blocks[i >> INDEX_BLOCK_BITS],
+                        i & (INDEX_BLOCK_SIZE - 1), &tail[i - index]);
+    index_truncate(idx, index);
+    if (index_set(idx, index, pos, timestamp, size, flags) < 0)
+        ret = -1;
+    for (i = 0; i < n - index; i++) {
+        if (index_set(idx, idx->nb_entries, tail[i].pos, tail[i].timestamp,
+                      tail[i].size, tail[i].flags) < 0)
+            ret = -1;
+    }
+    av_free(tail);
+    st->nb_index_entries = idx->nb_entries;
+
+    return ret < 0 ? -1 : index;
+}
+
+int av_index_search_timestamp(AVStream *st, int64_t wanted_timestamp,
+                              int flags) {
+    AVIndex *idx = st->index;
+    int nb_entries = st->nb_index_entries;
+    int a, b, m;
+
+    if (!nb_entries)
+        return -1;
+
+    // a 是时间戳不大于wanted_timestamp 的最后一项，b 是不小于的第一项。
+    a = index_find(idx, wanted_timestamp);
+    b = a >= 0 && index_ts(idx, a) == wanted_timestamp ? a : a + 1;
+
+    m = (flags & AVSEEK_FLAG_BACKWARD) ? a : b;
+
+    if (!(flags & AVSEEK_FLAG_ANY)) {
+        while (m >= 0 && m < nb_entries &&
+               !(index_flags(idx, m) & AVINDEX_KEYFRAME)) {
+            m += (flags & AVSEEK_FLAG_BACKWARD) ? -1 : 1;
+        }
+    }
+
+    if (m == nb_entries)
+        return -1;
+
+    return m;
+}
+
+// 取第i 项索引，i 越界时返回-1。
+int av_index_get_entry(AVStream *st, int i, AVIndexEntry *e) {
+    if (i < 0 || i >= st->nb_index_entries)
+        return -1;
+    index_block_get(&st->index->blocks[i >> INDEX_BLOCK_BITS],
+                    i & (INDEX_BLOCK_SIZE - 1), e);
+    return 0;
+}
+
+// 返回索引表占用的内存字节数。
+int64_t av_index_memory_usage(AVStream *st) {
+    AVIndex *idx = st->index;
+    int64_t size;
+    int i;
+
+    if (!idx)
+        return 0;
+    size = sizeof(AVIndex) +
+           (int64_t)idx->blocks_allocated * (sizeof(AVIndexBlock) + 8);
+    for (i = 0; i < idx->nb_blocks; i++) {
+        AVIndexBlock *b = &idx->blocks[i];
+
+        size += INDEX_BLOCK_SIZE * (4 + (b->pos_full ? 8 : 4));
+        if (b->ts_mode != INDEX_TS_DENSE)
+            size += INDEX_BLOCK_SIZE * (b->ts_mode == INDEX_TS_FULL ? 8 : 4);
+    }
+    return size;
+}
+
+void av_index_free(AVStream *st) {
+    AVIndex *idx = st->index;
+    int i;
+
+    if (!idx)
+        return;
+    for (i = 0; i < idx->nb_blocks; i++)
+        index_block_free(&idx->blocks[i]);
+    av_free(idx->blocks);
+    av_free(idx->first_ts);
+    av_freep(&st->index);
+    st->nb_index_entries = 0;
+}
+
+// 把索引按块内的存放方式原样写到pb，供索引缓存使用：总项数，然后每块是
+// 基准位置、基准时间戳、项数、存放方式和各个数组。数组按机器字节序写，
+// 和le2me_32() 一样假定机器是小端。
+int av_index_write(AVStream *st, ByteIOContext *pb) {
+    AVIndex *idx = st->index;
+    int i;
+
+    put_le32(pb, st->nb_index_entries);
+    if (!st->nb_index_entries)
+        return 0;
+    for (i = 0; i < idx->nb_blocks; i++) {
+        AVIndexBlock *b = &idx->blocks[i];
+
+        put_le64(pb, b->base_pos);
+        put_le64(pb, b->base_ts);
+        put_le32(pb, b->nb);
+        put_le32(pb, b->pos_full);
+        put_le32(pb, b->ts_mode);
+        put_buffer(pb, b->pos, b->nb * (b->pos_full ? 8 : 4));
+        if (b->ts_mode != INDEX_TS_DENSE)
+            put_buffer(pb, b->ts, b->nb * (b->ts_mode == INDEX_TS_FULL ? 8 : 4));
+        put_buffer(pb, (unsigned char *)b->size_flags, b->nb * 4);
+    }
+    return 0;
+}
+
+// 读入av_index_write() 写的索引，替换st 原有的索引。数据不合理时返回-1。
+int av_index_read(AVStream *st, ByteIOContext *pb) {
+    AVIndex *idx;
+    unsigned int nb_entries = get_le32(pb);
+    int i, n, nb_blocks, pos_size, ts_size;
+
+    av_index_free(st);
+    if (!nb_entries)
+        return 0;
+    if (nb_entries > INDEX_MAX_ENTRIES)
+        return -1;
+    nb_blocks = (nb_entries + INDEX_BLOCK_SIZE - 1) >> INDEX_BLOCK_BITS;
+
+    idx = st->index = av_mallocz(sizeof(AVIndex));
+    if (!idx)
+        return -1;
+    idx->blocks = av_mallocz(nb_blocks * sizeof(AVIndexBlock));
+    idx->first_ts = av_malloc(nb_blocks * sizeof(int64_t));
+    if (!idx->blocks || !idx->first_ts)
+        goto fail;
+    idx->blocks_allocated = nb_blocks;
+
+    for (i = 0; i < nb_blocks; i++) {
+        AVIndexBlock *b = &idx->blocks[i];
+
+        // 除最后一块外都是满的。
+        n = i < nb_blocks - 1 ? INDEX_BLOCK_SIZE
+                              : nb_entries - (i << INDEX_BLOCK_BITS);
+        b->base_pos = get_le64(pb);
+        b->base_ts = get_le64(pb);
+        b->nb = get_le32(pb);
+        b->pos_full = get_le32(pb);
+        b->ts_mode = get_le32(pb);
+        if (b->nb != n || (unsigned)b->pos_full > 1 ||
+            (unsigned)b->ts_mode > INDEX_TS_FULL)
+            goto fail;
+        idx->nb_blocks++;
+
+        pos_size = b->pos_full ? 8 : 4;
+        ts_size = b->ts_mode == INDEX_TS_FULL ? 8 : 4;
+        b->pos = av_malloc(INDEX_BLOCK_SIZE * pos_size);
+        b->size_flags = av_malloc(INDEX_BLOCK_SIZE * 4);
+        if (b->ts_mode != INDEX_TS_DENSE)
+            b->ts = av_malloc(INDEX_BLOCK_SIZE * ts_size);
+        if (!b->pos || !b->size_flags || (b->ts_mode != INDEX_TS_DENSE && !b->ts))
+            goto fail;
+        if (url_fread(pb, b->pos, n * pos_size) != n * pos_size)
+            goto fail;
+        if (b->ts && url_fread(pb, b->ts, n * ts_size) != n * ts_size)
+            goto fail;
+        if (url_fread(pb, (unsigned char *)b->size_flags, n * 4) != n * 4)
+            goto fail;
+        idx->first_ts[i] = index_block_ts(b, 0);
+    }
+    idx->nb_entries = nb_entries;
+    st->nb_index_entries = nb_entries;
+    return 0;
+
+fail:
+    av_index_free(st);
+    return -1;
+}
@@ -0,0 +1,204 @@
+#include "../berrno.h"
+#include "avformat.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// 索引缓存。解析文件头和索引的结果保存在媒体文件旁边的"文件名.ffindex" 中，
+// 再次打开同一个文件时直接从缓存恢复，省去探测、文件头解析和读索引。
+// 缓存以媒体文件的路径、大小和修改时间为键，任何一项不符就当作没有缓存，
+// 重新解析并覆盖旧的缓存。缓存文件格式(小端)：
+//   'FIDX' 版本号 文件大小(64 位) 修改时间(64 位) 路径 文件格式名
+//   文件格式私有数据(write_cache 写入)
+//   缓存文件总大小(64 位) 'FEND'
+// 字符串存为32 位长度加字符。缓存先写到临时文件再改名，读到的总是完整的文件。
+
+#define INT_MAX 2147483647
+
+#define MKTAG(a, b, c, d) (a | (b << 8) | (c << 16) | (d << 24))
+
+#define INDEX_CACHE_TAG MKTAG('F', 'I', 'D', 'X')
+#define INDEX_CACHE_END MKTAG('F', 'E', 'N', 'D')
+#define INDEX_CACHE_VERSION 2 // 2: 重建的索引只有视频的第一块是关键帧
+#define INDEX_CACHE_SUFFIX ".ffindex"
+#define INDEX_CACHE_TRAILER 12
+
+extern AVInputFormat *first_iformat;
+
+static int index_cache_stat(const char *path, int64_t *size, int64_t *mtime) {
+#ifdef CONFIG_WIN32
+    struct _stat64 st;
+
+    if (_stat64(path, &st) < 0)
+        return -ENOENT;
+#else
+    struct stat st;
+
+    if (stat(path, &st) < 0)
+        return -ENOENT;
+#endif
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return 0;
+}
+
+static int index_cache_path(char *buf, int buf_size, const char *source,
+                            const char *suffix) {
+    pstrcpy(buf, buf_size, source);
+    if (pstrcat(buf, buf_size, INDEX_CACHE_SUFFIX) >= buf_size)
+        return -EINVAL;
+    if (suffix && pstrcat(buf, buf_size, suffix) >= buf_size)
+        return -EINVAL;
+    return 0;
+}
+
+static void put_string(ByteIOContext *pb, const char *str) {
+    int len = strlen(str);
+
+    put_le32(pb, len);
+    put_buffer(pb, (const unsigned char *)str, len);
+}
+
+// 读一个字符串，和str 相同时返回0。
+static int check_string(ByteIOContext *pb, const char *str) {
+    unsigned char buf[1024];
+    unsigned int len = get_le32(pb);
+
+    if (len >= sizeof(buf) || url_fread(pb, buf, len) != len)
+        return -1;
+    buf[len] = '\0';
+    return strcmp((char *)buf, str) ? -1 : 0;
+}
+
+// 打开filename 对应的索引缓存，检查缓存是否和文件一致，缓存中记录的文件格式
+// 必须支持从缓存恢复。成功时pb 指向文件格式私有数据的开始。
+int av_index_cache_open(AVIndexCache **pc, const char *filename) {
+    const char *source = url_local_path(filename);
+    char path[1024], name[64];
+    int64_t size, mtime;
+    AVIndexCache *c;
+    AVFileMapping *map;
+    AVInputFormat *fmt;
+    uint8_t *end;
+    unsigned int len;
+    int err;
+
+    *pc = NULL;
+    err = index_cache_stat(source, &size, &mtime);
+    if (err < 0)
+        return err;
+    err = index_cache_path(path, sizeof(path), source, NULL);
+    if (err < 0)
+        return err;
+
+    c = av_mallocz(sizeof(AVIndexCache));
+    if (!c)
+        return -ENOMEM;
+    err = av_file_map(path, &c->map);
+    if (err < 0) {
+        av_free(c);
+        return err;
+    }
+    map = c->map;
+
+    err = -EINVAL;
+    if (map->size < INDEX_CACHE_TRAILER || map->size > INT_MAX)
+        goto fail;
+    // 尾部记录的大小不符说明缓存文件不完整。
+    end = map->data + map->size - INDEX_CACHE_TRAILER;
+    if (url_open_buf(&c->pb, end, INDEX_CACHE_TRAILER, URL_RDONLY) < 0 ||
+        get_le64(&c->pb) != (uint64_t)map->size ||
+        get_le32(&c->pb) != INDEX_CACHE_END)
+        goto fail;
+
+    url_open_buf(&c->pb, map->data, (int)(map->size - INDEX_CACHE_TRAILER),
+                 URL_RDONLY);
+    if (get_le32(&c->pb) != INDEX_CACHE_TAG ||
+        get_le32(&c->pb) != INDEX_CACHE_VERSION ||
+        (int64_t)get_le64(&c->pb) != size || (int64_t)get_le64(&c->pb) != mtime ||
+        check_string(&c->pb, source) < 0)
+        goto fail;
+
+    len = get_le32(&c->pb);
+    if (len >= sizeof(name) ||
+        url_fread(&c->pb, (unsigned char *)name, len) != len)
+        goto fail;
+    name[len] = '\0';
+    for (fmt = first_iformat; fmt; fmt = fmt->next) {
+        if (!strcmp(fmt->name, name) && fmt->read_cache)
+            break;
+    }
+    if (!fmt)
+        goto fail;
+    c->iformat = fmt;
+
+    *pc = c;
+    return 0;
+
+fail:
+    av_file_mapping_unref(c->map);
+    av_free(c);
+    return err;
+}
+
+void av_index_cache_close(AVIndexCache *c) {
+    if (!c)
+        return;
+    av_file_mapping_unref(c->map);
+    av_free(c);
+}
+
+// 把s 的文件头和索引写到索引缓存，失败时不留下缓存文件。
+int av_index_cache_write(AVFormatContext *s) {
+    const char *source = url_local_path(s->filename);
+    char path[1024], tmp[1024], url[1040];
+    int64_t size, mtime;
+    ByteIOContext pb;
+    int err;
+
+    if (!s->iformat->write_cache)
+        return -EINVAL;
+    err = index_cache_stat(source, &size, &mtime);
+    if (err < 0)
+        return err;
+    if (index_cache_path(path, sizeof(path), source, NULL) < 0 ||
+        index_cache_path(tmp, sizeof(tmp), source, ".tmp") < 0)
+        return -EINVAL;
+
+    // 加上file: 前缀，避免路径被当作其他协议。
+    pstrcpy(url, sizeof(url), "file:");
+    pstrcat(url, sizeof(url), tmp);
+    if (url_fopen(&pb, url, URL_WRONLY) < 0)
+        return AVERROR_IO;
+
+    put_le32(&pb, INDEX_CACHE_TAG);
+    put_le32(&pb, INDEX_CACHE_VERSION);
+    put_le64(&pb, size);
+    put_le64(&pb, mtime);
+    put_string(&pb, source);
+    put_string(&pb, s->iformat->name);
+    err = s->iformat->write_cache(s, &pb);
+
+    put_flush_packet(&pb);
+    put_le64(&pb, pb.pos + INDEX_CACHE_TRAILER);
+    put_le32(&pb, INDEX_CACHE_END);
+    put_flush_packet(&pb);
+    if (url_ferror(&pb))
+        err = AVERROR_IO;
+    url_fclose(&pb);
+
+    if (err < 0) {
+        remove(tmp);
+        return err;
+    }
+#ifdef CONFIG_WIN32
+    // windows 下rename() 不能覆盖已有文件。
+    remove(path);
+#endif
+    if (rename(tmp, path) < 0) {
+        remove(tmp);
+        return AVERROR_IO;
+    }
+    return 0;
+}
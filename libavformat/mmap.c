@@ -0,0 +1,228 @@
+#include "../berrno.h"
+#include "../libavutil/atomic.h"
+#include "avformat.h"
+
+#ifdef CONFIG_WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 此文件实现mmap 广义协议，用"mmap:"前缀标示。整个本地文件映射到内存，
+// ByteIOContext 的缓存直接指向映射区，av_get_packet() 交出的数据包也直接指向
+// 映射区，省去read() 到缓存和缓存到数据包的两次拷贝。
+// 映射区有引用计数，数据包持有引用，关闭文件后未释放的数据包仍然有效。
+
+// 映射整个文件，映射成功后引用计数为1。
+int av_file_map(const char *filename, AVFileMapping **pmap) {
+    AVFileMapping *map;
+
+    *pmap = NULL;
+    map = av_mallocz(sizeof(AVFileMapping));
+    if (!map)
+        return -ENOMEM;
+
+#ifdef CONFIG_WIN32
+    {
+        HANDLE file, mapping;
+        LARGE_INTEGER size;
+
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            av_free(map);
+            return -ENOENT;
+        }
+        if (!GetFileSizeEx(file, &size) || (size_t)size.QuadPart != size.QuadPart) {
+            CloseHandle(file);
+            av_free(map);
+            return -ENOMEM;
+        }
+        map->size = size.QuadPart;
+        // 空文件不能创建映射对象，这时只保留大小为0 的映射。
+        if (map->size > 0) {
+            mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping) {
+                map->data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+            if (!map->data) {
+                CloseHandle(file);
+                av_free(map);
+                return -ENOMEM;
+            }
+        }
+        CloseHandle(file);
+    }
+#else
+    {
+        struct stat st;
+        int fd;
+
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            av_free(map);
+            return -ENOENT;
+        }
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size != st.st_size) {
+            close(fd);
+            av_free(map);
+            return -ENOMEM;
+        }
+        map->size = st.st_size;
+        if (map->size > 0) {
+            map->data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map->data == MAP_FAILED) {
+                close(fd);
+                av_free(map);
+                return -ENOMEM;
+            }
+        }
+        close(fd);
+    }
+#endif
+
+    map->refcount = 1;
+    *pmap = map;
+    return 0;
+}
+
+void av_file_mapping_ref(AVFileMapping *map) {
+    av_atomic_int_add_and_fetch(&map->refcount, 1);
+}
+
+// 释放一个引用，最后一个引用释放时解除映射。
+void av_file_mapping_unref(AVFileMapping *map) {
+    if (av_atomic_int_add_and_fetch(&map->refcount, -1) > 0)
+        return;
+    if (map->data) {
+#ifdef CONFIG_WIN32
+        UnmapViewOfFile(map->data);
+#else
+        munmap(map->data, map->size);
+#endif
+    }
+    av_free(map);
+}
+
+// 数据包的destruct 回调，只释放映射区的引用。
+static void av_destruct_mapped_packet(AVPacket *pkt) {
+    if (!pkt->data) // 已经释放过
+        return;
+    av_file_mapping_unref(pkt->priv);
+    pkt->data = NULL;
+    pkt->size = 0;
+    pkt->priv = NULL;
+}
+
+// 广义文件是内存映射的，把数据包直接指向映射区。
+// 映射区末尾不足FF_INPUT_BUFFER_PADDING_SIZE 字节的填充时无法安全越界读，
+// 返回-1 由调用者退回拷贝方式。注意填充区是文件后续数据，不保证为0，
+// 数据包也是只读的，解码器不能改写。
+int av_get_mapped_packet(ByteIOContext *s, AVPacket *pkt, int size) {
+    AVFileMapping *map = s->mapping;
+    offset_t pos;
+
+    if (!map || size < 0)
+        return -1;
+    pos = url_ftell(s);
+    if (pos < 0 || pos + size + FF_INPUT_BUFFER_PADDING_SIZE > map->size)
+        return -1;
+
+    av_file_mapping_ref(map);
+    pkt->pts = AV_NOPTS_VALUE;
+    pkt->dts = AV_NOPTS_VALUE;
+    pkt->flags = 0;
+    pkt->stream_index = 0;
+    pkt->pos = pos;
+    pkt->data = map->data + pos;
+    pkt->size = size;
+    pkt->destruct = av_destruct_mapped_packet;
+    pkt->priv = map;
+
+    // 跳过数据包，映射方式下seek 只是移动缓存窗口。
+    url_fseek(s, pos + size, SEEK_SET);
+    return size;
+}
+
+// mmap 协议的上下文，记录映射区和当前读位置。
+typedef struct MmapContext {
+    AVFileMapping *map;
+    offset_t pos;
+} MmapContext;
+
+static int mmap_open(URLContext *h, const char *filename, int flags) {
+    MmapContext *c;
+    int err;
+
+    // 只读协议
+    if (flags & (URL_WRONLY | URL_RDWR))
+        return -EINVAL;
+    strstart(filename, "mmap:", &filename);
+
+    c = av_mallocz(sizeof(MmapContext));
+    if (!c)
+        return -ENOMEM;
+    err = av_file_map(filename, &c->map);
+    if (err < 0) {
+        av_free(c);
+        return err;
+    }
+    h->priv_data = c;
+    return 0;
+}
+
+// 普通读操作直接从映射区拷贝，供探测文件格式等场合使用。
+static int mmap_read(URLContext *h, unsigned char *buf, int size) {
+    MmapContext *c = h->priv_data;
+    offset_t left = c->map->size - c->pos;
+
+    if (left <= 0)
+        return 0;
+    if (size > left)
+        size = (int)left;
+    memcpy(buf, c->map->data + c->pos, size);
+    c->pos += size;
+    return size;
+}
+
+static offset_t mmap_seek(URLContext *h, offset_t pos, int whence) {
+    MmapContext *c = h->priv_data;
+
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        pos += c->pos;
+        break;
+    case SEEK_END:
+        pos += c->map->size;
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (pos < 0)
+        return -EINVAL;
+    c->pos = pos;
+    return pos;
+}
+
+static int mmap_close(URLContext *h) {
+    MmapContext *c = h->priv_data;
+
+    av_file_mapping_unref(c->map);
+    av_free(c);
+    return 0;
+}
+
+static AVFileMapping *mmap_get_mapping(URLContext *h) {
+    MmapContext *c = h->priv_data;
+    return c->map;
+}
+
+URLProtocol mmap_protocol = {
+    "mmap", mmap_open, mmap_read, NULL, mmap_seek, mmap_close, mmap_get_mapping,
+};
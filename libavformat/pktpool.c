@@ -0,0 +1,208 @@
+#include "../berrno.h"
+#include "../libavutil/thread.h"
+#include "avformat.h"
+
+// 数据包缓存池。av_get_packet() 原先每读一包就malloc 一次，解码后再free，
+// 这里按2 的幂分级缓存用过的数据包缓存，稳定状态下解复用/解码循环不再分配堆内存。
+// 缓存池由AVFormatContext 创建和持有，借出的缓存通过AVPacket 的destruct
+// 回调归还，解码线程和解复用线程可以同时操作，所以用互斥量保护。
+
+#define INT_MAX 2147483647
+
+#define POOL_MIN_SHIFT 10 // 最小的缓存级别1KB
+#define POOL_NB_CLASSES 13 // 1KB ~ 4MB，更大的包直接分配
+#define POOL_MAX_CACHED (8 * 1024 * 1024) // 池中空闲缓存的总量上限
+
+// 每块缓存前面的管理头，数据区紧跟其后，由pkt->data 可以直接找到管理头。
+typedef struct PoolBuffer {
+    struct AVPacketPool *pool;
+    struct PoolBuffer *next; // 空闲链表
+    int size_class;          // 缓存级别，-1 表示超大包，不进入缓存池
+    int alloc_size;          // 数据区大小
+} PoolBuffer;
+
+// 管理头按32 字节对齐，保证数据区的对齐和malloc 一致。
+#define POOL_HEADER_SIZE ((sizeof(PoolBuffer) + 31) & ~31)
+
+struct AVPacketPool {
+    AVMutex mutex;
+    PoolBuffer *free_list[POOL_NB_CLASSES];
+    int refcount; // 所有者持有1 个，每个借出的缓存持有1 个
+    int closed;   // 所有者已释放，归还的缓存直接free
+    AVPacketPoolStats stats;
+};
+
+// 计算能容纳size 字节的最小缓存级别，超过最大级别返回-1。
+static int pool_size_class(unsigned int size) {
+    int c;
+
+    for (c = 0; c < POOL_NB_CLASSES; c++) {
+        if (size <= (1u << (c + POOL_MIN_SHIFT)))
+            return c;
+    }
+    return -1;
+}
+
+static void pool_free(AVPacketPool *pool) {
+    PoolBuffer *b, *next;
+    int c;
+
+    for (c = 0; c < POOL_NB_CLASSES; c++) {
+        for (b = pool->free_list[c]; b; b = next) {
+            next = b->next;
+            av_free(b);
+        }
+    }
+    av_mutex_destroy(&pool->mutex);
+    av_free(pool);
+}
+
+AVPacketPool *av_packet_pool_new(void) {
+    AVPacketPool *pool = av_mallocz(sizeof(AVPacketPool));
+
+    if (!pool)
+        return NULL;
+    if (av_mutex_init(&pool->mutex) < 0) {
+        av_free(pool);
+        return NULL;
+    }
+    pool->refcount = 1;
+    return pool;
+}
+
+// 所有者释放缓存池，空闲缓存立即释放；还有借出的缓存时，
+// 缓存池在最后一块缓存归还时才真正释放。
+void av_packet_pool_release(AVPacketPool **ppool) {
+    AVPacketPool *pool = *ppool;
+    PoolBuffer *b, *next;
+    int c, last;
+
+    if (!pool)
+        return;
+    *ppool = NULL;
+
+    av_mutex_lock(&pool->mutex);
+    pool->closed = 1;
+    for (c = 0; c < POOL_NB_CLASSES; c++) {
+        for (b = pool->free_list[c]; b; b = next) {
+            next = b->next;
+            pool->stats.bytes_cached -= b->alloc_size;
+            av_free(b);
+        }
+        pool->free_list[c] = NULL;
+    }
+    last = --pool->refcount == 0;
+    av_mutex_unlock(&pool->mutex);
+
+    if (last)
+        pool_free(pool);
+}
+
+// 数据包的destruct 回调，把缓存归还缓存池。
+static void pool_destruct_packet(AVPacket *pkt) {
+    PoolBuffer *b;
+    AVPacketPool *pool;
+    int last;
+
+    // 和av_destruct_packet() 一样可以重复调用，已经释放过时data 为NULL
+    if (!pkt->data)
+        return;
+    b = (PoolBuffer *)(pkt->data - POOL_HEADER_SIZE);
+    pool = b->pool;
+
+    av_mutex_lock(&pool->mutex);
+    pool->stats.bytes_in_use -= b->alloc_size;
+    if (!pool->closed && b->size_class >= 0 &&
+        pool->stats.bytes_cached + b->alloc_size <= POOL_MAX_CACHED) {
+        b->next = pool->free_list[b->size_class];
+        pool->free_list[b->size_class] = b;
+        pool->stats.bytes_cached += b->alloc_size;
+    } else {
+        av_free(b);
+    }
+    last = --pool->refcount == 0;
+    av_mutex_unlock(&pool->mutex);
+
+    if (last)
+        pool_free(pool);
+
+    pkt->data = NULL;
+    pkt->size = 0;
+}
+
+// 为数据包分配size 字节的数据缓存，末尾附加FF_INPUT_BUFFER_PADDING_SIZE
+// 字节清0 的填充区，并初始化包的其他字段。pool 为NULL 时退化为直接malloc。
+int av_packet_pool_alloc(AVPacketPool *pool, AVPacket *pkt, int size) {
+    PoolBuffer *b = NULL;
+    uint8_t *data;
+    int need, size_class, alloc_size;
+
+    // 加上填充和缓存块的头部都不能超过int 的范围
+    if (size < 0 ||
+        size > INT_MAX - FF_INPUT_BUFFER_PADDING_SIZE - POOL_HEADER_SIZE)
+        return AVERROR_NOMEM;
+    need = size + FF_INPUT_BUFFER_PADDING_SIZE;
+
+    if (!pool) {
+        data = av_malloc(need);
+        if (!data)
+            return AVERROR_NOMEM;
+        pkt->destruct = av_destruct_packet;
+    } else {
+        size_class = pool_size_class(need);
+        alloc_size = size_class >= 0 ? 1 << (size_class + POOL_MIN_SHIFT) : need;
+
+        av_mutex_lock(&pool->mutex);
+        pool->stats.requests++;
+        if (size_class >= 0 && pool->free_list[size_class]) {
+            // 命中，直接从空闲链表取
+            b = pool->free_list[size_class];
+            pool->free_list[size_class] = b->next;
+            pool->stats.hits++;
+            pool->stats.bytes_cached -= alloc_size;
+        }
+        av_mutex_unlock(&pool->mutex);
+
+        if (!b) {
+            b = av_malloc(POOL_HEADER_SIZE + alloc_size);
+            if (!b)
+                return AVERROR_NOMEM;
+            b->pool = pool;
+            b->size_class = size_class;
+            b->alloc_size = alloc_size;
+        }
+
+        av_mutex_lock(&pool->mutex);
+        pool->refcount++;
+        pool->stats.bytes_in_use += alloc_size;
+        if (pool->stats.bytes_in_use + pool->stats.bytes_cached >
+            pool->stats.peak_bytes)
+            pool->stats.peak_bytes =
+                pool->stats.bytes_in_use + pool->stats.bytes_cached;
+        av_mutex_unlock(&pool->mutex);
+
+        b->next = NULL;
+        data = (uint8_t *)b + POOL_HEADER_SIZE;
+        pkt->destruct = pool_destruct_packet;
+    }
+
+    memset(data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
+    // 初始化相关值
+    pkt->pts = AV_NOPTS_VALUE;
+    pkt->dts = AV_NOPTS_VALUE;
+    pkt->pos = -1;
+    pkt->flags = 0;
+    pkt->stream_index = 0;
+    pkt->data = data;
+    pkt->size = size;
+    pkt->priv = NULL;
+    return 0;
+}
+
+// 取缓存池的统计信息，命中率为hits / requests。
+void av_packet_pool_get_stats(AVPacketPool *pool, AVPacketPoolStats *stats) {
+    av_mutex_lock(&pool->mutex);
+    *stats = pool->stats;
+    av_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,509 @@
+#include "../berrno.h"
+#include "avformat.h"
+
+#ifdef CONFIG_WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __NR_io_uring_setup
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+#endif
+
+// 此文件实现uring 广义协议，用"uring:"前缀标示。file 协议每次只有一个同步的
+// read()，磁盘队列深度始终是1。uring 协议把文件按块缓存，同时发起多个异步读：
+// 顺序读时保持后面几块在途，url_prefetch() 还可以提前发起分散位置的读，
+// 供非交织AVI 这类需要来回跳着读的文件使用。
+// 异步读的实现：windows 用重叠I/O，linux 用io_uring 系统调用，不依赖liburing；
+// 内核不支持io_uring 或者其他平台时退回同步pread()。
+// 只读协议。
+
+#define URING_BLOCK_SIZE (64 * 1024) // 块大小，块在文件中按块大小对齐
+#define URING_NB_BLOCKS 16           // 块缓存数，也是最大的队列深度
+#define URING_READAHEAD 4            // 顺序读时在途的后续块数
+
+enum { BLOCK_FREE, BLOCK_PENDING, BLOCK_DONE };
+
+typedef struct UringBlock {
+    uint8_t *data;
+    offset_t pos;      // 块在文件中的起始位置
+    int len;           // 读到的字节数，<0 是错误码
+    int state;
+    unsigned last_use; // 最近使用时间，淘汰最久未用的块
+#ifdef CONFIG_WIN32
+    OVERLAPPED ov;
+#elif defined(HAVE_IO_URING)
+    struct iovec iov;
+#endif
+} UringBlock;
+
+#ifdef HAVE_IO_URING
+// io_uring 的提交队列和完成队列，都是和内核共享的环形缓冲区。
+typedef struct UringRing {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned sq_local_tail; // 已经填好还没有告诉内核的提交项
+} UringRing;
+#endif
+
+typedef struct UringContext {
+#ifdef CONFIG_WIN32
+    HANDLE file;
+#else
+    int fd;
+#endif
+#ifdef HAVE_IO_URING
+    UringRing ring;
+    int use_ring; // io_uring 初始化失败时为0，退回同步读
+    // io_uring_enter() 出错后不再使用io_uring，改用同步读。
+    int ring_failed;
+#endif
+    offset_t pos;  // 当前读位置
+    offset_t size; // 文件大小
+    unsigned clock;
+    UringBlock blocks[URING_NB_BLOCKS];
+} UringContext;
+
+#ifdef HAVE_IO_URING
+static int ring_init(UringRing *r, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED ||
+        r->sqes == MAP_FAILED) {
+        if (r->sq_ptr != MAP_FAILED)
+            munmap(r->sq_ptr, r->sq_size);
+        if (r->cq_ptr != MAP_FAILED)
+            munmap(r->cq_ptr, r->cq_size);
+        if (r->sqes != MAP_FAILED)
+            munmap(r->sqes, r->sqes_size);
+        close(r->fd);
+        return -1;
+    }
+
+    r->sq_head = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((uint8_t *)r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *)((uint8_t *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((uint8_t *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((uint8_t *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((uint8_t *)r->cq_ptr + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+    return 0;
+}
+
+static void ring_end(UringRing *r) {
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->cq_ptr, r->cq_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->fd);
+}
+
+// 填一个读请求到提交队列，等ring_enter() 一次提交。
+static void ring_queue_read(UringRing *r, int fd, UringBlock *b) {
+    unsigned index = r->sq_local_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+
+    b->iov.iov_base = b->data;
+    b->iov.iov_len = URING_BLOCK_SIZE;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = fd;
+    sqe->off = b->pos;
+    sqe->addr = (unsigned long)&b->iov;
+    sqe->len = 1;
+    sqe->user_data = (unsigned long)b;
+    r->sq_array[index] = index;
+    r->sq_local_tail++;
+}
+
+// 提交所有填好的请求，wait 非0 时至少等一个请求完成。
+static int ring_enter(UringRing *r, int wait) {
+    unsigned to_submit;
+    int ret;
+
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    to_submit = r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (!to_submit && !wait)
+        return 0;
+    do {
+        ret = syscall(__NR_io_uring_enter, r->fd, to_submit, wait ? 1 : 0,
+                      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -1 : 0;
+}
+
+// 取出所有已完成的请求，标记相应的块。
+static void ring_reap(UringRing *r) {
+    unsigned head = *r->cq_head;
+    struct io_uring_cqe *cqe;
+    UringBlock *b;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &r->cqes[head & *r->cq_mask];
+        b = (UringBlock *)(unsigned long)cqe->user_data;
+        b->len = cqe->res;
+        b->state = BLOCK_DONE;
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+// 发起一块的读操作。同步方式下直接读完。
+static void block_queue(UringContext *c, UringBlock *b) {
+#ifdef CONFIG_WIN32
+    HANDLE event = b->ov.hEvent;
+
+    memset(&b->ov, 0, sizeof(OVERLAPPED));
+    b->ov.hEvent = event;
+    b->state = BLOCK_PENDING;
+    b->ov.Offset = (DWORD)b->pos;
+    b->ov.OffsetHigh = (DWORD)(b->pos >> 32);
+    ResetEvent(b->ov.hEvent);
+    if (!ReadFile(c->file, b->data, URING_BLOCK_SIZE, NULL, &b->ov) &&
+        GetLastError() != ERROR_IO_PENDING) {
+        b->len = GetLastError() == ERROR_HANDLE_EOF ? 0 : -EIO;
+        b->state = BLOCK_DONE;
+    }
+#else
+    b->state = BLOCK_PENDING;
+#ifdef HAVE_IO_URING
+    if (c->use_ring && !c->ring_failed) {
+        ring_queue_read(&c->ring, c->fd, b);
+        return;
+    }
+#endif
+    b->len = pread(c->fd, b->data, URING_BLOCK_SIZE, b->pos);
+    if (b->len < 0)
+        b->len = -EIO;
+    b->state = BLOCK_DONE;
+#endif
+}
+
+#ifdef HAVE_IO_URING
+// io_uring 出错，在途的读不知道什么时候完成，内核仍可能写入这些块的缓存。
+// 缓存留给内核不再释放，块换一块新的缓存后空出来；分配失败的块一直保持在途，
+// 不再使用。
+static void ring_fail(UringContext *c) {
+    uint8_t *data;
+    int i;
+
+    c->ring_failed = 1;
+    for (i = 0; i < URING_NB_BLOCKS; i++) {
+        if (c->blocks[i].state != BLOCK_PENDING)
+            continue;
+        data = av_malloc(URING_BLOCK_SIZE);
+        if (!data)
+            continue;
+        c->blocks[i].data = data;
+        c->blocks[i].state = BLOCK_FREE;
+    }
+}
+#endif
+
+// 把已经发起的读操作一次提交给内核。
+static void block_flush(UringContext *c) {
+#ifdef HAVE_IO_URING
+    if (c->use_ring && !c->ring_failed && ring_enter(&c->ring, 0) < 0)
+        ring_fail(c);
+#endif
+}
+
+// 等一块读完。io_uring 出错时块可能空出来或者仍然在途，调用者要检查state。
+static void block_wait(UringContext *c, UringBlock *b) {
+#ifdef CONFIG_WIN32
+    DWORD n;
+
+    if (b->state != BLOCK_PENDING)
+        return;
+    if (GetOverlappedResult(c->file, &b->ov, &n, TRUE))
+        b->len = n;
+    else
+        b->len = GetLastError() == ERROR_HANDLE_EOF ? 0 : -EIO;
+    b->state = BLOCK_DONE;
+#elif defined(HAVE_IO_URING)
+    while (b->state == BLOCK_PENDING) {
+        ring_reap(&c->ring);
+        if (b->state != BLOCK_PENDING || c->ring_failed)
+            break;
+        if (ring_enter(&c->ring, 1) < 0)
+            ring_fail(c);
+    }
+#endif
+}
+
+// io_uring 出错时还在途的块，永远不会完成。
+static int block_lost(UringContext *c, UringBlock *b) {
+#ifdef HAVE_IO_URING
+    return b->state == BLOCK_PENDING && c->ring_failed;
+#else
+    return 0;
+#endif
+}
+
+static UringBlock *block_find(UringContext *c, offset_t pos) {
+    int i;
+
+    for (i = 0; i < URING_NB_BLOCKS; i++) {
+        if (c->blocks[i].state != BLOCK_FREE && c->blocks[i].pos == pos &&
+            !block_lost(c, &c->blocks[i]))
+            return &c->blocks[i];
+    }
+    return NULL;
+}
+
+// 取一块空闲的块缓存，没有空闲块时淘汰最久未用的已读完的块。
+// wait 非0 时所有块都在途也要等最早的一块读完并淘汰它，否则返回NULL。
+static UringBlock *block_alloc(UringContext *c, offset_t pos, int wait) {
+    UringBlock *b = NULL, *oldest = NULL;
+    int i;
+
+    for (i = 0; i < URING_NB_BLOCKS && !b; i++) {
+        if (c->blocks[i].state == BLOCK_FREE)
+            b = &c->blocks[i];
+    }
+    for (i = 0; i < URING_NB_BLOCKS && !b; i++) {
+        UringBlock *t = &c->blocks[i];
+        if (t->state == BLOCK_DONE && (!oldest || t->last_use < oldest->last_use))
+            oldest = t;
+    }
+    if (!b && !oldest && wait) {
+        for (i = 0; i < URING_NB_BLOCKS; i++) {
+            UringBlock *t = &c->blocks[i];
+            if (!oldest || t->last_use < oldest->last_use)
+                oldest = t;
+        }
+        block_flush(c);
+        block_wait(c, oldest);
+        if (oldest->state == BLOCK_PENDING) // io_uring 出错，块不能再用
+            return NULL;
+    }
+    if (!b)
+        b = oldest;
+    if (!b)
+        return NULL;
+
+    b->pos = pos;
+    b->last_use = ++c->clock;
+    block_queue(c, b);
+    return b;
+}
+
+// 等所有在途的读操作结束，释放块缓存和文件。
+static void uring_free(UringContext *c) {
+    int i;
+
+#ifdef CONFIG_WIN32
+    CancelIo(c->file);
+#endif
+    for (i = 0; i < URING_NB_BLOCKS; i++) {
+        block_wait(c, &c->blocks[i]);
+#ifdef CONFIG_WIN32
+        if (c->blocks[i].ov.hEvent)
+            CloseHandle(c->blocks[i].ov.hEvent);
+#endif
+        // 还在途的块内核可能还会写入，宁可不释放
+        if (c->blocks[i].state != BLOCK_PENDING)
+            av_free(c->blocks[i].data);
+    }
+#ifdef CONFIG_WIN32
+    CloseHandle(c->file);
+#else
+#ifdef HAVE_IO_URING
+    if (c->use_ring)
+        ring_end(&c->ring);
+#endif
+    close(c->fd);
+#endif
+    av_free(c);
+}
+
+static int uring_open(URLContext *h, const char *filename, int flags) {
+    UringContext *c;
+    int i;
+
+    // 只读协议
+    if (flags & (URL_WRONLY | URL_RDWR))
+        return -EINVAL;
+    strstart(filename, "uring:", &filename);
+
+    c = av_mallocz(sizeof(UringContext));
+    if (!c)
+        return -ENOMEM;
+
+#ifdef CONFIG_WIN32
+    {
+        LARGE_INTEGER size;
+
+        c->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+        if (c->file == INVALID_HANDLE_VALUE) {
+            av_free(c);
+            return -ENOENT;
+        }
+        if (GetFileSizeEx(c->file, &size))
+            c->size = size.QuadPart;
+    }
+#else
+    {
+        struct stat st;
+
+        c->fd = open(filename, O_RDONLY);
+        if (c->fd < 0) {
+            av_free(c);
+            return -ENOENT;
+        }
+        if (fstat(c->fd, &st) == 0)
+            c->size = st.st_size;
+    }
+#ifdef HAVE_IO_URING
+    c->use_ring = ring_init(&c->ring, URING_NB_BLOCKS) == 0;
+#endif
+#endif
+
+    for (i = 0; i < URING_NB_BLOCKS; i++) {
+        c->blocks[i].data = av_malloc(URING_BLOCK_SIZE);
+#ifdef CONFIG_WIN32
+        c->blocks[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (!c->blocks[i].ov.hEvent) {
+            uring_free(c);
+            return -ENOMEM;
+        }
+#endif
+        if (!c->blocks[i].data) {
+            uring_free(c);
+            return -ENOMEM;
+        }
+    }
+    h->priv_data = c;
+    return 0;
+}
+
+// 从块缓存拷贝数据，同时保证后面URING_READAHEAD 块已经发起读操作。
+static int uring_read(URLContext *h, unsigned char *buf, int size) {
+    UringContext *c = h->priv_data;
+    UringBlock *b;
+    offset_t start, pos;
+    int i, offset, len;
+
+    if (c->pos >= c->size)
+        return 0;
+    start = c->pos - c->pos % URING_BLOCK_SIZE;
+    b = block_find(c, start);
+    if (!b)
+        b = block_alloc(c, start, 1);
+    if (!b)
+        return -EIO;
+    b->last_use = ++c->clock;
+
+    for (i = 1; i <= URING_READAHEAD; i++) {
+        pos = start + (offset_t)i * URING_BLOCK_SIZE;
+        if (pos >= c->size)
+            break;
+        if (!block_find(c, pos) && !block_alloc(c, pos, 0))
+            break;
+    }
+    block_flush(c);
+    block_wait(c, b);
+
+    if (b->state != BLOCK_DONE) {
+        // io_uring 出错，块空出来时改用同步读
+        if (b->state == BLOCK_PENDING)
+            return -EIO;
+        block_queue(c, b);
+    }
+    if (b->len < 0) {
+        len = b->len;
+        b->state = BLOCK_FREE;
+        return len;
+    }
+    offset = (int)(c->pos - start);
+    if (offset >= b->len)
+        return 0;
+    len = b->len - offset;
+    if (len > size)
+        len = size;
+    memcpy(buf, b->data + offset, len);
+    c->pos += len;
+    return len;
+}
+
+static offset_t uring_seek(URLContext *h, offset_t pos, int whence) {
+    UringContext *c = h->priv_data;
+
+    switch (whence) {
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        pos += c->pos;
+        break;
+    case SEEK_END:
+        pos += c->size;
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (pos < 0)
+        return -EINVAL;
+    c->pos = pos;
+    return pos;
+}
+
+static int uring_close(URLContext *h) {
+    uring_free(h->priv_data);
+    return 0;
+}
+
+// 提前发起[pos, pos + size) 范围的读操作，不等待完成。
+// 块缓存都在途时放弃剩下的部分，只是提示，不影响正确性。
+static int uring_prefetch(URLContext *h, offset_t pos, int size) {
+    UringContext *c = h->priv_data;
+    offset_t end = pos + size;
+
+    if (pos < 0 || size < 0)
+        return -EINVAL;
+    if (end > c->size)
+        end = c->size;
+    for (pos -= pos % URING_BLOCK_SIZE; pos < end; pos += URING_BLOCK_SIZE) {
+        if (!block_find(c, pos) && !block_alloc(c, pos, 0))
+            break;
+    }
+    block_flush(c);
+    return 0;
+}
+
+URLProtocol uring_protocol = {
+    "uring", uring_open, uring_read, NULL, uring_seek, uring_close, NULL,
+    uring_prefetch,
+};
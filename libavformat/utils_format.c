@@ -2,7 +2,7 @@
 #include "avformat.h"
 #include <assert.h>
 
-#define UINT_MAX (0xffffffff)
+#define INT_MAX 2147483647
 
 #define PROBE_BUF_MIN 2048
 #define PROBE_BUF_MAX 131072
@@ -87,11 +87,25 @@ AVInputFormat *av_probe_input_format(AVProbeData *pd, int is_opened) {
     return fmt;
 }
 
-// 打开输入流，其中AVFormatParameters *ap 参数在瘦身后的ffplay
-// 中没有用到，保留为了不改变接口
-int av_open_input_stream(AVFormatContext **ic_ptr, ByteIOContext *pb,
-                         const char *filename, AVInputFormat *fmt,
-                         AVFormatParameters *ap) {
+// 释放文件格式已经创建的流，从索引缓存恢复失败时改用read_header() 前调用。
+static void free_streams(AVFormatContext *ic) {
+    int i;
+
+    if (ic->iformat->read_close)
+        ic->iformat->read_close(ic);
+    for (i = 0; i < ic->nb_streams; i++) {
+        av_index_free(ic->streams[i]);
+        av_free(ic->streams[i]->actx);
+        av_freep(&ic->streams[i]);
+    }
+    ic->nb_streams = 0;
+    memset(ic->priv_data, 0, ic->iformat->priv_data_size);
+}
+
+// 打开输入流，cache 非NULL 时先试着从索引缓存恢复文件头和索引。
+static int open_input_stream(AVFormatContext **ic_ptr, ByteIOContext *pb,
+                             const char *filename, AVInputFormat *fmt,
+                             AVFormatParameters *ap, AVIndexCache *cache) {
     int err;
     AVFormatContext *ic;
     AVFormatParameters default_ap;
@@ -110,10 +124,20 @@ int av_open_input_stream(AVFormatContext **ic_ptr, ByteIOContext *pb,
     }
     // 关联AVFormatContext和AVInputFormat
     ic->iformat = fmt;
+    if (filename)
+        pstrcpy(ic->filename, sizeof(ic->filename), filename);
     // 关联AVFormatContext和广义文件ByteIOContext
     if (pb)
         ic->pb = *pb;
 
+    // 创建数据包缓存池，读包时从中借用数据缓存。
+    ic->packet_pool = av_packet_pool_new();
+    if (!ic->packet_pool) {
+        err = AVERROR_NOMEM;
+        goto fail;
+    }
+    ic->pb.packet_pool = ic->packet_pool;
+
     if (fmt->priv_data_size > 0) {
         // 分配priv_data 指向的内存。
         ic->priv_data = av_mallocz(fmt->priv_data_size);
@@ -124,24 +148,46 @@ int av_open_input_stream(AVFormatContext **ic_ptr, ByteIOContext *pb,
     } else {
         ic->priv_data = NULL;
     }
+    if (cache) {
+        if (fmt->read_cache(ic, &cache->pb, ap) >= 0)
+            goto done;
+        free_streams(ic);
+        url_fseek(&ic->pb, 0, SEEK_SET);
+    }
+
     // 读取文件头，识别媒体流格式。
     err = ic->iformat->read_header(ic, ap);
     if (err < 0)
         goto fail;
 
+    // 写缓存失败不影响播放，下次打开时重新解析。
+    if (ap->index_cache && fmt->write_cache && filename)
+        av_index_cache_write(ic);
+
+done:
     *ic_ptr = ic;
     return 0;
 
     // 简单常规的错误处理。
 fail:
-    if (ic)
+    if (ic) {
         av_freep(&ic->priv_data);
+        av_packet_pool_release(&ic->packet_pool);
+    }
 
     av_free(ic);
     *ic_ptr = NULL;
     return err;
 }
 
+// 打开输入流，其中AVFormatParameters *ap 参数在瘦身后的ffplay
+// 中没有用到，保留为了不改变接口
+int av_open_input_stream(AVFormatContext **ic_ptr, ByteIOContext *pb,
+                         const char *filename, AVInputFormat *fmt,
+                         AVFormatParameters *ap) {
+    return open_input_stream(ic_ptr, pb, filename, fmt, ap, NULL);
+}
+
 // 打开输入文件，并识别文件格式，然后调用函数识别媒体流格式。
 int av_open_input_file(AVFormatContext **ic_ptr, const char *filename,
                        AVInputFormat *fmt, int buf_size,
@@ -149,6 +195,7 @@ int av_open_input_file(AVFormatContext **ic_ptr, const char *filename,
     int err, must_open_file, file_opened, probe_size;
     AVProbeData probe_data, *pd = &probe_data;
     ByteIOContext pb1, *pb = &pb1;
+    AVIndexCache *cache = NULL;
 
     file_opened = 0;
     pd->filename = "";
@@ -159,6 +206,11 @@ int av_open_input_file(AVFormatContext **ic_ptr, const char *filename,
 
     must_open_file = 1;
 
+    // 有和文件一致的索引缓存时用缓存中记录的文件格式，不再探测。
+    if (!fmt && filename && ap && ap->index_cache &&
+        av_index_cache_open(&cache, filename) >= 0)
+        fmt = cache->iformat;
+
     if (!fmt || must_open_file) {
         // 打开输入文件，关联ByteIOContext，经过跳转几次后才实质调用文件系统open()函数实质打开文件。
         if (url_fopen(pb, filename, URL_RDONLY) < 0) {
@@ -203,14 +255,21 @@ int av_open_input_file(AVFormatContext **ic_ptr, const char *filename,
         goto fail;
     }
 
+    // 探测完成后再打开预读，探测阶段来回seek 不会打断预读。
+    // 预读失败不影响播放，退回同步读。
+    if (ap && ap->readahead_buffers > 0)
+        url_setreadahead(pb, ap->readahead_buffers);
+
     // 识别出文件格式后，调用函数识别流av_open_input_stream 格式。
-    err = av_open_input_stream(ic_ptr, pb, filename, fmt, ap);
+    err = open_input_stream(ic_ptr, pb, filename, fmt, ap, cache);
     if (err)
         goto fail;
+    av_index_cache_close(cache);
     return 0;
 
 fail:
     // 简单的异常错误处理。
+    av_index_cache_close(cache);
     av_freep(&pd->buf);
     if (file_opened)
         url_fclose(pb);
@@ -223,87 +282,40 @@ int av_read_packet(AVFormatContext *s, AVPacket *pkt) {
     return s->iformat->read_packet(s, pkt);
 }
 
-// 添加索引到索引表。有些媒体文件为便于seek，有音视频数据帧有索引，ffplay
-// 把这些索引以时间排序放到一个数据中。返回值添加项的索引。
-int av_add_index_entry(AVStream *st, int64_t pos, int64_t timestamp, int size,
-                       int distance, int flags) {
-    AVIndexEntry *entries, *ie;
-    int index;
-
-    if ((unsigned)st->nb_index_entries + 1 >=
-        UINT_MAX / sizeof(AVIndexEntry)) // 越界判断
-        return -1;
+// 返回seek 时默认使用的流，有视频流时是第一个视频流，否则是第一个流。
+int av_find_default_stream_index(AVFormatContext *s) {
+    int i;
 
-    entries =
-        av_fast_realloc(st->index_entries, &st->index_entries_allocated_size,
-                        (st->nb_index_entries + 1) * sizeof(AVIndexEntry));
-    if (!entries)
+    if (s->nb_streams <= 0)
         return -1;
-
-    st->index_entries = entries;
-
-    index = av_index_search_timestamp(st, timestamp, AVSEEK_FLAG_ANY);
-
-    if (index < 0) // 后续
-    {
-        index = st->nb_index_entries++;
-        ie = &entries[index];
-        assert(index == 0 || ie[-1].timestamp < timestamp);
-    } else // 中插
-    {
-        ie = &entries[index];
-        if (ie->timestamp != timestamp) {
-            if (ie->timestamp <= timestamp)
-                return -1;
-
-            memmove(entries + index + 1, entries + index,
-                    sizeof(AVIndexEntry) * (st->nb_index_entries - index));
-
-            st->nb_index_entries++;
-        }
+    for (i = 0; i < s->nb_streams; i++) {
+        if (s->streams[i]->actx->codec_type == CODEC_TYPE_VIDEO)
+            return i;
     }
-
-    ie->pos = pos;
-    ie->timestamp = timestamp;
-    ie->size = size;
-    ie->flags = flags;
-
-    return index;
+    return 0;
 }
 
-int av_index_search_timestamp(AVStream *st, int64_t wanted_timestamp,
-                              int flags) {
-    AVIndexEntry *entries = st->index_entries;
-    int nb_entries = st->nb_index_entries;
-    int a, b, m;
-    int64_t timestamp;
-
-    a = -1;
-    b = nb_entries;
-
-    while (b - a > 1) // 并没有记录idx值，采用的是折半查找
-    {
-        m = (a + b) >> 1;
-        timestamp = entries[m].timestamp;
-        if (timestamp >= wanted_timestamp)
-            b = m;
-        if (timestamp <= wanted_timestamp)
-            a = m;
-    }
-
-    m = (flags & AVSEEK_FLAG_BACKWARD) ? a : b;
-
-    if (!(flags & AVSEEK_FLAG_ANY)) {
-        while (m >= 0 && m < nb_entries &&
-               !(entries[m].flags & AVINDEX_KEYFRAME)) {
-            m += (flags & AVSEEK_FLAG_BACKWARD) ? -1 : 1;
-        }
-    }
+// seek 到stream_index 流中timestamp 对应的帧，默认找之后最近的关键帧，
+// AVSEEK_FLAG_BACKWARD 时找之前的，AVSEEK_FLAG_ANY 时不要求关键帧。
+// stream_index 为-1 时使用默认流，timestamp 以AV_TIME_BASE 为单位，否则以流的
+// 时间基为单位；AVSEEK_FLAG_BYTE 时timestamp 是文件位置。
+// 成功后下一次av_read_packet() 从新的位置读包，文件格式不支持seek 时返回-1。
+int av_seek_frame(AVFormatContext *s, int stream_index, int64_t timestamp,
+                  int flags) {
+    AVStream *st;
 
-    if (m == nb_entries)
+    if (!s->iformat->read_seek || stream_index >= s->nb_streams)
         return -1;
-
-    return m;
+    if (stream_index < 0) {
+        stream_index = av_find_default_stream_index(s);
+        if (stream_index < 0)
+            return -1;
+        st = s->streams[stream_index];
+        if (!(flags & AVSEEK_FLAG_BYTE))
+            timestamp = av_rescale(timestamp, st->time_base.den,
+                                   AV_TIME_BASE * (int64_t)st->time_base.num);
+    }
+    return s->iformat->read_seek(s, stream_index, timestamp, flags);
 }
 
 // 关闭输入媒体文件，一大堆的关闭释放操作。
@@ -316,13 +328,16 @@ void av_close_input_file(AVFormatContext *s) {
 
     for (i = 0; i < s->nb_streams; i++) {
         st = s->streams[i];
-        av_free(st->index_entries);
+        av_index_free(st);
         av_free(st->actx);
         av_free(st);
     }
 
     url_fclose(&s->pb);
 
+    // 还有未释放的数据包时，缓存池在最后一个包释放时才真正释放。
+    av_packet_pool_release(&s->packet_pool);
+
     av_freep(&s->priv_data);
     av_free(s);
 }
@@ -0,0 +1,66 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include "common.h"
+
+// 线程间共享整数的原子操作。get/set 带获取/释放语义，add_and_fetch 和
+// av_memory_barrier 是全屏障。windows vc 用Interlocked 系列内部函数实现，
+// linux gcc 用__atomic 内建函数实现。
+#ifdef CONFIG_WIN32
+#include <intrin.h>
+
+#pragma intrinsic(_ReadWriteBarrier, _InterlockedExchange,                    \
+                  _InterlockedExchangeAdd, _InterlockedCompareExchange)
+
+// x86 的普通读写本身就是获取/释放语义，只需阻止编译器重排。
+static inline int av_atomic_int_get(volatile int *ptr) {
+    int val = *ptr;
+    _ReadWriteBarrier();
+    return val;
+}
+
+static inline void av_atomic_int_set(volatile int *ptr, int val) {
+    _ReadWriteBarrier();
+    *ptr = val;
+}
+
+static inline int av_atomic_int_add_and_fetch(volatile int *ptr, int inc) {
+    return _InterlockedExchangeAdd((volatile long *)ptr, inc) + inc;
+}
+
+static inline int av_atomic_int_cas(volatile int *ptr, int oldval,
+                                    int newval) {
+    return _InterlockedCompareExchange((volatile long *)ptr, newval, oldval);
+}
+
+static inline void av_memory_barrier(void) {
+    long tmp;
+    _InterlockedExchange(&tmp, 0);
+}
+
+#else
+static inline int av_atomic_int_get(volatile int *ptr) {
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void av_atomic_int_set(volatile int *ptr, int val) {
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static inline int av_atomic_int_add_and_fetch(volatile int *ptr, int inc) {
+    return __atomic_add_fetch(ptr, inc, __ATOMIC_SEQ_CST);
+}
+
+static inline int av_atomic_int_cas(volatile int *ptr, int oldval,
+                                    int newval) {
+    __atomic_compare_exchange_n(ptr, &oldval, newval, 0, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST);
+    return oldval;
+}
+
+static inline void av_memory_barrier(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
+#endif
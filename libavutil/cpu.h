@@ -0,0 +1,86 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "common.h"
+
+// CPU 指令集检测，供各模块在初始化时选择SIMD 优化的实现函数。
+// 只检测x86 上用到的几种指令集，其他平台总是返回0，使用C 语言实现。
+#define AV_CPU_FLAG_SSE2 0x0001
+#define AV_CPU_FLAG_SSSE3 0x0002
+#define AV_CPU_FLAG_AVX2 0x0004
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) ||               \
+    defined(__x86_64__)
+#define ARCH_X86 1
+#endif
+
+// gcc 要在函数上标明使用的指令集才能用相应的内部函数，vc 不需要。
+#if defined(ARCH_X86) && defined(__GNUC__)
+#define AV_TARGET_SSE2 __attribute__((target("sse2")))
+#define AV_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define AV_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define AV_TARGET_SSE2
+#define AV_TARGET_SSSE3
+#define AV_TARGET_AVX2
+#endif
+
+#ifdef ARCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+
+static inline void av_cpuid(int leaf, int regs[4]) { __cpuidex(regs, leaf, 0); }
+
+static inline unsigned av_xgetbv(void) { return (unsigned)_xgetbv(0); }
+#else
+#include <cpuid.h>
+
+static inline void av_cpuid(int leaf, int regs[4]) {
+    unsigned a, b, c, d;
+
+    __cpuid_count(leaf, 0, a, b, c, d);
+    regs[0] = a;
+    regs[1] = b;
+    regs[2] = c;
+    regs[3] = d;
+}
+
+static inline unsigned av_xgetbv(void) {
+    unsigned eax, edx;
+
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return eax;
+}
+#endif
+#endif
+
+// 返回当前CPU 支持的指令集，AV_CPU_FLAG_* 的组合。
+// AVX2 还要求操作系统保存YMM 寄存器(XCR0 的第1、2 位)。
+static inline int av_get_cpu_flags(void) {
+    int flags = 0;
+#ifdef ARCH_X86
+    int regs[4], max_leaf;
+
+    av_cpuid(0, regs);
+    max_leaf = regs[0];
+    if (max_leaf < 1)
+        return 0;
+
+    av_cpuid(1, regs);
+    if (regs[3] & (1 << 26))
+        flags |= AV_CPU_FLAG_SSE2;
+    if (regs[2] & (1 << 9))
+        flags |= AV_CPU_FLAG_SSSE3;
+
+    // OSXSAVE 和AVX 都支持时才能检查XCR0
+    if ((regs[2] & (1 << 27)) && (regs[2] & (1 << 28)) &&
+        (av_xgetbv() & 6) == 6 && max_leaf >= 7) {
+        av_cpuid(7, regs);
+        if (regs[1] & (1 << 5))
+            flags |= AV_CPU_FLAG_AVX2;
+    }
+#endif
+    return flags;
+}
+
+#endif
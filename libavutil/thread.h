@@ -0,0 +1,116 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+#include "common.h"
+
+// 库内部使用的线程和线程同步原语，屏蔽windows 和linux 的差别。
+// windows vc 用临界区、条件变量和_beginthreadex 实现，linux gcc 用pthread 实现。
+#ifdef CONFIG_WIN32
+#include <process.h>
+#include <windows.h>
+
+typedef CRITICAL_SECTION AVMutex;
+typedef CONDITION_VARIABLE AVCond;
+
+typedef struct AVThread {
+    HANDLE handle;
+    void *(*func)(void *arg);
+    void *arg;
+} AVThread;
+
+static inline int av_mutex_init(AVMutex *m) {
+    InitializeCriticalSection(m);
+    return 0;
+}
+
+static inline void av_mutex_destroy(AVMutex *m) { DeleteCriticalSection(m); }
+static inline void av_mutex_lock(AVMutex *m) { EnterCriticalSection(m); }
+static inline void av_mutex_unlock(AVMutex *m) { LeaveCriticalSection(m); }
+
+static inline int av_cond_init(AVCond *c) {
+    InitializeConditionVariable(c);
+    return 0;
+}
+
+static inline void av_cond_destroy(AVCond *c) {}
+static inline void av_cond_signal(AVCond *c) { WakeConditionVariable(c); }
+static inline void av_cond_broadcast(AVCond *c) { WakeAllConditionVariable(c); }
+
+static inline void av_cond_wait(AVCond *c, AVMutex *m) {
+    SleepConditionVariableCS(c, m, INFINITE);
+}
+
+static unsigned __stdcall av_thread_entry(void *arg) {
+    AVThread *t = arg;
+    t->func(t->arg);
+    return 0;
+}
+
+// 创建线程，AVThread 结构在线程结束前必须保持有效。
+static inline int av_thread_create(AVThread *t, void *(*func)(void *arg),
+                                   void *arg) {
+    t->func = func;
+    t->arg = arg;
+    t->handle = (HANDLE)_beginthreadex(NULL, 0, av_thread_entry, t, 0, NULL);
+    return t->handle ? 0 : -1;
+}
+
+static inline void av_thread_join(AVThread *t) {
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+}
+
+// 返回逻辑CPU 个数。
+static inline int av_cpu_count(void) {
+    SYSTEM_INFO si;
+
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (int)si.dwNumberOfProcessors : 1;
+}
+
+#else
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t AVMutex;
+typedef pthread_cond_t AVCond;
+
+typedef struct AVThread {
+    pthread_t handle;
+} AVThread;
+
+static inline int av_mutex_init(AVMutex *m) {
+    return pthread_mutex_init(m, NULL) ? -1 : 0;
+}
+
+static inline void av_mutex_destroy(AVMutex *m) { pthread_mutex_destroy(m); }
+static inline void av_mutex_lock(AVMutex *m) { pthread_mutex_lock(m); }
+static inline void av_mutex_unlock(AVMutex *m) { pthread_mutex_unlock(m); }
+
+static inline int av_cond_init(AVCond *c) {
+    return pthread_cond_init(c, NULL) ? -1 : 0;
+}
+
+static inline void av_cond_destroy(AVCond *c) { pthread_cond_destroy(c); }
+static inline void av_cond_signal(AVCond *c) { pthread_cond_signal(c); }
+static inline void av_cond_broadcast(AVCond *c) { pthread_cond_broadcast(c); }
+
+static inline void av_cond_wait(AVCond *c, AVMutex *m) {
+    pthread_cond_wait(c, m);
+}
+
+static inline int av_thread_create(AVThread *t, void *(*func)(void *arg),
+                                   void *arg) {
+    return pthread_create(&t->handle, NULL, func, arg) ? -1 : 0;
+}
+
+static inline void av_thread_join(AVThread *t) { pthread_join(t->handle, NULL); }
+
+static inline int av_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+#endif
+
+#endif
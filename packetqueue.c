@@ -0,0 +1,199 @@
+#include "packetqueue.h"
+#include "./libavutil/atomic.h"
+
+// 字节数上限只作为没有dts 时的兜底保护，正常情况下按max_duration 限制缓存时长。
+#define MAX_QUEUE_SIZE (16 * 1024 * 1024)
+
+// 初始化队列，初始化为0 后再创建线程同步使用的互斥和条件。
+void packet_queue_init(PacketQueue *q) {
+    memset(q, 0, sizeof(PacketQueue));
+    av_mutex_init(&q->mutex);
+    av_cond_init(&q->cond);
+}
+
+// 唤醒因队列空或满而睡眠的对端线程。调用前必须有全屏障，保证对端要么看到
+// 本端新写的索引，要么本端看到对端增加的waiting 计数，不会丢失唤醒。
+static void packet_queue_wakeup(PacketQueue *q) {
+    if (av_atomic_int_get(&q->waiting)) {
+        av_mutex_lock(&q->mutex);
+        av_cond_broadcast(&q->cond);
+        av_mutex_unlock(&q->mutex);
+    }
+}
+
+// 睡眠等待，cond(q) 返回非0 时才真正睡眠，被唤醒后由调用者重新检查条件。
+static void packet_queue_wait(PacketQueue *q, int (*cond)(PacketQueue *q)) {
+    av_mutex_lock(&q->mutex);
+    av_atomic_int_add_and_fetch(&q->waiting, 1);
+    if (!q->abort_request && cond(q))
+        av_cond_wait(&q->cond, &q->mutex);
+    av_atomic_int_add_and_fetch(&q->waiting, -1);
+    av_mutex_unlock(&q->mutex);
+}
+
+// 把包的dts 换算成毫秒，没有dts 时返回0。
+static int packet_queue_dts_ms(PacketQueue *q, AVPacket *pkt) {
+    if (pkt->dts == AV_NOPTS_VALUE || !q->time_base.den)
+        return 0;
+    return (int)av_rescale(pkt->dts, 1000 * q->time_base.num, q->time_base.den);
+}
+
+// 队列中缓存数据的时长(毫秒)，即最近入队和最近出队的包的dts 之差。
+static int packet_queue_duration(PacketQueue *q) {
+    if (av_atomic_int_get(&q->windex) == av_atomic_int_get(&q->rindex))
+        return 0;
+    return av_atomic_int_get(&q->in_ms) - av_atomic_int_get(&q->out_ms);
+}
+
+// 环形缓冲区没有空闲槽位。
+static int packet_queue_no_slot(PacketQueue *q) {
+    return av_atomic_int_get(&q->windex) - av_atomic_int_get(&q->rindex) >=
+           PACKET_QUEUE_SIZE;
+}
+
+// 缓存的数据已经足够，解复用线程应暂停读包。
+static int packet_queue_is_full(PacketQueue *q) {
+    return packet_queue_no_slot(q) ||
+           av_atomic_int_get(&q->size) > MAX_QUEUE_SIZE ||
+           packet_queue_duration(q) > q->max_duration;
+}
+
+static int packet_queue_is_empty(PacketQueue *q) {
+    int rindex = av_atomic_int_get(&q->rindex);
+    return av_atomic_int_get(&q->windex) == rindex &&
+           rindex - av_atomic_int_get(&q->flush_index) >= 0;
+}
+
+// 释放读索引到end 之间的所有包，只能在消费者一侧或者消费者已停止时调用。
+static void packet_queue_drop(PacketQueue *q, int end) {
+    int rindex = q->rindex;
+    AVPacket *pkt;
+
+    while (rindex - end < 0) {
+        pkt = &q->pkts[rindex & PACKET_QUEUE_MASK];
+        av_atomic_int_add_and_fetch(&q->size, -pkt->size);
+        av_free_packet(pkt); // 释放音视频数据内存
+        rindex++;
+    }
+    av_atomic_int_set(&q->rindex, rindex);
+    av_memory_barrier();
+    packet_queue_wakeup(q);
+}
+
+// 刷新队列，丢弃目前已入队的所有包。
+// 环形队列的读端归消费者所有，这里只记录刷新位置，由消费者在下次取包时释放，
+// 所以生产者线程可以随时调用。
+void packet_queue_flush(PacketQueue *q) {
+    av_atomic_int_set(&q->flush_index, av_atomic_int_get(&q->windex));
+    av_memory_barrier();
+    packet_queue_wakeup(q);
+}
+
+// 释放队列占用所有资源，首先释放掉所有动态分配的内存，接着释放申请的互斥量和条件量。
+// 调用时消费者线程已经退出，直接释放剩余的包。
+void packet_queue_end(PacketQueue *q) {
+    packet_queue_drop(q, q->windex);
+    av_mutex_destroy(&q->mutex);
+    av_cond_destroy(&q->cond);
+}
+
+// 往音视频队列中挂接音视频数据帧/数据包，队列满时阻塞等待，请求退出时返回-1。
+int packet_queue_put(PacketQueue *q, AVPacket *pkt) {
+    int windex = q->windex;
+    int ms;
+
+    while (windex - av_atomic_int_get(&q->rindex) >= PACKET_QUEUE_SIZE) {
+        if (q->abort_request)
+            return -1;
+        packet_queue_wait(q, packet_queue_no_slot);
+    }
+    if (q->abort_request)
+        return -1;
+
+    q->pkts[windex & PACKET_QUEUE_MASK] = *pkt;
+    // 统计缓存的媒体数据大小和时长，队列为空时从本包开始计算时长。
+    av_atomic_int_add_and_fetch(&q->size, pkt->size);
+    if (pkt->dts != AV_NOPTS_VALUE) {
+        ms = packet_queue_dts_ms(q, pkt);
+        if (windex == av_atomic_int_get(&q->rindex))
+            av_atomic_int_set(&q->out_ms, ms);
+        av_atomic_int_set(&q->in_ms, ms);
+    }
+    // 发布新的写索引，之前对槽位的写入对消费者可见。
+    av_atomic_int_set(&q->windex, windex + 1);
+    av_memory_barrier();
+
+    // 如果解码线程因等待而睡眠就及时唤醒。
+    packet_queue_wakeup(q);
+    return 0;
+}
+
+// 设置异常请求退出状态。
+void packet_queue_abort(PacketQueue *q) {
+    av_mutex_lock(&q->mutex);
+
+    q->abort_request = 1; // 请求异常退出
+
+    av_cond_signal(&q->cond);
+
+    av_mutex_unlock(&q->mutex);
+}
+
+// 从队列中取出一帧/包数据。
+/* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block) {
+    int rindex, flush_index;
+
+    for (;;) {
+        // 如果异常请求退出标记置位，就带错误码返回。
+        if (q->abort_request)
+            return -1; // 异常
+
+        // 先处理刷新请求，丢弃刷新位置之前的包。
+        rindex = q->rindex;
+        flush_index = av_atomic_int_get(&q->flush_index);
+        if (rindex - flush_index < 0) {
+            packet_queue_drop(q, flush_index);
+            continue;
+        }
+
+        if (rindex != av_atomic_int_get(&q->windex)) {
+            // 如果队列中有数据，就取第一个数据包
+            *pkt = q->pkts[rindex & PACKET_QUEUE_MASK];
+            // 修正缓存的媒体大小和时长
+            av_atomic_int_add_and_fetch(&q->size, -pkt->size);
+            if (pkt->dts != AV_NOPTS_VALUE)
+                av_atomic_int_set(&q->out_ms, packet_queue_dts_ms(q, pkt));
+            av_atomic_int_set(&q->rindex, rindex + 1);
+            av_memory_barrier();
+            // 如果解复用线程因队列满而睡眠就及时唤醒。
+            packet_queue_wakeup(q);
+            return 1;
+        } else if (!block) // 阻塞标记，1(阻塞模式)，0(非阻塞模式)
+        {
+            return 0; // 非阻塞模式，没东西直接返回0
+        } else {
+            // 如果是阻塞模式，没数据就进入睡眠状态等待
+            packet_queue_wait(q, packet_queue_is_empty);
+        }
+    }
+}
+
+// 缓存的数据已经足够，并且没有中断等待的请求。
+static int packet_queue_wait_full(PacketQueue *q) {
+    return !q->interrupt && packet_queue_is_full(q);
+}
+
+// 解复用线程在队列缓存足够时睡眠，等解码线程取走数据腾出空间后被唤醒。
+void packet_queue_wait_space(PacketQueue *q) {
+    while (!q->abort_request && packet_queue_wait_full(q))
+        packet_queue_wait(q, packet_queue_wait_full);
+}
+
+// 设置或清除中断等待的请求，设置时唤醒在等待队列空间的解复用线程。
+void packet_queue_interrupt(PacketQueue *q, int interrupt) {
+    av_mutex_lock(&q->mutex);
+    q->interrupt = interrupt;
+    av_cond_broadcast(&q->cond);
+    av_mutex_unlock(&q->mutex);
+}
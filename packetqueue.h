@@ -0,0 +1,42 @@
+#ifndef PACKETQUEUE_H
+#define PACKETQUEUE_H
+
+#include "./libavformat/avformat.h"
+#include "./libavutil/thread.h"
+
+// ffplay 的音视频包队列，从ffplay.c 中独立出来，tools/ffbench 也用它做测试。
+
+// 包队列环形缓冲区的槽位数，必须是2 的幂，便于用位与代替取模。
+#define PACKET_QUEUE_SIZE 4096
+#define PACKET_QUEUE_MASK (PACKET_QUEUE_SIZE - 1)
+
+// 音视频数据包/数据帧队列数据结构定义
+// 单生产者(解复用线程)单消费者(解码线程)的无锁环形队列，读写索引用原子操作维护，
+// 只有在队列空或满需要睡眠等待时才用到互斥量和条件量。
+typedef struct PacketQueue {
+    AVPacket pkts[PACKET_QUEUE_SIZE]; // 环形缓冲区，直接存放AVPacket
+    volatile int windex; // 写索引，只由生产者修改，自由增长，用时取模
+    volatile int rindex; // 读索引，只由消费者修改，自由增长，用时取模
+    volatile int flush_index; // 刷新请求，消费者丢弃此索引之前的所有包
+    volatile int size;        // 缓存的媒体数据大小
+    volatile int waiting;     // 因队列空或满在cond 上睡眠的线程数
+    volatile int in_ms;  // 最近入队的包的dts，换算成毫秒
+    volatile int out_ms; // 最近出队的包的dts，换算成毫秒
+    AVRational time_base; // 所属流的时间基，用于把dts 换算成缓存时长
+    int max_duration;     // 缓存时长上限(毫秒)
+    int abort_request;
+    volatile int interrupt; // 非0 时解复用线程不再等待队列空间，及时处理seek 请求
+    AVMutex mutex;
+    AVCond cond;
+} PacketQueue;
+
+void packet_queue_init(PacketQueue *q);
+void packet_queue_end(PacketQueue *q);
+int packet_queue_put(PacketQueue *q, AVPacket *pkt);
+int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block);
+void packet_queue_flush(PacketQueue *q);
+void packet_queue_abort(PacketQueue *q);
+void packet_queue_wait_space(PacketQueue *q);
+void packet_queue_interrupt(PacketQueue *q, int interrupt);
+
+#endif
@@ -0,0 +1,129 @@
+#include "testavi.h"
+
+// 非交织AVI 的几种读法读到文件尾的结果都应该和只用pb 顺序读完全相同。
+// 合成文件有两个流，流0 的30 帧都存放在流1 的20 帧前面，按时间最后读的是
+// 流0 的后10 帧，索引读完后还要从流0 末尾接着往下找块。
+// 依次用不调度、调度、每个流独立I/O、两者都用的方式读，检查每个流的dts
+// 递增，包数不超过MAX_PACKETS，包的流号、dts、大小和内容和第一种读法一致。
+// 用法: avidec_test，有不一致时返回1。
+
+#define TEST_NAME "avidec_test.avi"
+#define MAX_PACKETS 1000
+
+typedef struct TestPacket {
+    int stream_index;
+    int64_t dts;
+    int size;
+    unsigned int crc;
+} TestPacket;
+
+static unsigned int checksum(const uint8_t *p, int size) {
+    unsigned int h = 2166136261u;
+
+    while (size--)
+        h = (h ^ *p++) * 16777619u;
+    return h;
+}
+
+// 读到文件尾，返回包数，打不开或者包太多返回-1。
+static int read_all(const char *filename, int sched, int stream_io,
+                    TestPacket *pkts) {
+    AVFormatContext *ic;
+    AVFormatParameters params;
+    AVPacket pkt;
+    int n = 0;
+
+    memset(&params, 0, sizeof(params));
+    params.ni_sched_packets = sched;
+    params.ni_stream_io = stream_io;
+    if (av_open_input_file(&ic, filename, NULL, 0, &params) < 0)
+        return -1;
+    while (av_read_packet(ic, &pkt) >= 0) {
+        if (n == MAX_PACKETS) {
+            av_free_packet(&pkt);
+            n = -1;
+            break;
+        }
+        pkts[n].stream_index = pkt.stream_index;
+        pkts[n].dts = pkt.dts;
+        pkts[n].size = pkt.size;
+        pkts[n].crc = checksum(pkt.data, pkt.size);
+        n++;
+        av_free_packet(&pkt);
+    }
+    av_close_input_file(ic);
+    return n;
+}
+
+// 检查每个流的dts 递增，返回0 表示通过。
+static int check_dts(const TestPacket *pkts, int n) {
+    int64_t last[TESTAVI_MAX_STREAMS];
+    int i, s;
+
+    for (s = 0; s < TESTAVI_MAX_STREAMS; s++)
+        last[s] = -1;
+    for (i = 0; i < n; i++) {
+        s = pkts[i].stream_index;
+        if (s < 0 || s >= TESTAVI_MAX_STREAMS || pkts[i].dts <= last[s])
+            return -1;
+        last[s] = pkts[i].dts;
+    }
+    return 0;
+}
+
+static int same_packets(const TestPacket *a, const TestPacket *b, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (a[i].stream_index != b[i].stream_index || a[i].dts != b[i].dts ||
+            a[i].size != b[i].size || a[i].crc != b[i].crc)
+            return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    static const int modes[4][2] = {{0, 0}, {16, 0}, {0, 1}, {16, 1}};
+    static TestPacket ref[MAX_PACKETS], pkts[MAX_PACKETS];
+    TestAvi t;
+    int nb_ref = -1, n, i, failed = 0;
+
+    av_register_all();
+
+    memset(&t, 0, sizeof(t));
+    t.width = 64;
+    t.height = 48;
+    t.nb_streams = 2;
+    t.nb_frames[0] = 30;
+    t.nb_frames[1] = 20;
+    t.keyint = 5;
+    t.non_interleaved = 1;
+    if (testavi_write(TEST_NAME, &t) < 0) {
+        printf("cannot write %s\n", TEST_NAME);
+        return 1;
+    }
+
+    for (i = 0; i < 4; i++) {
+        n = read_all(TEST_NAME, modes[i][0], modes[i][1], i ? pkts : ref);
+        if (!i)
+            nb_ref = n;
+        printf("sched %2d stream_io %d: ", modes[i][0], modes[i][1]);
+        if (n < 0) {
+            printf("FAILED, open failed or more than %d packets\n",
+                   MAX_PACKETS);
+            failed = 1;
+        } else if (check_dts(i ? pkts : ref, n) < 0) {
+            printf("FAILED, dts not increasing\n");
+            failed = 1;
+        } else if (i && (n != nb_ref || !same_packets(pkts, ref, n))) {
+            printf("FAILED, %d packets differ from plain reading\n", n);
+            failed = 1;
+        } else {
+            printf("ok (%d packets)\n", n);
+        }
+        if (nb_ref < 0)
+            break;
+    }
+    remove(TEST_NAME);
+    return failed;
+}
@@ -0,0 +1,30 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../libavformat/avformat.h"
+
+// tools/ffbench 的各项性能测试，每项测试是一个子命令，参数不含子命令本身，
+// 成功返回0，出错返回-1。
+
+// 单调时钟，以秒为单位，只用于计算时间差。
+double bench_now(void);
+
+// 读入整个文件，最大1GB，返回av_malloc() 分配的缓存，失败返回NULL。
+uint8_t *bench_read_file(const char *filename, int *size);
+
+// 把文件从系统缓存中清掉，模拟冷启动，只在linux 上支持，不支持时返回-1。
+int bench_drop_cache(const char *filename);
+
+unsigned int bench_rl32(const uint8_t *p);
+void bench_wl32(uint8_t *p, unsigned int v);
+
+int bench_queue(int argc, char **argv);
+int bench_uring(int argc, char **argv);
+int bench_resync(int argc, char **argv);
+int bench_idx1(int argc, char **argv);
+int bench_index(int argc, char **argv);
+int bench_index_cache(int argc, char **argv);
+int bench_convert(int argc, char **argv);
+int bench_msrle(int argc, char **argv);
+
+#endif
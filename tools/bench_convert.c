@@ -0,0 +1,356 @@
+#include "bench.h"
+#include "../libavutil/thread.h"
+
+// 图像格式转换的多线程扩展性: 每种转换和大小分别用1、2、4 个线程(或者命令行
+// 给出的线程数) 反复调用img_convert_frame()，至少转换MIN_FRAMES 帧、持续
+// MIN_TIME 秒，报告每秒帧数。源图像为随机数据，PAL8 的调色板也是随机的。
+// convert pal8 比较PAL8 转YUV420P 的查表直接转换和原来经过RGB24、YUV444P
+// 的转换，给出AVI 文件时测解码加转换，也就是ffplay 显示的路径。
+// convert context 比较每次调用img_convert() 和重复使用一个ImgConvertContext
+// 单线程转换同一帧。
+
+#define MIN_FRAMES 3
+#define MIN_TIME 0.5
+#define MAX_THREADS 16
+
+typedef struct ConvertCase {
+    const char *name;
+    int dst_fmt, src_fmt;
+} ConvertCase;
+
+static const ConvertCase cases[] = {
+    {"pal8>yuv420p", PIX_FMT_YUV420P, PIX_FMT_PAL8},
+    {"yuv420p>rgba32", PIX_FMT_RGBA32, PIX_FMT_YUV420P},
+    {"rgb565>yuv422p", PIX_FMT_YUV422P, PIX_FMT_RGB565},
+    {NULL}};
+
+// convert context 测试的转换
+static const ConvertCase context_cases[] = {
+    {"pal8>yuv420p", PIX_FMT_YUV420P, PIX_FMT_PAL8},
+    {"pal8>yuv422", PIX_FMT_YUV422, PIX_FMT_PAL8},
+    {"pal8>yuv422p", PIX_FMT_YUV422P, PIX_FMT_PAL8},
+    {"rgb565>yuv422p", PIX_FMT_YUV422P, PIX_FMT_RGB565},
+    {"yuv420p>bgr24", PIX_FMT_BGR24, PIX_FMT_YUV420P},
+    {NULL}};
+
+static const int sizes[][2] = {
+    {320, 240}, {640, 480}, {1920, 1080}, {3840, 2160}, {0, 0}};
+
+static unsigned int rnd_state = 1;
+
+static unsigned int rnd(void) {
+    rnd_state = rnd_state * 1664525 + 1013904223;
+    return rnd_state >> 8;
+}
+
+// 分配源图像和目标图像，源图像填入随机数据，成功返回0，出错返回-1。
+static int alloc_pictures(AVPicture *src, int src_fmt, AVPicture *dst,
+                          int dst_fmt, int width, int height) {
+    int i, size;
+
+    if (avpicture_alloc(src, src_fmt, width, height) < 0)
+        return -1;
+    if (avpicture_alloc(dst, dst_fmt, width, height) < 0) {
+        avpicture_free(src);
+        return -1;
+    }
+    size = avpicture_get_size(src_fmt, width, height);
+    for (i = 0; i < size; i++)
+        src->data[0][i] = (uint8_t)rnd();
+    return 0;
+}
+
+// 返回每秒帧数，出错返回-1。
+static double run_case(const ConvertCase *cc, int width, int height,
+                       int threads) {
+    ImgConvertContext *c;
+    AVPicture src, dst;
+    double start, t = 0;
+    int frames = 0;
+
+    if (alloc_pictures(&src, cc->src_fmt, &dst, cc->dst_fmt, width, height) < 0)
+        return -1;
+    c = img_convert_context_new(cc->dst_fmt, cc->src_fmt, width, height);
+    if (!c || img_convert_context_set_threads(c, threads) < 0) {
+        img_convert_context_free(c);
+        avpicture_free(&src);
+        avpicture_free(&dst);
+        return -1;
+    }
+    start = bench_now();
+    do {
+        if (img_convert_frame(c, &dst, &src) < 0)
+            break;
+        frames++;
+        t = bench_now() - start;
+    } while (frames < MIN_FRAMES || t < MIN_TIME);
+    img_convert_context_free(c);
+    avpicture_free(&src);
+    avpicture_free(&dst);
+    return frames && t > 0 ? frames / t : -1;
+}
+
+// 原来的PAL8 转YUV420P: img_convert() 没有直接的转换，经过RGB24 和YUV444P，
+// 每帧分配两个临时图像。
+static int pal8_convert_old(AVPicture *dst, const AVPicture *src, int width,
+                            int height) {
+    AVPicture rgb, yuv444;
+    int ret = -1;
+
+    if (avpicture_alloc(&rgb, PIX_FMT_RGB24, width, height) < 0)
+        return -1;
+    if (avpicture_alloc(&yuv444, PIX_FMT_YUV444P, width, height) < 0) {
+        avpicture_free(&rgb);
+        return -1;
+    }
+    if (img_convert(&rgb, PIX_FMT_RGB24, src, PIX_FMT_PAL8, width, height) >=
+            0 &&
+        img_convert(&yuv444, PIX_FMT_YUV444P, &rgb, PIX_FMT_RGB24, width,
+                    height) >= 0 &&
+        img_convert(dst, PIX_FMT_YUV420P, &yuv444, PIX_FMT_YUV444P, width,
+                    height) >= 0)
+        ret = 0;
+    avpicture_free(&rgb);
+    avpicture_free(&yuv444);
+    return ret;
+}
+
+static int pal8_convert_new(AVPicture *dst, const AVPicture *src, int width,
+                            int height) {
+    return img_convert(dst, PIX_FMT_YUV420P, src, PIX_FMT_PAL8, width, height);
+}
+
+// 随机图像反复转换，返回每秒帧数，出错返回-1。
+static double pal8_time(int (*convert)(AVPicture *, const AVPicture *, int,
+                                       int),
+                        AVPicture *dst, const AVPicture *src, int width,
+                        int height) {
+    double start, t = 0;
+    int frames = 0;
+
+    start = bench_now();
+    do {
+        if (convert(dst, src, width, height) < 0)
+            return -1;
+        frames++;
+        t = bench_now() - start;
+    } while (frames < MIN_FRAMES || t < MIN_TIME);
+    return t > 0 ? frames / t : -1;
+}
+
+// 解码filename 的第一个视频流，每帧用convert 转换成YUV420P，返回每秒帧数，
+// 出错返回-1。
+static double pal8_time_file(const char *filename,
+                             int (*convert)(AVPicture *, const AVPicture *,
+                                            int, int),
+                             int *nb_frames) {
+    AVFormatContext *ic;
+    AVFormatParameters params;
+    AVCodecContext *avctx = NULL;
+    AVCodec *codec;
+    AVFrame frame;
+    AVPicture pict;
+    AVPacket pkt;
+    double start, t;
+    int i, got_picture, frames = 0, ret = 0;
+
+    memset(&params, 0, sizeof(params));
+    if (av_open_input_file(&ic, filename, NULL, 0, &params) < 0)
+        return -1;
+    for (i = 0; i < ic->nb_streams; i++) {
+        if (ic->streams[i]->actx->codec_type == CODEC_TYPE_VIDEO) {
+            avctx = ic->streams[i]->actx;
+            break;
+        }
+    }
+    codec = avctx ? avcodec_find_decoder(avctx->codec_id) : NULL;
+    if (!codec || avcodec_open(avctx, codec) < 0) {
+        av_close_input_file(ic);
+        return -1;
+    }
+    if (avctx->pix_fmt != PIX_FMT_PAL8 ||
+        avpicture_alloc(&pict, PIX_FMT_YUV420P, avctx->width,
+                        avctx->height) < 0) {
+        avcodec_close(avctx);
+        av_close_input_file(ic);
+        return -1;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    start = bench_now();
+    while (ret >= 0 && av_read_packet(ic, &pkt) >= 0) {
+        if (pkt.stream_index == i) {
+            avcodec_decode_video(avctx, &frame, &got_picture, pkt.data,
+                                 pkt.size);
+            if (got_picture) {
+                ret = convert(&pict, (AVPicture *)&frame, avctx->width,
+                              avctx->height);
+                frames++;
+            }
+        }
+        av_free_packet(&pkt);
+    }
+    t = bench_now() - start;
+
+    avpicture_free(&pict);
+    avcodec_close(avctx);
+    av_close_input_file(ic);
+    *nb_frames = frames;
+    return ret >= 0 && frames && t > 0 ? frames / t : -1;
+}
+
+static int bench_pal8(int argc, char **argv) {
+    AVPicture src, dst_old, dst_new;
+    double fps_old, fps_new;
+    int i, size, frames, same;
+
+    if (argc > 0) {
+        fps_old = pal8_time_file(argv[0], pal8_convert_old, &frames);
+        fps_new = pal8_time_file(argv[0], pal8_convert_new, &frames);
+        if (fps_old < 0 || fps_new < 0) {
+            fprintf(stderr, "convert: cannot decode %s as PAL8 video\n",
+                    argv[0]);
+            return -1;
+        }
+        printf("%s: %d frames, decode + convert fps, old %8.1f, direct "
+               "%8.1f, x%.2f\n",
+               argv[0], frames, fps_old, fps_new, fps_new / fps_old);
+        return 0;
+    }
+
+    printf("pal8>yuv420p fps, old (RGB24, YUV444P) vs direct\n");
+    for (i = 0; sizes[i][0]; i++) {
+        if (alloc_pictures(&src, PIX_FMT_PAL8, &dst_old, PIX_FMT_YUV420P,
+                           sizes[i][0], sizes[i][1]) < 0)
+            return -1;
+        if (avpicture_alloc(&dst_new, PIX_FMT_YUV420P, sizes[i][0],
+                            sizes[i][1]) < 0) {
+            avpicture_free(&src);
+            avpicture_free(&dst_old);
+            return -1;
+        }
+        fps_old = pal8_time(pal8_convert_old, &dst_old, &src, sizes[i][0],
+                            sizes[i][1]);
+        fps_new = pal8_time(pal8_convert_new, &dst_new, &src, sizes[i][0],
+                            sizes[i][1]);
+        // 宽高都是偶数，两种转换的结果应该完全相同
+        size = avpicture_get_size(PIX_FMT_YUV420P, sizes[i][0], sizes[i][1]);
+        same = !memcmp(dst_old.data[0], dst_new.data[0], size);
+        printf("%4dx%-4d", sizes[i][0], sizes[i][1]);
+        if (fps_old < 0 || fps_new < 0)
+            printf(" failed\n");
+        else
+            printf(" %8.1f -> %8.1f, x%.2f%s\n", fps_old, fps_new,
+                   fps_new / fps_old, same ? "" : ", output differs");
+        avpicture_free(&src);
+        avpicture_free(&dst_old);
+        avpicture_free(&dst_new);
+    }
+    return 0;
+}
+
+// 返回每秒帧数，c 为NULL 时每次调用img_convert()，出错返回-1。
+static double context_time(const ConvertCase *cc, ImgConvertContext *c,
+                           AVPicture *dst, const AVPicture *src, int width,
+                           int height) {
+    double start, t = 0;
+    int frames = 0, ret;
+
+    start = bench_now();
+    do {
+        if (c)
+            ret = img_convert_frame(c, dst, src);
+        else
+            ret = img_convert(dst, cc->dst_fmt, src, cc->src_fmt, width,
+                              height);
+        if (ret < 0)
+            return -1;
+        frames++;
+        t = bench_now() - start;
+    } while (frames < MIN_FRAMES || t < MIN_TIME);
+    return t > 0 ? frames / t : -1;
+}
+
+static int bench_context(int argc, char **argv) {
+    const ConvertCase *cc;
+    ImgConvertContext *c;
+    AVPicture src, dst_call, dst_ctx;
+    double fps_call, fps_ctx;
+    int width = 320, height = 240, size, same;
+
+    if (argc > 0 && (sscanf(argv[0], "%dx%d", &width, &height) != 2 ||
+                     width <= 0 || height <= 0 || width > 16384 ||
+                     height > 16384))
+        return -1;
+
+    printf("%dx%d fps, img_convert() per call vs reused context\n", width,
+           height);
+    for (cc = context_cases; cc->name; cc++) {
+        if (alloc_pictures(&src, cc->src_fmt, &dst_call, cc->dst_fmt, width,
+                           height) < 0)
+            return -1;
+        if (avpicture_alloc(&dst_ctx, cc->dst_fmt, width, height) < 0) {
+            avpicture_free(&src);
+            avpicture_free(&dst_call);
+            return -1;
+        }
+        c = img_convert_context_new(cc->dst_fmt, cc->src_fmt, width, height);
+        fps_call = context_time(cc, NULL, &dst_call, &src, width, height);
+        fps_ctx = c ? context_time(cc, c, &dst_ctx, &src, width, height) : -1;
+        size = avpicture_get_size(cc->dst_fmt, width, height);
+        same = !memcmp(dst_call.data[0], dst_ctx.data[0], size);
+        printf("%-15s", cc->name);
+        if (fps_call < 0 || fps_ctx < 0)
+            printf(" failed\n");
+        else
+            printf(" %8.1f -> %8.1f, x%.2f%s\n", fps_call, fps_ctx,
+                   fps_ctx / fps_call, same ? "" : ", output differs");
+        img_convert_context_free(c);
+        avpicture_free(&src);
+        avpicture_free(&dst_call);
+        avpicture_free(&dst_ctx);
+    }
+    return 0;
+}
+
+int bench_convert(int argc, char **argv) {
+    int threads[MAX_THREADS], nb_threads, i, j, k;
+    double fps;
+
+    if (argc > 0 && !strcmp(argv[0], "pal8"))
+        return bench_pal8(argc - 1, argv + 1);
+    if (argc > 0 && !strcmp(argv[0], "context"))
+        return bench_context(argc - 1, argv + 1);
+    nb_threads = argc < MAX_THREADS ? argc : MAX_THREADS;
+    for (i = 0; i < nb_threads; i++) {
+        threads[i] = atoi(argv[i]);
+        if (threads[i] <= 0)
+            return -1;
+    }
+    if (!nb_threads) {
+        threads[0] = 1;
+        threads[1] = 2;
+        threads[2] = 4;
+        nb_threads = 3;
+    }
+
+    printf("%d cpus, fps with", av_cpu_count());
+    for (k = 0; k < nb_threads; k++)
+        printf(" %dT", threads[k]);
+    printf("\n");
+    for (i = 0; cases[i].name; i++) {
+        for (j = 0; sizes[j][0]; j++) {
+            printf("%-15s %4dx%-4d", cases[i].name, sizes[j][0], sizes[j][1]);
+            for (k = 0; k < nb_threads; k++) {
+                fps = run_case(&cases[i], sizes[j][0], sizes[j][1],
+                               threads[k]);
+                if (fps < 0)
+                    printf("   failed");
+                else
+                    printf(" %8.1f", fps);
+            }
+            printf("\n");
+        }
+    }
+    return 0;
+}
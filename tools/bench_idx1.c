@@ -0,0 +1,113 @@
+#include "bench.h"
+
+// 打开文件的时间和idx1 大小的关系。把给定AVI 的idx1 换成n 项合成的索引，
+// 写到ffbench_idx1.avi 后计时av_open_input_file()，测完后删除。
+// 合成的索引2/3 为视频、1/3 为音频，每7 项一个关键帧，位置按16 字节递增。
+// 每种大小打开OPEN_RUNS 次，取最短时间。
+
+#define IDX1_NAME "ffbench_idx1.avi"
+#define OPEN_RUNS 5
+
+// 用n 项合成索引替换idx1，成功返回0。
+static int write_idx1(const uint8_t *d, int idx1, int n) {
+    FILE *f;
+    uint8_t *ents, riff[8], head[8];
+    int k, ok;
+
+    ents = av_malloc(16 * n);
+    if (!ents)
+        return -1;
+    for (k = 0; k < n; k++) {
+        memcpy(ents + 16 * k, k % 3 ? "00dc" : "01wb", 4);
+        bench_wl32(ents + 16 * k + 4, k % 7 ? 0 : 0x10);
+        bench_wl32(ents + 16 * k + 8, 4 + 16 * k);
+        bench_wl32(ents + 16 * k + 12, 1000 + k % 13);
+    }
+    // RIFF 大小改为新文件大小减8，其余文件头不变
+    memcpy(riff, d, 4);
+    bench_wl32(riff + 4, idx1 + 16 * n);
+    memcpy(head, "idx1", 4);
+    bench_wl32(head + 4, 16 * n);
+
+    f = fopen(IDX1_NAME, "wb");
+    if (!f) {
+        av_free(ents);
+        return -1;
+    }
+    ok = fwrite(riff, 1, 8, f) == 8 &&
+         fwrite(d + 8, 1, idx1 - 8, f) == (size_t)(idx1 - 8) &&
+         fwrite(head, 1, 8, f) == 8 &&
+         fwrite(ents, 1, 16 * n, f) == (size_t)(16 * n);
+    if (fclose(f) != 0)
+        ok = 0;
+    av_free(ents);
+    return ok ? 0 : -1;
+}
+
+// 打开再关闭文件，返回秒数，entries 为所有流的索引项数。
+static double open_file(const char *filename, int *entries) {
+    AVFormatContext *ic;
+    AVFormatParameters params;
+    double start, t;
+    int i;
+
+    memset(&params, 0, sizeof(params));
+    start = bench_now();
+    if (av_open_input_file(&ic, filename, NULL, 0, &params) < 0)
+        return -1;
+    t = bench_now() - start;
+    *entries = 0;
+    for (i = 0; i < ic->nb_streams; i++)
+        *entries += ic->streams[i]->nb_index_entries;
+    av_close_input_file(ic);
+    return t;
+}
+
+int bench_idx1(int argc, char **argv) {
+    static const int default_sizes[3] = {1000, 100000, 500000};
+    uint8_t *d;
+    int size, idx1 = -1, i, n, run, entries, nb_sizes;
+    double t, best;
+
+    if (argc < 1) {
+        fprintf(stderr, "idx1: need an AVI file with an idx1 chunk\n");
+        return -1;
+    }
+    d = bench_read_file(argv[0], &size);
+    if (!d)
+        return -1;
+    for (i = size - 8; i >= 12; i--) {
+        if (!memcmp(d + i, "idx1", 4)) {
+            idx1 = i;
+            break;
+        }
+    }
+    if (idx1 < 0) {
+        fprintf(stderr, "idx1: no idx1 in %s\n", argv[0]);
+        av_free(d);
+        return -1;
+    }
+
+    nb_sizes = argc > 1 ? argc - 1 : 3;
+    for (i = 0; i < nb_sizes; i++) {
+        n = argc > 1 ? atoi(argv[i + 1]) : default_sizes[i];
+        if (n <= 0 || n > 16 * 1024 * 1024 || write_idx1(d, idx1, n) < 0) {
+            printf("%8d entries: cannot write %s\n", n, IDX1_NAME);
+            continue;
+        }
+        best = -1;
+        for (run = 0; run < OPEN_RUNS; run++) {
+            t = open_file(IDX1_NAME, &entries);
+            if (t >= 0 && (best < 0 || t < best))
+                best = t;
+        }
+        if (best < 0)
+            printf("%8d entries: open failed\n", n);
+        else
+            printf("%8d entries: open %8.3f ms %6.1f ns/entry, %d indexed\n",
+                   n, best * 1e3, best * 1e9 / n, entries);
+        remove(IDX1_NAME);
+    }
+    av_free(d);
+    return 0;
+}
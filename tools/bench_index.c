@@ -0,0 +1,130 @@
+#include "bench.h"
+
+// 索引表: 按AVI 中两种典型的流各建n 项索引。
+// video 时间戳逐项加1，每12 帧一个关键帧，包大小在2..50KB 之间变化；
+// audio 时间戳为累计的字节数，不规则增长，每项都是关键帧。
+// 报告建索引的时间、av_index_memory_usage()，以及同样内容存为原来的
+// AVIndexEntry 数组时的大小；再用同一组随机时间戳分别在AVIndex 和数组中
+// 向后查找关键帧，比较每次的耗时，并统计两者结果不同的次数，应为0。
+
+static unsigned int rnd_state = 1;
+
+static unsigned int rnd(void) {
+    rnd_state = rnd_state * 1664525 + 1013904223;
+    return rnd_state >> 8;
+}
+
+// 原来在AVIndexEntry 数组上的折半查找。
+static int array_search(const AVIndexEntry *entries, int nb_entries,
+                        int64_t wanted_timestamp, int flags) {
+    int a, b, m;
+    int64_t timestamp;
+
+    a = -1;
+    b = nb_entries;
+    while (b - a > 1) {
+        m = (a + b) >> 1;
+        timestamp = entries[m].timestamp;
+        if (timestamp >= wanted_timestamp)
+            b = m;
+        if (timestamp <= wanted_timestamp)
+            a = m;
+    }
+
+    m = (flags & AVSEEK_FLAG_BACKWARD) ? a : b;
+    if (!(flags & AVSEEK_FLAG_ANY)) {
+        while (m >= 0 && m < nb_entries &&
+               !(entries[m].flags & AVINDEX_KEYFRAME))
+            m += (flags & AVSEEK_FLAG_BACKWARD) ? -1 : 1;
+    }
+    if (m == nb_entries)
+        return -1;
+    return m;
+}
+
+static int build_index(AVStream *st, int audio, int n) {
+    int64_t pos = 4, timestamp = 0;
+    int i, size, flags;
+
+    for (i = 0; i < n; i++) {
+        if (audio) {
+            size = 1000 + rnd() % 3000;
+            flags = AVINDEX_KEYFRAME;
+        } else {
+            size = 2048 + rnd() % (48 * 1024);
+            flags = i % 12 ? 0 : AVINDEX_KEYFRAME;
+        }
+        if (av_add_index_entry(st, pos, timestamp, size, 0, flags) < 0)
+            return -1;
+        pos += 8 + size + (size & 1);
+        timestamp += audio ? size : 1;
+    }
+    return 0;
+}
+
+static int bench_stream(const char *name, int audio, int n, int lookups) {
+    AVStream st;
+    AVIndexEntry *entries;
+    int64_t *wanted, last;
+    double start, t_build, t_index, t_array;
+    int *found, i, mismatches = 0;
+
+    memset(&st, 0, sizeof(st));
+    start = bench_now();
+    if (build_index(&st, audio, n) < 0)
+        return -1;
+    t_build = bench_now() - start;
+
+    entries = av_malloc(n * sizeof(AVIndexEntry));
+    wanted = av_malloc(lookups * sizeof(int64_t));
+    found = av_malloc(lookups * sizeof(int));
+    if (!entries || !wanted || !found)
+        return -1;
+    for (i = 0; i < st.nb_index_entries; i++)
+        av_index_get_entry(&st, i, &entries[i]);
+    last = entries[st.nb_index_entries - 1].timestamp;
+    for (i = 0; i < lookups; i++)
+        wanted[i] = (int64_t)((double)rnd() / (1 << 24) * (last + 1));
+
+    start = bench_now();
+    for (i = 0; i < lookups; i++)
+        found[i] = av_index_search_timestamp(&st, wanted[i],
+                                             AVSEEK_FLAG_BACKWARD);
+    t_index = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i < lookups; i++) {
+        if (array_search(entries, st.nb_index_entries, wanted[i],
+                         AVSEEK_FLAG_BACKWARD) != found[i])
+            mismatches++;
+    }
+    t_array = bench_now() - start;
+
+    printf("%-5s build %7.1f ms, index %6.2f MB, array %6.2f MB\n", name,
+           t_build * 1e3, av_index_memory_usage(&st) / (1024.0 * 1024),
+           (double)n * sizeof(AVIndexEntry) / (1024 * 1024));
+    printf("%-5s lookup index %6.1f ns, array %6.1f ns, %d mismatches\n",
+           name, t_index * 1e9 / lookups, t_array * 1e9 / lookups,
+           mismatches);
+
+    av_index_free(&st);
+    av_free(entries);
+    av_free(wanted);
+    av_free(found);
+    return 0;
+}
+
+int bench_index(int argc, char **argv) {
+    int n, lookups;
+
+    n = argc > 0 ? atoi(argv[0]) : 360000;
+    lookups = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (n <= 0 || lookups <= 0)
+        return -1;
+
+    printf("%d entries, %d lookups\n", n, lookups);
+    if (bench_stream("video", 0, n, lookups) < 0 ||
+        bench_stream("audio", 1, n, lookups) < 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "bench.h"
+
+// 索引缓存: 打开文件并读出第一个包的时间，不用缓存时每次都要探测格式、解析
+// 文件头和idx1，用缓存时直接从"文件名.ffindex" 恢复。
+// warm 为文件都在系统缓存中，取runs 次中最短的时间；cold 为每次打开前把媒体
+// 文件和缓存文件从系统缓存中清掉，取平均时间，只在linux 上支持。
+// 测试前没有缓存文件时，测完后删除测试中生成的缓存文件。
+
+#define CACHE_SUFFIX ".ffindex"
+
+// 打开文件读出第一个包，返回秒数，出错返回-1。
+static double open_first_packet(const char *filename, int index_cache,
+                                int *entries) {
+    AVFormatContext *ic;
+    AVFormatParameters params;
+    AVPacket pkt;
+    double start, t;
+    int i;
+
+    memset(&params, 0, sizeof(params));
+    params.index_cache = index_cache;
+    start = bench_now();
+    if (av_open_input_file(&ic, filename, NULL, 0, &params) < 0)
+        return -1;
+    if (av_read_packet(ic, &pkt) < 0) {
+        av_close_input_file(ic);
+        return -1;
+    }
+    t = bench_now() - start;
+    av_free_packet(&pkt);
+    *entries = 0;
+    for (i = 0; i < ic->nb_streams; i++)
+        *entries += ic->streams[i]->nb_index_entries;
+    av_close_input_file(ic);
+    return t;
+}
+
+// 返回runs 次中最短(warm) 或者平均(cold) 的秒数，出错返回-1。
+static double measure(const char *filename, const char *cache_name,
+                      int index_cache, int cold, int runs, int *entries) {
+    double t, sum = 0, best = -1;
+    int i;
+
+    for (i = 0; i < runs; i++) {
+        if (cold && (bench_drop_cache(filename) < 0 ||
+                     (index_cache && bench_drop_cache(cache_name) < 0)))
+            return -1;
+        t = open_first_packet(filename, index_cache, entries);
+        if (t < 0)
+            return -1;
+        sum += t;
+        if (best < 0 || t < best)
+            best = t;
+    }
+    return cold ? sum / runs : best;
+}
+
+static void report(const char *mode, double t_plain, double t_cache) {
+    printf("%-4s", mode);
+    if (t_plain < 0 || t_cache < 0) {
+        printf(" not supported or failed\n");
+        return;
+    }
+    printf(" no cache %8.3f ms, cache %8.3f ms, x%.2f\n", t_plain * 1e3,
+           t_cache * 1e3, t_cache > 0 ? t_plain / t_cache : 0);
+}
+
+int bench_index_cache(int argc, char **argv) {
+    char cache_name[1024];
+    FILE *f;
+    long cache_size = 0;
+    int runs, had_cache, entries = 0, cold;
+    double t_plain, t_cache;
+
+    if (argc < 1) {
+        fprintf(stderr, "index-cache: need an AVI file\n");
+        return -1;
+    }
+    runs = argc > 1 ? atoi(argv[1]) : 10;
+    if (runs <= 0)
+        return -1;
+    snprintf(cache_name, sizeof(cache_name), "%s%s", argv[0], CACHE_SUFFIX);
+    f = fopen(cache_name, "rb");
+    had_cache = f != NULL;
+    if (f)
+        fclose(f);
+
+    // 第一次打开时生成缓存
+    if (open_first_packet(argv[0], 1, &entries) < 0) {
+        fprintf(stderr, "index-cache: cannot open %s\n", argv[0]);
+        return -1;
+    }
+    f = fopen(cache_name, "rb");
+    if (!f) {
+        fprintf(stderr, "index-cache: %s was not written\n", cache_name);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    cache_size = ftell(f);
+    fclose(f);
+
+    printf("%s: %d index entries, cache %.1f KB, %d runs\n", argv[0], entries,
+           cache_size / 1024.0, runs);
+    for (cold = 0; cold <= 1; cold++) {
+        t_plain = measure(argv[0], cache_name, 0, cold, runs, &entries);
+        t_cache = measure(argv[0], cache_name, 1, cold, runs, &entries);
+        report(cold ? "cold" : "warm", t_plain, t_cache);
+    }
+
+    if (!had_cache)
+        remove(cache_name);
+    return 0;
+}
@@ -0,0 +1,487 @@
+#include "bench.h"
+
+// MSRLE 解码速度: 按给定的大小(默认640x480、1920x1080、3840x2160) 合成一帧
+// 自底向上的关键帧，8 位和4 位各一种，行内随机交替重复段(4..63 像素) 和原样
+// 段(8..47 像素)，每行以行结束码结尾。同一帧反复解码至少MIN_FRAMES 帧、持续
+// MIN_TIME 秒，报告每帧的毫秒数。
+// msrle fused 测解码加转换成YUV420P: 两个关键帧和六个差分帧的序列，比较解码
+// 后整帧转换和通过draw_horiz_band 边解码边转换，默认大小320x240 到3840x2160。
+// msrle dirty 比较解码后整帧转换和只转换有改变的行(AVFrame.dirty)，报告每帧
+// 转换的行数。静态内容是一个关键帧后隔帧改变中间256x32 的区域，其余的帧
+// 没有改变；动态内容都是关键帧。默认大小320x240 到1920x1080。
+
+#define MIN_FRAMES 3
+#define MIN_TIME 0.5
+#define MAX_SIZES 16
+#define MAX_SEQ_FRAMES 30
+
+static unsigned int rnd_state = 1;
+
+static unsigned int rnd(void) {
+    rnd_state = rnd_state * 1664525 + 1013904223;
+    return rnd_state >> 8;
+}
+
+// 合成一帧，返回数据长度，bits 为8 或者4。
+static int make_frame(uint8_t *buf, int width, int height, int bits) {
+    uint8_t *p = buf;
+    int x, y, n, left, bytes, i;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x += n) {
+            left = width - x;
+            if (left < 8 || rnd() & 1) {
+                // 重复段: 长度和像素值，4 位时一个字节是交替的两个像素
+                n = 4 + rnd() % 60;
+                if (n > left)
+                    n = left;
+                *p++ = n;
+                *p++ = (uint8_t)rnd();
+            } else {
+                // 原样段: 0 和长度后跟像素数据，数据补齐到偶数字节
+                n = 8 + rnd() % 40;
+                if (n > left)
+                    n = left;
+                *p++ = 0;
+                *p++ = n;
+                bytes = bits == 8 ? n : (n + 1) / 2;
+                for (i = 0; i < bytes; i++)
+                    *p++ = (uint8_t)rnd();
+                if (bytes & 1)
+                    *p++ = 0;
+            }
+        }
+        // 行结束
+        *p++ = 0;
+        *p++ = 0;
+    }
+    // 帧结束
+    *p++ = 0;
+    *p++ = 1;
+    return p - buf;
+}
+
+// 合成一帧差分帧，只重画从下往上数第y0 行开始的h 行中从x0 开始的w 个像素，
+// 其余用跳过码跳过。返回数据长度。
+static int make_delta(uint8_t *buf, int x0, int y0, int w, int h, int color) {
+    uint8_t *p = buf;
+    int x, y, n;
+
+    for (y = y0; y > 0; y -= n) {
+        n = y < 255 ? y : 255;
+        *p++ = 0;
+        *p++ = 2;
+        *p++ = 0;
+        *p++ = n;
+    }
+    for (y = 0; y < h; y++) {
+        for (x = x0; x > 0; x -= n) {
+            n = x < 255 ? x : 255;
+            *p++ = 0;
+            *p++ = 2;
+            *p++ = n;
+            *p++ = 0;
+        }
+        for (x = 0; x < w; x += n) {
+            n = w - x < 255 ? w - x : 255;
+            *p++ = n;
+            *p++ = color + y;
+        }
+        if (y < h - 1) {
+            *p++ = 0;
+            *p++ = 0;
+        }
+    }
+    *p++ = 0;
+    *p++ = 1;
+    return p - buf;
+}
+
+// 一段8 位的帧序列，从关键帧开始，可以循环解码。
+typedef struct MsrleSeq {
+    uint8_t *buf[MAX_SEQ_FRAMES];
+    int size[MAX_SEQ_FRAMES];
+    int nb_frames;
+} MsrleSeq;
+
+static void free_seq(MsrleSeq *seq) {
+    int i;
+
+    for (i = 0; i < seq->nb_frames; i++)
+        av_free(seq->buf[i]);
+    seq->nb_frames = 0;
+}
+
+enum {
+    SEQ_MIXED,   // 两个关键帧各跟三个差分帧，差分帧重画宽1/2、高1/4 的区域
+    SEQ_STATIC,  // 一个关键帧，之后隔帧重画中间256x32 的区域，其余的帧不变
+    SEQ_DYNAMIC, // 都是关键帧
+};
+
+// 合成type 的序列，成功返回0，出错返回-1。
+static int make_seq(MsrleSeq *seq, int width, int height, int type) {
+    uint8_t *buf;
+    int i, size, w, h, nb_frames;
+
+    memset(seq, 0, sizeof(*seq));
+    nb_frames = type == SEQ_MIXED ? 8 : MAX_SEQ_FRAMES;
+    w = width < 256 ? width : 256;
+    h = height < 32 ? height : 32;
+    for (i = 0; i < nb_frames; i++) {
+        // 每个像素最多2 字节，再加行结束码和帧结束码，跳过码不会比这更长
+        buf = av_malloc((2 * width + 2) * height + 2);
+        if (!buf) {
+            free_seq(seq);
+            return -1;
+        }
+        if (type == SEQ_DYNAMIC || (i % 4 == 0 && (type == SEQ_MIXED || !i)))
+            size = make_frame(buf, width, height, 8);
+        else if (type == SEQ_MIXED)
+            size = make_delta(buf, (i % 4) * width / 8, i * height / 16,
+                              width / 2, height / 4, i * 16);
+        else if (i & 1)
+            size = make_delta(buf, (width - w) / 2, (height - h) / 2, w, h,
+                              i * 16);
+        else
+            size = make_delta(buf, 0, 0, 0, 0, 0);
+        // 按实际长度缩小，动态内容的序列比较大
+        seq->buf[i] = av_realloc(buf, size);
+        if (!seq->buf[i])
+            seq->buf[i] = buf;
+        seq->size[i] = size;
+        seq->nb_frames++;
+    }
+    return 0;
+}
+
+// 打开MSRLE 解码器，失败返回NULL。
+static AVCodecContext *open_decoder(int width, int height, int bits,
+                                    AVPaletteControl *pal) {
+    AVCodecContext *c;
+
+    c = avcodec_alloc_context();
+    if (!c)
+        return NULL;
+    pal->palette_changed = 1;
+    c->codec_type = CODEC_TYPE_VIDEO;
+    c->codec_id = CODEC_ID_MSRLE;
+    c->width = width;
+    c->height = height;
+    c->bits_per_sample = bits;
+    c->palctrl = pal;
+    if (avcodec_open(c, avcodec_find_decoder(CODEC_ID_MSRLE)) < 0) {
+        av_free(c);
+        return NULL;
+    }
+    return c;
+}
+
+static void random_palette(AVPaletteControl *pal) {
+    int i;
+
+    memset(pal, 0, sizeof(*pal));
+    for (i = 0; i < AVPALETTE_COUNT; i++)
+        pal->palette[i] = rnd();
+}
+
+// 返回每帧的秒数，出错返回-1。
+static double run_case(int width, int height, int bits) {
+    AVCodecContext *c;
+    AVPaletteControl pal;
+    AVFrame frame;
+    uint8_t *buf;
+    double start, t = 0;
+    int size, got, frames = 0;
+
+    // 每个像素最多2 字节，再加行结束码和帧结束码
+    buf = av_malloc((2 * width + 2) * height + 2);
+    if (!buf)
+        return -1;
+    size = make_frame(buf, width, height, bits);
+    random_palette(&pal);
+    c = open_decoder(width, height, bits, &pal);
+    if (!c) {
+        av_free(buf);
+        return -1;
+    }
+
+    start = bench_now();
+    do {
+        if (avcodec_decode_video(c, &frame, &got, buf, size) < 0 || !got)
+            break;
+        frames++;
+        t = bench_now() - start;
+    } while (frames < MIN_FRAMES || t < MIN_TIME);
+    avcodec_close(c);
+    av_free(c);
+    av_free(buf);
+    return frames >= MIN_FRAMES ? t / frames : -1;
+}
+
+// 解码加转换的方式
+enum {
+    CONVERT_FULL,  // 解码后整帧转换
+    CONVERT_FUSED, // 解码器每完成一段行就转换
+    CONVERT_DIRTY, // 解码后只转换有改变的行
+};
+
+typedef struct ConvertRun {
+    ImgConvertContext *convert;
+    AVPicture dst;
+    int rows; // 这一帧已经转换的行数
+    int error;
+} ConvertRun;
+
+static void draw_band(AVCodecContext *avctx, const AVFrame *src, int y,
+                      int height) {
+    ConvertRun *r = avctx->opaque;
+
+    if (r->error)
+        return;
+    if (img_convert_frame_rows(r->convert, &r->dst, (const AVPicture *)src, y,
+                               height) < 0) {
+        r->error = 1;
+        return;
+    }
+    r->rows += height;
+}
+
+// 只转换dirty 中有改变的行，连续有改变的块合成一段。返回转换的行数，出错
+// 返回-1。
+static int convert_dirty(ImgConvertContext *c, AVPicture *dst,
+                         const AVPicture *src, const uint8_t *dirty,
+                         int height) {
+    int y0 = 0, y1, n = 0;
+
+    while (y0 < height) {
+        if (!dirty[y0 / AV_DIRTY_ROWS]) {
+            y0 += AV_DIRTY_ROWS;
+            continue;
+        }
+        y1 = y0;
+        while (y1 < height && dirty[y1 / AV_DIRTY_ROWS])
+            y1 += AV_DIRTY_ROWS;
+        if (y1 > height)
+            y1 = height;
+        if (img_convert_frame_rows(c, dst, src, y0, y1 - y0) < 0)
+            return -1;
+        n += y1 - y0;
+        y0 = y1;
+    }
+    return n;
+}
+
+// 循环解码seq 并用mode 的方式转换成YUV420P，返回每帧的秒数，出错返回-1。
+// rows 返回平均每帧转换的行数，unchanged 返回没有转换任何行的帧的比例，
+// same 返回最后一帧的转换结果是否和img_convert_frame() 相同。
+static double run_convert(const MsrleSeq *seq, int width, int height,
+                          AVPaletteControl *pal, int mode, double *rows,
+                          double *unchanged, int *same) {
+    AVCodecContext *c;
+    AVFrame frame;
+    AVPicture check;
+    ConvertRun r;
+    double start, t = 0;
+    int64_t total_rows = 0;
+    int i, got, size, n, frames = 0, nb_unchanged = 0, ret = 0;
+
+    memset(&r, 0, sizeof(r));
+    c = open_decoder(width, height, 8, pal);
+    if (!c)
+        return -1;
+    r.convert = img_convert_context_new(PIX_FMT_YUV420P, PIX_FMT_PAL8, width,
+                                        height);
+    if (!r.convert ||
+        avpicture_alloc(&r.dst, PIX_FMT_YUV420P, width, height) < 0) {
+        img_convert_context_free(r.convert);
+        avcodec_close(c);
+        av_free(c);
+        return -1;
+    }
+    if (mode == CONVERT_FUSED) {
+        c->opaque = &r;
+        c->draw_horiz_band = draw_band;
+    }
+
+    start = bench_now();
+    do {
+        for (i = 0; i < seq->nb_frames && ret >= 0; i++) {
+            r.rows = 0;
+            r.error = 0;
+            if (avcodec_decode_video(c, &frame, &got, seq->buf[i],
+                                     seq->size[i]) < 0 ||
+                !got) {
+                ret = -1;
+                break;
+            }
+            n = height;
+            if (mode == CONVERT_DIRTY && frame.dirty) {
+                n = convert_dirty(r.convert, &r.dst, (AVPicture *)&frame,
+                                  frame.dirty, height);
+                if (n < 0) {
+                    ret = img_convert_frame(r.convert, &r.dst,
+                                            (AVPicture *)&frame);
+                    n = height;
+                }
+            } else if (mode != CONVERT_FUSED || r.error || r.rows != height) {
+                // 边解码边转换没有覆盖整帧时和ffplay 一样整帧重新转换
+                ret = img_convert_frame(r.convert, &r.dst,
+                                        (AVPicture *)&frame);
+            }
+            total_rows += n;
+            if (!n)
+                nb_unchanged++;
+            frames++;
+        }
+        t = bench_now() - start;
+    } while (ret >= 0 && t < MIN_TIME);
+
+    *same = 0;
+    if (ret >= 0 && avpicture_alloc(&check, PIX_FMT_YUV420P, width,
+                                    height) >= 0) {
+        size = avpicture_get_size(PIX_FMT_YUV420P, width, height);
+        if (img_convert_frame(r.convert, &check, (AVPicture *)&frame) >= 0)
+            *same = !memcmp(check.data[0], r.dst.data[0], size);
+        avpicture_free(&check);
+    }
+    avpicture_free(&r.dst);
+    img_convert_context_free(r.convert);
+    avcodec_close(c);
+    av_free(c);
+    if (frames) {
+        *rows = (double)total_rows / frames;
+        *unchanged = (double)nb_unchanged / frames;
+    }
+    return ret >= 0 && frames ? t / frames : -1;
+}
+
+static int bench_fused(int sizes[][2], int nb_sizes) {
+    AVPaletteControl pal;
+    MsrleSeq seq;
+    double t_full, t_fused, rows, unchanged;
+    int i, same_full, same_fused;
+
+    random_palette(&pal);
+    printf("decode + pal8>yuv420p, full-frame convert vs fused\n");
+    for (i = 0; i < nb_sizes; i++) {
+        if (make_seq(&seq, sizes[i][0], sizes[i][1], SEQ_MIXED) < 0)
+            return -1;
+        t_full = run_convert(&seq, sizes[i][0], sizes[i][1], &pal,
+                             CONVERT_FULL, &rows, &unchanged, &same_full);
+        t_fused = run_convert(&seq, sizes[i][0], sizes[i][1], &pal,
+                              CONVERT_FUSED, &rows, &unchanged, &same_fused);
+        printf("%5dx%-5d", sizes[i][0], sizes[i][1]);
+        if (t_full < 0 || t_fused < 0)
+            printf(" failed\n");
+        else
+            printf(" %8.3f -> %8.3f ms/frame%s\n", t_full * 1e3,
+                   t_fused * 1e3,
+                   same_full && same_fused ? "" : ", output differs");
+        free_seq(&seq);
+    }
+    return 0;
+}
+
+static int bench_dirty(int sizes[][2], int nb_sizes) {
+    static const char *const names[] = {"static", "dynamic"};
+    static const int types[] = {SEQ_STATIC, SEQ_DYNAMIC};
+    AVPaletteControl pal;
+    MsrleSeq seq;
+    double t_full, t_dirty, rows_full, rows, unchanged;
+    int i, k, same_full, same_dirty;
+
+    random_palette(&pal);
+    printf("decode + pal8>yuv420p, full-frame convert vs dirty rows\n");
+    for (k = 0; k < 2; k++) {
+        for (i = 0; i < nb_sizes; i++) {
+            if (make_seq(&seq, sizes[i][0], sizes[i][1], types[k]) < 0)
+                return -1;
+            t_full = run_convert(&seq, sizes[i][0], sizes[i][1], &pal,
+                                 CONVERT_FULL, &rows_full, &unchanged,
+                                 &same_full);
+            t_dirty = run_convert(&seq, sizes[i][0], sizes[i][1], &pal,
+                                  CONVERT_DIRTY, &rows, &unchanged,
+                                  &same_dirty);
+            printf("%-7s %5dx%-5d", names[k], sizes[i][0], sizes[i][1]);
+            if (t_full < 0 || t_dirty < 0)
+                printf(" failed\n");
+            else
+                printf(" %8.3f -> %8.3f ms/frame, %6.1f of %d rows/frame, "
+                       "%.0f%% unchanged%s\n",
+                       t_full * 1e3, t_dirty * 1e3, rows, sizes[i][1],
+                       unchanged * 100,
+                       same_full && same_dirty ? "" : ", output differs");
+            free_seq(&seq);
+        }
+    }
+    return 0;
+}
+
+int bench_msrle(int argc, char **argv) {
+    int sizes[MAX_SIZES][2], nb_sizes, i, bits, fused = 0, dirty = 0;
+    double t;
+
+    if (argc > 0 && !strcmp(argv[0], "fused")) {
+        fused = 1;
+        argc--;
+        argv++;
+    } else if (argc > 0 && !strcmp(argv[0], "dirty")) {
+        dirty = 1;
+        argc--;
+        argv++;
+    }
+    nb_sizes = argc < MAX_SIZES ? argc : MAX_SIZES;
+    for (i = 0; i < nb_sizes; i++) {
+        if (sscanf(argv[i], "%dx%d", &sizes[i][0], &sizes[i][1]) != 2 ||
+            sizes[i][0] <= 0 || sizes[i][1] <= 0 ||
+            sizes[i][0] > 16384 || sizes[i][1] > 16384)
+            return -1;
+    }
+    if (fused) {
+        if (!nb_sizes) {
+            sizes[0][0] = 320;
+            sizes[0][1] = 240;
+            sizes[1][0] = 640;
+            sizes[1][1] = 480;
+            sizes[2][0] = 1920;
+            sizes[2][1] = 1080;
+            sizes[3][0] = 3840;
+            sizes[3][1] = 2160;
+            nb_sizes = 4;
+        }
+        return bench_fused(sizes, nb_sizes);
+    }
+    if (dirty) {
+        if (!nb_sizes) {
+            sizes[0][0] = 320;
+            sizes[0][1] = 240;
+            sizes[1][0] = 640;
+            sizes[1][1] = 480;
+            sizes[2][0] = 1920;
+            sizes[2][1] = 1080;
+            nb_sizes = 3;
+        }
+        return bench_dirty(sizes, nb_sizes);
+    }
+    if (!nb_sizes) {
+        sizes[0][0] = 640;
+        sizes[0][1] = 480;
+        sizes[1][0] = 1920;
+        sizes[1][1] = 1080;
+        sizes[2][0] = 3840;
+        sizes[2][1] = 2160;
+        nb_sizes = 3;
+    }
+
+    for (bits = 8; bits >= 4; bits -= 4) {
+        for (i = 0; i < nb_sizes; i++) {
+            t = run_case(sizes[i][0], sizes[i][1], bits);
+            printf("pal%d %5dx%-5d", bits, sizes[i][0], sizes[i][1]);
+            if (t < 0)
+                printf(" failed\n");
+            else
+                printf(" %8.3f ms/frame\n", t * 1e3);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "bench.h"
+#include "../packetqueue.h"
+
+// 包队列: 生产者线程连续放入count 个包，主线程作为消费者阻塞地取出，
+// 统计每个包的平均耗时。对比ffplay 现在的无锁环形队列和原来的链表队列，
+// 后者每次放入、取出都加锁，每个包还要malloc/free 一个AVPacketList。
+
+// 原来的链表队列，只保留测试用到的部分。
+typedef struct ListQueue {
+    AVPacketList *first_pkt, *last_pkt;
+    int size;
+    AVMutex mutex;
+    AVCond cond;
+} ListQueue;
+
+static int list_queue_put(ListQueue *q, AVPacket *pkt) {
+    AVPacketList *pkt1;
+
+    pkt1 = av_malloc(sizeof(AVPacketList));
+    if (!pkt1)
+        return -1;
+    pkt1->pkt = *pkt;
+    pkt1->next = NULL;
+
+    av_mutex_lock(&q->mutex);
+    if (!q->last_pkt)
+        q->first_pkt = pkt1;
+    else
+        q->last_pkt->next = pkt1;
+    q->last_pkt = pkt1;
+    q->size += pkt1->pkt.size;
+    av_cond_signal(&q->cond);
+    av_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+static void list_queue_get(ListQueue *q, AVPacket *pkt) {
+    AVPacketList *pkt1;
+
+    av_mutex_lock(&q->mutex);
+    while (!(pkt1 = q->first_pkt))
+        av_cond_wait(&q->cond, &q->mutex);
+    q->first_pkt = pkt1->next;
+    if (!q->first_pkt)
+        q->last_pkt = NULL;
+    q->size -= pkt1->pkt.size;
+    *pkt = pkt1->pkt;
+    av_free(pkt1);
+    av_mutex_unlock(&q->mutex);
+}
+
+typedef struct QueueBench {
+    PacketQueue *ring;
+    ListQueue list;
+    int count;
+} QueueBench;
+
+// 测试用的包不带数据，大小在1..1024 之间变化。
+static void make_packet(AVPacket *pkt, int i) {
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->pts = pkt->dts = AV_NOPTS_VALUE;
+    pkt->size = (i & 1023) + 1;
+}
+
+static void *ring_producer(void *arg) {
+    QueueBench *b = arg;
+    AVPacket pkt;
+    int i;
+
+    for (i = 0; i < b->count; i++) {
+        make_packet(&pkt, i);
+        if (packet_queue_put(b->ring, &pkt) < 0)
+            break;
+    }
+    return NULL;
+}
+
+static void *list_producer(void *arg) {
+    QueueBench *b = arg;
+    AVPacket pkt;
+    int i;
+
+    for (i = 0; i < b->count; i++) {
+        make_packet(&pkt, i);
+        if (list_queue_put(&b->list, &pkt) < 0)
+            break;
+    }
+    return NULL;
+}
+
+static double run_ring(QueueBench *b) {
+    AVThread thread;
+    AVPacket pkt;
+    double start, elapsed;
+    int i;
+
+    packet_queue_init(b->ring);
+    start = bench_now();
+    if (av_thread_create(&thread, ring_producer, b) < 0)
+        return -1;
+    for (i = 0; i < b->count; i++) {
+        if (packet_queue_get(b->ring, &pkt, 1) < 0)
+            break;
+    }
+    av_thread_join(&thread);
+    elapsed = bench_now() - start;
+    packet_queue_end(b->ring);
+    return elapsed;
+}
+
+static double run_list(QueueBench *b) {
+    AVThread thread;
+    AVPacket pkt;
+    double start, elapsed;
+    int i;
+
+    memset(&b->list, 0, sizeof(b->list));
+    av_mutex_init(&b->list.mutex);
+    av_cond_init(&b->list.cond);
+    start = bench_now();
+    if (av_thread_create(&thread, list_producer, b) < 0)
+        return -1;
+    for (i = 0; i < b->count; i++)
+        list_queue_get(&b->list, &pkt);
+    av_thread_join(&thread);
+    elapsed = bench_now() - start;
+    av_mutex_destroy(&b->list.mutex);
+    av_cond_destroy(&b->list.cond);
+    return elapsed;
+}
+
+int bench_queue(int argc, char **argv) {
+    QueueBench b;
+    double t;
+
+    b.count = argc > 0 ? atoi(argv[0]) : 2000000;
+    if (b.count <= 0)
+        return -1;
+    b.ring = av_malloc(sizeof(PacketQueue));
+    if (!b.ring)
+        return -1;
+
+    printf("%d packets, %d cpus\n", b.count, av_cpu_count());
+    t = run_list(&b);
+    if (t >= 0)
+        printf("list  %8.3f s %8.1f ns/packet\n", t, t * 1e9 / b.count);
+    t = run_ring(&b);
+    if (t >= 0)
+        printf("ring  %8.3f s %8.1f ns/packet\n", t, t * 1e9 / b.count);
+    av_free(b.ring);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "bench.h"
+#include "../libavutil/cpu.h"
+
+// AVI 重新同步: 损坏或者没有索引的文件，avi_read_packet() 要在movi 中逐字节
+// 查找下一个块头。
+// 1. 块头查找函数的速度: C、SSE2、AVX2 三个实现分别扫描同一块垃圾数据，
+//    前一半为0，后一半为随机数，统计找到的候选位置数和MB/s。
+// 2. 给了AVI 文件时，在movi 的第5 个块之后插入同样的垃圾数据，生成
+//    ffbench_resync.avi，分别计时读完原文件和损坏文件的所有包，测完后删除。
+
+#define DAMAGED_NAME "ffbench_resync.avi"
+
+typedef const uint8_t *(*FindChunkFunc)(const uint8_t *p, const uint8_t *end);
+
+const uint8_t *ff_avi_find_chunk_c(const uint8_t *p, const uint8_t *end);
+#ifdef ARCH_X86
+const uint8_t *ff_avi_find_chunk_sse2(const uint8_t *p, const uint8_t *end);
+const uint8_t *ff_avi_find_chunk_avx2(const uint8_t *p, const uint8_t *end);
+#endif
+
+static unsigned int rnd_state = 1;
+
+static unsigned int rnd(void) {
+    rnd_state = rnd_state * 1664525 + 1013904223;
+    return rnd_state >> 8;
+}
+
+static void fill_garbage(uint8_t *buf, int size) {
+    int i;
+
+    memset(buf, 0, size / 2);
+    for (i = size / 2; i < size; i++)
+        buf[i] = (uint8_t)rnd();
+}
+
+static void bench_find_chunk(const char *name, FindChunkFunc find,
+                             const uint8_t *buf, int size) {
+    const uint8_t *p, *end = buf + size;
+    double start, t;
+    int hits = 0;
+
+    start = bench_now();
+    for (p = buf; (p = find(p, end)) < end; p++)
+        hits++;
+    t = bench_now() - start;
+    printf("find_chunk %-5s %8.3f s %8.1f MB/s %d candidates\n", name, t,
+           size / (t > 0 ? t : 1e-9) / (1024 * 1024), hits);
+}
+
+// 读入整个AVI，在movi 的第5 个块之后插入garbage，写到DAMAGED_NAME。
+static int write_damaged(const char *filename, const uint8_t *garbage,
+                         int garbage_size) {
+    FILE *f;
+    uint8_t *d;
+    unsigned int len;
+    int size, movi = -1, off, i, ok;
+
+    d = bench_read_file(filename, &size);
+    if (!d)
+        return -1;
+
+    for (i = 12; i + 4 <= size; i++) {
+        if (!memcmp(d + i, "movi", 4)) {
+            movi = i - 8;
+            break;
+        }
+    }
+    if (movi < 0) {
+        av_free(d);
+        return -1;
+    }
+    off = movi + 12;
+    for (i = 0; i < 5 && off + 8 <= size; i++) {
+        len = bench_rl32(d + off + 4);
+        if (len >= (unsigned int)(size - off - 8)) {
+            off = size;
+            break;
+        }
+        off += 8 + ((len + 1) & ~1);
+    }
+    if (off > size)
+        off = size;
+
+    bench_wl32(d + movi + 4, bench_rl32(d + movi + 4) + garbage_size);
+    bench_wl32(d + 4, (unsigned int)(size + garbage_size - 8));
+    f = fopen(DAMAGED_NAME, "wb");
+    if (!f) {
+        av_free(d);
+        return -1;
+    }
+    ok = fwrite(d, 1, off, f) == (size_t)off &&
+         fwrite(garbage, 1, garbage_size, f) == (size_t)garbage_size &&
+         fwrite(d + off, 1, size - off, f) == (size_t)(size - off);
+    if (fclose(f) != 0)
+        ok = 0;
+    av_free(d);
+    return ok ? 0 : -1;
+}
+
+// 读完文件的所有包，返回秒数，打不开返回-1。
+static double demux_file(const char *filename, int *packets) {
+    AVFormatContext *ic;
+    AVFormatParameters params, *ap = &params;
+    AVPacket pkt;
+    double start, t;
+
+    memset(ap, 0, sizeof(*ap));
+    start = bench_now();
+    if (av_open_input_file(&ic, filename, NULL, 0, ap) < 0)
+        return -1;
+    *packets = 0;
+    while (av_read_packet(ic, &pkt) >= 0) {
+        (*packets)++;
+        av_free_packet(&pkt);
+    }
+    av_close_input_file(ic);
+    t = bench_now() - start;
+    return t;
+}
+
+int bench_resync(int argc, char **argv) {
+    uint8_t *garbage;
+    int mb, size, packets, flags = av_get_cpu_flags();
+    double t;
+
+    mb = argc > 1 ? atoi(argv[1]) : 64;
+    if (mb <= 0 || mb > 1024)
+        return -1;
+    size = mb * 1024 * 1024;
+    garbage = av_malloc(size);
+    if (!garbage)
+        return -1;
+    fill_garbage(garbage, size);
+
+    printf("%d MB of garbage\n", mb);
+    bench_find_chunk("c", ff_avi_find_chunk_c, garbage, size);
+#ifdef ARCH_X86
+    if (flags & AV_CPU_FLAG_SSE2)
+        bench_find_chunk("sse2", ff_avi_find_chunk_sse2, garbage, size);
+    if (flags & AV_CPU_FLAG_AVX2)
+        bench_find_chunk("avx2", ff_avi_find_chunk_avx2, garbage, size);
+#endif
+
+    if (argc > 0) {
+        t = demux_file(argv[0], &packets);
+        if (t < 0)
+            printf("demux %s failed\n", argv[0]);
+        else
+            printf("demux original %8.3f s %d packets\n", t, packets);
+        if (write_damaged(argv[0], garbage, size) < 0) {
+            printf("cannot write %s\n", DAMAGED_NAME);
+        } else {
+            t = demux_file(DAMAGED_NAME, &packets);
+            if (t < 0)
+                printf("demux %s failed\n", DAMAGED_NAME);
+            else
+                printf("demux damaged  %8.3f s %d packets\n", t, packets);
+            remove(DAMAGED_NAME);
+        }
+    }
+    av_free(garbage);
+    return 0;
+}
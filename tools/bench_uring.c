@@ -0,0 +1,194 @@
+#include "bench.h"
+
+// file 协议和uring 协议的读速度，三种访问方式:
+// seq    从头到尾顺序读，每次64KB
+// ni     非交织AVI 的读法，在文件前半和后半两个位置交替读4..32KB，各自顺序前进，
+//        uring 协议提前PREFETCH_AHEAD 次用url_prefetch() 预告后面的读
+// random 随机位置读4..32KB，同样提前预告
+// cold 为读之前把文件从系统缓存中清掉，只在linux 上支持；warm 为文件已在缓存中。
+
+#define READ_SIZE (64 * 1024)
+// 预告的读最多占8 块，是uring 块缓存的一半，不会把还没用到的块淘汰掉
+#define PREFETCH_AHEAD 4
+
+typedef struct ReadPlan {
+    offset_t *pos;
+    int *len;
+    int count;
+} ReadPlan;
+
+static unsigned int rnd_state = 1;
+
+static unsigned int rnd(void) {
+    rnd_state = rnd_state * 1664525 + 1013904223;
+    return rnd_state >> 8;
+}
+
+static int make_plan(ReadPlan *plan, int ni, offset_t file_size, int count) {
+    offset_t half = file_size / 2, a = 0, b = half;
+    int i, len;
+
+    plan->pos = av_malloc(count * sizeof(offset_t));
+    plan->len = av_malloc(count * sizeof(int));
+    if (!plan->pos || !plan->len)
+        return -1;
+    plan->count = count;
+    for (i = 0; i < count; i++) {
+        len = 4096 + rnd() % (28 * 1024);
+        if (ni) {
+            // 两个流各自顺序读，读到自己那一半的末尾后从头再来
+            if (i & 1) {
+                if (b + len > file_size)
+                    b = half;
+                plan->pos[i] = b;
+                b += len;
+            } else {
+                if (a + len > half)
+                    a = 0;
+                plan->pos[i] = a;
+                a += len;
+            }
+        } else {
+            plan->pos[i] = (offset_t)(((double)rnd() / (1 << 24)) *
+                                      (file_size - len));
+        }
+        plan->len[i] = len;
+    }
+    return 0;
+}
+
+static void free_plan(ReadPlan *plan) {
+    av_free(plan->pos);
+    av_free(plan->len);
+}
+
+// 读满size 字节，返回读到的字节数。
+static int read_full(URLContext *h, uint8_t *buf, int size) {
+    int n = 0, ret;
+
+    while (n < size) {
+        ret = url_read(h, buf + n, size - n);
+        if (ret <= 0)
+            break;
+        n += ret;
+    }
+    return n;
+}
+
+// 返回秒数，出错返回-1，bytes 为读到的总字节数。
+static double read_seq(const char *url, uint8_t *buf, offset_t *bytes) {
+    URLContext *h;
+    double start, elapsed;
+    int ret;
+
+    if (url_open(&h, url, URL_RDONLY) < 0)
+        return -1;
+    *bytes = 0;
+    start = bench_now();
+    while ((ret = url_read(h, buf, READ_SIZE)) > 0)
+        *bytes += ret;
+    elapsed = bench_now() - start;
+    url_close(h);
+    return elapsed;
+}
+
+static double read_plan(const char *url, uint8_t *buf, const ReadPlan *plan,
+                        offset_t *bytes) {
+    URLContext *h;
+    double start, elapsed;
+    int i;
+
+    if (url_open(&h, url, URL_RDONLY) < 0)
+        return -1;
+    *bytes = 0;
+    start = bench_now();
+    for (i = 0; i < plan->count && i < PREFETCH_AHEAD; i++)
+        url_prefetch(h, plan->pos[i], plan->len[i]);
+    for (i = 0; i < plan->count; i++) {
+        if (i + PREFETCH_AHEAD < plan->count)
+            url_prefetch(h, plan->pos[i + PREFETCH_AHEAD],
+                         plan->len[i + PREFETCH_AHEAD]);
+        if (url_seek(h, plan->pos[i], SEEK_SET) < 0)
+            break;
+        *bytes += read_full(h, buf, plan->len[i]);
+    }
+    elapsed = bench_now() - start;
+    url_close(h);
+    return elapsed;
+}
+
+static void report(const char *mode, const char *proto, const char *cache,
+                   double t, offset_t bytes, int reads) {
+    if (t < 0) {
+        printf("%-6s %-5s %-4s failed\n", mode, proto, cache);
+        return;
+    }
+    printf("%-6s %-5s %-4s %8.3f s %8.1f MB/s", mode, proto, cache, t,
+           bytes / (t > 0 ? t : 1e-9) / (1024 * 1024));
+    if (reads)
+        printf(" %8.1f us/read", t * 1e6 / reads);
+    printf("\n");
+}
+
+int bench_uring(int argc, char **argv) {
+    static const char *protos[2] = {"file", "uring"};
+    static const char *modes[3] = {"seq", "ni", "random"};
+    char url[1024];
+    uint8_t *buf;
+    ReadPlan plans[2];
+    URLContext *h;
+    offset_t size, bytes;
+    int count, mode, proto, cold;
+    double t;
+
+    if (argc < 1) {
+        fprintf(stderr, "uring: need a file name\n");
+        return -1;
+    }
+    count = argc > 1 ? atoi(argv[1]) : 2000;
+    if (count <= 0)
+        return -1;
+
+    snprintf(url, sizeof(url), "file:%s", argv[0]);
+    if (url_open(&h, url, URL_RDONLY) < 0) {
+        fprintf(stderr, "uring: cannot open %s\n", argv[0]);
+        return -1;
+    }
+    size = url_seek(h, 0, SEEK_END);
+    url_close(h);
+    if (size < 2 * 32 * 1024) {
+        fprintf(stderr, "uring: %s is too small\n", argv[0]);
+        return -1;
+    }
+
+    buf = av_malloc(READ_SIZE);
+    if (!buf || make_plan(&plans[0], 1, size, count) < 0 ||
+        make_plan(&plans[1], 0, size, count) < 0)
+        return -1;
+
+    printf("%s: %.1f MB, %d scattered reads\n", argv[0],
+           size / (1024.0 * 1024), count);
+    for (mode = 0; mode < 3; mode++) {
+        for (cold = 1; cold >= 0; cold--) {
+            for (proto = 0; proto < 2; proto++) {
+                if (cold && bench_drop_cache(argv[0]) < 0) {
+                    printf("%-6s %-5s cold not supported\n", modes[mode],
+                           protos[proto]);
+                    continue;
+                }
+                snprintf(url, sizeof(url), "%s:%s", protos[proto], argv[0]);
+                if (mode == 0)
+                    t = read_seq(url, buf, &bytes);
+                else
+                    t = read_plan(url, buf, &plans[mode - 1], &bytes);
+                report(modes[mode], protos[proto], cold ? "cold" : "warm", t,
+                       bytes, mode ? count : 0);
+            }
+        }
+    }
+
+    free_plan(&plans[0]);
+    free_plan(&plans[1]);
+    av_free(buf);
+    return 0;
+}
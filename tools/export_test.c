@@ -0,0 +1,125 @@
+#include "testavi.h"
+#include "../export.h"
+
+// 并行导出的结果应该和顺序解码再转换成YUV420P 逐字节相同。
+// 测试两种合成文件: 小图像时每个任务至少EXPORT_TASK_FRAMES 帧；1920x1080 的
+// 一帧YUV420P 超过EXPORT_SPLIT_BYTES / EXPORT_TASK_FRAMES，任务按大小划分，
+// 每10 帧就是一个任务。都是每5 帧一个关键帧。
+// 用法: export_test [线程数]，有不一致时返回1。
+
+#define TEST_NAME "export_test.avi"
+#define OUT_NAME "export_test.yuv"
+
+typedef struct ExportCase {
+    int width, height, nb_frames;
+} ExportCase;
+
+static const ExportCase cases[] = {
+    {64, 48, 300},
+    {1920, 1080, 40},
+    {0}};
+
+// 顺序解码filename，每帧和导出文件out 中对应的帧比较。
+// 返回相同的帧数，有不同的帧或者帧数不对时返回-1。
+static int compare_sequential(const char *filename, FILE *out) {
+    AVFormatContext *ic;
+    AVFormatParameters params;
+    AVCodecContext *avctx;
+    AVFrame frame;
+    AVPicture pict;
+    AVPacket pkt;
+    uint8_t *buf;
+    int size, got_picture, frames = 0, ret = 0;
+
+    memset(&params, 0, sizeof(params));
+    if (av_open_input_file(&ic, filename, NULL, 0, &params) < 0)
+        return -1;
+    avctx = ic->streams[0]->actx;
+    if (avcodec_open(avctx, avcodec_find_decoder(avctx->codec_id)) < 0) {
+        av_close_input_file(ic);
+        return -1;
+    }
+    size = avpicture_get_size(PIX_FMT_YUV420P, avctx->width, avctx->height);
+    buf = av_malloc(size);
+    if (!buf || avpicture_alloc(&pict, PIX_FMT_YUV420P, avctx->width,
+                                avctx->height) < 0) {
+        av_free(buf);
+        avcodec_close(avctx);
+        av_close_input_file(ic);
+        return -1;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    while (ret >= 0 && av_read_packet(ic, &pkt) >= 0) {
+        if (pkt.stream_index == 0) {
+            avcodec_decode_video(avctx, &frame, &got_picture, pkt.data,
+                                 pkt.size);
+            if (got_picture) {
+                img_convert(&pict, PIX_FMT_YUV420P, (AVPicture *)&frame,
+                            avctx->pix_fmt, avctx->width, avctx->height);
+                // avpicture_alloc() 的三个平面是连续的，和导出的一帧布局相同
+                if (fread(buf, 1, size, out) != (size_t)size ||
+                    memcmp(buf, pict.data[0], size))
+                    ret = -1;
+                else
+                    frames++;
+            }
+        }
+        av_free_packet(&pkt);
+    }
+    // 导出的帧不能比顺序解码的多
+    if (ret >= 0 && fread(buf, 1, 1, out) != 0)
+        ret = -1;
+
+    avpicture_free(&pict);
+    av_free(buf);
+    avcodec_close(avctx);
+    av_close_input_file(ic);
+    return ret < 0 ? -1 : frames;
+}
+
+int main(int argc, char **argv) {
+    ExportStats stats;
+    TestAvi t;
+    FILE *out;
+    int nb_threads = 2, i, n, failed = 0;
+
+    if (argc > 1)
+        nb_threads = atoi(argv[1]);
+    if (nb_threads < 1)
+        nb_threads = 1;
+    av_register_all();
+
+    for (i = 0; cases[i].width; i++) {
+        memset(&t, 0, sizeof(t));
+        t.width = cases[i].width;
+        t.height = cases[i].height;
+        t.nb_streams = 1;
+        t.nb_frames[0] = cases[i].nb_frames;
+        t.keyint = 5;
+        printf("%4dx%-4d %3d frames: ", t.width, t.height, t.nb_frames[0]);
+        if (testavi_write(TEST_NAME, &t) < 0) {
+            printf("cannot write %s\n", TEST_NAME);
+            return 1;
+        }
+        if (video_export(TEST_NAME, OUT_NAME, nb_threads, 0, 0, &stats) < 0) {
+            printf("FAILED, export failed\n");
+            failed = 1;
+        } else {
+            out = fopen(OUT_NAME, "rb");
+            n = out ? compare_sequential(TEST_NAME, out) : -1;
+            if (out)
+                fclose(out);
+            if (n != t.nb_frames[0] || stats.nb_frames != n) {
+                printf("FAILED, differs from sequential decoding\n");
+                failed = 1;
+            } else {
+                printf("ok (%d tasks, %d re-decoded)\n", stats.nb_tasks,
+                       stats.nb_redecoded);
+            }
+        }
+        remove(OUT_NAME);
+        remove(TEST_NAME);
+    }
+    return failed;
+}
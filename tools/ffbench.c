@@ -0,0 +1,137 @@
+#include "bench.h"
+
+#ifdef CONFIG_WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// 性能测试程序，用法: ffbench <测试> [参数...]，不带参数时列出所有测试。
+// 各项测试的实现在bench_*.c 中。
+
+typedef struct BenchTest {
+    const char *name;
+    int (*func)(int argc, char **argv);
+    const char *usage;
+} BenchTest;
+
+static const BenchTest tests[] = {
+    {"queue", bench_queue,
+     "[packets]        packet queue throughput, ring vs linked list"},
+    {"uring", bench_uring,
+     "<file> [reads]   file vs uring protocol, sequential and scattered"},
+    {"resync", bench_resync,
+     "[file.avi] [MB]  chunk scanners, demux with garbage in movi"},
+    {"idx1", bench_idx1,
+     "<file.avi> [n..] open time with an idx1 of n entries"},
+    {"index", bench_index,
+     "[n] [lookups]    index memory and timestamp lookup"},
+    {"index-cache", bench_index_cache,
+     "<file.avi> [runs] open + first packet, with and without .ffindex"},
+    {"convert", bench_convert,
+     "[threads..]      img_convert_frame() fps per thread count\n"
+     "              pal8 [file.avi]  PAL8>YUV420P, direct vs via RGB24\n"
+     "              context [WxH]    img_convert() vs reused context"},
+    {"msrle", bench_msrle,
+     "[WxH..]          MSRLE decode time per frame, 8 and 4 bit\n"
+     "              fused [WxH..]    decode + convert, full frame vs fused\n"
+     "              dirty [WxH..]    decode + convert, full frame vs dirty rows"},
+    {NULL}};
+
+double bench_now(void) {
+#ifdef CONFIG_WIN32
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+uint8_t *bench_read_file(const char *filename, int *size) {
+    FILE *f;
+    uint8_t *buf;
+    long len;
+    int ok;
+
+    f = fopen(filename, "rb");
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len <= 0 || len > 1024L * 1024 * 1024) {
+        fclose(f);
+        return NULL;
+    }
+    buf = av_malloc(len);
+    ok = buf && fread(buf, 1, len, f) == (size_t)len;
+    fclose(f);
+    if (!ok) {
+        av_free(buf);
+        return NULL;
+    }
+    *size = (int)len;
+    return buf;
+}
+
+int bench_drop_cache(const char *filename) {
+#if defined(__linux__)
+    int fd, ret;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ret = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return ret ? -1 : 0;
+#else
+    return -1;
+#endif
+}
+
+unsigned int bench_rl32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+void bench_wl32(uint8_t *p, unsigned int v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void show_usage(void) {
+    int i;
+
+    printf("usage: ffbench <test> [options]\n");
+    for (i = 0; tests[i].name; i++)
+        printf("  %-11s %s\n", tests[i].name, tests[i].usage);
+}
+
+int main(int argc, char **argv) {
+    int i;
+
+    if (argc < 2) {
+        show_usage();
+        return 1;
+    }
+    av_register_all();
+    for (i = 0; tests[i].name; i++) {
+        if (!strcmp(argv[1], tests[i].name))
+            return tests[i].func(argc - 2, argv + 2) < 0 ? 1 : 0;
+    }
+    fprintf(stderr, "unknown test %s\n", argv[1]);
+    show_usage();
+    return 1;
+}
@@ -0,0 +1,269 @@
+#include "../libavcodec/avcodec.h"
+#include "../libavutil/cpu.h"
+
+// 检查imgconvert_x86.c 中每个SIMD 实现的输出和对应的ff_*_c() 完全相同。
+// 宽、高在1..100 之间随机，每个平面的linesize 在行宽之外再随机加0..63 字节，
+// 起始地址也随机错开，目标缓冲区事先填满同一个值，行尾的填充部分也一起比较。
+// 用法: imgconvert_test [次数] [随机种子]，有不一致时返回1。
+
+#define MAX_SIZE 100
+#define MAX_PAD 64
+
+typedef void (*ConvertFunc)(AVPicture *dst, const AVPicture *src, int width,
+                            int height);
+
+void ff_yuv422_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                            int height);
+void ff_uyvy422_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                             int height);
+void ff_yuv420p_to_rgb24_c(AVPicture *dst, const AVPicture *src, int width,
+                           int height);
+void ff_yuv420p_to_rgba32_c(AVPicture *dst, const AVPicture *src, int width,
+                            int height);
+void ff_rgb24_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                           int height);
+void ff_pal8_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                          int height, const uint32_t *yuv);
+
+#ifdef ARCH_X86
+void ff_yuv422_to_yuv420p_sse2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_uyvy422_to_yuv420p_sse2(AVPicture *dst, const AVPicture *src,
+                                int width, int height);
+void ff_yuv420p_to_rgba32_sse2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_yuv420p_to_rgb24_ssse3(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_rgb24_to_yuv420p_ssse3(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_yuv422_to_yuv420p_avx2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_uyvy422_to_yuv420p_avx2(AVPicture *dst, const AVPicture *src,
+                                int width, int height);
+void ff_yuv420p_to_rgba32_avx2(AVPicture *dst, const AVPicture *src,
+                               int width, int height);
+void ff_pal8_to_yuv420p_avx2(AVPicture *dst, const AVPicture *src, int width,
+                             int height, const uint32_t *yuv);
+#endif
+
+// pal8 的实现多一个YUV 表参数，测试时固定用pal_yuv。
+static uint32_t pal_yuv[256];
+
+static void pal8_to_yuv420p_c(AVPicture *dst, const AVPicture *src, int width,
+                              int height) {
+    ff_pal8_to_yuv420p_c(dst, src, width, height, pal_yuv);
+}
+
+#ifdef ARCH_X86
+static void pal8_to_yuv420p_avx2(AVPicture *dst, const AVPicture *src,
+                                 int width, int height) {
+    ff_pal8_to_yuv420p_avx2(dst, src, width, height, pal_yuv);
+}
+#endif
+
+typedef struct TestKernel {
+    const char *name;
+    int src_fmt, dst_fmt;
+    int cpu_flag;
+    ConvertFunc ref, simd;
+} TestKernel;
+
+static const TestKernel kernels[] = {
+#ifdef ARCH_X86
+    {"yuv422_to_yuv420p_sse2", PIX_FMT_YUV422, PIX_FMT_YUV420P,
+     AV_CPU_FLAG_SSE2, ff_yuv422_to_yuv420p_c, ff_yuv422_to_yuv420p_sse2},
+    {"uyvy422_to_yuv420p_sse2", PIX_FMT_UYVY422, PIX_FMT_YUV420P,
+     AV_CPU_FLAG_SSE2, ff_uyvy422_to_yuv420p_c, ff_uyvy422_to_yuv420p_sse2},
+    {"yuv420p_to_rgba32_sse2", PIX_FMT_YUV420P, PIX_FMT_RGBA32,
+     AV_CPU_FLAG_SSE2, ff_yuv420p_to_rgba32_c, ff_yuv420p_to_rgba32_sse2},
+    {"yuv420p_to_rgb24_ssse3", PIX_FMT_YUV420P, PIX_FMT_RGB24,
+     AV_CPU_FLAG_SSSE3, ff_yuv420p_to_rgb24_c, ff_yuv420p_to_rgb24_ssse3},
+    {"rgb24_to_yuv420p_ssse3", PIX_FMT_RGB24, PIX_FMT_YUV420P,
+     AV_CPU_FLAG_SSSE3, ff_rgb24_to_yuv420p_c, ff_rgb24_to_yuv420p_ssse3},
+    {"yuv422_to_yuv420p_avx2", PIX_FMT_YUV422, PIX_FMT_YUV420P,
+     AV_CPU_FLAG_AVX2, ff_yuv422_to_yuv420p_c, ff_yuv422_to_yuv420p_avx2},
+    {"uyvy422_to_yuv420p_avx2", PIX_FMT_UYVY422, PIX_FMT_YUV420P,
+     AV_CPU_FLAG_AVX2, ff_uyvy422_to_yuv420p_c, ff_uyvy422_to_yuv420p_avx2},
+    {"yuv420p_to_rgba32_avx2", PIX_FMT_YUV420P, PIX_FMT_RGBA32,
+     AV_CPU_FLAG_AVX2, ff_yuv420p_to_rgba32_c, ff_yuv420p_to_rgba32_avx2},
+    {"pal8_to_yuv420p_avx2", PIX_FMT_PAL8, PIX_FMT_YUV420P, AV_CPU_FLAG_AVX2,
+     pal8_to_yuv420p_c, pal8_to_yuv420p_avx2},
+#endif
+    {NULL}};
+
+static unsigned int rnd_state;
+
+static unsigned int rnd(void) {
+    rnd_state = rnd_state * 1664525 + 1013904223;
+    return rnd_state >> 8;
+}
+
+// 测试用到的格式各平面每个像素的字节数，chroma 为色度平面的宽高移位。
+static int plane_layout(int pix_fmt, int *bpp, int *chroma) {
+    *chroma = 0;
+    switch (pix_fmt) {
+    case PIX_FMT_YUV420P:
+        bpp[0] = bpp[1] = bpp[2] = 1;
+        *chroma = 1;
+        return 3;
+    case PIX_FMT_YUV422:
+    case PIX_FMT_UYVY422:
+        bpp[0] = 2;
+        return 1;
+    case PIX_FMT_RGB24:
+        bpp[0] = 3;
+        return 1;
+    case PIX_FMT_RGBA32:
+        bpp[0] = 4;
+        return 1;
+    case PIX_FMT_PAL8:
+        bpp[0] = 1;
+        return 1;
+    }
+    return 0;
+}
+
+// 一张测试图像，每个平面单独分配，linesize 和起始地址都随机。
+typedef struct TestPicture {
+    AVPicture pict;
+    uint8_t *buf[3];
+    int size[3];
+    int planes;
+} TestPicture;
+
+static int test_picture_alloc(TestPicture *p, int pix_fmt, int width,
+                              int height) {
+    int bpp[3], chroma, i, w, h, offset;
+
+    memset(p, 0, sizeof(*p));
+    p->planes = plane_layout(pix_fmt, bpp, &chroma);
+    for (i = 0; i < p->planes; i++) {
+        w = width;
+        h = height;
+        if (i > 0) {
+            w = (width + (1 << chroma) - 1) >> chroma;
+            h = (height + (1 << chroma) - 1) >> chroma;
+        } else if (pix_fmt == PIX_FMT_YUV422 || pix_fmt == PIX_FMT_UYVY422) {
+            // 打包的4:2:2 每两个像素共用一组色度，一行总是偶数个像素
+            w = (width + 1) & ~1;
+        }
+        offset = rnd() % 16;
+        p->pict.linesize[i] = w * bpp[i] + rnd() % MAX_PAD;
+        p->size[i] = offset + p->pict.linesize[i] * h;
+        p->buf[i] = av_malloc(p->size[i]);
+        if (!p->buf[i])
+            return -1;
+        p->pict.data[i] = p->buf[i] + offset;
+    }
+    return 0;
+}
+
+static void test_picture_free(TestPicture *p) {
+    int i;
+
+    for (i = 0; i < p->planes; i++)
+        av_free(p->buf[i]);
+}
+
+static void test_picture_random(TestPicture *p) {
+    int i, j;
+
+    for (i = 0; i < p->planes; i++) {
+        for (j = 0; j < p->size[i]; j++)
+            p->buf[i][j] = (uint8_t)rnd();
+    }
+}
+
+// dst 和src 的布局相同，复制内容。
+static void test_picture_copy(TestPicture *dst, const TestPicture *src) {
+    int i;
+
+    for (i = 0; i < src->planes; i++)
+        memcpy(dst->buf[i], src->buf[i], src->size[i]);
+}
+
+// 返回第一个不同的平面号，相同返回-1。
+static int test_picture_compare(const TestPicture *a, const TestPicture *b) {
+    int i;
+
+    for (i = 0; i < a->planes; i++) {
+        if (memcmp(a->buf[i], b->buf[i], a->size[i]))
+            return i;
+    }
+    return -1;
+}
+
+// 返回不一致的次数，分配失败返回-1。
+static int test_kernel(const TestKernel *k, int count) {
+    TestPicture src, ref, out;
+    int n, w, h, plane, fails = 0;
+
+    for (n = 0; n < count; n++) {
+        w = 1 + rnd() % MAX_SIZE;
+        h = 1 + rnd() % MAX_SIZE;
+        if (test_picture_alloc(&src, k->src_fmt, w, h) < 0 ||
+            test_picture_alloc(&ref, k->dst_fmt, w, h) < 0)
+            return -1;
+        // out 要和ref 的linesize、起始地址完全相同
+        out = ref;
+        for (plane = 0; plane < ref.planes; plane++) {
+            out.buf[plane] = av_malloc(ref.size[plane]);
+            if (!out.buf[plane])
+                return -1;
+            out.pict.data[plane] =
+                out.buf[plane] + (ref.pict.data[plane] - ref.buf[plane]);
+        }
+        test_picture_random(&src);
+        test_picture_random(&ref);
+        test_picture_copy(&out, &ref);
+
+        k->ref(&ref.pict, &src.pict, w, h);
+        k->simd(&out.pict, &src.pict, w, h);
+
+        plane = test_picture_compare(&ref, &out);
+        if (plane >= 0) {
+            if (fails < 5)
+                printf("%s: %dx%d plane %d differs\n", k->name, w, h, plane);
+            fails++;
+        }
+        test_picture_free(&src);
+        test_picture_free(&ref);
+        test_picture_free(&out);
+    }
+    return fails;
+}
+
+int main(int argc, char **argv) {
+    int count = 1000, flags, i, ret, failed = 0;
+    unsigned int seed = 1;
+
+    if (argc > 1)
+        count = atoi(argv[1]);
+    if (argc > 2)
+        seed = (unsigned int)atoi(argv[2]);
+    rnd_state = seed;
+    avcodec_init();
+
+    // pal8 的YUV 表: Y 在0-7 位，U 在8-15 位，V 在24-31 位，16-23 位为0
+    for (i = 0; i < 256; i++)
+        pal_yuv[i] = (rnd() & 0xff) | (rnd() & 0xff) << 8 |
+                     (uint32_t)(rnd() & 0xff) << 24;
+
+    flags = av_get_cpu_flags();
+    for (i = 0; kernels[i].name; i++) {
+        if (!(flags & kernels[i].cpu_flag)) {
+            printf("%-26s skipped\n", kernels[i].name);
+            continue;
+        }
+        ret = test_kernel(&kernels[i], count);
+        if (ret < 0) {
+            printf("%-26s out of memory\n", kernels[i].name);
+            return 1;
+        }
+        printf("%-26s %s (%d/%d)\n", kernels[i].name, ret ? "FAILED" : "ok",
+               count - ret, count);
+        if (ret)
+            failed = 1;
+    }
+    return failed;
+}
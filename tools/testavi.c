@@ -0,0 +1,253 @@
+#include "testavi.h"
+
+#define AVIIF_KEYFRAME 0x10
+#define AVIF_HASINDEX 0x10
+
+// 按顺序拼出整个文件的缓存。
+typedef struct TestBuf {
+    uint8_t *data;
+    int size, allocated;
+    int error;
+} TestBuf;
+
+static void tb_put_bytes(TestBuf *b, const void *p, int n) {
+    uint8_t *data;
+    int allocated;
+
+    if (b->error)
+        return;
+    if (b->size + n > b->allocated) {
+        allocated = (b->size + n) * 2;
+        data = av_realloc(b->data, allocated);
+        if (!data) {
+            b->error = 1;
+            return;
+        }
+        b->data = data;
+        b->allocated = allocated;
+    }
+    memcpy(b->data + b->size, p, n);
+    b->size += n;
+}
+
+static void tb_put_byte(TestBuf *b, int v) {
+    uint8_t c = (uint8_t)v;
+
+    tb_put_bytes(b, &c, 1);
+}
+
+static void tb_put_le16(TestBuf *b, unsigned int v) {
+    tb_put_byte(b, v);
+    tb_put_byte(b, v >> 8);
+}
+
+static void tb_put_le32(TestBuf *b, unsigned int v) {
+    tb_put_le16(b, v & 0xffff);
+    tb_put_le16(b, v >> 16);
+}
+
+static void tb_put_tag(TestBuf *b, const char *tag) { tb_put_bytes(b, tag, 4); }
+
+// 块头的大小先写0，块写完后用end_chunk() 补上，返回块头的位置。
+static int start_chunk(TestBuf *b, const char *tag) {
+    int pos = b->size;
+
+    tb_put_tag(b, tag);
+    tb_put_le32(b, 0);
+    return pos;
+}
+
+static void end_chunk(TestBuf *b, int pos) {
+    int size = b->size - pos - 8;
+
+    if (b->error)
+        return;
+    b->data[pos + 4] = size;
+    b->data[pos + 5] = size >> 8;
+    b->data[pos + 6] = size >> 16;
+    b->data[pos + 7] = size >> 24;
+    if (size & 1)
+        tb_put_byte(b, 0);
+}
+
+static int is_keyframe(const TestAvi *t, int n) {
+    return n == 0 || (t->keyint > 0 && n % t->keyint == 0);
+}
+
+// 一行用长度不超过255 的重复段画满。
+static void put_row(TestBuf *b, int width, int color) {
+    int x, n;
+
+    for (x = 0; x < width; x += n) {
+        n = width - x < 255 ? width - x : 255;
+        tb_put_byte(b, n);
+        tb_put_byte(b, color + x / 255);
+    }
+}
+
+// 流s 的第n 帧。MSRLE 自底向上，先画的是最下面一行。
+static void put_frame(TestBuf *b, const TestAvi *t, int s, int n) {
+    int y;
+
+    if (is_keyframe(t, n)) {
+        for (y = 0; y < t->height; y++) {
+            put_row(b, t->width, n * 7 + y + s * 50);
+            tb_put_byte(b, 0);
+            tb_put_byte(b, 0);
+        }
+    } else {
+        put_row(b, t->width, n * 13 + 1);
+    }
+    tb_put_byte(b, 0);
+    tb_put_byte(b, 1);
+}
+
+static void put_stream_header(TestBuf *b, const TestAvi *t, int s) {
+    int list, chunk, i;
+
+    list = start_chunk(b, "LIST");
+    tb_put_tag(b, "strl");
+    chunk = start_chunk(b, "strh");
+    tb_put_tag(b, "vids");
+    tb_put_tag(b, "mrle");
+    tb_put_le32(b, 0); // flags
+    tb_put_le32(b, 0); // priority, language
+    tb_put_le32(b, 0); // initial frames
+    tb_put_le32(b, 1); // scale
+    tb_put_le32(b, 25); // rate
+    tb_put_le32(b, 0); // start
+    tb_put_le32(b, t->nb_frames[s]);
+    tb_put_le32(b, 0); // buffer size
+    tb_put_le32(b, 0); // quality
+    tb_put_le32(b, 0); // sample size
+    tb_put_le32(b, 0); // frame
+    tb_put_le32(b, 0);
+    end_chunk(b, chunk);
+
+    // BITMAPINFOHEADER 后面是256 色的灰度调色板
+    chunk = start_chunk(b, "strf");
+    tb_put_le32(b, 40);
+    tb_put_le32(b, t->width);
+    tb_put_le32(b, t->height);
+    tb_put_le16(b, 1);
+    tb_put_le16(b, 8);
+    tb_put_le32(b, 1); // BI_RLE8
+    tb_put_le32(b, 0);
+    tb_put_le32(b, 0);
+    tb_put_le32(b, 0);
+    tb_put_le32(b, 256);
+    tb_put_le32(b, 0);
+    for (i = 0; i < 256; i++)
+        tb_put_le32(b, i * 0x010101);
+    end_chunk(b, chunk);
+    end_chunk(b, list);
+}
+
+typedef struct TestChunk {
+    int stream, frame;
+    int pos; // 块头相对movi 标签的位置
+    int size;
+} TestChunk;
+
+int testavi_write(const char *filename, const TestAvi *t) {
+    TestBuf b1, *b = &b1;
+    TestChunk *chunks, *c;
+    FILE *f;
+    int riff, hdrl, chunk, movi, total = 0, s, n, i, ok;
+
+    if (t->nb_streams < 1 || t->nb_streams > TESTAVI_MAX_STREAMS)
+        return -1;
+    for (s = 0; s < t->nb_streams; s++)
+        total += t->nb_frames[s];
+    chunks = av_malloc(total * sizeof(TestChunk));
+    if (!chunks)
+        return -1;
+    // 交错存放时按帧号排，非交错时按流排
+    for (n = 0, i = 0; i < total; n++) {
+        for (s = 0; s < t->nb_streams; s++) {
+            if (n < t->nb_frames[s]) {
+                chunks[i].stream = s;
+                chunks[i].frame = n;
+                i++;
+            }
+        }
+    }
+    if (t->non_interleaved) {
+        for (s = 0, i = 0; s < t->nb_streams; s++) {
+            for (n = 0; n < t->nb_frames[s]; n++, i++) {
+                chunks[i].stream = s;
+                chunks[i].frame = n;
+            }
+        }
+    }
+
+    memset(b, 0, sizeof(*b));
+    riff = start_chunk(b, "RIFF");
+    tb_put_tag(b, "AVI ");
+    hdrl = start_chunk(b, "LIST");
+    tb_put_tag(b, "hdrl");
+    chunk = start_chunk(b, "avih");
+    tb_put_le32(b, 40000); // frame period
+    tb_put_le32(b, 0);
+    tb_put_le32(b, 0);
+    tb_put_le32(b, t->no_idx1 ? 0 : AVIF_HASINDEX);
+    tb_put_le32(b, t->nb_frames[0]);
+    tb_put_le32(b, 0);
+    tb_put_le32(b, t->nb_streams);
+    tb_put_le32(b, 0);
+    tb_put_le32(b, t->width);
+    tb_put_le32(b, t->height);
+    for (i = 0; i < 4; i++)
+        tb_put_le32(b, 0);
+    end_chunk(b, chunk);
+    for (s = 0; s < t->nb_streams; s++)
+        put_stream_header(b, t, s);
+    end_chunk(b, hdrl);
+
+    movi = start_chunk(b, "LIST");
+    tb_put_tag(b, "movi");
+    for (i = 0; i < total; i++) {
+        char tag[5];
+
+        c = &chunks[i];
+        snprintf(tag, sizeof(tag), "%02ddc", c->stream);
+        c->pos = b->size - (movi + 8);
+        chunk = start_chunk(b, tag);
+        put_frame(b, t, c->stream, c->frame);
+        c->size = b->size - chunk - 8;
+        end_chunk(b, chunk);
+    }
+    end_chunk(b, movi);
+
+    if (!t->no_idx1) {
+        chunk = start_chunk(b, "idx1");
+        for (i = 0; i < total; i++) {
+            char tag[5];
+
+            c = &chunks[i];
+            snprintf(tag, sizeof(tag), "%02ddc", c->stream);
+            tb_put_tag(b, tag);
+            tb_put_le32(b, is_keyframe(t, c->frame) ? AVIIF_KEYFRAME : 0);
+            tb_put_le32(b, c->pos);
+            tb_put_le32(b, c->size);
+        }
+        end_chunk(b, chunk);
+    }
+    end_chunk(b, riff);
+    av_free(chunks);
+
+    if (b->error) {
+        av_free(b->data);
+        return -1;
+    }
+    f = fopen(filename, "wb");
+    if (!f) {
+        av_free(b->data);
+        return -1;
+    }
+    ok = fwrite(b->data, 1, b->size, f) == (size_t)b->size;
+    if (fclose(f) != 0)
+        ok = 0;
+    av_free(b->data);
+    return ok ? 0 : -1;
+}
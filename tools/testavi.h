@@ -0,0 +1,23 @@
+#ifndef TESTAVI_H
+#define TESTAVI_H
+
+#include "../libavformat/avformat.h"
+
+// 测试程序用的合成AVI 文件，每个流都是8 位MSRLE 视频，25 帧每秒。
+// 关键帧重画整幅图像，其余帧只重画最下面一行，必须从关键帧开始顺序解码。
+
+#define TESTAVI_MAX_STREAMS 2
+
+typedef struct TestAvi {
+    int width, height;
+    int nb_streams;
+    int nb_frames[TESTAVI_MAX_STREAMS];
+    int keyint;          // 每keyint 帧一个关键帧，0 时只有第一帧是
+    int non_interleaved; // 非0 时各个流的块依次存放，否则按帧交错存放
+    int no_idx1;         // 非0 时不写idx1
+} TestAvi;
+
+// 写出文件，成功返回0，出错返回-1。
+int testavi_write(const char *filename, const TestAvi *t);
+
+#endif